@@ -19,6 +19,23 @@ struct Rule {
     flow_direction: u8,
     action: u8,
     log: u8,
+    // 可选的日志限速列，留空时内核使用模块参数默认值
+    #[serde(default)]
+    log_rate: Option<u32>,
+    #[serde(default)]
+    log_burst: Option<u32>,
+    #[serde(default)]
+    log_sample: Option<u32>,
+    // LIMIT 动作（action 2）的可选速率列，留空表示不限速
+    #[serde(default)]
+    limit_rate: Option<u32>,
+    #[serde(default)]
+    limit_burst: Option<u32>,
+    #[serde(default)]
+    limit_per_src: Option<u8>,
+    // 来源已有连接数达到该值时规则才匹配新连接，留空表示不检查
+    #[serde(default)]
+    connlimit: Option<u32>,
 }
 
 #[derive(Debug, Clone, Serialize, Deserialize)]
@@ -170,6 +187,13 @@ impl MyApp {
                             flow_direction: 0,
                             action: 0,
                             log: 0,
+                            log_rate: None,
+                            log_burst: None,
+                            log_sample: None,
+                            limit_rate: None,
+                            limit_burst: None,
+                            limit_per_src: None,
+                            connlimit: None,
                         });
                     }
                 });
@@ -223,7 +247,8 @@ impl MyApp {
 }
 
 fn read_rules_from_csv(path: &str) -> Result<Vec<Rule>, csv::Error> {
-    let mut rdr = csv::Reader::from_path(path)?;
+    // 旧规则文件没有日志限速、LIMIT 和 connlimit 的可选列，允许行的列数不一致
+    let mut rdr = csv::ReaderBuilder::new().flexible(true).from_path(path)?;
     let mut rules = Vec::new();
     for result in rdr.deserialize() {
         match result {
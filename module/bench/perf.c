@@ -0,0 +1,89 @@
+#define _GNU_SOURCE
+#include "perf.h"
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <string.h>
+#include <unistd.h>
+
+const char *const perf_counter_names[PERF_NR_COUNTERS] = {
+    [PERF_CYCLES] = "cycles",
+    [PERF_INSTRUCTIONS] = "instructions",
+    [PERF_CACHE_REFERENCES] = "cache-references",
+    [PERF_CACHE_MISSES] = "cache-misses",
+    [PERF_BRANCH_MISSES] = "branch-misses",
+    [PERF_L1D_MISSES] = "L1-dcache-load-misses",
+};
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} perf_events[PERF_NR_COUNTERS] = {
+    [PERF_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [PERF_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [PERF_CACHE_REFERENCES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+    [PERF_CACHE_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    [PERF_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    [PERF_L1D_MISSES] = { PERF_TYPE_HW_CACHE,
+                          PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+};
+
+// Counters are opened individually rather than as a group so that one
+// unsupported event (common in VMs) does not disable the others.
+int perf_counters_open(struct perf_counters *pc)
+{
+    struct perf_event_attr attr;
+    int i, opened = 0;
+
+    for (i = 0; i < PERF_NR_COUNTERS; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_events[i].type;
+        attr.config = perf_events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        pc->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        pc->value[i] = 0;
+        if (pc->fd[i] >= 0)
+            opened++;
+    }
+    return opened;
+}
+
+void perf_counters_start(struct perf_counters *pc)
+{
+    int i;
+
+    for (i = 0; i < PERF_NR_COUNTERS; i++) {
+        if (pc->fd[i] < 0)
+            continue;
+        ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void perf_counters_stop(struct perf_counters *pc)
+{
+    int i;
+
+    for (i = 0; i < PERF_NR_COUNTERS; i++) {
+        if (pc->fd[i] < 0)
+            continue;
+        ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(pc->fd[i], &pc->value[i], sizeof(pc->value[i])) != sizeof(pc->value[i]))
+            pc->value[i] = 0;
+    }
+}
+
+void perf_counters_close(struct perf_counters *pc)
+{
+    int i;
+
+    for (i = 0; i < PERF_NR_COUNTERS; i++) {
+        if (pc->fd[i] >= 0)
+            close(pc->fd[i]);
+        pc->fd[i] = -1;
+    }
+}
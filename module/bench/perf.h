@@ -0,0 +1,31 @@
+#ifndef BENCH_PERF_H
+#define BENCH_PERF_H
+
+#include <stdint.h>
+
+// Hardware counters read around a benchmark phase. Built without the kernel
+// shim so the real <linux/perf_event.h> is used.
+enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_REFERENCES,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,
+    PERF_NR_COUNTERS,
+};
+
+struct perf_counters {
+    int fd[PERF_NR_COUNTERS]; // -1 when the counter is unavailable
+    uint64_t value[PERF_NR_COUNTERS];
+};
+
+extern const char *const perf_counter_names[PERF_NR_COUNTERS];
+
+// Returns the number of counters that could be opened.
+int perf_counters_open(struct perf_counters *pc);
+void perf_counters_start(struct perf_counters *pc);
+void perf_counters_stop(struct perf_counters *pc);
+void perf_counters_close(struct perf_counters *pc);
+
+#endif // BENCH_PERF_H
@@ -0,0 +1,4 @@
+#ifndef KSHIM_ASM_LOCAL_H
+#define KSHIM_ASM_LOCAL_H
+#include <kshim.h>
+#endif
@@ -0,0 +1,740 @@
+/*
+ * Minimal userspace stand-ins for the kernel APIs used by the firewall
+ * datapath, so that rule_filter.c, stateful_check.c, nat.c, log.c, stats.c
+ * and event_ring.c can be compiled unchanged for benchmarking. Only the
+ * behaviour the datapath relies on is modelled. kshim_cpu selects the
+ * per-CPU copy the calling thread uses.
+ */
+#ifndef KSHIM_H
+#define KSHIM_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/types.h>
+#include <linux/types.h>
+#include <asm/byteorder.h>
+#include <arpa/inet.h>
+
+/* ---- basic types and compiler helpers ---- */
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef unsigned int gfp_t;
+typedef long long time64_t;
+typedef unsigned int __poll_t;
+
+#define __init
+#define __exit
+#define __user
+#define __percpu
+#define __rcu
+#define __force
+#define __read_mostly
+#define ____cacheline_aligned __attribute__((aligned(64)))
+#define ____cacheline_aligned_in_smp ____cacheline_aligned
+#define __aligned(x) __attribute__((aligned(x)))
+#define __packed __attribute__((packed))
+#define __maybe_unused __attribute__((unused))
+
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define barrier() __asm__ __volatile__("" ::: "memory")
+#define READ_ONCE(x) (*(const volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v) (*(volatile __typeof__(x) *)&(x) = (v))
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_mb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define cpu_relax() barrier()
+
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define BUILD_BUG_ON(c) _Static_assert(!(c), "BUILD_BUG_ON")
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b) ((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define max_t(t, a, b) ((t)(a) > (t)(b) ? (t)(a) : (t)(b))
+#define clamp_t(t, v, lo, hi) min_t(t, max_t(t, v, lo), hi)
+#define U32_MAX ((u32)~0U)
+#define ALIGN(x, a) (((x) + (a) - 1) & ~((__typeof__(x))(a) - 1))
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define BIT(n) (1UL << (n))
+#define BIT_ULL(n) (1ULL << (n))
+
+/* ---- byte order, from the uapi <asm/byteorder.h> ---- */
+#define cpu_to_be64 __cpu_to_be64
+#define be64_to_cpu __be64_to_cpu
+#define cpu_to_be32 __cpu_to_be32
+#define be32_to_cpu __be32_to_cpu
+#define BITS_PER_LONG 64
+#define WARN_ON(c) (!!(c))
+#define WARN_ON_ONCE(c) (!!(c))
+#define BUG_ON(c) do { if (c) abort(); } while (0)
+#define EXPORT_SYMBOL(x)
+#define EXPORT_SYMBOL_GPL(x)
+#define MODULE_LICENSE(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_PARM_DESC(n, d)
+#define module_param(n, t, p)
+#define module_param_string(n, s, l, p)
+#define module_param_named(n, v, t, p)
+#define module_param_cb(n, o, a, p) static const struct kernel_param_ops *const __kshim_param_##n __attribute__((used)) = (o)
+#define THIS_MODULE NULL
+struct kernel_param { const char *name; void *arg; };
+struct kernel_param_ops {
+    int (*set)(const char *val, const struct kernel_param *kp);
+    int (*get)(char *buffer, const struct kernel_param *kp);
+};
+static inline int kstrtobool(const char *s, bool *res)
+{
+    if (!s)
+        return -EINVAL;
+    switch (s[0]) {
+    case 'y': case 'Y': case '1': *res = true; return 0;
+    case 'n': case 'N': case '0': *res = false; return 0;
+    default: return -EINVAL;
+    }
+}
+
+static inline int ilog2(unsigned long v) { return v ? 63 - __builtin_clzl(v) : 0; }
+static inline int fls64(u64 v) { return v ? 64 - __builtin_clzll(v) : 0; }
+static inline bool is_power_of_2(unsigned long n) { return n && !(n & (n - 1)); }
+static inline unsigned long roundup_pow_of_two(unsigned long n) { return n <= 1 ? 1 : 1UL << (64 - __builtin_clzl(n - 1)); }
+static inline u64 div_u64(u64 a, u32 b) { return a / b; }
+static inline u32 reciprocal_scale(u32 val, u32 ep_ro) { return (u32)(((u64)val * ep_ro) >> 32); }
+static inline u32 ror32(u32 w, unsigned int s) { return (w >> (s & 31)) | (w << ((-s) & 31)); }
+static inline u32 rol32(u32 w, unsigned int s) { return (w << (s & 31)) | (w >> ((-s) & 31)); }
+static inline unsigned int hweight32(u32 w) { return __builtin_popcount(w); }
+
+/* ---- bitmaps ---- */
+#define BITS_TO_LONGS(n) DIV_ROUND_UP(n, BITS_PER_LONG)
+#define DECLARE_BITMAP(name, bits) unsigned long name[BITS_TO_LONGS(bits)]
+static inline void bitmap_zero(unsigned long *dst, unsigned int nbits) { memset(dst, 0, BITS_TO_LONGS(nbits) * sizeof(long)); }
+static inline unsigned long *bitmap_zalloc(unsigned int nbits, gfp_t f) { (void)f; return calloc(BITS_TO_LONGS(nbits), sizeof(long)); }
+static inline void bitmap_free(const unsigned long *p) { free((void *)p); }
+static inline bool test_bit(unsigned long nr, const unsigned long *addr)
+{
+    return (addr[nr / BITS_PER_LONG] >> (nr % BITS_PER_LONG)) & 1;
+}
+static inline void __set_bit(unsigned long nr, unsigned long *addr)
+{
+    addr[nr / BITS_PER_LONG] |= 1UL << (nr % BITS_PER_LONG);
+}
+static inline void __clear_bit(unsigned long nr, unsigned long *addr)
+{
+    addr[nr / BITS_PER_LONG] &= ~(1UL << (nr % BITS_PER_LONG));
+}
+static inline void set_bit(unsigned long nr, unsigned long *addr)
+{
+    __atomic_fetch_or(&addr[nr / BITS_PER_LONG], 1UL << (nr % BITS_PER_LONG), __ATOMIC_SEQ_CST);
+}
+static inline void clear_bit(unsigned long nr, unsigned long *addr)
+{
+    __atomic_fetch_and(&addr[nr / BITS_PER_LONG], ~(1UL << (nr % BITS_PER_LONG)), __ATOMIC_SEQ_CST);
+}
+static inline bool test_and_set_bit(unsigned long nr, unsigned long *addr)
+{
+    unsigned long bit = 1UL << (nr % BITS_PER_LONG);
+
+    return __atomic_fetch_or(&addr[nr / BITS_PER_LONG], bit, __ATOMIC_SEQ_CST) & bit;
+}
+static inline bool test_and_clear_bit(unsigned long nr, unsigned long *addr)
+{
+    unsigned long bit = 1UL << (nr % BITS_PER_LONG);
+
+    return __atomic_fetch_and(&addr[nr / BITS_PER_LONG], ~bit, __ATOMIC_SEQ_CST) & bit;
+}
+
+/* ---- printk and kernel-style formatting (understands %pI4 / %pI6c) ---- */
+#define KERN_EMERG ""
+#define KERN_ALERT ""
+#define KERN_CRIT ""
+#define KERN_ERR ""
+#define KERN_WARNING ""
+#define KERN_NOTICE ""
+#define KERN_INFO ""
+#define KERN_DEBUG ""
+extern int kshim_verbose;
+int kshim_vsnprintf(char *buf, size_t size, const char *fmt, va_list args);
+int kshim_snprintf(char *buf, size_t size, const char *fmt, ...);
+int scnprintf(char *buf, size_t size, const char *fmt, ...);
+int vscnprintf(char *buf, size_t size, const char *fmt, va_list args);
+int printk(const char *fmt, ...);
+#define snprintf kshim_snprintf
+#define vsnprintf kshim_vsnprintf
+#define pr_info(fmt, ...) printk(fmt, ##__VA_ARGS__)
+#define pr_warn(fmt, ...) printk(fmt, ##__VA_ARGS__)
+#define pr_err(fmt, ...) printk(fmt, ##__VA_ARGS__)
+#define pr_debug(fmt, ...) do { } while (0)
+
+/* ---- memory ---- */
+#define GFP_KERNEL 0u
+#define GFP_ATOMIC 1u
+#define __GFP_NOWARN 0u
+#define __GFP_ZERO 2u
+static inline void *kmalloc(size_t n, gfp_t f) { return (f & __GFP_ZERO) ? calloc(1, n) : malloc(n); }
+static inline void *kzalloc(size_t n, gfp_t f) { (void)f; return calloc(1, n); }
+static inline void *kcalloc(size_t c, size_t n, gfp_t f) { (void)f; return calloc(c, n); }
+static inline void *kmalloc_array(size_t c, size_t n, gfp_t f) { (void)f; return calloc(c, n); }
+static inline void kfree(const void *p) { free((void *)p); }
+static inline void *vzalloc(size_t n) { return calloc(1, n); }
+static inline void *vzalloc_node(size_t n, int node) { (void)node; return calloc(1, n); }
+static inline void *vmalloc(size_t n) { return malloc(n); }
+static inline void vfree(const void *p) { free((void *)p); }
+static inline void *kvzalloc(size_t n, gfp_t f) { (void)f; return calloc(1, n); }
+static inline void *kvmalloc(size_t n, gfp_t f) { (void)f; return malloc(n); }
+static inline void *kvcalloc(size_t c, size_t n, gfp_t f) { (void)f; return calloc(c, n); }
+static inline void *kvmalloc_array(size_t c, size_t n, gfp_t f) { (void)f; return calloc(c, n); }
+static inline void kvfree(const void *p) { free((void *)p); }
+static inline size_t ksize(const void *p) { (void)p; return 0; }
+
+struct kmem_cache { size_t size; };
+static inline struct kmem_cache *kmem_cache_create(const char *n, size_t sz, size_t a, unsigned long f, void *c)
+{
+    struct kmem_cache *k = malloc(sizeof(*k));
+    (void)n; (void)a; (void)f; (void)c;
+    if (k)
+        k->size = sz;
+    return k;
+}
+static inline void *kmem_cache_alloc(struct kmem_cache *k, gfp_t f) { return kmalloc(k->size, f); }
+static inline void *kmem_cache_zalloc(struct kmem_cache *k, gfp_t f) { (void)f; return calloc(1, k->size); }
+static inline void kmem_cache_free(struct kmem_cache *k, void *p) { (void)k; free(p); }
+static inline void kmem_cache_destroy(struct kmem_cache *k) { free(k); }
+#define SLAB_HWCACHE_ALIGN 0
+
+/* ---- errors ---- */
+#define MAX_ERRNO 4095
+#define IS_ERR_VALUE(x) ((unsigned long)(void *)(x) >= (unsigned long)-MAX_ERRNO)
+static inline void *ERR_PTR(long e) { return (void *)e; }
+static inline long PTR_ERR(const void *p) { return (long)p; }
+static inline bool IS_ERR(const void *p) { return IS_ERR_VALUE((unsigned long)p); }
+static inline bool IS_ERR_OR_NULL(const void *p) { return !p || IS_ERR(p); }
+
+/* ---- strings ---- */
+int kstrtouint(const char *s, unsigned int base, unsigned int *res);
+int kstrtoint(const char *s, unsigned int base, int *res);
+int kstrtoul(const char *s, unsigned int base, unsigned long *res);
+int kstrtou32(const char *s, unsigned int base, u32 *res);
+int kstrtou16(const char *s, unsigned int base, u16 *res);
+int kstrtou8(const char *s, unsigned int base, u8 *res);
+static inline char *skip_spaces(const char *s) { while (isspace((unsigned char)*s)) s++; return (char *)s; }
+static inline char *strim(char *s)
+{
+    size_t n = strlen(s);
+    while (n && isspace((unsigned char)s[n - 1]))
+        s[--n] = '\0';
+    return skip_spaces(s);
+}
+typedef int (*cmp_func_t)(const void *a, const void *b);
+typedef void (*swap_func_t)(void *a, void *b, int size);
+static inline void sort(void *base, size_t num, size_t size, cmp_func_t cmp, swap_func_t swap)
+{
+    (void)swap;
+    qsort(base, num, size, cmp);
+}
+static inline ssize_t strscpy(char *d, const char *s, size_t n)
+{
+    size_t l = strnlen(s, n);
+    if (!n)
+        return -E2BIG;
+    if (l == n) {
+        memcpy(d, s, n - 1);
+        d[n - 1] = '\0';
+        return -E2BIG;
+    }
+    memcpy(d, s, l + 1);
+    return l;
+}
+
+/* ---- atomics, local_t, per-CPU ---- */
+typedef struct { int counter; } atomic_t;
+typedef struct { long counter; } atomic_long_t;
+typedef struct { s64 counter; } atomic64_t;
+typedef struct { long v; } local_t;
+#define ATOMIC_INIT(i) { (i) }
+#define atomic_read(a) __atomic_load_n(&(a)->counter, __ATOMIC_RELAXED)
+#define atomic_set(a, i) __atomic_store_n(&(a)->counter, (i), __ATOMIC_RELAXED)
+#define atomic_inc(a) ((void)__atomic_add_fetch(&(a)->counter, 1, __ATOMIC_SEQ_CST))
+#define atomic_dec(a) ((void)__atomic_sub_fetch(&(a)->counter, 1, __ATOMIC_SEQ_CST))
+#define atomic_add(i, a) ((void)__atomic_add_fetch(&(a)->counter, (i), __ATOMIC_SEQ_CST))
+#define atomic_sub(i, a) ((void)__atomic_sub_fetch(&(a)->counter, (i), __ATOMIC_SEQ_CST))
+#define atomic_inc_return(a) __atomic_add_fetch(&(a)->counter, 1, __ATOMIC_SEQ_CST)
+#define atomic_dec_return(a) __atomic_sub_fetch(&(a)->counter, 1, __ATOMIC_SEQ_CST)
+#define atomic_add_return(i, a) __atomic_add_fetch(&(a)->counter, (i), __ATOMIC_SEQ_CST)
+#define atomic_xchg(a, i) __atomic_exchange_n(&(a)->counter, (i), __ATOMIC_SEQ_CST)
+#define atomic_dec_if_positive(a) kshim_atomic_dec_if_positive(&(a)->counter)
+static inline int kshim_atomic_dec_if_positive(int *c)
+{
+    int old = __atomic_load_n(c, __ATOMIC_RELAXED);
+    do {
+        if (old <= 0)
+            return old - 1;
+    } while (!__atomic_compare_exchange_n(c, &old, old - 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    return old - 1;
+}
+#define atomic_long_read atomic_read
+#define atomic_long_set atomic_set
+#define atomic_long_inc atomic_inc
+#define atomic_long_dec atomic_dec
+#define atomic_long_add atomic_add
+#define atomic_long_sub atomic_sub
+#define atomic_long_xchg atomic_xchg
+#define atomic_long_add_return atomic_add_return
+#define atomic_long_inc_return atomic_inc_return
+#define atomic64_read atomic_read
+#define atomic64_set atomic_set
+#define atomic64_inc atomic_inc
+#define atomic64_inc_return atomic_inc_return
+#define atomic64_add atomic_add
+#define atomic64_xchg atomic_xchg
+static inline bool atomic64_try_cmpxchg(atomic64_t *a, s64 *old, s64 new)
+{
+    return __atomic_compare_exchange_n(&a->counter, old, new, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+static inline s64 atomic64_cmpxchg(atomic64_t *a, s64 old, s64 new)
+{
+    __atomic_compare_exchange_n(&a->counter, &old, new, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    return old;
+}
+static inline int atomic_cmpxchg(atomic_t *a, int old, int new)
+{
+    __atomic_compare_exchange_n(&a->counter, &old, new, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    return old;
+}
+#define cmpxchg(p, o, n) ({ __typeof__(*(p)) __o = (o); \
+    __atomic_compare_exchange_n((p), &__o, (n), false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED); __o; })
+#define xchg(p, v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define local_read(l) ((l)->v)
+#define local_set(l, i) ((l)->v = (i))
+#define local_inc(l) ((void)((l)->v++))
+#define local_inc_return(l) (++(l)->v)
+#define local_add_return(i, l) ((l)->v += (i))
+
+#define KSHIM_NR_CPUS 64
+extern __thread int kshim_cpu;
+extern int nr_cpu_ids;
+#define num_possible_cpus() nr_cpu_ids
+#define num_online_cpus() nr_cpu_ids
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < nr_cpu_ids; (cpu)++)
+#define for_each_online_cpu(cpu) for_each_possible_cpu(cpu)
+#define smp_processor_id() kshim_cpu
+#define raw_smp_processor_id() kshim_cpu
+#define get_cpu() kshim_cpu
+#define put_cpu() do { } while (0)
+#define cpu_to_node(c) 0
+/* Per-CPU areas work like the kernel's: every per-CPU object has one
+ * canonical address and each CPU's copy lives at a fixed offset from it. */
+extern char __start_kshim_percpu[] __attribute__((weak));
+extern char __stop_kshim_percpu[] __attribute__((weak));
+extern long kshim_percpu_off[KSHIM_NR_CPUS];
+void *kshim_alloc_percpu(size_t size, size_t align);
+void kshim_free_percpu(void *p);
+#define DEFINE_PER_CPU(type, name) __attribute__((section("kshim_percpu"))) __typeof__(type) name
+#define DEFINE_PER_CPU_ALIGNED(type, name) __attribute__((section("kshim_percpu"), aligned(64))) __typeof__(type) name
+#define DECLARE_PER_CPU(type, name) extern __typeof__(type) name
+#define per_cpu_ptr(p, cpu) ((__typeof__(p))((char *)(p) + kshim_percpu_off[cpu]))
+#define this_cpu_ptr(p) per_cpu_ptr(p, kshim_cpu)
+#define per_cpu(var, cpu) (*per_cpu_ptr(&(var), cpu))
+#define this_cpu_read(var) (*this_cpu_ptr(&(var)))
+#define this_cpu_write(var, v) (*this_cpu_ptr(&(var)) = (v))
+#define this_cpu_inc(var) ((*this_cpu_ptr(&(var)))++)
+#define this_cpu_dec(var) ((*this_cpu_ptr(&(var)))--)
+#define this_cpu_add(var, v) ((*this_cpu_ptr(&(var))) += (v))
+#define this_cpu_sub(var, v) ((*this_cpu_ptr(&(var))) -= (v))
+#define __this_cpu_inc this_cpu_inc
+#define __this_cpu_dec this_cpu_dec
+#define __this_cpu_add this_cpu_add
+#define __this_cpu_sub this_cpu_sub
+#define __this_cpu_read this_cpu_read
+#define __this_cpu_write this_cpu_write
+#define raw_cpu_inc this_cpu_inc
+#define raw_cpu_add this_cpu_add
+#define this_cpu_inc_return(var) (++(*this_cpu_ptr(&(var))))
+#define get_cpu_var(var) (*this_cpu_ptr(&(var)))
+#define put_cpu_var(var) do { } while (0)
+#define alloc_percpu(type) ((type *)kshim_alloc_percpu(sizeof(type), __alignof__(type)))
+#define alloc_percpu_gfp(type, gfp) alloc_percpu(type)
+#define __alloc_percpu(size, align) kshim_alloc_percpu(size, align)
+#define free_percpu(p) kshim_free_percpu(p)
+#define raw_cpu_ptr(p) this_cpu_ptr(p)
+#define get_cpu_ptr(p) this_cpu_ptr(p)
+#define put_cpu_ptr(p) do { } while (0)
+
+/* ---- preemption, bottom halves, RCU, locks (single-threaded model) ---- */
+#define preempt_disable() barrier()
+#define preempt_enable() barrier()
+#define local_bh_disable() barrier()
+#define local_bh_enable() barrier()
+#define local_irq_save(f) ((f) = 0)
+#define local_irq_restore(f) ((void)(f))
+#define in_softirq() 1
+#define in_task() 0
+#define might_sleep() do { } while (0)
+#define cond_resched() do { } while (0)
+
+#define rcu_read_lock() barrier()
+#define rcu_read_unlock() barrier()
+#define rcu_read_lock_bh() barrier()
+#define rcu_read_unlock_bh() barrier()
+#define rcu_dereference(p) READ_ONCE(p)
+#define rcu_dereference_bh(p) READ_ONCE(p)
+#define rcu_dereference_protected(p, c) (p)
+#define rcu_dereference_raw(p) READ_ONCE(p)
+#define rcu_access_pointer(p) READ_ONCE(p)
+#define rcu_assign_pointer(p, v) do { smp_wmb(); WRITE_ONCE(p, v); } while (0)
+#define RCU_INIT_POINTER(p, v) WRITE_ONCE(p, v)
+#define lockdep_is_held(l) 1
+#define lockdep_assert_held(l) do { } while (0)
+/* Quiescent-state based RCU. Threads that read RCU-protected data while
+ * another thread updates it register and call kshim_rcu_quiescent() between
+ * packets, as a CPU passes a quiescent state when it leaves softirq. With
+ * no registered readers a grace period completes immediately. */
+struct rcu_head { struct rcu_head *next; void (*func)(struct rcu_head *); unsigned long gp; };
+void kshim_call_rcu(struct rcu_head *h, void (*f)(struct rcu_head *));
+#define call_rcu(h, f) kshim_call_rcu(h, f)
+void synchronize_rcu(void);
+void rcu_barrier(void);
+void kshim_rcu_register(void);
+void kshim_rcu_unregister(void);
+void kshim_rcu_quiescent(void);
+void kshim_rcu_poll(void); /* run callbacks whose grace period has ended */
+#define kfree_rcu(p, field) kfree(p)
+
+typedef struct { int locked; } spinlock_t;
+typedef spinlock_t raw_spinlock_t;
+#define __SPIN_LOCK_UNLOCKED(n) { 0 }
+#define DEFINE_SPINLOCK(n) spinlock_t n = { 0 }
+#define spin_lock_init(l) ((l)->locked = 0)
+#define spin_lock(l) ((l)->locked = 1)
+#define spin_unlock(l) ((l)->locked = 0)
+#define spin_trylock(l) ((l)->locked ? 0 : ((l)->locked = 1))
+#define spin_lock_bh spin_lock
+#define spin_unlock_bh spin_unlock
+#define spin_lock_irqsave(l, f) ((f) = 0, spin_lock(l))
+#define spin_unlock_irqrestore(l, f) ((void)(f), spin_unlock(l))
+#define raw_spin_lock spin_lock
+#define raw_spin_unlock spin_unlock
+struct mutex { int locked; };
+#define DEFINE_MUTEX(n) struct mutex n = { 0 }
+#define mutex_init(m) ((m)->locked = 0)
+#define mutex_lock(m) ((m)->locked = 1)
+#define mutex_unlock(m) ((m)->locked = 0)
+#define mutex_trylock(m) ((m)->locked ? 0 : ((m)->locked = 1))
+typedef struct { unsigned int sequence; } seqcount_t;
+
+/* ---- static keys (plain booleans) ---- */
+struct static_key_false { int enabled; };
+struct static_key_true { int enabled; };
+#define DEFINE_STATIC_KEY_FALSE(n) struct static_key_false n = { 0 }
+#define DEFINE_STATIC_KEY_TRUE(n) struct static_key_true n = { 1 }
+#define DECLARE_STATIC_KEY_FALSE(n) extern struct static_key_false n
+#define DECLARE_STATIC_KEY_TRUE(n) extern struct static_key_true n
+#define static_branch_unlikely(k) unlikely((k)->enabled)
+#define static_branch_likely(k) likely((k)->enabled)
+#define static_branch_enable(k) ((k)->enabled = 1)
+#define static_branch_disable(k) ((k)->enabled = 0)
+#define static_key_enabled(k) ((k)->enabled)
+#define static_branch_inc(k) ((k)->enabled++)
+#define static_branch_dec(k) ((k)->enabled--)
+
+/* ---- time ---- */
+#define HZ 1000
+#define NSEC_PER_SEC 1000000000ULL
+#define NSEC_PER_MSEC 1000000ULL
+#define NSEC_PER_USEC 1000ULL
+#define USEC_PER_SEC 1000000ULL
+#define MSEC_PER_SEC 1000ULL
+extern volatile unsigned long jiffies;
+#define time_after(a, b) ((long)((b) - (a)) < 0)
+#define time_before(a, b) time_after(b, a)
+#define time_after_eq(a, b) ((long)((a) - (b)) >= 0)
+#define time_before_eq(a, b) time_after_eq(b, a)
+static inline unsigned long msecs_to_jiffies(unsigned int m) { return m; }
+static inline unsigned int jiffies_to_msecs(unsigned long j) { return (unsigned int)j; }
+static inline u64 jiffies_to_nsecs(unsigned long j) { return (u64)j * NSEC_PER_MSEC; }
+static inline u64 kshim_clock_ns(clockid_t id)
+{
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+static inline u64 ktime_get_ns(void) { return kshim_clock_ns(CLOCK_MONOTONIC); }
+extern u64 kshim_real_offset_ns; // added to the wall clock, to fake a long module unload
+static inline u64 ktime_get_real_ns(void) { return kshim_clock_ns(CLOCK_REALTIME) + kshim_real_offset_ns; }
+static inline u64 ktime_get_mono_fast_ns(void) { return kshim_clock_ns(CLOCK_MONOTONIC); }
+static inline u64 local_clock(void) { return kshim_clock_ns(CLOCK_MONOTONIC); }
+static inline time64_t ktime_get_real_seconds(void) { return (time64_t)time(NULL); }
+static inline time64_t ktime_get_seconds(void) { return kshim_clock_ns(CLOCK_MONOTONIC) / NSEC_PER_SEC; }
+struct timespec64 { time64_t tv_sec; long tv_nsec; };
+static inline void ktime_get_real_ts64(struct timespec64 *ts)
+{
+    u64 ns = ktime_get_real_ns();
+    ts->tv_sec = ns / NSEC_PER_SEC;
+    ts->tv_nsec = ns % NSEC_PER_SEC;
+}
+void time64_to_tm(time64_t totalsecs, int offset, struct tm *result);
+
+struct timer_list {
+    void (*function)(struct timer_list *);
+    unsigned long expires;
+    int pending;
+};
+#define timer_setup(t, fn, fl) ((t)->function = (fn), (t)->expires = 0, (t)->pending = 0)
+static inline int mod_timer(struct timer_list *t, unsigned long e) { t->expires = e; t->pending = 1; return 0; }
+static inline int del_timer_sync(struct timer_list *t) { t->pending = 0; return 0; }
+static inline int del_timer(struct timer_list *t) { t->pending = 0; return 0; }
+#define from_timer(var, t, field) container_of(t, __typeof__(*var), field)
+/* Run a timer callback if it is due; the benchmark drives this by hand. */
+static inline void kshim_run_timer(struct timer_list *t)
+{
+    if (t->pending && time_after_eq(jiffies, t->expires)) {
+        t->pending = 0;
+        t->function(t);
+    }
+}
+
+/* ---- work queues: run inline when flushed ---- */
+struct work_struct { void (*func)(struct work_struct *); int pending; };
+struct delayed_work { struct work_struct work; struct timer_list timer; };
+struct workqueue_struct { int unused; };
+#define INIT_WORK(w, f) ((w)->func = (f), (w)->pending = 0)
+#define INIT_DELAYED_WORK(w, f) INIT_WORK(&(w)->work, f)
+#define to_delayed_work(w) container_of(w, struct delayed_work, work)
+static inline bool schedule_work(struct work_struct *w) { w->pending = 1; return true; }
+static inline bool queue_work(struct workqueue_struct *q, struct work_struct *w) { (void)q; return schedule_work(w); }
+static inline bool schedule_delayed_work(struct delayed_work *w, unsigned long d) { (void)d; return schedule_work(&w->work); }
+static inline bool queue_delayed_work(struct workqueue_struct *q, struct delayed_work *w, unsigned long d) { (void)q; (void)d; return schedule_work(&w->work); }
+static inline bool mod_delayed_work(struct workqueue_struct *q, struct delayed_work *w, unsigned long d) { (void)q; (void)d; return schedule_work(&w->work); }
+static inline bool cancel_work_sync(struct work_struct *w) { int p = w->pending; w->pending = 0; return p; }
+static inline bool cancel_delayed_work_sync(struct delayed_work *w) { return cancel_work_sync(&w->work); }
+static inline void flush_work(struct work_struct *w) { if (w->pending) { w->pending = 0; w->func(w); } }
+static inline bool flush_delayed_work(struct delayed_work *w) { flush_work(&w->work); return true; }
+static inline struct workqueue_struct *alloc_workqueue(const char *f, unsigned int fl, int m, ...) { (void)f; (void)fl; (void)m; return calloc(1, sizeof(struct workqueue_struct)); }
+#define create_singlethread_workqueue(n) alloc_workqueue(n, 0, 1)
+#define alloc_ordered_workqueue(n, fl, ...) alloc_workqueue(n, fl, 1)
+static inline void destroy_workqueue(struct workqueue_struct *q) { free(q); }
+#define system_wq NULL
+#define WQ_UNBOUND 0
+#define WQ_MEM_RECLAIM 0
+#define WQ_FREEZABLE 0
+
+/* ---- random ---- */
+static inline u32 get_random_u32(void) { return (u32)random() ^ ((u32)random() << 16); }
+static inline void get_random_bytes(void *buf, size_t n)
+{
+    unsigned char *p = buf;
+    while (n--)
+        *p++ = (unsigned char)random();
+}
+
+/* ---- files (backed by stdio) ---- */
+struct inode { int unused; };
+/* A dentry is just its path; filp_open builds the file's dentry and its parent */
+struct dentry { struct dentry *d_parent; struct inode *d_inode; char *d_name; int d_count; };
+struct vfsmount { int unused; };
+struct path { struct vfsmount *mnt; struct dentry *dentry; };
+struct file { FILE *fp; void *private_data; struct path f_path; };
+#define O_RDONLY 00
+#define O_WRONLY 01
+#define O_RDWR 02
+#define O_CREAT 0100
+#define O_TRUNC 01000
+#define O_APPEND 02000
+#define O_DIRECTORY 0200000 /* fopen(3) opens a directory read-only too */
+#define O_LARGEFILE 0
+struct file *filp_open(const char *path, int flags, unsigned short mode);
+int filp_close(struct file *f, void *id);
+ssize_t kernel_read(struct file *f, void *buf, size_t count, loff_t *pos);
+ssize_t kernel_write(struct file *f, const void *buf, size_t count, loff_t *pos);
+struct dentry *kshim_dentry(const char *path, struct dentry *parent);
+void dput(struct dentry *d);
+static inline struct dentry *dget_parent(struct dentry *d)
+{
+    d->d_parent->d_count++;
+    return d->d_parent;
+}
+static inline struct inode *d_inode(const struct dentry *d) { return d->d_inode; }
+static inline int d_unhashed(const struct dentry *d) { (void)d; return 0; }
+static inline const char *kbasename(const char *path)
+{
+    const char *tail = strrchr(path, '/');
+    return tail ? tail + 1 : path;
+}
+#define I_MUTEX_PARENT 1
+#define inode_lock_nested(inode, subclass) ((void)(inode), (void)(subclass))
+#define inode_unlock(inode) ((void)(inode))
+#define mnt_want_write(mnt) ((void)(mnt), 0)
+#define mnt_drop_write(mnt) ((void)(mnt))
+struct mnt_idmap;
+#define mnt_idmap(mnt) ((void)(mnt), (struct mnt_idmap *)NULL)
+struct renamedata {
+    struct mnt_idmap *old_mnt_idmap;
+    struct inode *old_dir;
+    struct dentry *old_dentry;
+    struct mnt_idmap *new_mnt_idmap;
+    struct inode *new_dir;
+    struct dentry *new_dentry;
+    unsigned int flags;
+};
+struct dentry *lookup_one_len(const char *name, struct dentry *dir, int len);
+int vfs_rename(struct renamedata *rd);
+static inline long copy_to_user(void *to, const void *from, unsigned long n) { memcpy(to, from, n); return 0; }
+#define u64_to_user_ptr(x) ((void __user *)(uintptr_t)(x))
+static inline long copy_from_user(void *to, const void *from, unsigned long n) { memcpy(to, from, n); return 0; }
+static inline long strncpy_from_user(char *dst, const char *src, long count)
+{
+    long n = strnlen(src, count);
+    memcpy(dst, src, n < count ? n + 1 : n);
+    return n;
+}
+
+struct seq_file { char *buf; size_t size; size_t count; void *private; };
+int seq_printf(struct seq_file *m, const char *fmt, ...);
+void seq_puts(struct seq_file *m, const char *s);
+void seq_putc(struct seq_file *m, char c);
+int seq_write(struct seq_file *m, const void *data, size_t len);
+static inline bool seq_has_overflowed(struct seq_file *m) { return m->count == m->size; }
+int single_open(struct file *f, int (*show)(struct seq_file *, void *), void *data);
+int single_release(struct inode *inode, struct file *f);
+ssize_t seq_read(struct file *f, char __user *buf, size_t size, loff_t *ppos);
+loff_t seq_lseek(struct file *f, loff_t off, int whence);
+int single_open_size(struct file *f, int (*show)(struct seq_file *, void *), void *data, size_t size);
+
+/* ---- netfilter ---- */
+/* Only init_net exists; registering pernet operations runs them on it */
+#define KSHIM_NET_GEN_MAX 4
+struct proc_dir_entry;
+struct list_head;
+struct user_namespace;
+struct net {
+    struct proc_dir_entry *proc_net;
+    struct user_namespace *user_ns;
+    void *gen[KSHIM_NET_GEN_MAX];
+};
+extern struct net init_net;
+struct pernet_operations {
+    int (*init)(struct net *net);
+    void (*pre_exit)(struct net *net);
+    void (*exit)(struct net *net);
+    void (*exit_batch)(struct list_head *net_exit_list);
+    unsigned int *id;
+    size_t size;
+};
+int register_pernet_subsys(struct pernet_operations *ops);
+void unregister_pernet_subsys(struct pernet_operations *ops);
+static inline void *net_generic(const struct net *net, unsigned int id) { return net->gen[id]; }
+static inline bool net_eq(const struct net *a, const struct net *b) { return a == b; }
+static inline struct net *get_net(struct net *net) { return net; }
+static inline void put_net(struct net *net) { (void)net; }
+#define __net_init
+#define __net_exit
+struct net_device { char name[16]; int ifindex; };
+struct sk_buff;
+struct nf_hook_state {
+    unsigned int hook;
+    u8 pf;
+    struct net_device *in;
+    struct net_device *out;
+    struct net *net;
+};
+typedef unsigned int nf_hookfn(void *priv, struct sk_buff *skb, const struct nf_hook_state *state);
+struct nf_hook_ops {
+    nf_hookfn *hook;
+    struct net_device *dev;
+    void *priv;
+    u8 pf;
+    unsigned int hooknum;
+    int priority;
+};
+static inline int nf_register_net_hook(struct net *n, const struct nf_hook_ops *o) { (void)n; (void)o; return 0; }
+static inline void nf_unregister_net_hook(struct net *n, const struct nf_hook_ops *o) { (void)n; (void)o; }
+static inline int nf_register_net_hooks(struct net *n, const struct nf_hook_ops *o, unsigned int c) { (void)n; (void)o; (void)c; return 0; }
+static inline void nf_unregister_net_hooks(struct net *n, const struct nf_hook_ops *o, unsigned int c) { (void)n; (void)o; (void)c; }
+#ifndef PF_INET
+#define PF_INET 2
+#endif
+#ifndef PF_INET6
+#define PF_INET6 10
+#endif
+
+/* ---- sk_buff ---- */
+struct sk_buff {
+    unsigned char *head;
+    unsigned char *data;
+    unsigned int len;
+    unsigned int data_len;
+    u16 network_header;
+    u16 transport_header;
+    __be16 protocol;
+    u32 hash;
+    struct net_device *dev;
+};
+static inline unsigned char *skb_network_header(const struct sk_buff *skb) { return skb->head + skb->network_header; }
+static inline unsigned char *skb_transport_header(const struct sk_buff *skb) { return skb->head + skb->transport_header; }
+static inline int skb_network_offset(const struct sk_buff *skb) { return (int)(skb_network_header(skb) - skb->data); }
+static inline int skb_transport_offset(const struct sk_buff *skb) { return (int)(skb_transport_header(skb) - skb->data); }
+static inline unsigned int skb_headlen(const struct sk_buff *skb) { return skb->len - skb->data_len; }
+static inline void skb_set_transport_header(struct sk_buff *skb, int off) { skb->transport_header = (u16)(skb->data - skb->head + off); }
+static inline void skb_reset_network_header(struct sk_buff *skb) { skb->network_header = (u16)(skb->data - skb->head); }
+static inline void *skb_header_pointer(const struct sk_buff *skb, int offset, int len, void *buffer)
+{
+    (void)buffer;
+    if (offset < 0 || (unsigned int)(offset + len) > skb->len)
+        return NULL;
+    return skb->data + offset;
+}
+static inline int skb_ensure_writable(struct sk_buff *skb, unsigned int len) { return len <= skb->len ? 0 : -ENOMEM; }
+static inline bool skb_is_nonlinear(const struct sk_buff *skb) { return skb->data_len != 0; }
+static inline bool skb_is_gso(const struct sk_buff *skb) { (void)skb; return false; }
+
+/* ---- checksum helpers ---- */
+typedef __u16 __sum16_t;
+void csum_replace4(__sum16 *sum, __be32 from, __be32 to);
+void csum_replace2(__sum16 *sum, __be16 from, __be16 to);
+void inet_proto_csum_replace4(__sum16 *sum, struct sk_buff *skb, __be32 from, __be32 to, bool pseudohdr);
+void inet_proto_csum_replace2(__sum16 *sum, struct sk_buff *skb, __be16 from, __be16 to, bool pseudohdr);
+
+/* ---- inet ---- */
+__be32 in_aton(const char *str);
+int in4_pton(const char *src, int srclen, u8 *dst, int delim, const char **end);
+int in6_pton(const char *src, int srclen, u8 *dst, int delim, const char **end);
+int inet_pton_with_scope(struct net *net, unsigned short af, const char *src, const char *port,
+                         struct sockaddr_storage *addr);
+
+/* ---- sockets (userspace sockets) and kernel threads (pthreads) ---- */
+struct sock { int fd; };
+struct socket { struct sock *sk; };
+struct kvec { void *iov_base; size_t iov_len; };
+int sock_create_kern(struct net *net, int family, int type, int proto, struct socket **res);
+void sock_release(struct socket *sock);
+int kernel_bind(struct socket *sock, struct sockaddr *addr, int addrlen);
+int kernel_sendmsg(struct socket *sock, struct msghdr *msg, struct kvec *vec, size_t num, size_t len);
+int kernel_recvmsg(struct socket *sock, struct msghdr *msg, struct kvec *vec, size_t num, size_t len, int flags);
+int kernel_sock_shutdown(struct socket *sock, int how);
+void sock_set_rcvbuf(struct sock *sk, int val);
+struct task_struct;
+struct task_struct *kthread_run(int (*fn)(void *), void *data, const char *namefmt, ...);
+bool kthread_should_stop(void);
+int kthread_stop(struct task_struct *t);
+
+#endif /* KSHIM_H */
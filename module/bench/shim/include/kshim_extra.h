@@ -0,0 +1,100 @@
+/* Control-plane declarations: proc files, character devices, mmap and poll.
+ * Only what the datapath reaches (event ring allocation and wakeups) is
+ * implemented in kshim.c; the rest exists so main.c and driver.c can be
+ * syntax-checked with "make -C bench check". */
+#ifndef KSHIM_EXTRA_H
+#define KSHIM_EXTRA_H
+#include <kshim.h>
+#include <linux/list.h>
+struct proc_dir_entry;
+struct vm_area_struct { unsigned long vm_start, vm_end, vm_pgoff, vm_flags; void *vm_private_data; const struct vm_operations_struct *vm_ops; struct file *vm_file; };
+struct vm_fault { struct vm_area_struct *vma; unsigned long pgoff; struct page *page; unsigned long address; };
+typedef unsigned int vm_fault_t;
+struct vm_operations_struct { void (*open)(struct vm_area_struct *); void (*close)(struct vm_area_struct *); vm_fault_t (*fault)(struct vm_fault *); };
+struct page;
+
+struct poll_table_struct;
+typedef struct poll_table_struct poll_table;
+typedef struct { int x; } wait_queue_head_t;
+struct proc_ops {
+    int (*proc_open)(struct inode *, struct file *);
+    ssize_t (*proc_read)(struct file *, char __user *, size_t, loff_t *);
+    ssize_t (*proc_write)(struct file *, const char __user *, size_t, loff_t *);
+    loff_t (*proc_lseek)(struct file *, loff_t, int);
+    int (*proc_release)(struct inode *, struct file *);
+    __poll_t (*proc_poll)(struct file *, struct poll_table_struct *);
+    long (*proc_ioctl)(struct file *, unsigned int, unsigned long);
+    int (*proc_mmap)(struct file *, struct vm_area_struct *);
+};
+struct file_operations {
+    void *owner;
+    loff_t (*llseek)(struct file *, loff_t, int);
+    ssize_t (*read)(struct file *, char __user *, size_t, loff_t *);
+    ssize_t (*write)(struct file *, const char __user *, size_t, loff_t *);
+    __poll_t (*poll)(struct file *, struct poll_table_struct *);
+    long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+    long (*compat_ioctl)(struct file *, unsigned int, unsigned long);
+    int (*mmap)(struct file *, struct vm_area_struct *);
+    int (*open)(struct inode *, struct file *);
+    int (*release)(struct inode *, struct file *);
+};
+struct proc_dir_entry *proc_create(const char *name, unsigned short mode, struct proc_dir_entry *parent, const struct proc_ops *ops);
+struct proc_dir_entry *proc_create_data(const char *name, unsigned short mode, struct proc_dir_entry *parent, const struct proc_ops *ops, void *data);
+struct proc_dir_entry *proc_create_single(const char *name, unsigned short mode, struct proc_dir_entry *parent, int (*show)(struct seq_file *, void *));
+struct proc_dir_entry *proc_create_net_single(const char *name, unsigned short mode, struct proc_dir_entry *parent, int (*show)(struct seq_file *, void *), void *data);
+typedef int (*proc_write_t)(struct file *, char *, size_t);
+struct proc_dir_entry *proc_create_net_single_write(const char *name, unsigned short mode, struct proc_dir_entry *parent, int (*show)(struct seq_file *, void *), proc_write_t write, void *data);
+struct proc_dir_entry *proc_symlink(const char *name, struct proc_dir_entry *parent, const char *dest);
+void remove_proc_entry(const char *name, struct proc_dir_entry *parent);
+static inline struct net *seq_file_single_net(struct seq_file *m) { (void)m; return &init_net; }
+struct nsproxy { struct net *net_ns; };
+struct task_struct { struct nsproxy *nsproxy; void *kthread; };
+extern struct task_struct *kshim_current;
+#define current kshim_current
+void *pde_data(const struct inode *inode);
+void *PDE_DATA(const struct inode *inode);
+ssize_t simple_read_from_buffer(void __user *to, size_t count, loff_t *ppos, const void *from, size_t available);
+struct class; struct device;
+int register_chrdev(unsigned int major, const char *name, const struct file_operations *fops);
+void unregister_chrdev(unsigned int major, const char *name);
+struct class *class_create(void *owner, const char *name);
+void class_destroy(struct class *cls);
+void class_unregister(struct class *cls);
+struct device *device_create(struct class *cls, struct device *parent, unsigned int devt, void *drvdata, const char *fmt, ...);
+void device_destroy(struct class *cls, unsigned int devt);
+#define MKDEV(ma, mi) (((ma) << 20) | (mi))
+#define module_init(f) int kshim_init_dummy(void) { return f(); }
+#define module_exit(f) void kshim_exit_dummy(void) { f(); }
+int param_set_bool(const char *val, const struct kernel_param *kp);
+int param_get_bool(char *buffer, const struct kernel_param *kp);
+int param_set_uint(const char *val, const struct kernel_param *kp);
+int param_get_uint(char *buffer, const struct kernel_param *kp);
+#define init_waitqueue_head(q) ((void)(q))
+#define DECLARE_WAIT_QUEUE_HEAD(n) wait_queue_head_t n
+void wake_up_interruptible(wait_queue_head_t *q);
+void poll_wait(struct file *f, wait_queue_head_t *q, poll_table *p);
+#define EPOLLIN 1
+#define EPOLLRDNORM 0x40
+#define POLLIN 1
+#define POLLRDNORM 0x40
+int remap_vmalloc_range(struct vm_area_struct *vma, void *addr, unsigned long pgoff);
+void *vmalloc_user(unsigned long size);
+#define PAGE_SIZE 4096UL
+#define PAGE_SHIFT 12
+#define PAGE_ALIGN(x) (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+#define VM_WRITE 2
+#define VM_SHARED 8
+#define VM_DONTEXPAND 0x40000
+#define VM_DONTDUMP 0x4000000
+#define _IOC_NONE 0
+#define _IO(t,n) ((t)<<8|(n))
+#define _IOR(t,n,s) (0x80000000|(sizeof(s)<<16)|((t)<<8)|(n))
+#define _IOW(t,n,s) (0x40000000|(sizeof(s)<<16)|((t)<<8)|(n))
+#define _IOWR(t,n,s) (0xc0000000|(sizeof(s)<<16)|((t)<<8)|(n))
+#define _IOC_SIZE(n) (((n) >> 16) & 0x3fff)
+#define ENOTTY 25
+long compat_ptr_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
+int capable(int cap);
+static inline bool ns_capable(struct user_namespace *ns, int cap) { (void)ns; (void)cap; return true; }
+#define CAP_NET_ADMIN 12
+#endif
@@ -0,0 +1,5 @@
+#ifndef KSHIM_LINUX_BITOPS_H
+#define KSHIM_LINUX_BITOPS_H
+#include <kshim.h>
+#include <linux/list.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef KSHIM_LINUX_BOTTOM_HALF_H
+#define KSHIM_LINUX_BOTTOM_HALF_H
+#include <kshim.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef KSHIM_LINUX_ERRNO_H
+#define KSHIM_LINUX_ERRNO_H
+#include_next <linux/errno.h>
+#endif
@@ -0,0 +1,5 @@
+#ifndef KSHIM_LINUX_FS_H
+#define KSHIM_LINUX_FS_H
+#include <kshim.h>
+#include <linux/list.h>
+#endif
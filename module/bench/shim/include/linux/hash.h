@@ -0,0 +1,4 @@
+#ifndef KSHIM_LINUX_HASH_H
+#define KSHIM_LINUX_HASH_H
+#include <linux/hashtable.h>
+#endif
@@ -0,0 +1,40 @@
+/* Userspace copy of <linux/hashtable.h>. */
+#ifndef KSHIM_LINUX_HASHTABLE_H
+#define KSHIM_LINUX_HASHTABLE_H
+
+#include <linux/list.h>
+
+#define GOLDEN_RATIO_32 0x61C88647
+static inline u32 hash_32(u32 val, unsigned int bits) { return (val * GOLDEN_RATIO_32) >> (32 - bits); }
+static inline u32 hash_64(u64 val, unsigned int bits) { return (u32)((val * 0x61C8864680B583EBull) >> (64 - bits)); }
+
+#define DEFINE_HASHTABLE(name, bits) struct hlist_head name[1 << (bits)] = { [0 ... ((1 << (bits)) - 1)] = HLIST_HEAD_INIT }
+#define DECLARE_HASHTABLE(name, bits) struct hlist_head name[1 << (bits)]
+#define HASH_SIZE(name) (ARRAY_SIZE(name))
+#define HASH_BITS(name) ilog2(HASH_SIZE(name))
+#define hash_min(val, bits) (sizeof(val) <= 4 ? hash_32(val, bits) : hash_64(val, bits))
+
+static inline void __hash_init(struct hlist_head *ht, unsigned int sz)
+{
+    unsigned int i;
+    for (i = 0; i < sz; i++)
+        INIT_HLIST_HEAD(&ht[i]);
+}
+#define hash_init(table) __hash_init(table, HASH_SIZE(table))
+#define hash_add(table, node, key) hlist_add_head(node, &table[hash_min(key, HASH_BITS(table))])
+#define hash_add_rcu hash_add
+static inline void hash_del(struct hlist_node *node) { hlist_del_init(node); }
+#define hash_del_rcu hash_del
+static inline bool hash_hashed(struct hlist_node *node) { return !hlist_unhashed(node); }
+#define hash_for_each(name, bkt, obj, member) \
+    for ((bkt) = 0, obj = NULL; obj == NULL && (bkt) < (int)HASH_SIZE(name); (bkt)++) \
+        hlist_for_each_entry(obj, &name[bkt], member)
+#define hash_for_each_rcu hash_for_each
+#define hash_for_each_safe(name, bkt, tmp, obj, member) \
+    for ((bkt) = 0, obj = NULL; obj == NULL && (bkt) < (int)HASH_SIZE(name); (bkt)++) \
+        hlist_for_each_entry_safe(obj, tmp, &name[bkt], member)
+#define hash_for_each_possible(name, obj, member, key) \
+    hlist_for_each_entry(obj, &name[hash_min(key, HASH_BITS(name))], member)
+#define hash_for_each_possible_rcu(name, obj, member, key, ...) hash_for_each_possible(name, obj, member, key)
+
+#endif /* KSHIM_LINUX_HASHTABLE_H */
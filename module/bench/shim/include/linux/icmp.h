@@ -0,0 +1,6 @@
+#ifndef KSHIM_LINUX_ICMP_H
+#define KSHIM_LINUX_ICMP_H
+#include <kshim.h>
+#include_next <linux/icmp.h>
+static inline struct icmphdr *icmp_hdr(const struct sk_buff *skb) { return (struct icmphdr *)skb_transport_header(skb); }
+#endif
@@ -0,0 +1,5 @@
+#ifndef KSHIM_LINUX_ICMPV6_H
+#define KSHIM_LINUX_ICMPV6_H
+#include <kshim.h>
+#include_next <linux/icmpv6.h>
+#endif
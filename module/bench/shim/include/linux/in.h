@@ -0,0 +1,5 @@
+#ifndef KSHIM_LINUX_IN_H
+#define KSHIM_LINUX_IN_H
+#include <kshim.h>
+#include_next <linux/in.h>
+#endif
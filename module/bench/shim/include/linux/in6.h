@@ -0,0 +1,5 @@
+#ifndef KSHIM_LINUX_IN6_H
+#define KSHIM_LINUX_IN6_H
+#include <kshim.h>
+#include_next <linux/in6.h>
+#endif
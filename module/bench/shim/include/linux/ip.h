@@ -0,0 +1,12 @@
+#ifndef KSHIM_LINUX_IP_H
+#define KSHIM_LINUX_IP_H
+#include <kshim.h>
+#include_next <linux/ip.h>
+static inline struct iphdr *ip_hdr(const struct sk_buff *skb) { return (struct iphdr *)skb_network_header(skb); }
+static inline unsigned int ip_hdrlen(const struct sk_buff *skb) { return ip_hdr(skb)->ihl * 4; }
+#ifndef IP_MF
+#define IP_MF 0x2000
+#define IP_OFFSET 0x1FFF
+#endif
+static inline bool ip_is_fragment(const struct iphdr *iph) { return (iph->frag_off & htons(IP_MF | IP_OFFSET)) != 0; }
+#endif
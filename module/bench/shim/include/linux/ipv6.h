@@ -0,0 +1,6 @@
+#ifndef KSHIM_LINUX_IPV6_H
+#define KSHIM_LINUX_IPV6_H
+#include <kshim.h>
+#include_next <linux/ipv6.h>
+static inline struct ipv6hdr *ipv6_hdr(const struct sk_buff *skb) { return (struct ipv6hdr *)skb_network_header(skb); }
+#endif
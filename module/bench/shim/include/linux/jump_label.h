@@ -0,0 +1,5 @@
+#ifndef KSHIM_LINUX_JUMP_LABEL_H
+#define KSHIM_LINUX_JUMP_LABEL_H
+#include <kshim.h>
+#include <linux/list.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef KSHIM_LINUX_KTHREAD_H
+#define KSHIM_LINUX_KTHREAD_H
+#include <kshim.h>
+#endif
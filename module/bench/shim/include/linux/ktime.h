@@ -0,0 +1,5 @@
+#ifndef KSHIM_LINUX_KTIME_H
+#define KSHIM_LINUX_KTIME_H
+#include <kshim.h>
+#include <linux/list.h>
+#endif
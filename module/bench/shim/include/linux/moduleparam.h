@@ -0,0 +1,5 @@
+#ifndef KSHIM_LINUX_MODULEPARAM_H
+#define KSHIM_LINUX_MODULEPARAM_H
+#include <kshim.h>
+#include <linux/list.h>
+#endif
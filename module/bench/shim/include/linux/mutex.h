@@ -0,0 +1,4 @@
+#ifndef KSHIM_LINUX_MUTEX_H
+#define KSHIM_LINUX_MUTEX_H
+#include <kshim.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef KSHIM_LINUX_NET_H
+#define KSHIM_LINUX_NET_H
+#include <kshim.h>
+#endif
@@ -0,0 +1,5 @@
+#ifndef KSHIM_LINUX_NETFILTER_H
+#define KSHIM_LINUX_NETFILTER_H
+#include <kshim.h>
+#include_next <linux/netfilter.h>
+#endif
@@ -0,0 +1,5 @@
+#ifndef KSHIM_LINUX_NETFILTER_IPV4_H
+#define KSHIM_LINUX_NETFILTER_IPV4_H
+#include <kshim.h>
+#include_next <linux/netfilter_ipv4.h>
+#endif
@@ -0,0 +1,5 @@
+#ifndef KSHIM_LINUX_NETFILTER_IPV6_H
+#define KSHIM_LINUX_NETFILTER_IPV6_H
+#include <kshim.h>
+#include_next <linux/netfilter_ipv6.h>
+#endif
@@ -0,0 +1,5 @@
+#ifndef KSHIM_LINUX_NSPROXY_H
+#define KSHIM_LINUX_NSPROXY_H
+#include <kshim.h>
+#include <kshim_extra.h>
+#endif
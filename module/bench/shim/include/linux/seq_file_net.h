@@ -0,0 +1,5 @@
+#ifndef KSHIM_LINUX_SEQ_FILE_NET_H
+#define KSHIM_LINUX_SEQ_FILE_NET_H
+#include <kshim.h>
+#include <kshim_extra.h>
+#endif
@@ -0,0 +1,6 @@
+#ifndef KSHIM_LINUX_SKBUFF_H
+#define KSHIM_LINUX_SKBUFF_H
+#include <kshim.h>
+#include <linux/list.h>
+#include <linux/netfilter.h>
+#endif
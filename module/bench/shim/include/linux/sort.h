@@ -0,0 +1,4 @@
+#ifndef KSHIM_LINUX_SORT_H
+#define KSHIM_LINUX_SORT_H
+#include <kshim.h>
+#endif
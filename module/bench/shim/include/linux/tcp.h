@@ -0,0 +1,6 @@
+#ifndef KSHIM_LINUX_TCP_H
+#define KSHIM_LINUX_TCP_H
+#include <kshim.h>
+#include_next <linux/tcp.h>
+static inline struct tcphdr *tcp_hdr(const struct sk_buff *skb) { return (struct tcphdr *)skb_transport_header(skb); }
+#endif
@@ -0,0 +1,15 @@
+/* Tracepoints compile to empty inline functions in the shim. */
+#ifndef KSHIM_LINUX_TRACEPOINT_H
+#define KSHIM_LINUX_TRACEPOINT_H
+#include <kshim.h>
+#define TP_PROTO(args...) args
+#define TP_ARGS(args...) args
+#define TP_STRUCT__entry(args...)
+#define TP_fast_assign(args...)
+#define TP_printk(fmt, args...)
+#define TRACE_EVENT(name, proto, args, struct, assign, print) \
+    static inline void trace_##name(proto) { }
+#define DECLARE_EVENT_CLASS(name, proto, args, tstruct, assign, print)
+#define DEFINE_EVENT(template, name, proto, args) \
+    static inline void trace_##name(proto) { }
+#endif
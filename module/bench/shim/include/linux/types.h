@@ -0,0 +1,5 @@
+#ifndef KSHIM_LINUX_TYPES_H
+#define KSHIM_LINUX_TYPES_H
+#include_next <linux/types.h>
+#include <kshim.h>
+#endif
@@ -0,0 +1,6 @@
+#ifndef KSHIM_LINUX_UDP_H
+#define KSHIM_LINUX_UDP_H
+#include <kshim.h>
+#include_next <linux/udp.h>
+static inline struct udphdr *udp_hdr(const struct sk_buff *skb) { return (struct udphdr *)skb_transport_header(skb); }
+#endif
@@ -0,0 +1,5 @@
+#ifndef KSHIM_LINUX_VERSION_H
+#define KSHIM_LINUX_VERSION_H
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + ((c) > 255 ? 255 : (c)))
+#define LINUX_VERSION_CODE KERNEL_VERSION(6, 3, 0)
+#endif
@@ -0,0 +1,4 @@
+#ifndef KSHIM_NET_IP_H
+#define KSHIM_NET_IP_H
+#include <linux/ip.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef KSHIM_NET_NET_NAMESPACE_H
+#define KSHIM_NET_NET_NAMESPACE_H
+#include <kshim.h>
+#endif
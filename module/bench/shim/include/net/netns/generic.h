@@ -0,0 +1,4 @@
+#ifndef KSHIM_NET_NETNS_GENERIC_H
+#define KSHIM_NET_NETNS_GENERIC_H
+#include <kshim.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef KSHIM_NET_SOCK_H
+#define KSHIM_NET_SOCK_H
+#include <kshim.h>
+#endif
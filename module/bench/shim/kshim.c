@@ -0,0 +1,912 @@
+/*
+ * Out-of-line parts of the kernel shim: formatting, file I/O, seq_file,
+ * address parsing and checksum helpers.
+ */
+#include <kshim.h>
+#include <kshim_extra.h>
+#include <linux/list.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#undef snprintf
+#undef vsnprintf
+
+int kshim_verbose;
+__thread int kshim_cpu;
+int nr_cpu_ids = 1;
+volatile unsigned long jiffies;
+u64 kshim_real_offset_ns;
+struct net init_net;
+struct task_struct *kshim_current = &(struct task_struct){ .nsproxy = &(struct nsproxy){ .net_ns = &init_net } };
+
+/* Format one kernel-style conversion; returns the number of fmt chars used. */
+static size_t kshim_fmt_pointer(char *out, size_t size, const char *fmt, const void *p, int *written)
+{
+    if (fmt[0] == 'I' && fmt[1] == '4') {
+        const u8 *a = p;
+        *written = snprintf(out, size, "%u.%u.%u.%u", a[0], a[1], a[2], a[3]);
+        return 2;
+    }
+    if (fmt[0] == 'I' && fmt[1] == '6') {
+        char tmp[INET6_ADDRSTRLEN];
+        inet_ntop(AF_INET6, p, tmp, sizeof(tmp));
+        *written = snprintf(out, size, "%s", tmp);
+        return fmt[2] == 'c' ? 3 : 2;
+    }
+    if (fmt[0] == 'I' && fmt[1] == 'S') {
+        *written = snprintf(out, size, "%s", "addr");
+        return 2;
+    }
+    *written = snprintf(out, size, "%p", p);
+    return 0;
+}
+
+int kshim_vsnprintf(char *buf, size_t size, const char *fmt, va_list args)
+{
+    size_t total = 0;
+    char spec[32];
+    char tmp[256];
+
+    while (*fmt) {
+        const char *start = fmt;
+        int n = 0;
+        size_t sl;
+        char lenmod[3] = "";
+        char conv;
+
+        if (*fmt != '%') {
+            if (total + 1 < size)
+                buf[total] = *fmt;
+            total++;
+            fmt++;
+            continue;
+        }
+        fmt++;
+        if (*fmt == '%') {
+            if (total + 1 < size)
+                buf[total] = '%';
+            total++;
+            fmt++;
+            continue;
+        }
+        while (strchr("-+ #0", *fmt))
+            fmt++;
+        if (*fmt == '*') {
+            fmt++;
+        } else {
+            while (isdigit((unsigned char)*fmt))
+                fmt++;
+        }
+        if (*fmt == '.') {
+            fmt++;
+            if (*fmt == '*')
+                fmt++;
+            else
+                while (isdigit((unsigned char)*fmt))
+                    fmt++;
+        }
+        while (strchr("hlzjt", *fmt) && strlen(lenmod) < 2)
+            lenmod[strlen(lenmod)] = *fmt++;
+        conv = *fmt++;
+        sl = (size_t)(fmt - start);
+        if (sl >= sizeof(spec))
+            sl = sizeof(spec) - 1;
+        memcpy(spec, start, sl);
+        spec[sl] = '\0';
+
+        switch (conv) {
+        case 'd': case 'i':
+            if (!strcmp(lenmod, "ll"))
+                n = snprintf(tmp, sizeof(tmp), spec, va_arg(args, long long));
+            else if (lenmod[0] == 'l' || lenmod[0] == 'z')
+                n = snprintf(tmp, sizeof(tmp), spec, va_arg(args, long));
+            else
+                n = snprintf(tmp, sizeof(tmp), spec, va_arg(args, int));
+            break;
+        case 'u': case 'x': case 'X': case 'o':
+            if (!strcmp(lenmod, "ll"))
+                n = snprintf(tmp, sizeof(tmp), spec, va_arg(args, unsigned long long));
+            else if (lenmod[0] == 'l' || lenmod[0] == 'z')
+                n = snprintf(tmp, sizeof(tmp), spec, va_arg(args, unsigned long));
+            else
+                n = snprintf(tmp, sizeof(tmp), spec, va_arg(args, unsigned int));
+            break;
+        case 'c':
+            n = snprintf(tmp, sizeof(tmp), spec, va_arg(args, int));
+            break;
+        case 's':
+            n = snprintf(tmp, sizeof(tmp), spec, va_arg(args, const char *));
+            break;
+        case 'p':
+            fmt += kshim_fmt_pointer(tmp, sizeof(tmp), fmt, va_arg(args, const void *), &n);
+            break;
+        default:
+            n = snprintf(tmp, sizeof(tmp), "%s", spec);
+            break;
+        }
+        if (n < 0)
+            n = 0;
+        if ((size_t)n >= sizeof(tmp))
+            n = sizeof(tmp) - 1;
+        if (total < size)
+            memcpy(buf + total, tmp, min((size_t)n, size - total));
+        total += n;
+    }
+    if (size)
+        buf[min(total, size - 1)] = '\0';
+    return (int)total;
+}
+
+int kshim_snprintf(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = kshim_vsnprintf(buf, size, fmt, args);
+    va_end(args);
+    return n;
+}
+
+int vscnprintf(char *buf, size_t size, const char *fmt, va_list args)
+{
+    int n = kshim_vsnprintf(buf, size, fmt, args);
+
+    if (!size)
+        return 0;
+    return (size_t)n >= size ? (int)size - 1 : n;
+}
+
+int scnprintf(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = vscnprintf(buf, size, fmt, args);
+    va_end(args);
+    return n;
+}
+
+int printk(const char *fmt, ...)
+{
+    char buf[512];
+    va_list args;
+
+    if (!kshim_verbose)
+        return 0;
+    va_start(args, fmt);
+    kshim_vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    fputs(buf, stderr);
+    return 0;
+}
+
+static int kshim_strtoull(const char *s, unsigned int base, unsigned long long max, unsigned long long *res)
+{
+    char *end;
+    unsigned long long v;
+
+    if (!*s || *s == '-')
+        return -EINVAL;
+    errno = 0;
+    v = strtoull(s, &end, base);
+    if (*end == '\n')
+        end++;
+    if (*end || errno)
+        return -EINVAL;
+    if (v > max)
+        return -ERANGE;
+    *res = v;
+    return 0;
+}
+
+int kstrtouint(const char *s, unsigned int base, unsigned int *res)
+{
+    unsigned long long v;
+    int ret = kshim_strtoull(s, base, UINT32_MAX, &v);
+
+    if (!ret)
+        *res = (unsigned int)v;
+    return ret;
+}
+
+int kstrtoul(const char *s, unsigned int base, unsigned long *res)
+{
+    unsigned long long v;
+    int ret = kshim_strtoull(s, base, ULONG_MAX, &v);
+
+    if (!ret)
+        *res = (unsigned long)v;
+    return ret;
+}
+
+int kstrtou32(const char *s, unsigned int base, u32 *res)
+{
+    return kstrtouint(s, base, res);
+}
+
+int kstrtou16(const char *s, unsigned int base, u16 *res)
+{
+    unsigned long long v;
+    int ret = kshim_strtoull(s, base, UINT16_MAX, &v);
+
+    if (!ret)
+        *res = (u16)v;
+    return ret;
+}
+
+int kstrtou8(const char *s, unsigned int base, u8 *res)
+{
+    unsigned long long v;
+    int ret = kshim_strtoull(s, base, UINT8_MAX, &v);
+
+    if (!ret)
+        *res = (u8)v;
+    return ret;
+}
+
+int kstrtoint(const char *s, unsigned int base, int *res)
+{
+    char *end;
+    long v;
+
+    if (!*s)
+        return -EINVAL;
+    errno = 0;
+    v = strtol(s, &end, base);
+    if (*end == '\n')
+        end++;
+    if (*end || errno)
+        return -EINVAL;
+    if (v < INT32_MIN || v > INT32_MAX)
+        return -ERANGE;
+    *res = (int)v;
+    return 0;
+}
+
+struct file *filp_open(const char *path, int flags, unsigned short mode)
+{
+    struct file *f;
+    const char *m = "r";
+
+    (void)mode;
+    if (flags & O_WRONLY)
+        m = (flags & O_APPEND) ? "a" : (flags & O_TRUNC) ? "w" : "r+";
+    else if (flags & O_RDWR)
+        m = (flags & O_TRUNC) ? "w+" : "r+";
+    f = calloc(1, sizeof(*f));
+    if (!f)
+        return ERR_PTR(-ENOMEM);
+    f->fp = fopen(path, m);
+    if (!f->fp && (flags & O_CREAT))
+        f->fp = fopen(path, "w+");
+    if (!f->fp) {
+        int err = errno;
+        free(f);
+        return ERR_PTR(-err);
+    }
+    {
+        const char *slash = strrchr(path, '/');
+        char *dir = slash ? strndup(path, slash == path ? 1 : (size_t)(slash - path)) : strdup(".");
+
+        f->f_path.dentry = kshim_dentry(path, kshim_dentry(dir, NULL));
+        free(dir);
+    }
+    return f;
+}
+
+struct dentry *kshim_dentry(const char *path, struct dentry *parent)
+{
+    struct dentry *d = calloc(1, sizeof(*d));
+
+    d->d_name = strdup(path);
+    d->d_parent = parent ? parent : d;
+    d->d_count = 1;
+    return d;
+}
+
+void dput(struct dentry *d)
+{
+    if (!d || --d->d_count)
+        return;
+    if (d->d_parent != d)
+        dput(d->d_parent);
+    free(d->d_name);
+    free(d);
+}
+
+struct dentry *lookup_one_len(const char *name, struct dentry *dir, int len)
+{
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%.*s", dir->d_name, len, name);
+    dir->d_count++;
+    return kshim_dentry(path, dir);
+}
+
+int vfs_rename(struct renamedata *rd)
+{
+    return rename(rd->old_dentry->d_name, rd->new_dentry->d_name) ? -errno : 0;
+}
+
+int filp_close(struct file *f, void *id)
+{
+    (void)id;
+    dput(f->f_path.dentry);
+    fclose(f->fp);
+    free(f);
+    return 0;
+}
+
+ssize_t kernel_read(struct file *f, void *buf, size_t count, loff_t *pos)
+{
+    size_t n;
+
+    if (fseeko(f->fp, *pos, SEEK_SET))
+        return -EIO;
+    n = fread(buf, 1, count, f->fp);
+    *pos += n;
+    return (ssize_t)n;
+}
+
+ssize_t kernel_write(struct file *f, const void *buf, size_t count, loff_t *pos)
+{
+    size_t n;
+
+    // Files opened with O_APPEND still write at the end, as in the kernel
+    if (fseeko(f->fp, *pos, SEEK_SET))
+        return -EIO;
+    n = fwrite(buf, 1, count, f->fp);
+
+    *pos += n;
+    return (ssize_t)n;
+}
+
+int seq_write(struct seq_file *m, const void *data, size_t len)
+{
+    if (m->count + len > m->size) {
+        size_t nsize = max(m->size * 2, m->count + len + 4096);
+        char *nbuf = realloc(m->buf, nsize);
+        if (!nbuf)
+            return -1;
+        m->buf = nbuf;
+        m->size = nsize;
+    }
+    memcpy(m->buf + m->count, data, len);
+    m->count += len;
+    return 0;
+}
+
+int seq_printf(struct seq_file *m, const char *fmt, ...)
+{
+    char buf[1024];
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = vscnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    return seq_write(m, buf, n);
+}
+
+void seq_puts(struct seq_file *m, const char *s)
+{
+    seq_write(m, s, strlen(s));
+}
+
+void seq_putc(struct seq_file *m, char c)
+{
+    seq_write(m, &c, 1);
+}
+
+int single_open(struct file *f, int (*show)(struct seq_file *, void *), void *data)
+{
+    struct seq_file *m = calloc(1, sizeof(*m));
+    int ret;
+
+    if (!m)
+        return -ENOMEM;
+    m->private = data;
+    ret = show(m, NULL);
+    f->private_data = m;
+    return ret;
+}
+
+int single_open_size(struct file *f, int (*show)(struct seq_file *, void *), void *data, size_t size)
+{
+    (void)size;
+    return single_open(f, show, data);
+}
+
+int single_release(struct inode *inode, struct file *f)
+{
+    struct seq_file *m = f->private_data;
+
+    (void)inode;
+    if (m) {
+        free(m->buf);
+        free(m);
+    }
+    f->private_data = NULL;
+    return 0;
+}
+
+ssize_t seq_read(struct file *f, char __user *buf, size_t size, loff_t *ppos)
+{
+    struct seq_file *m = f->private_data;
+    size_t n;
+
+    if (!m || (size_t)*ppos >= m->count)
+        return 0;
+    n = min(size, m->count - (size_t)*ppos);
+    memcpy(buf, m->buf + *ppos, n);
+    *ppos += n;
+    return (ssize_t)n;
+}
+
+loff_t seq_lseek(struct file *f, loff_t off, int whence)
+{
+    (void)f;
+    (void)whence;
+    return off;
+}
+
+void time64_to_tm(time64_t totalsecs, int offset, struct tm *result)
+{
+    time_t t = (time_t)(totalsecs + offset);
+
+    gmtime_r(&t, result);
+}
+
+#include <pthread.h>
+#include <sched.h>
+#define KSHIM_RCU_READERS 64
+static unsigned long kshim_rcu_gp; /* last grace period started */
+static unsigned long kshim_rcu_seen[KSHIM_RCU_READERS]; /* per reader, 0 = slot free */
+static __thread int kshim_rcu_slot = -1;
+static struct rcu_head *kshim_rcu_head, **kshim_rcu_tail = &kshim_rcu_head;
+static pthread_mutex_t kshim_rcu_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void kshim_rcu_register(void)
+{
+    int i;
+
+    for (i = 0; i < KSHIM_RCU_READERS; i++) {
+        unsigned long free = 0;
+
+        if (__atomic_compare_exchange_n(&kshim_rcu_seen[i], &free, __atomic_load_n(&kshim_rcu_gp, __ATOMIC_SEQ_CST) + 1,
+                                        false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            kshim_rcu_slot = i;
+            return;
+        }
+    }
+    abort();
+}
+
+void kshim_rcu_unregister(void)
+{
+    if (kshim_rcu_slot < 0)
+        return;
+    __atomic_store_n(&kshim_rcu_seen[kshim_rcu_slot], 0, __ATOMIC_SEQ_CST);
+    kshim_rcu_slot = -1;
+}
+
+/* The reader holds no references past this point: every grace period
+ * started so far may end as far as this thread is concerned. */
+void kshim_rcu_quiescent(void)
+{
+    if (kshim_rcu_slot < 0)
+        return;
+    __atomic_store_n(&kshim_rcu_seen[kshim_rcu_slot], __atomic_load_n(&kshim_rcu_gp, __ATOMIC_SEQ_CST) + 1,
+                     __ATOMIC_SEQ_CST);
+}
+
+/* Newest grace period every registered reader has passed */
+static unsigned long kshim_rcu_completed(void)
+{
+    unsigned long done = __atomic_load_n(&kshim_rcu_gp, __ATOMIC_SEQ_CST);
+    int i;
+
+    for (i = 0; i < KSHIM_RCU_READERS; i++) {
+        unsigned long seen = __atomic_load_n(&kshim_rcu_seen[i], __ATOMIC_SEQ_CST);
+
+        if (seen && i != kshim_rcu_slot && seen - 1 < done)
+            done = seen - 1;
+    }
+    return done;
+}
+
+void kshim_rcu_poll(void)
+{
+    struct rcu_head *ready = NULL, **ready_tail = &ready, *h;
+    unsigned long done;
+
+    pthread_mutex_lock(&kshim_rcu_lock);
+    done = kshim_rcu_completed();
+    while ((h = kshim_rcu_head) && h->gp <= done) {
+        kshim_rcu_head = h->next;
+        *ready_tail = h;
+        ready_tail = &h->next;
+    }
+    if (!kshim_rcu_head)
+        kshim_rcu_tail = &kshim_rcu_head;
+    pthread_mutex_unlock(&kshim_rcu_lock);
+    *ready_tail = NULL;
+
+    while ((h = ready)) {
+        ready = h->next;
+        h->func(h);
+    }
+}
+
+/* Callbacks run from kshim_rcu_poll() or rcu_barrier(), never inline, so
+ * the caller's timing does not include them. */
+void kshim_call_rcu(struct rcu_head *h, void (*f)(struct rcu_head *))
+{
+    h->func = f;
+    h->next = NULL;
+    pthread_mutex_lock(&kshim_rcu_lock);
+    h->gp = __atomic_add_fetch(&kshim_rcu_gp, 1, __ATOMIC_SEQ_CST);
+    *kshim_rcu_tail = h;
+    kshim_rcu_tail = &h->next;
+    pthread_mutex_unlock(&kshim_rcu_lock);
+}
+
+void synchronize_rcu(void)
+{
+    unsigned long gp = __atomic_add_fetch(&kshim_rcu_gp, 1, __ATOMIC_SEQ_CST);
+
+    while (kshim_rcu_completed() < gp)
+        sched_yield();
+}
+
+void rcu_barrier(void)
+{
+    synchronize_rcu();
+    kshim_rcu_poll();
+}
+
+static unsigned int kshim_net_gen_next;
+
+int register_pernet_subsys(struct pernet_operations *ops)
+{
+    int ret;
+
+    if (ops->id) {
+        if (kshim_net_gen_next == KSHIM_NET_GEN_MAX)
+            return -ENOSPC;
+        *ops->id = kshim_net_gen_next++;
+        if (ops->size && !(init_net.gen[*ops->id] = calloc(1, ops->size)))
+            return -ENOMEM;
+    }
+    ret = ops->init ? ops->init(&init_net) : 0;
+    if (ret && ops->id) {
+        free(init_net.gen[*ops->id]);
+        init_net.gen[*ops->id] = NULL;
+    }
+    return ret;
+}
+
+void unregister_pernet_subsys(struct pernet_operations *ops)
+{
+    LIST_HEAD(net_exit_list);
+
+    if (ops->pre_exit)
+        ops->pre_exit(&init_net);
+    if (ops->exit)
+        ops->exit(&init_net);
+    if (ops->exit_batch)
+        ops->exit_batch(&net_exit_list);
+    if (ops->id) {
+        free(init_net.gen[*ops->id]);
+        init_net.gen[*ops->id] = NULL;
+        /* Registering again, as a module reload does, gets the same id */
+        if (*ops->id == kshim_net_gen_next - 1)
+            kshim_net_gen_next--;
+    }
+}
+
+__be32 in_aton(const char *str)
+{
+    struct in_addr a;
+
+    if (inet_pton(AF_INET, str, &a) != 1)
+        return 0;
+    return a.s_addr;
+}
+
+static int kshim_pton(int af, const char *src, int srclen, u8 *dst, int delim, const char **end)
+{
+    char tmp[INET6_ADDRSTRLEN];
+    size_t n = srclen < 0 ? strlen(src) : (size_t)srclen;
+    size_t i;
+
+    for (i = 0; i < n && src[i] && src[i] != delim; i++)
+        ;
+    n = i;
+    if (n >= sizeof(tmp))
+        return 0;
+    memcpy(tmp, src, n);
+    tmp[n] = '\0';
+    if (end)
+        *end = src + n;
+    return inet_pton(af, tmp, dst) == 1;
+}
+
+int in4_pton(const char *src, int srclen, u8 *dst, int delim, const char **end)
+{
+    return kshim_pton(AF_INET, src, srclen, dst, delim, end);
+}
+
+int in6_pton(const char *src, int srclen, u8 *dst, int delim, const char **end)
+{
+    return kshim_pton(AF_INET6, src, srclen, dst, delim, end);
+}
+
+int inet_pton_with_scope(struct net *net, unsigned short af, const char *src, const char *port,
+                         struct sockaddr_storage *addr)
+{
+    struct sockaddr_in *sin = (struct sockaddr_in *)addr;
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)addr;
+    char *end;
+    unsigned long p = strtoul(port, &end, 10);
+
+    (void)net;
+    if (!*port || *end || p > 65535)
+        return -EINVAL;
+    memset(addr, 0, sizeof(*addr));
+    if (af != AF_INET6 && inet_pton(AF_INET, src, &sin->sin_addr) == 1) {
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(p);
+        return 0;
+    }
+    if (af != AF_INET && inet_pton(AF_INET6, src, &sin6->sin6_addr) == 1) {
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(p);
+        return 0;
+    }
+    return -EINVAL;
+}
+
+/* A kernel socket is a plain userspace socket; struct sock holds the fd */
+int sock_create_kern(struct net *net, int family, int type, int proto, struct socket **res)
+{
+    struct socket *sock = calloc(1, sizeof(*sock) + sizeof(struct sock));
+
+    (void)net;
+    if (!sock)
+        return -ENOMEM;
+    sock->sk = (struct sock *)(sock + 1);
+    sock->sk->fd = socket(family, type, proto);
+    if (sock->sk->fd < 0) {
+        int err = errno;
+        free(sock);
+        return -err;
+    }
+    *res = sock;
+    return 0;
+}
+
+void sock_release(struct socket *sock)
+{
+    close(sock->sk->fd);
+    free(sock);
+}
+
+int kernel_bind(struct socket *sock, struct sockaddr *addr, int addrlen)
+{
+    return bind(sock->sk->fd, addr, addrlen) ? -errno : 0;
+}
+
+int kernel_sendmsg(struct socket *sock, struct msghdr *msg, struct kvec *vec, size_t num, size_t len)
+{
+    ssize_t n;
+
+    (void)len;
+    msg->msg_iov = (struct iovec *)vec;
+    msg->msg_iovlen = num;
+    n = sendmsg(sock->sk->fd, msg, msg->msg_flags);
+    return n < 0 ? -errno : (int)n;
+}
+
+int kernel_recvmsg(struct socket *sock, struct msghdr *msg, struct kvec *vec, size_t num, size_t len, int flags)
+{
+    ssize_t n;
+
+    (void)len;
+    msg->msg_iov = (struct iovec *)vec;
+    msg->msg_iovlen = num;
+    n = recvmsg(sock->sk->fd, msg, flags);
+    return n < 0 ? -errno : (int)n;
+}
+
+int kernel_sock_shutdown(struct socket *sock, int how)
+{
+    return shutdown(sock->sk->fd, how) ? -errno : 0;
+}
+
+/* SO_RCVBUFFORCE needs CAP_NET_ADMIN; fall back to the rmem_max cap */
+void sock_set_rcvbuf(struct sock *sk, int val)
+{
+    if (setsockopt(sk->fd, SOL_SOCKET, SO_RCVBUFFORCE, &val, sizeof(val)))
+        setsockopt(sk->fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val));
+}
+
+struct kshim_kthread {
+    pthread_t thread;
+    int (*fn)(void *);
+    void *data;
+    int stop;
+    int ret;
+};
+
+static __thread struct kshim_kthread *kshim_kthread_self;
+
+static void *kshim_kthread_main(void *arg)
+{
+    struct kshim_kthread *k = arg;
+
+    kshim_kthread_self = k;
+    k->ret = k->fn(k->data);
+    return NULL;
+}
+
+struct task_struct *kthread_run(int (*fn)(void *), void *data, const char *namefmt, ...)
+{
+    struct task_struct *t = calloc(1, sizeof(*t) + sizeof(struct kshim_kthread));
+    struct kshim_kthread *k;
+
+    (void)namefmt;
+    if (!t)
+        return ERR_PTR(-ENOMEM);
+    k = (struct kshim_kthread *)(t + 1);
+    k->fn = fn;
+    k->data = data;
+    t->nsproxy = kshim_current->nsproxy;
+    t->kthread = k;
+    if (pthread_create(&k->thread, NULL, kshim_kthread_main, k)) {
+        free(t);
+        return ERR_PTR(-EAGAIN);
+    }
+    return t;
+}
+
+bool kthread_should_stop(void)
+{
+    return __atomic_load_n(&kshim_kthread_self->stop, __ATOMIC_ACQUIRE);
+}
+
+int kthread_stop(struct task_struct *t)
+{
+    struct kshim_kthread *k = t->kthread;
+    int ret;
+
+    __atomic_store_n(&k->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(k->thread, NULL);
+    ret = k->ret;
+    free(t);
+    return ret;
+}
+
+static u16 csum_fold32(u32 sum)
+{
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (u16)sum;
+}
+
+/* RFC 1624 incremental update: HC' = ~(~HC + ~m + m') */
+void csum_replace4(__sum16 *sum, __be32 from, __be32 to)
+{
+    u32 s = (u16)~*sum;
+
+    s += (u16)~(from & 0xffff) + (u16)~(from >> 16);
+    s += (to & 0xffff) + (to >> 16);
+    *sum = (__sum16)~csum_fold32(s);
+}
+
+void csum_replace2(__sum16 *sum, __be16 from, __be16 to)
+{
+    u32 s = (u16)~*sum;
+
+    s += (u16)~from + to;
+    *sum = (__sum16)~csum_fold32(s);
+}
+
+void inet_proto_csum_replace4(__sum16 *sum, struct sk_buff *skb, __be32 from, __be32 to, bool pseudohdr)
+{
+    (void)skb;
+    (void)pseudohdr;
+    csum_replace4(sum, from, to);
+}
+
+void inet_proto_csum_replace2(__sum16 *sum, struct sk_buff *skb, __be16 from, __be16 to, bool pseudohdr)
+{
+    (void)skb;
+    (void)pseudohdr;
+    csum_replace2(sum, from, to);
+}
+
+/* Per-CPU arena: one KSHIM_PCPU_STRIDE slice per CPU. Each slice starts with
+ * a copy of the static kshim_percpu section, followed by dynamic
+ * allocations. kshim_percpu_off[cpu] maps a canonical address (inside or
+ * past the static section) to that CPU's slice. */
+#include <sys/mman.h>
+#define KSHIM_PCPU_STRIDE (8UL << 20)
+long kshim_percpu_off[KSHIM_NR_CPUS];
+static char *kshim_pcpu_arena;
+static size_t kshim_pcpu_static, kshim_pcpu_bump;
+static pthread_mutex_t kshim_pcpu_lock = PTHREAD_MUTEX_INITIALIZER;
+
+__attribute__((constructor)) static void kshim_percpu_setup(void)
+{
+    char *base = __start_kshim_percpu ? __start_kshim_percpu : (char *)kshim_percpu_off;
+    int cpu;
+
+    kshim_pcpu_arena = mmap(NULL, KSHIM_PCPU_STRIDE * KSHIM_NR_CPUS, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (kshim_pcpu_arena == MAP_FAILED)
+        abort();
+    kshim_pcpu_static = __start_kshim_percpu ? (size_t)(__stop_kshim_percpu - __start_kshim_percpu) : 0;
+    kshim_pcpu_bump = (kshim_pcpu_static + 63) & ~63UL;
+    for (cpu = 0; cpu < KSHIM_NR_CPUS; cpu++) {
+        char *slice = kshim_pcpu_arena + cpu * KSHIM_PCPU_STRIDE;
+        if (kshim_pcpu_static)
+            memcpy(slice, __start_kshim_percpu, kshim_pcpu_static);
+        kshim_percpu_off[cpu] = slice - base;
+    }
+}
+
+void *kshim_alloc_percpu(size_t size, size_t align)
+{
+    char *base = __start_kshim_percpu ? __start_kshim_percpu : (char *)kshim_percpu_off;
+    size_t off;
+    int cpu;
+
+    if (align < 8)
+        align = 8;
+    pthread_mutex_lock(&kshim_pcpu_lock);
+    off = (kshim_pcpu_bump + align - 1) & ~(align - 1);
+    if (off + size > KSHIM_PCPU_STRIDE) {
+        pthread_mutex_unlock(&kshim_pcpu_lock);
+        return NULL;
+    }
+    kshim_pcpu_bump = off + size;
+    pthread_mutex_unlock(&kshim_pcpu_lock);
+    for (cpu = 0; cpu < KSHIM_NR_CPUS; cpu++)
+        memset(kshim_pcpu_arena + cpu * KSHIM_PCPU_STRIDE + off, 0, size);
+    return base + off;
+}
+
+void kshim_free_percpu(void *p)
+{
+    (void)p; /* bump allocator; the arena lives for the whole process */
+}
+
+/* Event ring support: the ring is plain memory and nobody sleeps on it. */
+void *vmalloc_user(unsigned long size)
+{
+    void *p = aligned_alloc(PAGE_SIZE, PAGE_ALIGN(size));
+
+    if (p)
+        memset(p, 0, PAGE_ALIGN(size));
+    return p;
+}
+
+int remap_vmalloc_range(struct vm_area_struct *vma, void *addr, unsigned long pgoff)
+{
+    (void)vma; (void)addr; (void)pgoff;
+    return 0;
+}
+
+void wake_up_interruptible(wait_queue_head_t *q)
+{
+    (void)q;
+}
+
+void poll_wait(struct file *f, wait_queue_head_t *q, poll_table *p)
+{
+    (void)f; (void)q; (void)p;
+}
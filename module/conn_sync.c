@@ -0,0 +1,455 @@
+#include "conn_sync.h"
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/bottom_half.h>
+#include <linux/net.h>
+#include <linux/inet.h>
+#include <linux/in.h>
+#include <linux/seq_file.h>
+#include <linux/seq_file_net.h>
+#include <net/sock.h>
+#include "log.h"
+#include "stats.h"
+
+DEFINE_STATIC_KEY_FALSE(fw_conn_sync_key);
+
+static unsigned int sync_interval_ms = 100;
+module_param(sync_interval_ms, uint, 0644);
+MODULE_PARM_DESC(sync_interval_ms, "How often queued conntrack changes are sent to the sync peer (default 100)");
+
+#define CONN_SYNC_BATCH ((CONN_SYNC_MTU - sizeof(struct conn_sync_hdr)) / sizeof(conn_rec_t))
+#define CONN_SYNC_NAME_LEN 64
+
+// Serialises configuration changes and /proc/net/fw_sync readers
+static DEFINE_MUTEX(conn_sync_mutex);
+
+struct conn_sync_queue {
+    spinlock_t lock;
+    unsigned int n;
+    conn_rec_t *rec; // CONN_SYNC_QUEUE entries
+};
+
+struct conn_sync_tx {
+    struct fw_net *fn;
+    struct socket *sock;
+    struct sockaddr_storage peer;
+    int peer_len;
+    char name[CONN_SYNC_NAME_LEN];
+    struct conn_sync_queue __percpu *queue;
+    conn_rec_t *spare; // traded for a CPU's full queue by the worker
+    struct delayed_work work;
+    u32 seq;
+    u64 datagrams;
+    u64 bytes;
+    u64 errors;
+    unsigned int n; // records in pkt
+    u8 pkt[CONN_SYNC_MTU] __aligned(8);
+};
+
+struct conn_sync_rx {
+    struct fw_net *fn;
+    struct socket *sock;
+    struct sockaddr_storage from; // only datagrams from this address are applied
+    struct task_struct *thread;
+    char name[CONN_SYNC_NAME_LEN];
+    bool seq_valid;
+    u32 seq;
+    u64 datagrams;
+    u64 bytes;
+    u8 pkt[CONN_SYNC_MTU] __aligned(8);
+};
+
+// Called with the connection's queued bit just set, or for a deletion from
+// the expiry timer. Only the tuple is copied; the worker reads the state of
+// an update when it sends it, so later changes in the same interval ride
+// along for free.
+void conn_sync_queue(struct fw_net *fn, connection_t *conn, u8 op)
+{
+    struct conn_sync_tx *tx;
+    struct conn_sync_queue *q;
+    conn_rec_t *rec;
+
+    rcu_read_lock();
+    tx = rcu_dereference(fn->sync_tx);
+    if (!tx)
+        goto unqueue;
+    local_bh_disable();
+    q = this_cpu_ptr(tx->queue);
+    spin_lock(&q->lock);
+    if (q->n == CONN_SYNC_QUEUE)
+    {
+        spin_unlock(&q->lock);
+        local_bh_enable();
+        fw_stat_inc(fn->stats, FW_STAT_SYNC_QUEUE_DROP);
+        goto unqueue;
+    }
+    rec = &q->rec[q->n++];
+    memset(rec, 0, sizeof(*rec));
+    rec->src_ip = conn->src_ip;
+    rec->dst_ip = conn->dst_ip;
+    rec->src_port = conn->src_port;
+    rec->dst_port = conn->dst_port;
+    rec->proto = conn->proto;
+    rec->op = op;
+    spin_unlock(&q->lock);
+    local_bh_enable();
+    rcu_read_unlock();
+    return;
+
+unqueue:
+    // The connection's next packet tries again
+    if (op == CONN_REC_UPDATE)
+        clear_bit(CONN_F_SYNC_QUEUED, &conn->flags);
+    rcu_read_unlock();
+}
+
+static void conn_sync_send(struct conn_sync_tx *tx)
+{
+    struct conn_sync_hdr *hdr = (struct conn_sync_hdr *)tx->pkt;
+    struct kvec vec = {
+        .iov_base = tx->pkt,
+        .iov_len = sizeof(*hdr) + tx->n * sizeof(conn_rec_t),
+    };
+    struct msghdr msg = {
+        .msg_name = &tx->peer,
+        .msg_namelen = tx->peer_len,
+    };
+    int ret;
+
+    if (!tx->n)
+        return;
+    hdr->magic = CONN_SYNC_MAGIC;
+    hdr->version = CONN_SYNC_VERSION;
+    hdr->count = tx->n;
+    hdr->seq = tx->seq++;
+    hdr->reserved = 0;
+    ret = kernel_sendmsg(tx->sock, &msg, &vec, 1, vec.iov_len);
+    if (ret < 0)
+    {
+        // Counted only: an unreachable peer would otherwise flood the log
+        tx->errors++;
+    }
+    else
+    {
+        tx->datagrams++;
+        tx->bytes += ret;
+        fw_stat_add(tx->fn->stats, FW_STAT_SYNC_SENT, tx->n);
+    }
+    tx->n = 0;
+}
+
+// Take every CPU's queue in turn, swapping in the spare buffer, and send
+// the records in full datagrams. Looking an update up clears the
+// connection's queued bit, so a later peer gets it again.
+static void conn_sync_drain(struct conn_sync_tx *tx)
+{
+    conn_rec_t *out = (conn_rec_t *)(tx->pkt + sizeof(struct conn_sync_hdr));
+    struct conn_sync_queue *q;
+    conn_rec_t *rec;
+    unsigned int n, i;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+    {
+        q = per_cpu_ptr(tx->queue, cpu);
+        spin_lock_bh(&q->lock);
+        rec = q->rec;
+        n = q->n;
+        q->rec = tx->spare;
+        q->n = 0;
+        spin_unlock_bh(&q->lock);
+        tx->spare = rec;
+
+        for (i = 0; i < n; i++)
+        {
+            // An update of a connection that has expired since is dropped;
+            // its deletion is queued as well
+            if (rec[i].op == CONN_REC_UPDATE && !stateful_firewall_sync_fill(tx->fn, &rec[i]))
+                continue;
+            out[tx->n++] = rec[i];
+            if (tx->n == CONN_SYNC_BATCH)
+                conn_sync_send(tx);
+        }
+    }
+    conn_sync_send(tx);
+}
+
+static void conn_sync_work(struct work_struct *work)
+{
+    struct conn_sync_tx *tx = container_of(to_delayed_work(work), struct conn_sync_tx, work);
+
+    conn_sync_drain(tx);
+    schedule_delayed_work(&tx->work, msecs_to_jiffies(max(READ_ONCE(sync_interval_ms), 1U)));
+}
+
+static void conn_sync_free_tx(struct conn_sync_tx *tx)
+{
+    int cpu;
+
+    if (tx->queue)
+    {
+        for_each_possible_cpu(cpu)
+            kvfree(per_cpu_ptr(tx->queue, cpu)->rec);
+        free_percpu(tx->queue);
+    }
+    kvfree(tx->spare);
+    if (tx->sock)
+        sock_release(tx->sock);
+    kfree(tx);
+}
+
+static void conn_sync_stop_tx(struct fw_net *fn)
+{
+    struct conn_sync_tx *tx = rcu_dereference_protected(fn->sync_tx, lockdep_is_held(&conn_sync_mutex));
+
+    if (!tx)
+        return;
+    RCU_INIT_POINTER(fn->sync_tx, NULL);
+    static_branch_dec(&fw_conn_sync_key);
+    // No packet is queueing into tx after this. What is still queued is
+    // sent, so a planned switchover loses nothing.
+    synchronize_rcu();
+    cancel_delayed_work_sync(&tx->work);
+    conn_sync_drain(tx);
+    log_message(LOG_INFO, "Stopped sending conntrack changes to %s", tx->name);
+    conn_sync_free_tx(tx);
+}
+
+static void conn_sync_stop_rx(struct fw_net *fn)
+{
+    struct conn_sync_rx *rx = fn->sync_rx;
+
+    if (!rx)
+        return;
+    fn->sync_rx = NULL;
+    // Wakes the thread from kernel_recvmsg(), which returns at once from now on
+    kernel_sock_shutdown(rx->sock, SHUT_RDWR);
+    kthread_stop(rx->thread);
+    sock_release(rx->sock);
+    log_message(LOG_INFO, "Stopped receiving conntrack changes on %s", rx->name);
+    kfree(rx);
+}
+
+int conn_sync_set_peer(struct fw_net *fn, const char *addr, const char *port)
+{
+    struct conn_sync_tx *tx;
+    int cpu, ret;
+
+    tx = kzalloc(sizeof(*tx), GFP_KERNEL);
+    if (!tx)
+        return -ENOMEM;
+    tx->fn = fn;
+    snprintf(tx->name, sizeof(tx->name), "%s port %s", addr, port);
+    INIT_DELAYED_WORK(&tx->work, conn_sync_work);
+    ret = inet_pton_with_scope(fn->net, AF_UNSPEC, addr, port, &tx->peer);
+    if (ret)
+        goto err;
+    tx->peer_len = tx->peer.ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+    ret = sock_create_kern(fn->net, tx->peer.ss_family, SOCK_DGRAM, IPPROTO_UDP, &tx->sock);
+    if (ret)
+    {
+        tx->sock = NULL;
+        goto err;
+    }
+    ret = -ENOMEM;
+    tx->spare = kvmalloc_array(CONN_SYNC_QUEUE, sizeof(conn_rec_t), GFP_KERNEL);
+    tx->queue = alloc_percpu(struct conn_sync_queue);
+    if (!tx->spare || !tx->queue)
+        goto err;
+    for_each_possible_cpu(cpu)
+    {
+        struct conn_sync_queue *q = per_cpu_ptr(tx->queue, cpu);
+
+        spin_lock_init(&q->lock);
+        q->rec = kvmalloc_array(CONN_SYNC_QUEUE, sizeof(conn_rec_t), GFP_KERNEL);
+        if (!q->rec)
+            goto err;
+    }
+
+    mutex_lock(&conn_sync_mutex);
+    conn_sync_stop_tx(fn);
+    rcu_assign_pointer(fn->sync_tx, tx);
+    static_branch_inc(&fw_conn_sync_key);
+    schedule_delayed_work(&tx->work, msecs_to_jiffies(max(READ_ONCE(sync_interval_ms), 1U)));
+    mutex_unlock(&conn_sync_mutex);
+    log_message(LOG_INFO, "Sending conntrack changes to %s", tx->name);
+    return 0;
+
+err:
+    conn_sync_free_tx(tx);
+    return ret;
+}
+
+// The source port is the sender's ephemeral one, so only the address counts
+static bool conn_sync_from_peer(const struct conn_sync_rx *rx, const struct sockaddr_storage *src)
+{
+    if (src->ss_family != rx->from.ss_family)
+        return false;
+    if (src->ss_family == AF_INET)
+        return ((const struct sockaddr_in *)src)->sin_addr.s_addr ==
+               ((const struct sockaddr_in *)&rx->from)->sin_addr.s_addr;
+    return !memcmp(&((const struct sockaddr_in6 *)src)->sin6_addr,
+                   &((const struct sockaddr_in6 *)&rx->from)->sin6_addr, sizeof(struct in6_addr));
+}
+
+static void conn_sync_receive(struct conn_sync_rx *rx, const struct sockaddr_storage *src, int len)
+{
+    const struct conn_sync_hdr *hdr = (const struct conn_sync_hdr *)rx->pkt;
+    const conn_rec_t *rec = (const conn_rec_t *)(hdr + 1);
+    struct fw_net *fn = rx->fn;
+    u32 gap;
+    int i;
+
+    // Anyone who can reach the port could otherwise write the table. A
+    // spoofed source address still gets through, hence the dedicated link.
+    if (!conn_sync_from_peer(rx, src))
+    {
+        fw_stat_inc(fn->stats, FW_STAT_SYNC_FOREIGN);
+        return;
+    }
+    if (len < sizeof(*hdr) || hdr->magic != CONN_SYNC_MAGIC || hdr->version != CONN_SYNC_VERSION ||
+        len != sizeof(*hdr) + hdr->count * sizeof(*rec))
+    {
+        fw_stat_inc(fn->stats, FW_STAT_SYNC_BAD);
+        return;
+    }
+    // A small jump forward means lost datagrams; anything else is a
+    // restarted sender or reordering, which starts the count over
+    gap = hdr->seq - rx->seq - 1;
+    if (rx->seq_valid && gap < 0x10000)
+        fw_stat_add(fn->stats, FW_STAT_SYNC_LOST, gap);
+    rx->seq = hdr->seq;
+    rx->seq_valid = true;
+    rx->datagrams++;
+    rx->bytes += len;
+
+    for (i = 0; i < hdr->count; i++)
+        stateful_firewall_sync_apply(fn, &rec[i]);
+    fw_stat_add(fn->stats, FW_STAT_SYNC_RECV, hdr->count);
+}
+
+static int conn_sync_rx_thread(void *data)
+{
+    struct conn_sync_rx *rx = data;
+    struct sockaddr_storage src;
+    struct msghdr msg;
+    struct kvec vec;
+    int len;
+
+    while (!kthread_should_stop())
+    {
+        memset(&msg, 0, sizeof(msg));
+        memset(&src, 0, sizeof(src));
+        msg.msg_name = &src;
+        msg.msg_namelen = sizeof(src);
+        vec.iov_base = rx->pkt;
+        vec.iov_len = sizeof(rx->pkt);
+        len = kernel_recvmsg(rx->sock, &msg, &vec, 1, sizeof(rx->pkt), 0);
+        if (len > 0)
+            conn_sync_receive(rx, &src, len);
+    }
+    return 0;
+}
+
+int conn_sync_listen(struct fw_net *fn, const char *addr, const char *port, const char *from)
+{
+    struct sockaddr_storage local;
+    struct conn_sync_rx *rx;
+    int ret;
+
+    ret = inet_pton_with_scope(fn->net, AF_UNSPEC, addr, port, &local);
+    if (ret)
+        return ret;
+    rx = kzalloc(sizeof(*rx), GFP_KERNEL);
+    if (!rx)
+        return -ENOMEM;
+    rx->fn = fn;
+    // The peer must be of the socket's family; a v4-mapped sender is not matched
+    ret = inet_pton_with_scope(fn->net, local.ss_family, from, "0", &rx->from);
+    if (ret)
+        goto err_free;
+    snprintf(rx->name, sizeof(rx->name), "%s port %s from %s", addr, port, from);
+    ret = sock_create_kern(fn->net, local.ss_family, SOCK_DGRAM, IPPROTO_UDP, &rx->sock);
+    if (ret)
+        goto err_free;
+    sock_set_rcvbuf(rx->sock->sk, CONN_SYNC_RCVBUF);
+
+    mutex_lock(&conn_sync_mutex);
+    // The old receiver may hold the port
+    conn_sync_stop_rx(fn);
+    ret = kernel_bind(rx->sock, (struct sockaddr *)&local,
+                      local.ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+    if (ret)
+        goto err_unlock;
+    rx->thread = kthread_run(conn_sync_rx_thread, rx, "fw_sync_rx");
+    if (IS_ERR(rx->thread))
+    {
+        ret = PTR_ERR(rx->thread);
+        goto err_unlock;
+    }
+    fn->sync_rx = rx;
+    mutex_unlock(&conn_sync_mutex);
+    log_message(LOG_INFO, "Receiving conntrack changes on %s", rx->name);
+    return 0;
+
+err_unlock:
+    mutex_unlock(&conn_sync_mutex);
+    sock_release(rx->sock);
+err_free:
+    kfree(rx);
+    return ret;
+}
+
+void conn_sync_stop(struct fw_net *fn)
+{
+    mutex_lock(&conn_sync_mutex);
+    conn_sync_stop_tx(fn);
+    conn_sync_stop_rx(fn);
+    mutex_unlock(&conn_sync_mutex);
+}
+
+// Configuration and datagram counts; the record counters are in fw_stats
+int conn_sync_proc_show(struct seq_file *m, void *v)
+{
+    struct fw_net *fn = fw_net(seq_file_single_net(m));
+    struct conn_sync_tx *tx;
+    struct conn_sync_rx *rx;
+
+    mutex_lock(&conn_sync_mutex);
+    tx = rcu_dereference_protected(fn->sync_tx, lockdep_is_held(&conn_sync_mutex));
+    rx = fn->sync_rx;
+    seq_printf(m, "interval_ms      %u\n", READ_ONCE(sync_interval_ms));
+    seq_printf(m, "peer             %s\n", tx ? tx->name : "off");
+    if (tx)
+        seq_printf(m, "  datagrams      %llu\n  bytes          %llu\n  send_errors    %llu\n",
+                   tx->datagrams, tx->bytes, tx->errors);
+    seq_printf(m, "listen           %s\n", rx ? rx->name : "off");
+    if (rx)
+        seq_printf(m, "  datagrams      %llu\n  bytes          %llu\n", rx->datagrams, rx->bytes);
+    mutex_unlock(&conn_sync_mutex);
+    return 0;
+}
+
+int conn_sync_proc_write(struct file *file, char *buf, size_t count)
+{
+    struct fw_net *fn = fw_net(seq_file_single_net(file->private_data));
+    char cmd[16], addr[INET6_ADDRSTRLEN], port[8], from[INET6_ADDRSTRLEN];
+    int n = sscanf(buf, "%15s %45s %7s %45s", cmd, addr, port, from);
+
+    if (n == 1 && !strcmp(cmd, "off"))
+    {
+        conn_sync_stop(fn);
+        return 0;
+    }
+    if (n == 3 && !strcmp(cmd, "peer"))
+        return conn_sync_set_peer(fn, addr, port);
+    if (n == 4 && !strcmp(cmd, "listen"))
+        return conn_sync_listen(fn, addr, port, from);
+    return -EINVAL;
+}
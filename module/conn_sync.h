@@ -0,0 +1,65 @@
+#ifndef CONN_SYNC_H
+#define CONN_SYNC_H
+
+#include <linux/types.h>
+#include <linux/jiffies.h>
+#include <linux/jump_label.h>
+#include <linux/rcupdate.h>
+#include <linux/bitops.h>
+#include "stateful_check.h"
+#include "fw_net.h"
+
+// 主备防火墙之间的连接表同步，每个网络命名空间经 /proc/net/fw_sync 各自配置。
+// 主机把新建、状态变化、仍在活动和超时删除的连接记进每 CPU 队列，每隔
+// sync_interval_ms 合并成批经 UDP 发给对端；备机的接收线程把记录写进自己的
+// 连接表。一条连接在一批里只发一次，发送时取它的最新状态。UDP 不重传，
+// 丢失的记录由之后的刷新补上
+#define CONN_SYNC_MAGIC 0x46575359 // "FWSY"
+#define CONN_SYNC_VERSION 1
+#define CONN_SYNC_QUEUE 16384      // 每 CPU 两次发送之间最多排队的记录数，满了丢弃并计数
+#define CONN_SYNC_MTU 1400         // 报文的最大长度，不会被分片
+#define CONN_SYNC_RCVBUF (4 << 20) // 接收缓冲区，容纳一次发送的突发
+// 有包经过的连接至少每隔这么久重发一次。小于连接超时的一半，
+// 备机上仍在活动的连接不会超时
+#define CONN_SYNC_REFRESH (2 * HZ)
+
+// 报文：头部后接 count 条 conn_rec_t，按本机字节序，两端须是同一种字节序
+struct conn_sync_hdr {
+    u32 magic;
+    u16 version;
+    u16 count;
+    u32 seq;      // 每个报文加一，接收方据此统计丢失的报文
+    u32 reserved;
+};
+
+// 有命名空间向对端发送时打开，所有命名空间共用
+DECLARE_STATIC_KEY_FALSE(fw_conn_sync_key);
+
+void conn_sync_queue(struct fw_net *fn, connection_t *conn, u8 op);
+
+// 包经过连接之后调用，changed 表示连接是新建的或状态变了
+static inline void conn_sync_note(struct fw_net *fn, connection_t *conn, bool changed)
+{
+    if (!static_branch_unlikely(&fw_conn_sync_key) || !rcu_access_pointer(fn->sync_tx))
+        return;
+    if (!changed && !time_after(jiffies, READ_ONCE(conn->synced) + CONN_SYNC_REFRESH))
+        return;
+    if (!test_and_set_bit(CONN_F_SYNC_QUEUED, &conn->flags))
+        conn_sync_queue(fn, conn, CONN_REC_UPDATE);
+}
+
+// 开始向 addr:port 发送，替换已有的对端。addr 为 IPv4 或 IPv6 地址
+int conn_sync_set_peer(struct fw_net *fn, const char *addr, const char *port);
+// 在 addr:port 上接收对端的记录，替换已有的接收线程。只接受源地址为 from
+// 的报文，from 与 addr 须同为 IPv4 或 IPv6
+int conn_sync_listen(struct fw_net *fn, const char *addr, const char *port, const char *from);
+// 停止发送和接收，命名空间销毁时在注销钩子之后调用
+void conn_sync_stop(struct fw_net *fn);
+
+struct seq_file;
+struct file;
+// /proc/net/fw_sync，写入 "peer ADDR PORT"、"listen ADDR PORT PEER" 或 "off"
+int conn_sync_proc_show(struct seq_file *m, void *v);
+int conn_sync_proc_write(struct file *file, char *buf, size_t count);
+
+#endif // CONN_SYNC_H
@@ -4,10 +4,17 @@
 #include <linux/uaccess.h>
 #include <linux/slab.h>
 #include <linux/jhash.h>
+#include <linux/nsproxy.h>
+#include <linux/mutex.h>
+#include <linux/capability.h>
 #include "rule_filter.h"
 #include "driver.h"
-#include "stateful_check.h"
+#include "fw_net.h"
 #include "log.h"
+#include "event_ring.h"
+#include "stateful_check.h"
+#include "stats.h"
+#include "fw_uapi.h"
 
 #define DEVICE_NAME "firewall_ctrl"
 #define CLASS_NAME "firewall"
@@ -15,41 +22,271 @@
 static int major_number;
 static struct class* firewall_class = NULL;
 static struct device* firewall_device = NULL;
-static char *buffer;
-static size_t buffer_size;
-static size_t buffer_offset;
 
-extern struct hlist_head connection_table[1 << 16]; // 从其他文件中导入连接表
-extern void print_connection_table(void); // 从其他文件中导入打印函数
+// 每次打开设备各自的状态，并发的客户端互不覆盖对方的快照
+struct firewall_ctrl_file {
+    struct net *net;
+    struct mutex lock; // 串行化同一文件上的命令和读取
+    void *data;        // 最近一次快照，read() 从这里读
+    size_t size;
+    loff_t pos;
+};
 
+// 串行化改变钩子和默认动作的命令，不同文件可能作用于同一命名空间
+static DEFINE_MUTEX(firewall_ctrl_mutex);
+
+// 打开设备时记下调用者的网络命名空间，之后的命令都作用于该命名空间的实例
 static int firewall_dev_open(struct inode *inodep, struct file *filep) {
+    struct firewall_ctrl_file *ctx;
+
+    ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+    if (!ctx) {
+        return -ENOMEM;
+    }
+    mutex_init(&ctx->lock);
+    ctx->net = get_net(current->nsproxy->net_ns);
+    filep->private_data = ctx;
     printk(KERN_INFO "Firewall device opened\n");
     log_message(LOG_INFO, "Firewall device opened");
     return 0;
 }
 
+// 读出本文件最近一次快照：命令 '3' 为 CSV 文本，FW_CTRL_SNAPSHOT_CONNS 为 struct fw_ctrl_conn 数组
 static ssize_t firewall_dev_read(struct file *filep, char *user_buffer, size_t len, loff_t *offset) {
+    struct firewall_ctrl_file *ctx = filep->private_data;
     ssize_t ret;
 
-    if (buffer_offset >= buffer_size) {
-        return 0;
+    mutex_lock(&ctx->lock);
+    ret = simple_read_from_buffer(user_buffer, len, &ctx->pos, ctx->data, ctx->size);
+    mutex_unlock(&ctx->lock);
+    return ret;
+}
+
+// 替换本文件的快照，下一次 read() 从头读
+static void firewall_ctrl_set_data(struct firewall_ctrl_file *ctx, void *data, size_t size) {
+    kvfree(ctx->data);
+    ctx->data = data;
+    ctx->size = size;
+    ctx->pos = 0;
+}
+
+static int firewall_hooks_on(struct fw_net *fn) {
+    int ret = 0;
+
+    mutex_lock(&firewall_ctrl_mutex);
+    if (fn->filter_status == 0) {
+        // 注册钩子
+        ret = rule_filter_register_hooks(fn->net);
+        if (ret < 0) {
+            printk(KERN_ALERT "Failed to register firewall hooks\n");
+            log_message(LOG_WARN, "Failed to register firewall hooks");
+        } else {
+            fn->filter_status = 1;
+            printk(KERN_INFO "Firewall hooks registered\n");
+            log_message(LOG_INFO, "Firewall hooks registered");
+        }
     }
+    mutex_unlock(&firewall_ctrl_mutex);
+    return ret;
+}
+
+static void firewall_hooks_off(struct fw_net *fn) {
+    mutex_lock(&firewall_ctrl_mutex);
+    if (fn->filter_status == 1) {
+        // 注销钩子
+        rule_filter_unregister_hooks(fn->net);
+        fn->filter_status = 0;
+        printk(KERN_INFO "Firewall hooks unregistered\n");
+        log_message(LOG_INFO, "Firewall hooks unregistered");
+    }
+    mutex_unlock(&firewall_ctrl_mutex);
+}
 
-    if (len > buffer_size - buffer_offset) {
-        len = buffer_size - buffer_offset;
+// 返回新规则集的规则数
+static int firewall_reload(struct fw_net *fn) {
+    rule_reload_stats_t stats;
+    int ret;
+
+    ret = rule_filter_load_rules(fn);
+    if (ret != 0) {
+        printk(KERN_ALERT "Failed to reload rules\n");
+        log_message(LOG_WARN, "Failed to reload rules");
+        return ret < 0 ? ret : -EINVAL;
     }
+    printk(KERN_INFO "Firewall rules reloaded\n");
+    log_message(LOG_INFO, "Firewall rules reloaded");
+    rule_filter_get_reload_stats(fn, &stats);
+    return stats.rules;
+}
 
-    ret = copy_to_user(user_buffer, buffer + buffer_offset, len);
-    if (ret) {
+// 把 len 字节的结果写到命令的 out，放不下时只回报所需的长度
+static int firewall_ctrl_out(struct fw_ctrl_cmd *cmd, const void *src, size_t len) {
+    if (cmd->out_len < len) {
+        cmd->out_len = len;
+        return -ENOSPC;
+    }
+    if (copy_to_user(u64_to_user_ptr(cmd->out), src, len)) {
         return -EFAULT;
     }
+    cmd->out_len = len;
+    return 0;
+}
+
+static int firewall_get_status(struct fw_net *fn, struct fw_ctrl_cmd *cmd) {
+    struct fw_ctrl_status status = { .version = FW_CTRL_VERSION };
+    rule_reload_stats_t stats;
+
+    rule_filter_get_reload_stats(fn, &stats);
+    status.hooks = READ_ONCE(fn->filter_status);
+    status.default_action = READ_ONCE(fn->rules.default_action) == ACTION_ACCEPT ? FW_CTRL_ACCEPT : FW_CTRL_DROP;
+    status.rules = stats.rules;
+    status.generation = stats.generation;
+    status.reloads = stats.reloads;
+    status.reload_failures = stats.failures;
+    status.connections = stateful_firewall_count(fn->net);
+    return firewall_ctrl_out(cmd, &status, sizeof(status));
+}
+
+static int firewall_get_stats(struct fw_net *fn, struct fw_ctrl_cmd *cmd) {
+    size_t len = sizeof(struct fw_ctrl_stats) + (2 * FW_HOOK_MAX + FW_STAT_MAX) * sizeof(u64);
+    struct fw_cpu_stats *sum;
+    struct fw_ctrl_stats *out;
+    int h, c, ret;
+
+    sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+    out = kmalloc(len, GFP_KERNEL);
+    if (!sum || !out) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    fw_stats_sum(fn->stats, sum);
+    out->nr_hooks = FW_HOOK_MAX;
+    out->nr_counters = FW_STAT_MAX;
+    for (h = 0; h < FW_HOOK_MAX; h++) {
+        out->value[h] = sum->accept[h];
+        out->value[FW_HOOK_MAX + h] = sum->drop[h];
+    }
+    for (c = 0; c < FW_STAT_MAX; c++) {
+        out->value[2 * FW_HOOK_MAX + c] = sum->counter[c];
+    }
+    ret = firewall_ctrl_out(cmd, out, len);
+out:
+    kfree(out);
+    kfree(sum);
+    return ret;
+}
+
+// 复制 out 放得下的规则，返回规则总数，调用者据此判断是否截断
+static int firewall_get_rules(struct fw_net *fn, struct fw_ctrl_cmd *cmd) {
+    u32 total = rule_filter_dump_rules(fn, NULL, 0);
+    u32 max = min_t(u32, cmd->out_len / sizeof(struct fw_ctrl_rule), total);
+    struct fw_ctrl_rule *rules;
+    int ret;
+
+    if (total && !max) {
+        cmd->out_len = total * sizeof(*rules);
+        return -ENOSPC;
+    }
+    rules = kvmalloc_array(max, sizeof(*rules), GFP_KERNEL);
+    if (!rules) {
+        return -ENOMEM;
+    }
+    // 两次调用之间规则可能被重载
+    total = rule_filter_dump_rules(fn, rules, max);
+    ret = firewall_ctrl_out(cmd, rules, min(max, total) * sizeof(*rules));
+    kvfree(rules);
+    return ret < 0 ? ret : total;
+}
+
+// 快照存进本文件供 read() 读出，out 非空时同时复制放得下的前若干条。
+// out 连一条都放不下时和其他查询一样返回 -ENOSPC 和所需长度，快照仍可 read()
+static int firewall_snapshot_conns(struct firewall_ctrl_file *ctx, struct fw_ctrl_cmd *cmd) {
+    struct fw_net *fn = fw_net(ctx->net);
+    unsigned long count = stateful_firewall_count(ctx->net);
+    unsigned int max = count + count / 8 + 64; // 留出复制期间新建的连接
+    struct fw_ctrl_conn *conns;
+    unsigned int n;
+    int ret = 0;
+
+    conns = kvmalloc_array(max, sizeof(*conns), GFP_KERNEL);
+    if (!conns) {
+        return -ENOMEM;
+    }
+    n = stateful_firewall_dump(fn, conns, max);
+    firewall_ctrl_set_data(ctx, conns, n * sizeof(*conns));
+    if (cmd->out && n && cmd->out_len < sizeof(*conns)) {
+        cmd->out_len = n * sizeof(*conns);
+        return -ENOSPC;
+    }
+    if (cmd->out) {
+        ret = firewall_ctrl_out(cmd, conns, min_t(size_t, cmd->out_len / sizeof(*conns), n) * sizeof(*conns));
+    }
+    return ret < 0 ? ret : n;
+}
+
+// 设置本命名空间的规则文件或集合文件。路径在重载时按发起重载的进程解析，
+// 所以容器里设的路径指向容器自己的文件；只有本命名空间的管理员能改
+static int firewall_set_file(struct firewall_ctrl_file *ctx, struct fw_ctrl_cmd *cmd) {
+    struct fw_net *fn = fw_net(ctx->net);
+    char path[sizeof(fn->rule_file)];
+    long len;
+
+    if (!ns_capable(ctx->net->user_ns, CAP_NET_ADMIN)) {
+        return -EPERM;
+    }
+    len = strncpy_from_user(path, u64_to_user_ptr(cmd->arg), sizeof(path));
+    if (len < 0) {
+        return len;
+    }
+    if (len == sizeof(path)) {
+        return -ENAMETOOLONG;
+    }
+    if (cmd->op == FW_CTRL_SET_RULE_FILE) {
+        return rule_filter_set_rule_file(fn, path);
+    }
+    return rule_filter_set_set_file(fn, path);
+}
 
-    buffer_offset += len;
-    return len;
+// 执行一条命令，调用者持有 ctx->lock
+static int firewall_ctrl_exec(struct firewall_ctrl_file *ctx, struct fw_ctrl_cmd *cmd) {
+    struct fw_net *fn = fw_net(ctx->net);
+
+    switch (cmd->op) {
+        case FW_CTRL_HOOKS_ON:
+            return firewall_hooks_on(fn);
+        case FW_CTRL_HOOKS_OFF:
+            firewall_hooks_off(fn);
+            return 0;
+        case FW_CTRL_RELOAD:
+            return firewall_reload(fn);
+        case FW_CTRL_DEFAULT_ACTION:
+            if (cmd->arg != FW_CTRL_ACCEPT && cmd->arg != FW_CTRL_DROP) {
+                return -EINVAL;
+            }
+            rule_filter_set_default_action(fn, cmd->arg == FW_CTRL_ACCEPT ? ACTION_ACCEPT : ACTION_DROP);
+            return 0;
+        case FW_CTRL_GET_STATUS:
+            return firewall_get_status(fn, cmd);
+        case FW_CTRL_GET_STATS:
+            return firewall_get_stats(fn, cmd);
+        case FW_CTRL_GET_RULES:
+            return firewall_get_rules(fn, cmd);
+        case FW_CTRL_SNAPSHOT_CONNS:
+            return firewall_snapshot_conns(ctx, cmd);
+        case FW_CTRL_SET_RULE_FILE:
+        case FW_CTRL_SET_SET_FILE:
+            return firewall_set_file(ctx, cmd);
+        default:
+            return -EINVAL;
+    }
 }
 
+// 单字节 ASCII 命令，保留给旧的工具：'0' 开、'1' 关、'2' 重载、'3' 导出连接表、'd' 切换默认动作
 static ssize_t firewall_dev_write(struct file *filep, const char *user_buffer, size_t len, loff_t *offset) {
+    struct firewall_ctrl_file *ctx = filep->private_data;
+    struct fw_net *fn = fw_net(ctx->net);
     char command;
+    int ret = 0;
 
     if (len != 1) {
         return -EINVAL;
@@ -59,83 +296,125 @@ static ssize_t firewall_dev_write(struct file *filep, const char *user_buffer, s
         return -EFAULT;
     }
 
+    mutex_lock(&ctx->lock);
     switch (command) {
         case '0':
             printk(KERN_INFO "Received command on\n");
             log_message(LOG_INFO, "Received command on");
-            if (filter_status == 0) {
-                // 注册钩子
-                firewall_in_hook.hook = rule_filter_apply_inbound;
-                firewall_out_hook.hook = rule_filter_apply_outbound;
-                if (nf_register_net_hook(&init_net, &firewall_in_hook) < 0) {
-                    printk(KERN_ALERT "Failed to register inbound firewall hook\n");
-                    log_message(LOG_WARN, "Failed to register inbound firewall hook");
-                    return -EFAULT;
-                }
-                if (nf_register_net_hook(&init_net, &firewall_out_hook) < 0) {
-                    printk(KERN_ALERT "Failed to register outbound firewall hook\n");
-                    log_message(LOG_WARN, "Failed to register outbound firewall hook");
-                    nf_unregister_net_hook(&init_net, &firewall_in_hook);
-                    return -EFAULT;
-                }
-                filter_status = 1;
-                printk(KERN_INFO "Firewall hooks registered\n");
-                log_message(LOG_INFO, "Firewall hooks registered");
-            }
+            ret = firewall_hooks_on(fn);
             break;
         case '1':
             printk(KERN_INFO "Received command turn off\n");
             log_message(LOG_INFO, "Received command turn off");
-            if (filter_status == 1) {
-                // 注销钩子
-                nf_unregister_net_hook(&init_net, &firewall_in_hook);
-                nf_unregister_net_hook(&init_net, &firewall_out_hook);
-                filter_status = 0;
-                printk(KERN_INFO "Firewall hooks unregistered\n");
-                log_message(LOG_INFO, "Firewall hooks unregistered");
-            }
+            firewall_hooks_off(fn);
             break;
         case '2':
             printk(KERN_INFO "Received command reload\n");
             log_message(LOG_INFO, "Received command reload");
-            if (rule_filter_load_rules() != 0) {
-                printk(KERN_ALERT "Failed to reload rules\n");
-                log_message(LOG_WARN, "Failed to reload rules");
-                return -EFAULT;
-            }
-            printk(KERN_INFO "Firewall rules reloaded\n");
-            log_message(LOG_INFO, "Firewall rules reloaded");
+            ret = firewall_reload(fn);
             break;
-        case '3':
+        case '3': {
+            size_t size;
+            char *text;
+
             printk(KERN_INFO "Received command printf\n");
             log_message(LOG_INFO, "Received command printf");
-            print_connection_table();
-            buffer_offset = 0;
+            print_connection_table(fn);
+            // 同一份表也留给本文件的 read()
+            text = stateful_firewall_format_table(fn, &size);
+            if (!text) {
+                ret = -ENOMEM;
+                break;
+            }
+            firewall_ctrl_set_data(ctx, text, size);
             break;
+        }
         case 'd':
             printk(KERN_INFO "Received command debug\n");
             log_message(LOG_INFO, "Received command debug");
-            switch_default_action();
+            mutex_lock(&firewall_ctrl_mutex);
+            switch_default_action(fn);
+            mutex_unlock(&firewall_ctrl_mutex);
             break;
         default:
             printk(KERN_INFO "Unknown command\n");
             log_message(LOG_INFO, "Unknown command");
-            return -EINVAL;
+            ret = -EINVAL;
     }
+    mutex_unlock(&ctx->lock);
 
-    return len;
+    return ret < 0 ? ret : len;
+}
+
+// FW_IOC_BATCH：按顺序执行一批命令，把每条的结果和输出长度写回用户态，见 fw_uapi.h
+static long firewall_dev_ioctl(struct file *filep, unsigned int cmd, unsigned long arg) {
+    struct firewall_ctrl_file *ctx = filep->private_data;
+    struct fw_ctrl_batch __user *ubatch = (struct fw_ctrl_batch __user *)arg;
+    struct fw_ctrl_batch batch;
+    struct fw_ctrl_cmd *cmds;
+    long ret = 0;
+
+    if (cmd != FW_IOC_BATCH) {
+        return -ENOTTY;
+    }
+    if (copy_from_user(&batch, ubatch, sizeof(batch))) {
+        return -EFAULT;
+    }
+    if (batch.version != FW_CTRL_VERSION) {
+        return -EPROTONOSUPPORT;
+    }
+    if (batch.count > FW_CTRL_MAX_CMDS || (batch.flags & ~FW_CTRL_F_CONTINUE)) {
+        return -EINVAL;
+    }
+
+    cmds = kmalloc_array(batch.count, sizeof(*cmds), GFP_KERNEL);
+    if (!cmds) {
+        return -ENOMEM;
+    }
+    if (copy_from_user(cmds, u64_to_user_ptr(batch.cmds), batch.count * sizeof(*cmds))) {
+        kfree(cmds);
+        return -EFAULT;
+    }
+
+    mutex_lock(&ctx->lock);
+    for (batch.done = 0; batch.done < batch.count;) {
+        struct fw_ctrl_cmd *c = &cmds[batch.done++];
+
+        c->result = firewall_ctrl_exec(ctx, c);
+        if (c->result < 0 && !(batch.flags & FW_CTRL_F_CONTINUE)) {
+            break;
+        }
+    }
+    mutex_unlock(&ctx->lock);
+
+    if (copy_to_user(u64_to_user_ptr(batch.cmds), cmds, batch.done * sizeof(*cmds)) ||
+        copy_to_user(&ubatch->done, &batch.done, sizeof(batch.done))) {
+        ret = -EFAULT;
+    }
+    kfree(cmds);
+    return ret;
 }
 
 static int firewall_dev_release(struct inode *inodep, struct file *filep) {
+    struct firewall_ctrl_file *ctx = filep->private_data;
+
+    kvfree(ctx->data);
+    put_net(ctx->net);
+    kfree(ctx);
     printk(KERN_INFO "Firewall device closed\n");
     log_message(LOG_INFO, "Firewall device closed");
     return 0;
 }
 
 static struct file_operations fops = {
+    .owner = THIS_MODULE,
     .open = firewall_dev_open,
     .read = firewall_dev_read,
     .write = firewall_dev_write,
+    .unlocked_ioctl = firewall_dev_ioctl,
+    .compat_ioctl = compat_ptr_ioctl, // 结构里只有定长字段，32 位进程共用同一布局
+    .mmap = event_ring_mmap, // 事件环，见 fw_uapi.h
+    .poll = event_ring_poll,
     .release = firewall_dev_release,
 };
 
@@ -178,5 +457,4 @@ void unregister_firewall_device(void) {
     class_unregister(firewall_class);
     class_destroy(firewall_class);
     unregister_chrdev(major_number, DEVICE_NAME);
-    kfree(buffer);
 }
\ No newline at end of file
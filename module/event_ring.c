@@ -0,0 +1,245 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/spinlock.h>
+#include <linux/percpu.h>
+#include <linux/bottom_half.h>
+#include <linux/bitops.h>
+#include <linux/bitmap.h>
+#include <linux/timer.h>
+#include <linux/jiffies.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/timekeeping.h>
+#include "event_ring.h"
+
+#define EVENT_RETIRE_INTERVAL (HZ / 10) // 未写满的块最多等待 100ms 交给用户态
+#define EVENT_FIRST_OFFSET ALIGN(sizeof(struct fw_block_desc), 8)
+#define EVENT_PER_BLOCK ((FW_EVENT_BLOCK_SIZE - EVENT_FIRST_OFFSET) / sizeof(struct fw_event))
+
+int event_ring_users = 0;
+static char *ring;              // vmalloc_user 分配，可映射到用户态
+static unsigned int nr_blocks;  // 加载时确定，每个 CPU 至少两块，见 fw_uapi.h
+static size_t ring_size;
+
+// 每个 CPU 各自填充一块，写事件只取本 CPU 的锁，换块时才取全局的 ring_lock
+struct event_cpu {
+    spinlock_t lock; // 本 CPU 写事件与定时退休之间
+    int block;       // 正在填充的块，-1 为没有
+    u32 records;     // 内核私有的记录计数，不信任共享内存中的值
+    u32 drops;       // 没有可用块时丢弃的事件，随本 CPU 退休的下一块报告
+};
+static DEFINE_PER_CPU(struct event_cpu, event_cpu);
+
+static DEFINE_SPINLOCK(ring_lock); // 保护 block_busy、next_block、next_seq 和 event_ring_users
+static unsigned long *block_busy; // 正被某个 CPU 填充的块，nr_blocks 位
+static unsigned int next_block;    // 从这里开始找可用的块，各块轮流使用
+static u64 next_seq;
+static DECLARE_WAIT_QUEUE_HEAD(ring_wait);
+static struct timer_list retire_timer;
+
+static struct fw_block_desc *block_desc(unsigned int idx)
+{
+    return (struct fw_block_desc *)(ring + (size_t)idx * FW_EVENT_BLOCK_SIZE);
+}
+
+// 为本 CPU 占用一块已归还给内核的块，调用者持有 ec->lock
+static bool claim_block(struct event_cpu *ec)
+{
+    struct fw_block_desc *desc;
+    unsigned int i, idx;
+
+    spin_lock(&ring_lock);
+    for (i = 0; i < nr_blocks; i++) {
+        idx = (next_block + i) % nr_blocks;
+        desc = block_desc(idx);
+        if (test_bit(idx, block_busy) || READ_ONCE(desc->block_status) != FW_BLOCK_STATUS_KERNEL)
+            continue;
+        smp_rmb(); // 用户态归还之后才改写块的内容
+        __set_bit(idx, block_busy);
+        next_block = (idx + 1) % nr_blocks;
+        desc->num_records = 0;
+        desc->offset_to_first = EVENT_FIRST_OFFSET;
+        desc->dropped = 0;
+        desc->seq_num = next_seq++;
+        desc->ts_first_ns = 0;
+        desc->ts_last_ns = 0;
+        spin_unlock(&ring_lock);
+        ec->block = idx;
+        ec->records = 0;
+        return true;
+    }
+    spin_unlock(&ring_lock);
+    return false;
+}
+
+// 把本 CPU 的块交给用户态，调用者持有 ec->lock
+static void retire_block(struct event_cpu *ec)
+{
+    struct fw_block_desc *desc = block_desc(ec->block);
+
+    desc->num_records = ec->records;
+    desc->dropped = ec->drops;
+    ec->drops = 0;
+    smp_wmb(); // 记录先于状态对用户态可见
+    WRITE_ONCE(desc->block_status, FW_BLOCK_STATUS_USER);
+    spin_lock(&ring_lock);
+    __clear_bit(ec->block, block_busy);
+    spin_unlock(&ring_lock);
+    ec->block = -1;
+    wake_up_interruptible(&ring_wait);
+}
+
+void __event_ring_emit(uint16_t type, uint8_t direction, uint32_t rule_id, uint32_t state, const fw_log_tuple_t *tuple)
+{
+    struct event_cpu *ec;
+    struct fw_block_desc *desc;
+    struct fw_event *ev;
+    u64 now = ktime_get_real_ns();
+
+    local_bh_disable();
+    ec = this_cpu_ptr(&event_cpu);
+    spin_lock(&ec->lock);
+    if (ec->block < 0 && !claim_block(ec)) {
+        // 用户态还没归还任何一块，丢弃而不是等待
+        ec->drops++;
+        goto out;
+    }
+    desc = block_desc(ec->block);
+    ev = (struct fw_event *)((char *)desc + EVENT_FIRST_OFFSET) + ec->records;
+    ev->ts_ns = now;
+    ev->type = type;
+    ev->proto = tuple->proto;
+    ev->direction = direction;
+    ev->rule_id = rule_id;
+    memcpy(ev->src_ip, &tuple->src_ip, sizeof(ev->src_ip));
+    memcpy(ev->dst_ip, &tuple->dst_ip, sizeof(ev->dst_ip));
+    ev->src_port = tuple->src_port;
+    ev->dst_port = tuple->dst_port;
+    ev->state = state;
+    if (ec->records++ == 0)
+        desc->ts_first_ns = now;
+    desc->ts_last_ns = now;
+    if (ec->records == EVENT_PER_BLOCK)
+        retire_block(ec);
+out:
+    spin_unlock(&ec->lock);
+    local_bh_enable();
+}
+
+// 定时把各 CPU 不满的块交给用户态，低速率下事件也能及时送达
+static void retire_timeout(struct timer_list *t)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        struct event_cpu *ec = per_cpu_ptr(&event_cpu, cpu);
+
+        spin_lock_bh(&ec->lock);
+        if (ec->block >= 0 && ec->records > 0)
+            retire_block(ec);
+        spin_unlock_bh(&ec->lock);
+    }
+    mod_timer(&retire_timer, jiffies + EVENT_RETIRE_INTERVAL);
+}
+
+static void event_vma_open(struct vm_area_struct *vma)
+{
+    spin_lock_bh(&ring_lock);
+    event_ring_users++;
+    spin_unlock_bh(&ring_lock);
+}
+
+static void event_vma_close(struct vm_area_struct *vma)
+{
+    spin_lock_bh(&ring_lock);
+    event_ring_users--;
+    spin_unlock_bh(&ring_lock);
+}
+
+static const struct vm_operations_struct event_vm_ops = {
+    .open = event_vma_open,
+    .close = event_vma_close,
+};
+
+int event_ring_mmap(struct file *filep, struct vm_area_struct *vma)
+{
+    int ret;
+
+    // 只映射块 0 用来读 nr_blocks，或者映射整个环
+    if (vma->vm_pgoff != 0 ||
+        (vma->vm_end - vma->vm_start != FW_EVENT_BLOCK_SIZE && vma->vm_end - vma->vm_start != ring_size))
+        return -EINVAL;
+    if (!(vma->vm_flags & VM_SHARED))
+        return -EINVAL;
+
+    ret = remap_vmalloc_range(vma, ring, 0);
+    if (ret)
+        return ret;
+    vma->vm_ops = &event_vm_ops;
+    event_vma_open(vma);
+    return 0;
+}
+
+__poll_t event_ring_poll(struct file *filep, struct poll_table_struct *wait)
+{
+    unsigned int i;
+
+    poll_wait(filep, &ring_wait, wait);
+    for (i = 0; i < nr_blocks; i++) {
+        if (READ_ONCE(block_desc(i)->block_status) == FW_BLOCK_STATUS_USER)
+            return EPOLLIN | EPOLLRDNORM;
+    }
+    return 0;
+}
+
+int event_ring_init(void)
+{
+    unsigned int i;
+    int cpu;
+
+    // 每个 CPU 同时占着一块，再留同样多的块给用户态读
+    nr_blocks = max_t(unsigned int, FW_EVENT_MIN_BLOCKS, 2 * num_possible_cpus());
+    ring_size = (size_t)nr_blocks * FW_EVENT_BLOCK_SIZE;
+    ring = vmalloc_user(ring_size);
+    if (!ring)
+        return -ENOMEM;
+    block_busy = bitmap_zalloc(nr_blocks, GFP_KERNEL);
+    if (!block_busy) {
+        vfree(ring);
+        ring = NULL;
+        return -ENOMEM;
+    }
+    for (i = 0; i < nr_blocks; i++) {
+        struct fw_block_desc *desc = block_desc(i);
+
+        desc->magic = FW_EVENT_MAGIC;
+        desc->version = FW_EVENT_VERSION;
+        desc->record_size = sizeof(struct fw_event);
+        desc->nr_blocks = nr_blocks;
+        desc->block_status = FW_BLOCK_STATUS_KERNEL;
+    }
+    for_each_possible_cpu(cpu) {
+        struct event_cpu *ec = per_cpu_ptr(&event_cpu, cpu);
+
+        spin_lock_init(&ec->lock);
+        ec->block = -1;
+        ec->records = 0;
+        ec->drops = 0;
+    }
+    next_block = 0;
+
+    timer_setup(&retire_timer, retire_timeout, 0);
+    mod_timer(&retire_timer, jiffies + EVENT_RETIRE_INTERVAL);
+    return 0;
+}
+
+void event_ring_exit(void)
+{
+    del_timer_sync(&retire_timer);
+    vfree(ring);
+    ring = NULL;
+    bitmap_free(block_busy);
+    block_busy = NULL;
+}
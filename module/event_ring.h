@@ -0,0 +1,27 @@
+#ifndef EVENT_RING_H
+#define EVENT_RING_H
+
+#include <linux/types.h>
+#include <linux/fs.h>
+#include "fw_uapi.h"
+#include "log.h"
+
+struct vm_area_struct;
+struct poll_table_struct;
+
+extern int event_ring_users; // 当前映射事件环的 VMA 数
+
+int event_ring_init(void);
+void event_ring_exit(void);
+void __event_ring_emit(uint16_t type, uint8_t direction, uint32_t rule_id, uint32_t state, const fw_log_tuple_t *tuple);
+int event_ring_mmap(struct file *filep, struct vm_area_struct *vma);
+__poll_t event_ring_poll(struct file *filep, struct poll_table_struct *wait);
+
+// 没有消费者映射时不加锁、不写环
+static inline void event_ring_emit(uint16_t type, uint8_t direction, uint32_t rule_id, uint32_t state, const fw_log_tuple_t *tuple)
+{
+    if (READ_ONCE(event_ring_users))
+        __event_ring_emit(type, direction, rule_id, state, tuple);
+}
+
+#endif // EVENT_RING_H
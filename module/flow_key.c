@@ -0,0 +1,246 @@
+#include "flow_key.h"
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/inet.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <linux/icmp.h>
+#include <linux/icmpv6.h>
+#include <linux/netfilter.h>
+#include <net/ip.h> // IP_OFFSET
+
+#define FW_IPV6_MAX_EXTHDRS 8 // longer chains are dropped rather than walked
+
+// IPv6 fragment header (RFC 8200 4.5)
+struct fw_frag_hdr {
+    u8 nexthdr;
+    u8 reserved;
+    __be16 frag_off; // offset in 8-byte units << 3, low bit = more fragments
+    __be32 identification;
+};
+
+static void fw_addr_mask(fw_addr_t *mask, unsigned int len)
+{
+    int i;
+
+    for (i = 0; i < 2; i++)
+    {
+        unsigned int bits = clamp_t(int, (int)len - 64 * i, 0, 64);
+
+        mask->w[i] = bits ? cpu_to_be64(~0ULL << (64 - bits)) : 0;
+    }
+}
+
+int fw_addr_parse(const char *s, fw_addr_t *addr, fw_addr_t *mask)
+{
+    bool v6 = strchr(s, ':') != NULL;
+    const char *end;
+    unsigned int len;
+    __be32 ip;
+
+    memset(addr, 0, sizeof(*addr));
+    memset(mask, 0, sizeof(*mask));
+    if (!*s || !strcmp(s, "0"))
+        return 0;
+
+    if (v6)
+    {
+        if (!in6_pton(s, -1, addr->in6.s6_addr, '/', &end))
+            return -EINVAL;
+    }
+    else
+    {
+        if (!in4_pton(s, -1, (u8 *)&ip, '/', &end))
+            return -EINVAL;
+        fw_addr_set_v4(addr, ip);
+    }
+
+    if (*end == '/')
+    {
+        if (kstrtouint(end + 1, 10, &len) || len > (v6 ? 128 : 32))
+            return -EINVAL;
+    }
+    else
+    {
+        if (*end)
+            return -EINVAL;
+        // Without a prefix the unspecified address is a wildcard, as 0 always was
+        if (v6 ? !(addr->w[0] | addr->w[1]) : !ip)
+        {
+            memset(addr, 0, sizeof(*addr));
+            return 0;
+        }
+        len = v6 ? 128 : 32;
+    }
+
+    fw_addr_mask(mask, v6 ? len : 96 + len);
+    addr->w[0] &= mask->w[0];
+    addr->w[1] &= mask->w[1];
+    return 0;
+}
+
+int fw_addr_format(char *buf, size_t size, const fw_addr_t *a)
+{
+    if (fw_addr_is_v4(a))
+        return scnprintf(buf, size, "%pI4", &a->ip6[3]);
+    return scnprintf(buf, size, "%pI6c", &a->in6);
+}
+
+static int fw_flow_key_parse_v4(const struct sk_buff *skb, int off, fw_flow_key_t *key)
+{
+    const struct iphdr *iph;
+    struct iphdr _iph;
+
+    iph = skb_header_pointer(skb, off, sizeof(_iph), &_iph);
+    if (!iph || iph->ihl < 5)
+        return -EINVAL;
+
+    fw_addr_set_v4(&key->src_ip, iph->saddr);
+    fw_addr_set_v4(&key->dst_ip, iph->daddr);
+    key->proto = iph->protocol;
+    // Later fragments carry payload where the transport header would be
+    if (iph->frag_off & htons(IP_OFFSET))
+        key->fragment = FW_FRAG_LATER;
+    else if (iph->frag_off & htons(IP_MF))
+        key->fragment = FW_FRAG_FIRST;
+    else
+        key->fragment = FW_FRAG_NONE;
+    key->frag_id = iph->id;
+    key->l4_offset = off + iph->ihl * 4;
+    return 0;
+}
+
+// Skip the extension headers to the upper-layer header. The fragment header
+// supplies the fragment state and ID; anything behind a later fragment's
+// fragment header is payload.
+static int fw_flow_key_parse_v6(const struct sk_buff *skb, int off, fw_flow_key_t *key)
+{
+    const struct ipv6hdr *ip6h;
+    struct ipv6hdr _ip6h;
+    u8 nexthdr;
+    int i;
+
+    ip6h = skb_header_pointer(skb, off, sizeof(_ip6h), &_ip6h);
+    if (!ip6h)
+        return -EINVAL;
+
+    key->src_ip.in6 = ip6h->saddr;
+    key->dst_ip.in6 = ip6h->daddr;
+    key->fragment = FW_FRAG_NONE;
+    key->frag_id = 0;
+    nexthdr = ip6h->nexthdr;
+    off += sizeof(*ip6h);
+
+    for (i = 0; i < FW_IPV6_MAX_EXTHDRS; i++)
+    {
+        const struct ipv6_opt_hdr *hp;
+        struct ipv6_opt_hdr _hp;
+        const struct fw_frag_hdr *fh;
+        struct fw_frag_hdr _fh;
+
+        switch (nexthdr)
+        {
+        case IPPROTO_HOPOPTS:
+        case IPPROTO_ROUTING:
+        case IPPROTO_DSTOPTS:
+        case IPPROTO_AH:
+            hp = skb_header_pointer(skb, off, sizeof(_hp), &_hp);
+            if (!hp)
+                return -EINVAL;
+            // AH counts its length in 4-byte units minus 2, the rest in 8-byte units minus 1
+            off += nexthdr == IPPROTO_AH ? (hp->hdrlen + 2) << 2 : (hp->hdrlen + 1) << 3;
+            nexthdr = hp->nexthdr;
+            break;
+        case IPPROTO_FRAGMENT:
+            fh = skb_header_pointer(skb, off, sizeof(_fh), &_fh);
+            if (!fh)
+                return -EINVAL;
+            nexthdr = fh->nexthdr;
+            off += sizeof(*fh);
+            key->frag_id = fh->identification;
+            if (fh->frag_off & htons(0xfff8))
+            {
+                key->fragment = FW_FRAG_LATER;
+                goto done;
+            }
+            if (fh->frag_off & htons(0x0001))
+                key->fragment = FW_FRAG_FIRST;
+            break;
+        default:
+            goto done;
+        }
+    }
+    return -EINVAL;
+
+done:
+    key->proto = nexthdr;
+    key->l4_offset = off;
+    return 0;
+}
+
+// Fill key from the network header at the network offset and, for the first
+// (or only) fragment, the transport header behind it. Only the bytes used
+// are copied, and only when they are not in the linear area.
+int fw_flow_key_parse(const struct sk_buff *skb, u8 pf, fw_flow_key_t *key)
+{
+    int off = skb_network_offset(skb);
+    int ret;
+
+    key->src_port = 0;
+    key->dst_port = 0;
+    key->tcp_flags = 0;
+    key->tcp_seq = 0;
+    key->tcp_ack = 0;
+    key->icmp_type = 0;
+    ret = pf == NFPROTO_IPV6 ? fw_flow_key_parse_v6(skb, off, key) : fw_flow_key_parse_v4(skb, off, key);
+    if (ret || key->fragment == FW_FRAG_LATER)
+        return ret;
+
+    switch (key->proto)
+    {
+    case IPPROTO_TCP:
+    {
+        const struct tcphdr *th;
+        struct tcphdr _th;
+
+        th = skb_header_pointer(skb, key->l4_offset, sizeof(_th), &_th);
+        if (!th)
+            return -EINVAL;
+        key->src_port = ntohs(th->source);
+        key->dst_port = ntohs(th->dest);
+        key->tcp_flags = (th->fin ? FW_TCP_FIN : 0) | (th->syn ? FW_TCP_SYN : 0) |
+                         (th->rst ? FW_TCP_RST : 0) | (th->ack ? FW_TCP_ACK : 0);
+        key->tcp_seq = ntohl(th->seq);
+        key->tcp_ack = ntohl(th->ack_seq);
+        break;
+    }
+    case IPPROTO_UDP:
+    {
+        const struct udphdr *uh;
+        struct udphdr _uh;
+
+        uh = skb_header_pointer(skb, key->l4_offset, sizeof(_uh), &_uh);
+        if (!uh)
+            return -EINVAL;
+        key->src_port = ntohs(uh->source);
+        key->dst_port = ntohs(uh->dest);
+        break;
+    }
+    case IPPROTO_ICMP:
+    case IPPROTO_ICMPV6:
+    {
+        // The type is the first byte of both headers
+        const u8 *type;
+        u8 _type;
+
+        type = skb_header_pointer(skb, key->l4_offset, sizeof(_type), &_type);
+        if (!type)
+            return -EINVAL;
+        key->icmp_type = *type;
+        break;
+    }
+    }
+    return 0;
+}
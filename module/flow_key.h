@@ -0,0 +1,86 @@
+#ifndef FLOW_KEY_H
+#define FLOW_KEY_H
+
+#include <linux/types.h>
+#include <linux/in6.h>
+#include <linux/skbuff.h>
+
+// TCP 头第 13 字节中的标志位
+#define FW_TCP_FIN 0x01
+#define FW_TCP_SYN 0x02
+#define FW_TCP_RST 0x04
+#define FW_TCP_ACK 0x10
+
+// fw_flow_key_t.fragment
+#define FW_FRAG_NONE 0  // 未分片
+#define FW_FRAG_FIRST 1 // 首分片，带传输层头
+#define FW_FRAG_LATER 2 // 后续分片，没有传输层头
+
+#define FW_ADDR_STRLEN 48 // fw_addr_format() 输出的最大长度，含结尾的 0
+
+// 统一的地址表示：IPv6 原样保存，IPv4 保存为 ::ffff:a.b.c.d 映射地址。
+// 规则匹配和连接表都按两个 64 位字比较，不区分协议族
+typedef union fw_addr {
+    struct in6_addr in6;
+    __be32 ip6[4];
+    u64 w[2];
+} fw_addr_t;
+
+static inline void fw_addr_set_v4(fw_addr_t *a, __be32 ip)
+{
+    a->w[0] = 0;
+    a->ip6[2] = htonl(0xffff);
+    a->ip6[3] = ip;
+}
+
+static inline bool fw_addr_is_v4(const fw_addr_t *a)
+{
+    return a->w[0] == 0 && a->ip6[2] == htonl(0xffff);
+}
+
+static inline bool fw_addr_equal(const fw_addr_t *a, const fw_addr_t *b)
+{
+    return ((a->w[0] ^ b->w[0]) | (a->w[1] ^ b->w[1])) == 0;
+}
+
+// addr 是否落在 net/mask 内，mask 全 0 时匹配任意地址
+static inline bool fw_addr_match(const fw_addr_t *addr, const fw_addr_t *net, const fw_addr_t *mask)
+{
+    return (((addr->w[0] ^ net->w[0]) & mask->w[0]) | ((addr->w[1] ^ net->w[1]) & mask->w[1])) == 0;
+}
+
+// 哈希用的 32 位折叠值
+static inline u32 fw_addr_fold(const fw_addr_t *a)
+{
+    return a->ip6[0] ^ a->ip6[1] ^ a->ip6[2] ^ a->ip6[3];
+}
+
+// 解析规则中的地址列："a.b.c.d"、"a.b.c.d/len"、IPv6 地址或前缀。
+// 空串、"0"、不带前缀的 0.0.0.0 和 :: 表示任意地址（mask 全 0）。
+// IPv4 前缀 /len 对应映射地址的 /(96 + len)，只匹配 IPv4 报文
+int fw_addr_parse(const char *s, fw_addr_t *addr, fw_addr_t *mask);
+// IPv4 输出点分十进制，IPv6 输出压缩格式
+int fw_addr_format(char *buf, size_t size, const fw_addr_t *a);
+
+// 每个钩子只解析一次的包元数据，规则匹配、状态检测和 NAT 共用。
+// 头部经 skb_header_pointer 读取，非线性（GRO 聚合、分页）的 skb 不需要线性化
+typedef struct fw_flow_key {
+    fw_addr_t src_ip;
+    fw_addr_t dst_ip;
+    uint16_t src_port;  // 主机字节序，非 TCP/UDP 或非首分片时为 0
+    uint16_t dst_port;
+    uint8_t proto;      // IPv6 为跳过扩展头之后的上层协议
+    uint8_t tcp_flags;  // FW_TCP_*，仅 TCP
+    uint8_t icmp_type;  // 仅 ICMP / ICMPv6
+    uint8_t fragment;   // FW_FRAG_*
+    uint32_t frag_id;   // IP 标识（IPv6 取分片头），网络字节序，同一数据报的分片相同
+    uint32_t tcp_seq;   // 主机字节序，仅 TCP，SYN 洪泛期间校验握手用
+    uint32_t tcp_ack;
+    uint16_t l4_offset; // 传输层头相对 skb->data 的偏移
+} fw_flow_key_t;
+
+// pf 为 NFPROTO_IPV4 或 NFPROTO_IPV6。成功返回 0；网络层头或首分片的
+// 传输层头被截断、IPv6 扩展头过多时返回 -EINVAL
+int fw_flow_key_parse(const struct sk_buff *skb, u8 pf, fw_flow_key_t *key);
+
+#endif // FLOW_KEY_H
@@ -0,0 +1,84 @@
+#include "frag_cache.h"
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/jhash.h>
+#include <linux/jiffies.h>
+#include <linux/bottom_half.h>
+#include "rule_filter.h"
+
+// One datagram. A hook records its verdict when it sees the first fragment,
+// so PRE_ROUTING and FORWARD share the entry without evicting each other.
+typedef struct frag_cache_entry {
+    fw_addr_t src_ip;
+    fw_addr_t dst_ip;
+    uint32_t frag_id;
+    uint8_t proto;
+    uint8_t valid; // bit d: verdict[d] was recorded by direction d
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t verdict[FLOW_MAX];
+    uint64_t generation; // rule generation the verdicts were taken from
+    unsigned long expires;
+} frag_cache_entry_t;
+
+struct frag_cache {
+    frag_cache_entry_t entry[1 << FRAG_CACHE_BITS];
+};
+
+static DEFINE_PER_CPU(struct frag_cache, frag_cache);
+
+static inline frag_cache_entry_t *frag_cache_slot(const fw_flow_key_t *key)
+{
+    u32 hash = jhash_3words(fw_addr_fold(&key->src_ip), fw_addr_fold(&key->dst_ip) ^ key->proto, key->frag_id, 0);
+
+    return &this_cpu_ptr(&frag_cache)->entry[hash & ((1 << FRAG_CACHE_BITS) - 1)];
+}
+
+static inline bool frag_cache_same(const frag_cache_entry_t *e, const fw_flow_key_t *key, uint64_t generation)
+{
+    return fw_addr_equal(&e->src_ip, &key->src_ip) && fw_addr_equal(&e->dst_ip, &key->dst_ip) && e->frag_id == key->frag_id &&
+           e->proto == key->proto && e->generation == generation && time_before(jiffies, e->expires);
+}
+
+// LOCAL_OUT hooks can run with bottom halves enabled; keep a softirq on this
+// CPU from seeing a half-written entry.
+bool frag_cache_lookup(fw_flow_key_t *key, int direction, uint64_t generation, unsigned int *verdict)
+{
+    frag_cache_entry_t *e;
+    bool hit;
+
+    local_bh_disable();
+    e = frag_cache_slot(key);
+    hit = frag_cache_same(e, key, generation) && (e->valid & BIT(direction));
+    if (hit)
+    {
+        key->src_port = e->src_port;
+        key->dst_port = e->dst_port;
+        *verdict = e->verdict[direction];
+    }
+    local_bh_enable();
+    return hit;
+}
+
+void frag_cache_store(const fw_flow_key_t *key, int direction, uint64_t generation, unsigned int verdict)
+{
+    frag_cache_entry_t *e;
+
+    local_bh_disable();
+    e = frag_cache_slot(key);
+    if (!frag_cache_same(e, key, generation) || e->src_port != key->src_port || e->dst_port != key->dst_port)
+    {
+        e->src_ip = key->src_ip;
+        e->dst_ip = key->dst_ip;
+        e->frag_id = key->frag_id;
+        e->proto = key->proto;
+        e->src_port = key->src_port;
+        e->dst_port = key->dst_port;
+        e->generation = generation;
+        e->valid = 0;
+    }
+    e->expires = jiffies + FRAG_CACHE_TIMEOUT;
+    e->verdict[direction] = verdict;
+    e->valid |= BIT(direction);
+    local_bh_enable();
+}
@@ -0,0 +1,17 @@
+#ifndef FRAG_CACHE_H
+#define FRAG_CACHE_H
+
+#include <linux/types.h>
+#include "flow_key.h"
+
+// 分片判决缓存：首分片按完整五元组过滤后，把判决和端口记在本 CPU 的缓存里，
+// 同一数据报（源、目的、协议、IP 标识相同，IPv6 取分片头的标识）的后续分片直接沿用。
+// 后续分片先于首分片到达、被挤出缓存或已过期时查不到，按端口 0 匹配规则
+#define FRAG_CACHE_BITS 6 // 每 CPU 64 项，直接映射
+#define FRAG_CACHE_TIMEOUT HZ
+
+// 查到时返回 true，并把首分片的端口填入 key
+bool frag_cache_lookup(fw_flow_key_t *key, int direction, uint64_t generation, unsigned int *verdict);
+void frag_cache_store(const fw_flow_key_t *key, int direction, uint64_t generation, unsigned int verdict);
+
+#endif // FRAG_CACHE_H
@@ -0,0 +1,102 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include "fw_net.h"
+#include "log.h"
+#include "conn_sync.h"
+
+unsigned int fw_net_id __read_mostly;
+
+// Every namespace, including init_net when the module loads, gets an empty
+// ruleset, its own conntrack table and the filter and NAT hooks.
+static int __net_init fw_net_init(struct net *net)
+{
+    struct fw_net *fn = fw_net(net);
+    int ret;
+
+    fn->net = net;
+    INIT_LIST_HEAD(&fn->nat_rules);
+    fn->stats = alloc_percpu(struct fw_cpu_stats);
+    if (!fn->stats)
+        return -ENOMEM;
+    fn->top = alloc_percpu(struct fw_top);
+    if (!fn->top)
+    {
+        free_percpu(fn->stats);
+        return -ENOMEM;
+    }
+
+    ret = rule_filter_net_init(fn);
+    if (ret)
+        goto err_stats;
+    ret = stateful_firewall_init(fn);
+    if (ret)
+        goto err_rules;
+
+    // PRE_ROUTING, LOCAL_IN, FORWARD and LOCAL_OUT
+    ret = rule_filter_register_hooks(net);
+    if (ret < 0)
+    {
+        log_message(LOG_WARN, "Failed to register firewall hooks");
+        goto err_conntrack;
+    }
+    fn->filter_status = 1;
+
+    ret = nat_register_hooks(net);
+    if (ret < 0)
+    {
+        log_message(LOG_WARN, "Failed to register NAT hook");
+        goto err_filter_hooks;
+    }
+    return 0;
+
+err_filter_hooks:
+    rule_filter_unregister_hooks(net);
+    fn->filter_status = 0;
+err_conntrack:
+    stateful_firewall_exit(fn);
+err_rules:
+    rule_filter_net_exit(fn);
+err_stats:
+    free_percpu(fn->top);
+    free_percpu(fn->stats);
+    return ret;
+}
+
+static void __net_exit fw_net_exit(struct net *net)
+{
+    struct fw_net *fn = fw_net(net);
+
+    // Unregistering waits for the packets still inside the hooks
+    nat_unregister_hooks(net);
+    // The filter hooks may already be off through the control device
+    if (fn->filter_status)
+        rule_filter_unregister_hooks(net);
+    fn->filter_status = 0;
+
+    // No packet queues sync records any more; the receiver must stop
+    // writing to the table before it goes away
+    conn_sync_stop(fn);
+    stateful_firewall_exit(fn);
+    nat_net_exit(fn);
+    rule_filter_net_exit(fn);
+    free_percpu(fn->top);
+    free_percpu(fn->stats);
+}
+
+// Retired rule generations are freed by RCU callbacks that update counters
+// in fw_net; wait for them, and for the conntrack entries queued with
+// kfree_rcu(), before the memory goes away.
+static void __net_exit fw_net_exit_batch(struct list_head *net_list)
+{
+    rcu_barrier();
+}
+
+struct pernet_operations fw_net_ops = {
+    .init = fw_net_init,
+    .exit = fw_net_exit,
+    .exit_batch = fw_net_exit_batch,
+    .id = &fw_net_id,
+    .size = sizeof(struct fw_net),
+};
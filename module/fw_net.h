@@ -0,0 +1,45 @@
+#ifndef FW_NET_H
+#define FW_NET_H
+
+#include <linux/list.h>
+#include <linux/percpu.h>
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
+#include "rule_filter.h"
+#include "stateful_check.h"
+#include "nat.h"
+#include "stats.h"
+#include "top.h"
+
+struct conn_sync_tx;
+struct conn_sync_rx;
+
+// 每个网络命名空间一份的防火墙实例，经 net_generic 挂在 struct net 上。
+// 命名空间创建时分配并注册钩子，销毁时注销钩子并释放，容器之间不共享
+// 规则集、连接表和统计。日志、事件环和分片缓存仍是全局的
+struct fw_net {
+    struct net *net;
+    int filter_status;                // 0: 过滤钩子已注销，1: 已注册
+    // 本命名空间的规则文件和 IP 集合文件，改动和重载都持有 rules.mutex。
+    // 初始命名空间取模块参数 rule_file / set_file，其他命名空间为空，
+    // 由控制设备的 FW_CTRL_SET_RULE_FILE / FW_CTRL_SET_SET_FILE 设置
+    char rule_file[256];
+    char set_file[256];
+    fw_rules_t rules;
+    fw_conntrack_t conntrack;
+    struct list_head nat_rules;       // nat_rule_t
+    struct fw_cpu_stats __percpu *stats;
+    struct fw_top __percpu *top;      // 热点统计，/proc/net/fw_top
+    struct conn_sync_tx __rcu *sync_tx; // 主备同步的发送端，见 conn_sync.h
+    struct conn_sync_rx *sync_rx;       // 主备同步的接收端
+};
+
+extern unsigned int fw_net_id;
+extern struct pernet_operations fw_net_ops;
+
+static inline struct fw_net *fw_net(const struct net *net)
+{
+    return net_generic(net, fw_net_id);
+}
+
+#endif // FW_NET_H
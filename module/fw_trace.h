@@ -0,0 +1,124 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM firewall
+
+#if !defined(FW_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define FW_TRACE_H
+
+#include <linux/tracepoint.h>
+#include "flow_key.h"
+
+// 数据路径 tracepoint，位于 /sys/kernel/tracing/events/firewall/
+// 未启用时只是一条 static key 跳转，可用 perf / ftrace 按需挂载
+// 地址按 16 字节记录，IPv4 显示为 ::ffff:a.b.c.d
+
+DECLARE_EVENT_CLASS(fw_tuple_class,
+    TP_PROTO(const fw_addr_t *saddr, const fw_addr_t *daddr, u16 sport, u16 dport, u8 proto),
+    TP_ARGS(saddr, daddr, sport, dport, proto),
+    TP_STRUCT__entry(
+        __array(u8, saddr, 16)
+        __array(u8, daddr, 16)
+        __field(u16, sport)
+        __field(u16, dport)
+        __field(u8, proto)
+    ),
+    TP_fast_assign(
+        memcpy(__entry->saddr, saddr, 16);
+        memcpy(__entry->daddr, daddr, 16);
+        __entry->sport = sport;
+        __entry->dport = dport;
+        __entry->proto = proto;
+    ),
+    TP_printk("%pI6c:%u -> %pI6c:%u proto=%u",
+              __entry->saddr, __entry->sport, __entry->daddr, __entry->dport, __entry->proto)
+);
+
+DEFINE_EVENT(fw_tuple_class, fw_conn_insert,
+    TP_PROTO(const fw_addr_t *saddr, const fw_addr_t *daddr, u16 sport, u16 dport, u8 proto),
+    TP_ARGS(saddr, daddr, sport, dport, proto)
+);
+
+TRACE_EVENT(fw_rule_match,
+    TP_PROTO(u32 rule_id, int direction, int action, const fw_addr_t *saddr, const fw_addr_t *daddr, u16 sport, u16 dport, u8 proto),
+    TP_ARGS(rule_id, direction, action, saddr, daddr, sport, dport, proto),
+    TP_STRUCT__entry(
+        __field(u32, rule_id)
+        __field(int, direction)
+        __field(int, action)
+        __array(u8, saddr, 16)
+        __array(u8, daddr, 16)
+        __field(u16, sport)
+        __field(u16, dport)
+        __field(u8, proto)
+    ),
+    TP_fast_assign(
+        __entry->rule_id = rule_id;
+        __entry->direction = direction;
+        __entry->action = action;
+        memcpy(__entry->saddr, saddr, 16);
+        memcpy(__entry->daddr, daddr, 16);
+        __entry->sport = sport;
+        __entry->dport = dport;
+        __entry->proto = proto;
+    ),
+    TP_printk("rule=%u dir=%d action=%d %pI6c:%u -> %pI6c:%u proto=%u",
+              __entry->rule_id, __entry->direction, __entry->action,
+              __entry->saddr, __entry->sport, __entry->daddr, __entry->dport, __entry->proto)
+);
+
+TRACE_EVENT(fw_conn_expire,
+    TP_PROTO(const fw_addr_t *saddr, const fw_addr_t *daddr, u16 sport, u16 dport, u8 proto, int state, unsigned long idle_jiffies),
+    TP_ARGS(saddr, daddr, sport, dport, proto, state, idle_jiffies),
+    TP_STRUCT__entry(
+        __array(u8, saddr, 16)
+        __array(u8, daddr, 16)
+        __field(u16, sport)
+        __field(u16, dport)
+        __field(u8, proto)
+        __field(int, state)
+        __field(unsigned long, idle_jiffies)
+    ),
+    TP_fast_assign(
+        memcpy(__entry->saddr, saddr, 16);
+        memcpy(__entry->daddr, daddr, 16);
+        __entry->sport = sport;
+        __entry->dport = dport;
+        __entry->proto = proto;
+        __entry->state = state;
+        __entry->idle_jiffies = idle_jiffies;
+    ),
+    TP_printk("%pI6c:%u -> %pI6c:%u proto=%u state=%d idle=%lu",
+              __entry->saddr, __entry->sport, __entry->daddr, __entry->dport,
+              __entry->proto, __entry->state, __entry->idle_jiffies)
+);
+
+TRACE_EVENT(fw_nat_rewrite,
+    TP_PROTO(int direction, u8 proto, u32 old_addr, u16 old_port, u32 new_addr, u16 new_port),
+    TP_ARGS(direction, proto, old_addr, old_port, new_addr, new_port),
+    TP_STRUCT__entry(
+        __field(int, direction)
+        __field(u8, proto)
+        __field(u32, old_addr)
+        __field(u16, old_port)
+        __field(u32, new_addr)
+        __field(u16, new_port)
+    ),
+    TP_fast_assign(
+        __entry->direction = direction;
+        __entry->proto = proto;
+        __entry->old_addr = old_addr;
+        __entry->old_port = old_port;
+        __entry->new_addr = new_addr;
+        __entry->new_port = new_port;
+    ),
+    TP_printk("%s proto=%u %pI4:%u => %pI4:%u",
+              __entry->direction ? "DNAT" : "SNAT", __entry->proto,
+              &__entry->old_addr, __entry->old_port, &__entry->new_addr, __entry->new_port)
+);
+
+#endif // FW_TRACE_H
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE fw_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,175 @@
+#ifndef FW_UAPI_H
+#define FW_UAPI_H
+
+// 内核与用户态共享的 /dev/firewall_ctrl 接口定义
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * 事件环（mmap /dev/firewall_ctrl，偏移 0，长度 nr_blocks * FW_EVENT_BLOCK_SIZE）
+ *
+ * 环由 nr_blocks 个块组成，块数在模块加载时按 CPU 数确定：至少
+ * FW_EVENT_MIN_BLOCKS，且不少于 CPU 数的两倍，每个 CPU 填充一块时仍有块可以
+ * 交给用户态。用户态先只映射块 0（长度 FW_EVENT_BLOCK_SIZE），从描述符读出
+ * nr_blocks 后再映射整个环。每块以 struct fw_block_desc 开头，后面
+ * 紧跟 num_records 条 struct fw_event。内核写满一块或超时后把块“退休”，
+ * 将 block_status 置为 FW_BLOCK_STATUS_USER 并唤醒 poll()；用户态读完后写回
+ * FW_BLOCK_STATUS_KERNEL 归还该块。内核遇到仍归用户的块时丢弃事件并计数。
+ *
+ * 每个 CPU 各自占用一块填充，一块里只有同一 CPU 的事件。seq_num 是块被占用
+ * 的顺序，不同 CPU 的块在时间上会重叠，需要全局时间顺序时按 ts_ns 合并。
+ */
+#define FW_EVENT_BLOCK_SIZE (1 << 16)
+#define FW_EVENT_MIN_BLOCKS 16
+
+#define FW_BLOCK_STATUS_KERNEL 0
+#define FW_BLOCK_STATUS_USER 1
+
+#define FW_EVENT_DROP 1     // 报文被规则或默认动作丢弃
+#define FW_EVENT_ACCEPT 2   // 报文命中 log=1 的放行规则
+#define FW_EVENT_FLOW_NEW 3 // 新建连接
+#define FW_EVENT_FLOW_END 4 // 连接超时删除
+
+/*
+ * 每块的描述符以 magic、version、record_size 和 nr_blocks 开头，加载时写好、
+ * 之后不变。用户态 mmap 后先检查块 0 的前三项，布局不符就拒绝读取。版本 1 是
+ * 地址为 __u32 的旧布局（没有这几项），版本 2 起地址为 16 字节，版本 3 起块数
+ * 不再固定为 16，由 nr_blocks 给出。
+ */
+#define FW_EVENT_MAGIC 0x46574556 // "FWEV"
+#define FW_EVENT_VERSION 3
+
+struct fw_block_desc {
+    __u32 magic;       // FW_EVENT_MAGIC
+    __u16 version;     // FW_EVENT_VERSION
+    __u16 record_size; // sizeof(struct fw_event)
+    __u32 nr_blocks;   // 环的块数
+    __u32 block_status;
+    __u32 num_records;
+    __u32 offset_to_first; // 第一条记录相对块首的偏移
+    __u32 dropped;         // 块退休前因环满丢弃的事件数
+    __u32 reserved;
+    __u64 seq_num;         // 块序号，单调递增
+    __u64 ts_first_ns;
+    __u64 ts_last_ns;
+};
+
+struct fw_event {
+    __u64 ts_ns;
+    __u16 type;
+    __u8 proto;
+    __u8 direction;
+    __u32 rule_id;
+    __u8 src_ip[16]; // 网络字节序，IPv4 为 ::ffff:a.b.c.d 映射地址
+    __u8 dst_ip[16];
+    __u16 src_port;
+    __u16 dst_port;
+    __u32 state;
+};
+
+/*
+ * 批量控制命令（ioctl FW_IOC_BATCH）
+ *
+ * 一次调用携带最多 FW_CTRL_MAX_CMDS 条 struct fw_ctrl_cmd，按顺序执行，每条
+ * 命令的结果写回它的 result。默认遇到失败的命令就停下，done 为已执行的条数；
+ * 置 FW_CTRL_F_CONTINUE 时继续执行后面的命令。ioctl 本身只在批次无法读写时
+ * 失败（-EFAULT、-EINVAL、-EPROTONOSUPPORT），命令的错误看各自的 result。
+ *
+ * 查询类命令把结构化结果写到 out 指向的缓冲区，out_len 入为缓冲区长度、出为
+ * 写入的字节数；缓冲区不够放一个完整结构时 result 为 -ENOSPC，out_len 为所需
+ * 长度。连接表快照保存在打开的文件里，之后 read() 从头读出全部记录，同一进程
+ * 或其他进程的其他打开互不影响。
+ */
+#define FW_CTRL_VERSION 1
+#define FW_CTRL_MAX_CMDS 64
+
+#define FW_CTRL_F_CONTINUE 1 // 命令失败后继续执行批次里后面的命令
+
+#define FW_CTRL_HOOKS_ON 1       // 注册本命名空间的钩子
+#define FW_CTRL_HOOKS_OFF 2      // 注销钩子
+#define FW_CTRL_RELOAD 3         // 重新加载规则文件，result 为新规则集的规则数
+#define FW_CTRL_DEFAULT_ACTION 4 // arg 为 FW_CTRL_ACCEPT 或 FW_CTRL_DROP
+#define FW_CTRL_GET_STATUS 5     // out 为 struct fw_ctrl_status
+#define FW_CTRL_GET_STATS 6      // out 为 struct fw_ctrl_stats 加计数
+#define FW_CTRL_GET_RULES 7      // out 为 struct fw_ctrl_rule 数组，result 为规则总数
+#define FW_CTRL_SNAPSHOT_CONNS 8 // 快照连接表，result 为连接数，out 可选，放得下的前若干条 struct fw_ctrl_conn
+#define FW_CTRL_SET_RULE_FILE 9  // arg 为以 NUL 结尾的路径的地址，空串清除；下次重载时生效，需要 CAP_NET_ADMIN
+#define FW_CTRL_SET_SET_FILE 10  // 同上，设置 IP 集合文件
+
+#define FW_CTRL_ACCEPT 0
+#define FW_CTRL_DROP 1
+
+struct fw_ctrl_cmd {
+    __u32 op;       // FW_CTRL_*
+    __s32 result;   // 出：>= 0 成功，< 0 为 -errno
+    __u64 arg;
+    __u64 out;      // 用户态缓冲区地址，不需要输出时为 0
+    __u32 out_len;
+    __u32 reserved;
+};
+
+struct fw_ctrl_batch {
+    __u32 version; // FW_CTRL_VERSION
+    __u32 flags;   // FW_CTRL_F_*
+    __u32 count;   // cmds 的条数
+    __u32 done;    // 出：执行了的命令数
+    __u64 cmds;    // struct fw_ctrl_cmd 数组的地址
+};
+
+#define FW_IOC_MAGIC 'F'
+#define FW_IOC_BATCH _IOWR(FW_IOC_MAGIC, 1, struct fw_ctrl_batch)
+
+struct fw_ctrl_status {
+    __u32 version;        // FW_CTRL_VERSION
+    __u32 hooks;          // 1 为钩子已注册
+    __u32 default_action; // FW_CTRL_ACCEPT 或 FW_CTRL_DROP
+    __u32 rules;
+    __u64 generation;     // 当前规则集代号
+    __u64 reloads;
+    __u64 reload_failures;
+    __u64 connections;
+};
+
+// value 依次为 accept[nr_hooks]、drop[nr_hooks]、counter[nr_counters]，
+// 钩子和计数的顺序与 /proc/net/fw_stats 中的行一致，新增的计数只加在末尾
+struct fw_ctrl_stats {
+    __u32 nr_hooks;
+    __u32 nr_counters;
+    __u64 value[];
+};
+
+#define FW_CTRL_RULE_SRC_SET 1 // 源地址列引用地址集合，src_ip/src_mask 为任意地址
+#define FW_CTRL_RULE_DST_SET 2
+
+// 按钩子分组输出，组内按匹配顺序
+struct fw_ctrl_rule {
+    __u32 id;        // 规则文件中的物理行号，表头为第 1 行，与日志和事件中的规则号相同
+    __u8 direction;  // flow_direction 列
+    __u8 action;     // action 列
+    __u8 proto;
+    __u8 flags;      // FW_CTRL_RULE_*
+    __u8 src_ip[16]; // 网络字节序，IPv4 为映射地址，同 fw_event
+    __u8 src_mask[16];
+    __u8 dst_ip[16];
+    __u8 dst_mask[16];
+    __u16 src_port;  // 主机字节序，0 为任意端口
+    __u16 dst_port;
+    __u32 limit_rate;
+    __u32 connlimit;
+    __u32 reserved;
+};
+
+struct fw_ctrl_conn {
+    __u8 src_ip[16];
+    __u8 dst_ip[16];
+    __u16 src_port;
+    __u16 dst_port;
+    __u8 proto;
+    __u8 state;
+    __u16 reserved;
+    __u32 idle_ms; // 距上次有包经过的毫秒数
+    __u32 reserved2;
+};
+
+#endif // FW_UAPI_H
@@ -0,0 +1,429 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/ctype.h>
+#include <linux/string.h>
+#include <linux/random.h>
+#include <linux/bitmap.h>
+#include "ipset.h"
+#include "log.h"
+
+#define IPSET_READ_CHUNK 65536
+#define IPSET_MIN_SLOTS 16
+#define IPSET_MAX_SLOTS (1U << 27)
+#define IPSET_BITMAP_MIN_PREFIX 8 // a /8 bitmap takes 2 MB
+
+// Set file layout, one member per line after the header:
+//   name,type,member
+// type is "hash", "hash+bloom" or "bitmap:a.b.c.d/len". The first line of a
+// set creates it; later lines must repeat the same type. Hash members are
+// single addresses, bitmap members an address or prefix inside the range.
+char set_file_path[256] = "/home/moyi/ws/module/net_set.csv";
+module_param_string(set_file, set_file_path, sizeof(set_file_path), 0444);
+MODULE_PARM_DESC(set_file, "Path of the IP set CSV loaded with the rule file of the initial namespace");
+
+void change_set_file_path(char *path)
+{
+    strscpy(set_file_path, path, sizeof(set_file_path));
+}
+
+char *get_set_file_path(void)
+{
+    return set_file_path;
+}
+
+fw_ipset_t *fw_ipset_find(struct list_head *sets, const char *name)
+{
+    fw_ipset_t *set;
+
+    list_for_each_entry(set, sets, list)
+    {
+        if (!strcmp(set->name, name))
+            return set;
+    }
+    return NULL;
+}
+
+static void ipset_free(fw_ipset_t *set)
+{
+    kvfree(set->v4);
+    kvfree(set->v6);
+    kvfree(set->bloom);
+    kvfree(set->map);
+    kfree(set);
+}
+
+void fw_ipset_free_all(struct list_head *sets)
+{
+    fw_ipset_t *set, *tmp;
+
+    list_for_each_entry_safe(set, tmp, sets, list)
+    {
+        list_del(&set->list);
+        ipset_free(set);
+    }
+}
+
+static bool ipset_name_valid(const char *name)
+{
+    size_t len = strlen(name), i;
+
+    if (!len || len >= FW_IPSET_NAME_LEN)
+        return false;
+    for (i = 0; i < len; i++)
+    {
+        if (!isalnum(name[i]) && name[i] != '_' && name[i] != '-' && name[i] != '.')
+            return false;
+    }
+    return true;
+}
+
+// Parse the type column into set; for a bitmap also the range
+static int ipset_parse_type(const char *s, fw_ipset_t *set)
+{
+    fw_addr_t addr, mask;
+    unsigned int len;
+
+    if (!strcmp(s, "hash") || !strcmp(s, "hash+bloom"))
+    {
+        set->type = FW_IPSET_HASH;
+        set->with_bloom = s[4] == '+';
+        return 0;
+    }
+    if (strncmp(s, "bitmap:", 7) || fw_addr_parse(s + 7, &addr, &mask) || !fw_addr_is_v4(&addr))
+        return -EINVAL;
+    len = hweight32(ntohl(mask.ip6[3]));
+    if (len < IPSET_BITMAP_MIN_PREFIX)
+        return -EINVAL;
+    set->type = FW_IPSET_BITMAP;
+    set->base = ntohl(addr.ip6[3]);
+    set->size = 1U << (32 - len);
+    return 0;
+}
+
+static fw_ipset_t *ipset_create(const char *name, const char *type)
+{
+    fw_ipset_t *set;
+
+    if (!ipset_name_valid(name))
+        return ERR_PTR(-EINVAL);
+    set = kzalloc(sizeof(*set), GFP_KERNEL);
+    if (!set)
+        return ERR_PTR(-ENOMEM);
+    if (ipset_parse_type(type, set))
+    {
+        kfree(set);
+        return ERR_PTR(-EINVAL);
+    }
+    strscpy(set->name, name, sizeof(set->name));
+    set->seed = get_random_u32();
+    if (set->type == FW_IPSET_BITMAP)
+    {
+        set->map = kvcalloc(BITS_TO_LONGS(set->size), sizeof(unsigned long), GFP_KERNEL);
+        if (!set->map)
+        {
+            kfree(set);
+            return ERR_PTR(-ENOMEM);
+        }
+    }
+    return set;
+}
+
+static u32 ipset_hash4(const fw_ipset_t *set, __be32 ip)
+{
+    return jhash_1word((__force u32)ip, set->seed);
+}
+
+static u32 ipset_hash6(const fw_ipset_t *set, const fw_addr_t *a)
+{
+    return jhash2((const u32 *)a->ip6, 4, set->seed);
+}
+
+// Tables grow by doubling to keep the load factor at or below 3/4, so a
+// miss usually stops at the first or second empty slot
+static int ipset_hash4_grow(fw_ipset_t *set)
+{
+    u32 slots = set->v4 ? (set->v4_mask + 1) * 2 : IPSET_MIN_SLOTS, i, j;
+    __be32 *v4;
+
+    if (slots > IPSET_MAX_SLOTS)
+        return -E2BIG;
+    v4 = kvcalloc(slots, sizeof(*v4), GFP_KERNEL);
+    if (!v4)
+        return -ENOMEM;
+    for (j = 0; set->v4 && j <= set->v4_mask; j++)
+    {
+        if (!set->v4[j])
+            continue;
+        for (i = ipset_hash4(set, set->v4[j]) & (slots - 1); v4[i]; i = (i + 1) & (slots - 1))
+            ;
+        v4[i] = set->v4[j];
+    }
+    kvfree(set->v4);
+    set->v4 = v4;
+    set->v4_mask = slots - 1;
+    return 0;
+}
+
+static int ipset_hash6_grow(fw_ipset_t *set)
+{
+    u32 slots = set->v6 ? (set->v6_mask + 1) * 2 : IPSET_MIN_SLOTS, i, j;
+    fw_addr_t *v6;
+
+    if (slots > IPSET_MAX_SLOTS)
+        return -E2BIG;
+    v6 = kvcalloc(slots, sizeof(*v6), GFP_KERNEL);
+    if (!v6)
+        return -ENOMEM;
+    for (j = 0; set->v6 && j <= set->v6_mask; j++)
+    {
+        if (!(set->v6[j].w[0] | set->v6[j].w[1]))
+            continue;
+        for (i = ipset_hash6(set, &set->v6[j]) & (slots - 1); v6[i].w[0] | v6[i].w[1]; i = (i + 1) & (slots - 1))
+            ;
+        v6[i] = set->v6[j];
+    }
+    kvfree(set->v6);
+    set->v6 = v6;
+    set->v6_mask = slots - 1;
+    return 0;
+}
+
+static int ipset_hash_add(fw_ipset_t *set, const fw_addr_t *a)
+{
+    u32 i;
+    int ret;
+
+    if (fw_addr_is_v4(a))
+    {
+        if (!set->v4 || (set->v4_count + 1) * 4 > (set->v4_mask + 1) * 3)
+        {
+            ret = ipset_hash4_grow(set);
+            if (ret)
+                return ret;
+        }
+        for (i = ipset_hash4(set, a->ip6[3]) & set->v4_mask; set->v4[i]; i = (i + 1) & set->v4_mask)
+        {
+            if (set->v4[i] == a->ip6[3])
+                return 0;
+        }
+        set->v4[i] = a->ip6[3];
+        set->v4_count++;
+        return 0;
+    }
+
+    if (!set->v6 || (set->v6_count + 1) * 4 > (set->v6_mask + 1) * 3)
+    {
+        ret = ipset_hash6_grow(set);
+        if (ret)
+            return ret;
+    }
+    for (i = ipset_hash6(set, a) & set->v6_mask; set->v6[i].w[0] | set->v6[i].w[1]; i = (i + 1) & set->v6_mask)
+    {
+        if (fw_addr_equal(&set->v6[i], a))
+            return 0;
+    }
+    set->v6[i] = *a;
+    set->v6_count++;
+    return 0;
+}
+
+static int ipset_bitmap_add(fw_ipset_t *set, const fw_addr_t *addr, const fw_addr_t *mask)
+{
+    u32 start, n, len, i;
+
+    // IPv4 members only, including a ::ffff:a.b.c.d/len written as IPv6
+    if (!fw_addr_is_v4(addr) || mask->ip6[2] != htonl(0xffffffff))
+        return -EINVAL;
+    start = ntohl(addr->ip6[3]) - set->base;
+    len = hweight32(ntohl(mask->ip6[3]));
+    // A /0 member covers 2^32 addresses, more than any bitmap range
+    n = len ? 1U << (32 - len) : 0;
+    if (!n || start >= set->size || n > set->size - start)
+        return -EINVAL;
+    for (i = start; i < start + n; i++)
+    {
+        if (!test_bit(i, set->map))
+        {
+            __set_bit(i, set->map);
+            set->count++;
+        }
+    }
+    return 0;
+}
+
+// One "name,type,member" line. Returns -EINVAL for a line to skip
+static int ipset_add_line(struct list_head *sets, char *line)
+{
+    char *name = strsep(&line, ","), *type = strsep(&line, ","), *member = strsep(&line, ",");
+    fw_ipset_t *set, tmp = { 0 };
+    fw_addr_t addr, mask;
+
+    if (!name || !type || !member)
+        return -EINVAL;
+    set = fw_ipset_find(sets, name);
+    if (!set)
+    {
+        set = ipset_create(name, type);
+        if (IS_ERR(set))
+            return PTR_ERR(set);
+        list_add_tail(&set->list, sets);
+    }
+    else if (ipset_parse_type(type, &tmp) || tmp.type != set->type || tmp.with_bloom != set->with_bloom ||
+             tmp.base != set->base || tmp.size != set->size)
+    {
+        return -EINVAL;
+    }
+
+    // A wildcard member would make the set match everything
+    if (fw_addr_parse(member, &addr, &mask) || !(mask.w[0] | mask.w[1]))
+        return -EINVAL;
+    if (set->type == FW_IPSET_BITMAP)
+        return ipset_bitmap_add(set, &addr, &mask);
+    if ((mask.w[0] & mask.w[1]) != ~0ULL)
+        return -EINVAL; // hash members are single addresses
+    return ipset_hash_add(set, &addr);
+}
+
+static void ipset_bloom_add(fw_ipset_t *set, u32 h)
+{
+    u64 g = h * 0x9E3779B97F4A7C15ULL;
+
+    set->bloom[(g >> 32) & set->bloom_mask] |=
+        BIT_ULL((g >> 8) & 63) | BIT_ULL((g >> 14) & 63) | BIT_ULL((g >> 20) & 63) | BIT_ULL((g >> 26) & 63);
+}
+
+// Size the Bloom filter for the final member count, fill it and account the
+// memory; sets are read-only once the generation is published
+static int ipset_finish(fw_ipset_t *set)
+{
+    u32 words, i;
+
+    set->bytes = sizeof(*set);
+    if (set->type == FW_IPSET_BITMAP)
+    {
+        set->bytes += BITS_TO_LONGS(set->size) * sizeof(unsigned long);
+        return 0;
+    }
+    set->count = set->v4_count + set->v6_count;
+    if (set->v4)
+        set->bytes += (set->v4_mask + 1) * sizeof(*set->v4);
+    if (set->v6)
+        set->bytes += (set->v6_mask + 1) * sizeof(*set->v6);
+    if (!set->with_bloom || !set->count)
+        return 0;
+
+    words = roundup_pow_of_two(DIV_ROUND_UP((u64)set->count * FW_IPSET_BLOOM_BITS, 64));
+    set->bloom = kvcalloc(words, sizeof(*set->bloom), GFP_KERNEL);
+    if (!set->bloom)
+        return -ENOMEM;
+    set->bloom_mask = words - 1;
+    for (i = 0; set->v4 && i <= set->v4_mask; i++)
+    {
+        if (set->v4[i])
+            ipset_bloom_add(set, ipset_hash4(set, set->v4[i]));
+    }
+    for (i = 0; set->v6 && i <= set->v6_mask; i++)
+    {
+        if (set->v6[i].w[0] | set->v6[i].w[1])
+            ipset_bloom_add(set, ipset_hash6(set, &set->v6[i]));
+    }
+    set->bytes += words * sizeof(*set->bloom);
+    return 0;
+}
+
+// The set file may hold millions of lines, so it is read in large chunks
+// rather than a byte at a time as the rule file is
+int fw_ipset_load(struct list_head *sets, const char *path)
+{
+    struct file *file;
+    fw_ipset_t *set;
+    char *buf, *line, *nl, *end;
+    loff_t pos = 0;
+    size_t have = 0;
+    ssize_t len;
+    unsigned long lines = 0, skipped = 0, entries = 0;
+    unsigned int count = 0;
+    int ret = 0;
+
+    if (!path[0])
+        return 0;
+    file = filp_open(path, O_RDONLY, 0);
+    if (IS_ERR(file))
+    {
+        // Sets are optional; rules that name one are rejected
+        if (PTR_ERR(file) == -ENOENT)
+            return 0;
+        log_message(LOG_WARN, "Failed to open set file");
+        return PTR_ERR(file);
+    }
+
+    buf = kvmalloc(IPSET_READ_CHUNK + 1, GFP_KERNEL);
+    if (!buf)
+    {
+        filp_close(file, NULL);
+        return -ENOMEM;
+    }
+
+    for (;;)
+    {
+        len = kernel_read(file, buf + have, IPSET_READ_CHUNK - have, &pos);
+        if (len < 0)
+        {
+            ret = len;
+            goto out;
+        }
+        end = buf + have + len;
+        // The last line may lack its newline
+        if (!len)
+        {
+            if (!have)
+                break;
+            *end++ = '\n';
+        }
+        for (line = buf; (nl = memchr(line, '\n', end - line)); line = nl + 1)
+        {
+            *nl = '\0';
+            if (nl > line && nl[-1] == '\r')
+                nl[-1] = '\0';
+            // Empty lines are skipped, the first line is the header
+            if (!*line || !lines++)
+                continue;
+            ret = ipset_add_line(sets, line);
+            if (ret == -ENOMEM)
+                goto out;
+            if (ret)
+                skipped++;
+        }
+        ret = 0;
+        have = end - line;
+        if (!len)
+            break;
+        if (have == IPSET_READ_CHUNK)
+        {
+            log_message(LOG_WARN, "Set file line too long");
+            ret = -EINVAL;
+            goto out;
+        }
+        memmove(buf, line, have);
+    }
+
+    list_for_each_entry(set, sets, list)
+    {
+        ret = ipset_finish(set);
+        if (ret)
+            goto out;
+        count++;
+        entries += set->count;
+    }
+    if (skipped)
+        log_message(LOG_WARN, "Skipped %lu invalid set file lines", skipped);
+    log_message(LOG_INFO, "Loaded %u sets with %lu entries", count, entries);
+    printk(KERN_INFO "Loaded %u sets with %lu entries\n", count, entries);
+out:
+    kvfree(buf);
+    filp_close(file, NULL);
+    return ret;
+}
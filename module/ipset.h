@@ -0,0 +1,99 @@
+#ifndef IPSET_H
+#define IPSET_H
+
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/jhash.h>
+#include <linux/bitops.h>
+#include "flow_key.h"
+
+// 命名地址集合，规则的 src_ip / dst_ip 列写 "@名字" 引用。集合从 set_file
+// 读取，和规则文件一起加载，属于同一代规则集，随它发布和回收
+#define FW_IPSET_NAME_LEN 32
+
+// fw_ipset_t.type
+#define FW_IPSET_HASH 0   // 任意 IPv4 / IPv6 地址，开放寻址哈希表
+#define FW_IPSET_BITMAP 1 // 一个 IPv4 前缀内的地址，每个地址 1 位
+
+#define FW_IPSET_BLOOM_BITS 8 // Bloom 过滤器每个成员的位数
+
+typedef struct fw_ipset {
+    char name[FW_IPSET_NAME_LEN];
+    int type;
+    uint32_t count; // 成员数，bitmap 集合按地址计
+    size_t bytes;   // 集合占用的内存
+    uint32_t seed;
+
+    // FW_IPSET_HASH：线性探测，全 0 表示空槽，所以 0.0.0.0 和 :: 不能作成员
+    __be32 *v4;     // IPv4 成员
+    uint32_t v4_mask; // 槽数 - 1
+    uint32_t v4_count;
+    fw_addr_t *v6;  // IPv6 成员
+    uint32_t v6_mask;
+    uint32_t v6_count;
+    bool with_bloom; // 类型写作 hash+bloom
+    // 可选的分块 Bloom 过滤器，同一成员的位都在一个 64 位字里，
+    // 不在集合中的地址多数只读这一个字就返回
+    u64 *bloom;
+    uint32_t bloom_mask; // 字数 - 1
+
+    // FW_IPSET_BITMAP：[base, base + size) 内的 IPv4 地址，主机字节序
+    uint32_t base;
+    uint32_t size;
+    unsigned long *map;
+
+    struct list_head list;
+} fw_ipset_t;
+
+// 读取 path 中的全部集合挂到 sets 上，path 为空或文件不存在时没有集合。
+// 格式错误的行被跳过；分配失败或读文件出错时返回负的错误码，
+// 已读入的集合留在 sets 上，由调用者用 fw_ipset_free_all() 释放
+int fw_ipset_load(struct list_head *sets, const char *path);
+void fw_ipset_free_all(struct list_head *sets);
+fw_ipset_t *fw_ipset_find(struct list_head *sets, const char *name);
+void change_set_file_path(char *path);
+char *get_set_file_path(void);
+
+static inline bool fw_ipset_bloom_test(const fw_ipset_t *set, u32 h)
+{
+    u64 g = h * 0x9E3779B97F4A7C15ULL;
+    u64 bits = BIT_ULL((g >> 8) & 63) | BIT_ULL((g >> 14) & 63) | BIT_ULL((g >> 20) & 63) | BIT_ULL((g >> 26) & 63);
+
+    return (set->bloom[(g >> 32) & set->bloom_mask] & bits) == bits;
+}
+
+// 包路径上的成员判断，哈希集合最多读一个 Bloom 字和一串探测槽
+static inline bool fw_ipset_test(const fw_ipset_t *set, const fw_addr_t *a)
+{
+    u32 h, i;
+
+    if (set->type == FW_IPSET_BITMAP)
+    {
+        u32 off = ntohl(a->ip6[3]) - set->base;
+
+        return fw_addr_is_v4(a) && off < set->size && test_bit(off, set->map);
+    }
+    if (fw_addr_is_v4(a))
+    {
+        if (!set->v4_count)
+            return false;
+        h = jhash_1word((__force u32)a->ip6[3], set->seed);
+        if (set->bloom && !fw_ipset_bloom_test(set, h))
+            return false;
+        for (i = h & set->v4_mask; set->v4[i]; i = (i + 1) & set->v4_mask)
+            if (set->v4[i] == a->ip6[3])
+                return true;
+        return false;
+    }
+    if (!set->v6_count)
+        return false;
+    h = jhash2((const u32 *)a->ip6, 4, set->seed);
+    if (set->bloom && !fw_ipset_bloom_test(set, h))
+        return false;
+    for (i = h & set->v6_mask; set->v6[i].w[0] | set->v6[i].w[1]; i = (i + 1) & set->v6_mask)
+        if (fw_addr_equal(&set->v6[i], a))
+            return true;
+    return false;
+}
+
+#endif // IPSET_H
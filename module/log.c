@@ -11,80 +11,571 @@
 #include <linux/errno.h>
 #include <linux/namei.h>
 #include <linux/dcache.h>
+#include <linux/mount.h>
+#include <linux/version.h>
 #include <linux/err.h>
+#include <linux/percpu.h>
+#include <linux/vmalloc.h>
+#include <linux/seq_file.h>
+#include <linux/cpumask.h>
+#include <linux/moduleparam.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <asm/local.h>
+#include "stateful_check.h" // for get_protocol_type
 
 char log_file_path[256] = "/home/moyi/ws/module/net_log.txt";
+module_param_string(log_file, log_file_path, sizeof(log_file_path), 0444);
+MODULE_PARM_DESC(log_file, "File the background writer appends the log to (empty = memory only)");
+static unsigned long log_file_max = 8 << 20;
+module_param(log_file_max, ulong, 0644);
+MODULE_PARM_DESC(log_file_max, "Rename log_file to <log_file>.1 and start a new one once it reaches this many bytes");
 
-// void log_message(uint8_t level, const char *fmt, ...) {
-//     struct file *log_file;
-//     char *buf;
-//     size_t buf_size = 512;
-//     loff_t pos = 0;
-//     int len;
-//     va_list args;
-//     char time_str[20];
-//     struct timespec64 ts;
-//     struct tm broken;
-//     const char *level_str;
-
-//     log_file = filp_open(log_file_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
-//     if (IS_ERR(log_file)) {
-//         printk(KERN_ERR "Failed to open log file: %ld\n", PTR_ERR(log_file));
-//         return;
-//     }
-
-//     buf = kmalloc(buf_size, GFP_KERNEL);
-//     if (!buf) {
-//         printk(KERN_ERR "Failed to allocate memory for log buffer\n");
-//         filp_close(log_file, NULL);
-//         return;
-//     }
-
-//     ktime_get_real_ts64(&ts);
-//     time64_to_tm(ts.tv_sec, 0, &broken);
-//     snprintf(time_str, sizeof(time_str), "%04ld-%02d-%02d %02d:%02d:%02d",
-//              broken.tm_year + 1900, broken.tm_mon + 1, broken.tm_mday,
-//              broken.tm_hour, broken.tm_min, broken.tm_sec);
-
-//     switch (level) {
-//         case LOG_DEBUG: level_str = "DEBUG"; break;
-//         case LOG_INFO:  level_str = "INFO"; break;
-//         case LOG_WARN:  level_str = "WARN"; break;
-//         case LOG_ERROR: level_str = "ERROR"; break;
-//         default: level_str = "UNKNOWN"; break;
-//     }
-
-//     len = snprintf(buf, buf_size, "[%s] [%s] ", time_str, level_str);
-
-//     va_start(args, fmt);
-//     len += vscnprintf(buf + len, buf_size - len, fmt, args);
-//     va_end(args);
-
-//     len += snprintf(buf + len, buf_size - len, "\n");
-
-//     kernel_write(log_file, buf, len, &pos);
-
-//     kfree(buf);
-//     filp_close(log_file, NULL);
-// }
+#define LOG_FLUSH_INTERVAL HZ       // 后台写盘周期
+#define LOG_WRITE_BATCH (64 << 10)  // 每次 kernel_write 的批量大小
 
+DEFINE_STATIC_KEY_FALSE(fw_log_debug_key);
+DEFINE_STATIC_KEY_TRUE(fw_log_info_key);
+
+// Module parameters that flip the static keys; the key is the single
+// source of truth so reading the parameter reports its current state.
+static int log_key_set(const char *val, const struct kernel_param *kp)
+{
+    bool enable;
+    int ret = kstrtobool(val, &enable);
+
+    if (ret)
+        return ret;
+    if (kp->arg == &fw_log_debug_key) {
+        if (enable)
+            static_branch_enable(&fw_log_debug_key);
+        else
+            static_branch_disable(&fw_log_debug_key);
+    } else {
+        if (enable)
+            static_branch_enable(&fw_log_info_key);
+        else
+            static_branch_disable(&fw_log_info_key);
+    }
+    return 0;
+}
+
+static int log_key_get(char *buffer, const struct kernel_param *kp)
+{
+    bool enabled = kp->arg == &fw_log_debug_key ? static_key_enabled(&fw_log_debug_key)
+                                                : static_key_enabled(&fw_log_info_key);
+    return sprintf(buffer, "%c\n", enabled ? 'Y' : 'N');
+}
+
+static const struct kernel_param_ops log_key_ops = {
+    .set = log_key_set,
+    .get = log_key_get,
+};
+
+module_param_cb(log_debug, &log_key_ops, &fw_log_debug_key, 0644);
+MODULE_PARM_DESC(log_debug, "Log rule parsing and other debug messages (default N)");
+module_param_cb(log_info, &log_key_ops, &fw_log_info_key, 0644);
+MODULE_PARM_DESC(log_info, "Log per-connection info messages on the packet path (default Y)");
+
+// Per-CPU log ring. Writers only touch the ring of the CPU they run on and
+// reserve slots with local_inc_return(), so softirq, irq and process context
+// writers on the same CPU never need a lock. Old records are overwritten.
+struct fw_log_ring {
+    local_t head;            // next slot to reserve (monotonic)
+    unsigned long disk_tail; // next slot the disk writer will read
+    fw_log_record_t rec[FW_LOG_RING_SIZE];
+};
+
+static DEFINE_PER_CPU(struct fw_log_ring *, log_rings);
+
+// Background disk writer state, only touched from log_wq and start/stop_log
+static struct workqueue_struct *log_wq;
+static struct delayed_work log_writer_work;
+static bool log_writer_running;
+static struct file *log_filp;
+static loff_t log_file_pos;
+static char *log_write_buf;
+static unsigned long *log_writer_cursor;
+static unsigned long *log_writer_head;
+static unsigned long log_records_written;
+static unsigned long log_records_lost; // overwritten before the writer got to them
+
+int log_init(void)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        struct fw_log_ring *ring = vzalloc_node(sizeof(*ring), cpu_to_node(cpu));
+        if (!ring) {
+            log_exit();
+            return -ENOMEM;
+        }
+        local_set(&ring->head, 0);
+        per_cpu(log_rings, cpu) = ring;
+    }
+    return 0;
+}
+
+void log_exit(void)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        vfree(per_cpu(log_rings, cpu));
+        per_cpu(log_rings, cpu) = NULL;
+    }
+}
+
+// Reserve the next slot on this CPU. Caller must have preemption disabled.
+static fw_log_record_t *log_reserve(struct fw_log_ring *ring, unsigned long *idx)
+{
+    fw_log_record_t *rec;
+
+    *idx = local_inc_return(&ring->head) - 1;
+    rec = &ring->rec[*idx & (FW_LOG_RING_SIZE - 1)];
+    WRITE_ONCE(rec->seq, 0);
+    smp_wmb();
+    rec->ts_ns = ktime_get_real_ns();
+    // Ring half full since the writer last ran: flush early rather than lose records
+    if (unlikely(*idx - READ_ONCE(ring->disk_tail) == FW_LOG_RING_SIZE / 2) && READ_ONCE(log_writer_running))
+        mod_delayed_work(log_wq, &log_writer_work, 0);
+    return rec;
+}
+
+static void log_commit(fw_log_record_t *rec, unsigned long idx)
+{
+    smp_wmb();
+    WRITE_ONCE(rec->seq, (u64)idx + 1);
+}
+
+void log_event_arg(uint8_t level, uint16_t event, uint32_t rule_id, uint32_t arg, const fw_log_tuple_t *tuple)
+{
+    struct fw_log_ring *ring;
+    fw_log_record_t *rec;
+    unsigned long idx;
+
+    preempt_disable();
+    ring = this_cpu_read(log_rings);
+    if (likely(ring)) {
+        rec = log_reserve(ring, &idx);
+        rec->level = level;
+        rec->event = event;
+        rec->rule_id = rule_id;
+        rec->src_ip = tuple->src_ip;
+        rec->dst_ip = tuple->dst_ip;
+        rec->src_port = tuple->src_port;
+        rec->dst_port = tuple->dst_port;
+        rec->proto = tuple->proto;
+        rec->arg = arg;
+        log_commit(rec, idx);
+    }
+    preempt_enable();
+}
+
+void log_message(uint8_t level, const char *fmt, ...)
+{
+    struct fw_log_ring *ring;
+    fw_log_record_t *rec;
+    unsigned long idx;
+    va_list args;
+
+    preempt_disable();
+    ring = this_cpu_read(log_rings);
+    if (likely(ring)) {
+        rec = log_reserve(ring, &idx);
+        rec->level = level;
+        rec->event = FW_EV_TEXT;
+        rec->rule_id = 0;
+        rec->src_port = 0;
+        rec->dst_port = 0;
+        rec->proto = 0;
+        rec->arg = 0;
+        va_start(args, fmt);
+        vscnprintf(rec->text, sizeof(rec->text), fmt, args);
+        va_end(args);
+        log_commit(rec, idx);
+    }
+    preempt_enable();
+}
+
+// Copy slot idx out of a ring. Returns -EAGAIN while it is still being
+// written and -ENOENT once a newer record has overwritten it.
+static int log_read_slot(struct fw_log_ring *ring, unsigned long idx, fw_log_record_t *out)
+{
+    const fw_log_record_t *rec = &ring->rec[idx & (FW_LOG_RING_SIZE - 1)];
+    u64 seq = READ_ONCE(rec->seq);
+
+    if (seq != (u64)idx + 1)
+        return seq > (u64)idx + 1 ? -ENOENT : -EAGAIN;
+    smp_rmb();
+    memcpy(out, rec, sizeof(*out));
+    smp_rmb();
+    return READ_ONCE(rec->seq) == seq ? 0 : -ENOENT;
+}
+
+// Pop the oldest record across all CPUs in [cursor, head). Overwritten slots
+// are skipped and counted in *lost; a CPU whose next slot is still being
+// written is held back so records never come out of order. Returns the CPU
+// the record came from, or -1 when every ring is drained.
+static int log_merge_next(unsigned long *cursor, unsigned long *head, fw_log_record_t *out, unsigned long *lost)
+{
+    fw_log_record_t rec;
+    int cpu, best = -1;
+
+    for_each_possible_cpu(cpu) {
+        struct fw_log_ring *ring = per_cpu(log_rings, cpu);
+        int ret = -ENOENT;
+
+        if (!ring)
+            continue;
+        while (cursor[cpu] < head[cpu]) {
+            ret = log_read_slot(ring, cursor[cpu], &rec);
+            if (ret != -ENOENT)
+                break;
+            cursor[cpu]++;
+            (*lost)++;
+        }
+        if (ret == -EAGAIN)
+            head[cpu] = cursor[cpu];
+        if (ret != 0 || cursor[cpu] >= head[cpu])
+            continue;
+        if (best < 0 || rec.ts_ns < out->ts_ns) {
+            best = cpu;
+            *out = rec;
+        }
+    }
+    if (best >= 0)
+        cursor[best]++;
+    return best;
+}
+
+static const char *log_level_str(uint8_t level)
+{
+    switch (level) {
+        case LOG_DEBUG: return "DEBUG";
+        case LOG_INFO:  return "INFO";
+        case LOG_WARN:  return "WARN";
+        case LOG_ERROR: return "ERROR";
+        default: return "UNKNOWN";
+    }
+}
+
+// "a.b.c.d:port", or "[v6]:port" so the port stays readable
+static void log_format_endpoint(char *buf, size_t size, const fw_addr_t *addr, uint16_t port)
+{
+    char a[FW_ADDR_STRLEN];
+
+    fw_addr_format(a, sizeof(a), addr);
+    scnprintf(buf, size, fw_addr_is_v4(addr) ? "%s:%u" : "[%s]:%u", a, port);
+}
+
+static int log_format_record(const fw_log_record_t *rec, char *buf, size_t size)
+{
+    char src[FW_ADDR_STRLEN + 8], dst[FW_ADDR_STRLEN + 8];
+    struct tm broken;
+    int len;
+
+    time64_to_tm(div_u64(rec->ts_ns, NSEC_PER_SEC), 0, &broken);
+    len = scnprintf(buf, size, "[%04ld-%02d-%02d %02d:%02d:%02d] [%s] ",
+                    broken.tm_year + 1900, broken.tm_mon + 1, broken.tm_mday,
+                    broken.tm_hour, broken.tm_min, broken.tm_sec,
+                    log_level_str(rec->level));
+
+    switch (rec->event) {
+        case FW_EV_TEXT:
+            len += scnprintf(buf + len, size - len, "%s\n", rec->text);
+            break;
+        case FW_EV_RULE_LOG:
+            log_format_endpoint(src, sizeof(src), &rec->src_ip, rec->src_port);
+            log_format_endpoint(dst, sizeof(dst), &rec->dst_ip, rec->dst_port);
+            len += scnprintf(buf + len, size - len, "Rule %u matched %s packet from %s to %s\n",
+                             rec->rule_id, get_protocol_type(rec->proto), src, dst);
+            break;
+        case FW_EV_RULE_DROP:
+            log_format_endpoint(src, sizeof(src), &rec->src_ip, rec->src_port);
+            log_format_endpoint(dst, sizeof(dst), &rec->dst_ip, rec->dst_port);
+            len += scnprintf(buf + len, size - len, "Rule %u dropped %s packet from %s to %s\n",
+                             rec->rule_id, get_protocol_type(rec->proto), src, dst);
+            break;
+        case FW_EV_CONN_NEW:
+            fw_addr_format(src, sizeof(src), &rec->src_ip);
+            fw_addr_format(dst, sizeof(dst), &rec->dst_ip);
+            len += scnprintf(buf + len, size - len, "New connection added: src_ip=%s, dst_ip=%s, src_port=%u, dst_port=%u, proto=%u\n",
+                             src, dst, rec->src_port, rec->dst_port, rec->proto);
+            break;
+        case FW_EV_RULE_SUPPRESSED:
+            len += scnprintf(buf + len, size - len, "Rule %u: %u log messages suppressed by rate limit\n",
+                             rec->rule_id, rec->arg);
+            break;
+        case FW_EV_RULE_SAMPLED:
+            len += scnprintf(buf + len, size - len, "Rule %u: %u matching packets not logged by sampling\n",
+                             rec->rule_id, rec->arg);
+            break;
+        default:
+            len += scnprintf(buf + len, size - len, "event %u\n", rec->event);
+            break;
+    }
+    return len;
+}
+
+// Merge every CPU's ring by timestamp and format the records as text.
+static int log_proc_show(struct seq_file *m, void *v)
+{
+    unsigned long *cursor, *head;
+    unsigned long lost = 0;
+    fw_log_record_t rec;
+    char line[256];
+    int cpu;
+
+    cursor = kcalloc(nr_cpu_ids, sizeof(*cursor), GFP_KERNEL);
+    head = kcalloc(nr_cpu_ids, sizeof(*head), GFP_KERNEL);
+    if (!cursor || !head) {
+        kfree(cursor);
+        kfree(head);
+        return -ENOMEM;
+    }
+
+    for_each_possible_cpu(cpu) {
+        struct fw_log_ring *ring = per_cpu(log_rings, cpu);
+        if (!ring)
+            continue;
+        head[cpu] = local_read(&ring->head);
+        cursor[cpu] = head[cpu] > FW_LOG_RING_SIZE ? head[cpu] - FW_LOG_RING_SIZE : 0;
+    }
+
+    while (log_merge_next(cursor, head, &rec, &lost) >= 0)
+        seq_write(m, line, log_format_record(&rec, line, sizeof(line)));
+
+    kfree(cursor);
+    kfree(head);
+    return 0;
+}
+
+int log_proc_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, log_proc_show, NULL);
+}
+
+
+// Open log_file, truncating it. Caller holds no locks.
+static int log_file_open(void)
+{
+    log_filp = filp_open(log_file_path, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0644);
+    if (IS_ERR(log_filp)) {
+        int err = PTR_ERR(log_filp);
+        log_filp = NULL;
+        return err;
+    }
+    log_file_pos = 0;
+    return 0;
+}
+
+// Rename the open log_file to <log_file>.1, replacing the previous one,
+// so readers following log_file by name always see the newest records.
+static int log_file_rename_old(void)
+{
+    struct dentry *old_dentry = log_filp->f_path.dentry;
+    struct vfsmount *mnt = log_filp->f_path.mnt;
+    char new_name[NAME_MAX + 1];
+    struct dentry *dir, *new_dentry;
+    int len, err;
+
+    len = snprintf(new_name, sizeof(new_name), "%s.1", kbasename(log_file_path));
+    if (len >= (int)sizeof(new_name))
+        return -ENAMETOOLONG;
+    err = mnt_want_write(mnt);
+    if (err)
+        return err;
+    dir = dget_parent(old_dentry);
+    inode_lock_nested(d_inode(dir), I_MUTEX_PARENT);
+    // The file may have been moved or unlinked behind our back
+    if (old_dentry->d_parent != dir || d_unhashed(old_dentry)) {
+        err = -ENOENT;
+        goto unlock;
+    }
+    new_dentry = lookup_one_len(new_name, dir, len);
+    if (IS_ERR(new_dentry)) {
+        err = PTR_ERR(new_dentry);
+        goto unlock;
+    }
+    {
+        struct renamedata rd = {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+            .old_mnt_idmap = mnt_idmap(mnt),
+            .new_mnt_idmap = mnt_idmap(mnt),
+#else
+            .old_mnt_userns = mnt_user_ns(mnt),
+            .new_mnt_userns = mnt_user_ns(mnt),
+#endif
+            .old_dir = d_inode(dir),
+            .old_dentry = old_dentry,
+            .new_dir = d_inode(dir),
+            .new_dentry = new_dentry,
+        };
+        err = vfs_rename(&rd);
+    }
+    dput(new_dentry);
+unlock:
+    inode_unlock(d_inode(dir));
+    dput(dir);
+    mnt_drop_write(mnt);
+    return err;
+}
+
+static void log_file_write(const char *buf, size_t len)
+{
+    ssize_t ret;
+
+    if (!log_filp || !len)
+        return;
+    // Size-based rotation: log_file -> log_file.1, then start log_file afresh.
+    // If the rename fails the old records are truncated rather than kept growing.
+    if (log_file_max && log_file_pos + len > log_file_max) {
+        int err = log_file_rename_old();
+        if (err)
+            printk(KERN_WARNING "Failed to rename log file to %s.1: %d\n", log_file_path, err);
+        filp_close(log_filp, NULL);
+        if (log_file_open() != 0) {
+            printk(KERN_ERR "Failed to rotate log file\n");
+            return;
+        }
+    }
+    ret = kernel_write(log_filp, buf, len, &log_file_pos);
+    if (ret < 0)
+        printk(KERN_ERR "Failed to write log file: %zd\n", ret);
+}
+
+// Drain every ring from the writer's cursors into the file in large writes.
+static void log_writer_flush(void)
+{
+    unsigned long lost = 0;
+    fw_log_record_t rec;
+    size_t len = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        struct fw_log_ring *ring = per_cpu(log_rings, cpu);
+        if (!ring)
+            continue;
+        log_writer_head[cpu] = local_read(&ring->head);
+        // Producers never wait for us; whatever they lapped is gone
+        if (log_writer_head[cpu] - log_writer_cursor[cpu] > FW_LOG_RING_SIZE) {
+            lost += log_writer_head[cpu] - FW_LOG_RING_SIZE - log_writer_cursor[cpu];
+            log_writer_cursor[cpu] = log_writer_head[cpu] - FW_LOG_RING_SIZE;
+        }
+    }
+
+    while ((cpu = log_merge_next(log_writer_cursor, log_writer_head, &rec, &lost)) >= 0) {
+        if (LOG_WRITE_BATCH - len < 256) {
+            log_file_write(log_write_buf, len);
+            len = 0;
+        }
+        len += log_format_record(&rec, log_write_buf + len, LOG_WRITE_BATCH - len);
+        log_records_written++;
+    }
+    if (lost) {
+        log_records_lost += lost;
+        len += scnprintf(log_write_buf + len, LOG_WRITE_BATCH - len,
+                         "[log writer] %lu records lost, %lu total\n", lost, log_records_lost);
+    }
+    log_file_write(log_write_buf, len);
+
+    for_each_possible_cpu(cpu) {
+        struct fw_log_ring *ring = per_cpu(log_rings, cpu);
+        if (ring)
+            WRITE_ONCE(ring->disk_tail, log_writer_cursor[cpu]);
+    }
+}
+
+static void log_writer_fn(struct work_struct *work)
+{
+    log_writer_flush();
+    if (READ_ONCE(log_writer_running))
+        queue_delayed_work(log_wq, &log_writer_work, LOG_FLUSH_INTERVAL);
+}
+
+unsigned long log_writer_written(void)
+{
+    return log_records_written;
+}
+
+unsigned long log_writer_lost(void)
+{
+    return log_records_lost;
+}
+
+// Start the background writer. Failure only disables the on-disk copy;
+// the in-memory rings and /proc/fw_log keep working.
 void start_log(void) {
-    struct file *log_file;
+    int cpu, ret;
 
-    // Open the log file in write mode to truncate it
-    log_file = filp_open(log_file_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (IS_ERR(log_file)) {
-        printk(KERN_ERR "Failed to open log file: %ld\n", PTR_ERR(log_file));
+    if (!log_file_path[0])
         return;
+
+    log_writer_cursor = kcalloc(nr_cpu_ids, sizeof(*log_writer_cursor), GFP_KERNEL);
+    log_writer_head = kcalloc(nr_cpu_ids, sizeof(*log_writer_head), GFP_KERNEL);
+    log_write_buf = kvmalloc(LOG_WRITE_BATCH, GFP_KERNEL);
+    log_wq = alloc_ordered_workqueue("fw_log_writer", 0);
+    if (!log_writer_cursor || !log_writer_head || !log_write_buf || !log_wq) {
+        printk(KERN_ERR "Failed to allocate log writer\n");
+        goto fail;
     }
-    filp_close(log_file, NULL);
 
+    // Open the log file in write mode to truncate it
+    ret = log_file_open();
+    if (ret) {
+        printk(KERN_ERR "Failed to open log file: %d\n", ret);
+        goto fail;
+    }
+
+    // Start from what is already in the rings
+    for_each_possible_cpu(cpu) {
+        struct fw_log_ring *ring = per_cpu(log_rings, cpu);
+        unsigned long head = ring ? local_read(&ring->head) : 0;
+        log_writer_cursor[cpu] = head > FW_LOG_RING_SIZE ? head - FW_LOG_RING_SIZE : 0;
+    }
+
+    INIT_DELAYED_WORK(&log_writer_work, log_writer_fn);
+    WRITE_ONCE(log_writer_running, true);
+    queue_delayed_work(log_wq, &log_writer_work, LOG_FLUSH_INTERVAL);
     log_message(LOG_INFO, "Log started");
+    return;
+
+fail:
+    if (log_wq)
+        destroy_workqueue(log_wq);
+    log_wq = NULL;
+    kvfree(log_write_buf);
+    log_write_buf = NULL;
+    kfree(log_writer_head);
+    log_writer_head = NULL;
+    kfree(log_writer_cursor);
+    log_writer_cursor = NULL;
 }
 
 
 void stop_log(void) {
-    struct timespec64 ts;
-    ktime_get_real_ts64(&ts);
+    if (!log_wq)
+        return;
     log_message(LOG_INFO, "Log stopped");
+
+    WRITE_ONCE(log_writer_running, false);
+    // Producers test log_writer_running with preemption disabled
+    synchronize_rcu();
+    cancel_delayed_work_sync(&log_writer_work);
+    destroy_workqueue(log_wq);
+    log_wq = NULL;
+
+    // Final synchronous drain
+    log_writer_flush();
+    if (log_filp)
+        filp_close(log_filp, NULL);
+    log_filp = NULL;
+
+    kvfree(log_write_buf);
+    log_write_buf = NULL;
+    kfree(log_writer_head);
+    log_writer_head = NULL;
+    kfree(log_writer_cursor);
+    log_writer_cursor = NULL;
 }
\ No newline at end of file
@@ -2,15 +2,83 @@
 #define LOG_H
 
 #include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/jump_label.h>
+#include "flow_key.h"
 
 #define LOG_DEBUG 0
 #define LOG_INFO  1
 #define LOG_WARN  2
 #define LOG_ERROR 3
 
+// 日志事件类型，热路径只记录二进制字段，读取 /proc/fw_log 时才格式化
+#define FW_EV_TEXT      0 // 控制路径的自由文本
+#define FW_EV_RULE_LOG  1 // 规则 log=1 命中
+#define FW_EV_RULE_DROP 2 // 规则丢弃
+#define FW_EV_CONN_NEW  3 // 新建连接
+#define FW_EV_RULE_SUPPRESSED 4 // 规则日志被限速丢弃的条数，arg 为计数
+#define FW_EV_RULE_SAMPLED 5    // 规则命中但因 1/N 采样没有记录的包数，arg 为计数
 
+#define FW_LOG_RING_SIZE 512 // 每个 CPU 的记录数，必须是 2 的幂
+#define FW_LOG_TEXT_LEN  96
+
+typedef struct fw_log_tuple {
+    fw_addr_t src_ip;
+    fw_addr_t dst_ip;
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t proto;
+} fw_log_tuple_t;
+
+// 定长二进制日志记录（128 字节）
+typedef struct fw_log_record {
+    u64 seq;       // 提交后为槽位序号 + 1，写入过程中为 0
+    u64 ts_ns;     // ktime_get_real_ns()
+    uint8_t level;
+    uint8_t proto;
+    uint16_t event;
+    uint32_t rule_id;
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint32_t arg;
+    // 文本记录没有地址，两者共用空间
+    union {
+        struct {
+            fw_addr_t src_ip;
+            fw_addr_t dst_ip;
+        };
+        char text[FW_LOG_TEXT_LEN]; // 仅 FW_EV_TEXT 使用
+    };
+} fw_log_record_t;
+
+int log_init(void);
+void log_exit(void);
 void log_message(uint8_t level, const char *fmt, ...);
+void log_event_arg(uint8_t level, uint16_t event, uint32_t rule_id, uint32_t arg, const fw_log_tuple_t *tuple);
+int log_proc_open(struct inode *inode, struct file *file);
 void start_log(void);
 void stop_log(void);
+unsigned long log_writer_written(void);
+unsigned long log_writer_lost(void);
+
+// 调试/信息级日志的开关，对应模块参数 log_debug / log_info。
+// 关闭时热路径上只剩一条被打补丁的 nop，不做任何格式化。
+DECLARE_STATIC_KEY_FALSE(fw_log_debug_key);
+DECLARE_STATIC_KEY_TRUE(fw_log_info_key);
+
+#define log_debug(fmt, ...)                                      \
+    do {                                                         \
+        if (static_branch_unlikely(&fw_log_debug_key)) {         \
+            log_message(LOG_DEBUG, fmt, ##__VA_ARGS__);          \
+            printk(KERN_DEBUG "firewall: " fmt "\n", ##__VA_ARGS__); \
+        }                                                        \
+    } while (0)
+
+#define log_info_enabled() static_branch_likely(&fw_log_info_key)
+
+static inline void log_event(uint8_t level, uint16_t event, uint32_t rule_id, const fw_log_tuple_t *tuple)
+{
+    log_event_arg(level, event, rule_id, 0, tuple);
+}
 
-#endif // LOG_H
\ No newline at end of file
+#endif // LOG_H
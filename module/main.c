@@ -2,6 +2,8 @@
 #include <linux/netfilter.h>
 #include <linux/netfilter_ipv4.h>
 #include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/seq_file_net.h>
 #include <linux/uaccess.h>
 #include <linux/slab.h>
 #include <linux/jhash.h>
@@ -10,38 +12,34 @@
 #include "stateful_check.h"
 #include "nat.h"
 #include "log.h"
+#include "event_ring.h"
+#include "stats.h"
+#include "fw_net.h"
+#include "top.h"
+#include "conn_sync.h"
+
+#define CREATE_TRACE_POINTS
+#include "fw_trace.h"
 #include <linux/timekeeping.h>
 #include <linux/inet.h>
 
 #define PROC_LOG_FILE_NAME "fw_log"
 #define PROC_CONN_FILE_NAME "connection_table"
-#define LOG_BUFFER_SIZE 4096
+#define PROC_STATS_FILE_NAME "fw_stats"
+#define PROC_TOP_FILE_NAME "fw_top"
+#define PROC_SYNC_FILE_NAME "fw_sync"
 
-static struct nf_hook_ops nat_hook = {
-    .hook = nat_apply,
-    .pf = PF_INET,
-    .hooknum = NF_INET_POST_ROUTING,
-    .priority = NF_IP_PRI_FIRST,
-};
-
-
-static char log_buffer[LOG_BUFFER_SIZE];
-static size_t log_buffer_pos = 0;
 static struct proc_dir_entry *proc_log_file;
-static struct proc_dir_entry *proc_conn_file;
-
-extern struct hlist_head connection_table[1 << 16]; // 从其他文件中导入连接表
-
-static ssize_t proc_log_read(struct file *file, char __user *buf, size_t count, loff_t *ppos) {
-    return simple_read_from_buffer(buf, count, ppos, log_buffer, log_buffer_pos);
-}
 
 static ssize_t proc_log_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos) {
     return -EINVAL; // 不允许写入
 }
 
 static const struct proc_ops proc_log_file_ops = {
-    .proc_read = proc_log_read,
+    .proc_open = log_proc_open,
+    .proc_read = seq_read,
+    .proc_lseek = seq_lseek,
+    .proc_release = single_release,
     .proc_write = proc_log_write,
 };
 
@@ -53,6 +51,8 @@ static const char* get_protocol_name(uint8_t proto) {
             return "UDP";
         case IPPROTO_ICMP:
             return "ICMP";
+        case IPPROTO_ICMPV6:
+            return "ICMPv6";
         case IPPROTO_IP:
             return "IP";
         default:
@@ -70,226 +70,193 @@ static void get_current_time_str(char *buffer, size_t buffer_size) {
 }
 
 
-static ssize_t proc_conn_read(struct file *file, char __user *buf, size_t count, loff_t *ppos) {
-    char *kbuf;
+// /proc/net/connection_table，只列出读者所在命名空间的连接
+static int proc_conn_show(struct seq_file *m, void *v) {
+    fw_conntrack_t *ct = &fw_net(seq_file_single_net(m))->conntrack;
     struct connection_t *conn;
     int bkt;
-    size_t offset = 0;
     char time_str[32];
-
-    // 计算缓冲区大小
-    size_t buffer_size = snprintf(NULL, 0, "src_ip,dst_ip,src_port,dst_port,proto,state,last_seen\n");
-    hash_for_each(connection_table, bkt, conn, list) {
-        buffer_size += snprintf(NULL, 0, "%pI4,%pI4,%u,%u,%s,%d,%s\n",
-                                &conn->src_ip, &conn->dst_ip, conn->src_port, conn->dst_port,
-                                get_protocol_name(conn->proto), conn->state, time_str);
+    char src[FW_ADDR_STRLEN], dst[FW_ADDR_STRLEN];
+
+    get_current_time_str(time_str, sizeof(time_str));
+
+    seq_puts(m, "src_ip,dst_ip,src_port,dst_port,proto,state,last_seen\n");
+    rcu_read_lock();
+    conn_for_each_rcu(ct, bkt, conn) {
+        fw_addr_format(src, sizeof(src), &conn->src_ip);
+        fw_addr_format(dst, sizeof(dst), &conn->dst_ip);
+        seq_printf(m, "%s,%s,%u,%u,%s,%d,%s\n",
+                   src, dst, conn->src_port, conn->dst_port,
+                   get_protocol_name(conn->proto), conn->state, time_str);
     }
+    rcu_read_unlock();
+    return 0;
+}
 
-    kbuf = kmalloc(buffer_size + 1, GFP_KERNEL);
-    if (!kbuf) {
+// 每个命名空间的 /proc/net/fw_stats、/proc/net/fw_top、/proc/net/fw_sync 和
+// /proc/net/connection_table
+static int __net_init fw_proc_net_init(struct net *net) {
+    // 写入任意内容清零
+    if (!proc_create_net_single_write(PROC_STATS_FILE_NAME, 0644, net->proc_net,
+                                      stats_proc_show, stats_proc_write, NULL))
         return -ENOMEM;
-    }
-
-    // 填充缓冲区
-    offset += snprintf(kbuf + offset, buffer_size - offset + 1, "src_ip,dst_ip,src_port,dst_port,proto,state,last_seen\n");
-    hash_for_each(connection_table, bkt, conn, list) {
-        get_current_time_str(time_str, sizeof(time_str));
-        offset += snprintf(kbuf + offset, buffer_size - offset + 1, "%pI4,%pI4,%u,%u,%s,%d,%s\n",
-                           &conn->src_ip, &conn->dst_ip, conn->src_port, conn->dst_port,
-                           get_protocol_name(conn->proto), conn->state, time_str);
-    }
-
-    if (*ppos >= offset) {
-        kfree(kbuf);
-        return 0;
-    }
-
-    if (count > offset - *ppos) {
-        count = offset - *ppos;
-    }
+    if (!proc_create_net_single_write(PROC_TOP_FILE_NAME, 0644, net->proc_net,
+                                      fw_top_proc_show, fw_top_proc_write, NULL))
+        goto err_stats;
+    // 写入主备同步的配置
+    if (!proc_create_net_single_write(PROC_SYNC_FILE_NAME, 0644, net->proc_net,
+                                      conn_sync_proc_show, conn_sync_proc_write, NULL))
+        goto err_top;
+    if (!proc_create_net_single(PROC_CONN_FILE_NAME, 0444, net->proc_net, proc_conn_show, NULL))
+        goto err_sync;
+    return 0;
 
-    if (copy_to_user(buf, kbuf + *ppos, count)) {
-        kfree(kbuf);
-        return -EFAULT;
-    }
+err_sync:
+    remove_proc_entry(PROC_SYNC_FILE_NAME, net->proc_net);
+err_top:
+    remove_proc_entry(PROC_TOP_FILE_NAME, net->proc_net);
+err_stats:
+    remove_proc_entry(PROC_STATS_FILE_NAME, net->proc_net);
+    return -ENOMEM;
+}
 
-    *ppos += count;
-    kfree(kbuf);
-    return count;
+static void __net_exit fw_proc_net_exit(struct net *net) {
+    remove_proc_entry(PROC_CONN_FILE_NAME, net->proc_net);
+    remove_proc_entry(PROC_SYNC_FILE_NAME, net->proc_net);
+    remove_proc_entry(PROC_TOP_FILE_NAME, net->proc_net);
+    remove_proc_entry(PROC_STATS_FILE_NAME, net->proc_net);
 }
 
-static const struct proc_ops proc_conn_file_ops = {
-    .proc_read = proc_conn_read,
+// 在 fw_net_ops 之后注册，命名空间销毁时先于实例退出
+static struct pernet_operations fw_proc_net_ops = {
+    .init = fw_proc_net_init,
+    .exit = fw_proc_net_exit,
 };
 
-void log_message(uint8_t level, const char *fmt, ...) {
-    char temp_buf[256];
-    va_list args;
-    int len;
-    char time_str[20];
-    struct timespec64 ts;
-    struct tm broken;
-    const char *level_str;
+static int __init firewall_init(void) {
+    int ret = -1;
 
-    ktime_get_real_ts64(&ts);
-    time64_to_tm(ts.tv_sec, 0, &broken);
-    snprintf(time_str, sizeof(time_str), "%04ld-%02d-%02d %02d:%02d:%02d",
-             broken.tm_year + 1900, broken.tm_mon + 1, broken.tm_mday,
-             broken.tm_hour, broken.tm_min, broken.tm_sec);
-
-    switch (level) {
-        case LOG_DEBUG: level_str = "DEBUG"; break;
-        case LOG_INFO:  level_str = "INFO"; break;
-        case LOG_WARN:  level_str = "WARN"; break;
-        case LOG_ERROR: level_str = "ERROR"; break;
-        default: level_str = "UNKNOWN"; break;
+    // 初始化每 CPU 日志环
+    if (log_init() != 0) {
+        printk(KERN_ERR "Failed to allocate log rings\n");
+        return -ENOMEM;
     }
-
-    va_start(args, fmt);
-    len = vsnprintf(temp_buf, sizeof(temp_buf), fmt, args);
-    va_end(args);
-
-    len = snprintf(log_buffer + log_buffer_pos, LOG_BUFFER_SIZE - log_buffer_pos, "[%s] [%s] %s\n", time_str, level_str, temp_buf);
-    log_buffer_pos += len;
-
-    if (log_buffer_pos >= LOG_BUFFER_SIZE) {
-        log_buffer_pos = 0; // 环形缓冲区
+    // 分配 mmap 事件环
+    if (event_ring_init() != 0) {
+        printk(KERN_ERR "Failed to allocate event ring\n");
+        log_exit();
+        return -ENOMEM;
     }
-}
-
-static int __init firewall_init(void) {
-    // start_log();
+    // 启动后台日志写盘线程，失败时只保留内存日志
+    start_log();
     log_message(LOG_INFO, "Loading firewall module");
 
     // 创建 /proc/fw_log 文件
     proc_log_file = proc_create(PROC_LOG_FILE_NAME, 0444, NULL, &proc_log_file_ops);
     if (!proc_log_file) {
         log_message(LOG_ERROR, "Failed to create /proc/%s", PROC_LOG_FILE_NAME);
-        return -ENOMEM;
-    }
-
-    // 创建 /proc/connection_table 文件
-    proc_conn_file = proc_create(PROC_CONN_FILE_NAME, 0444, NULL, &proc_conn_file_ops);
-    if (!proc_conn_file) {
-        log_message(LOG_ERROR, "Failed to create /proc/%s", PROC_CONN_FILE_NAME);
-        remove_proc_entry(PROC_LOG_FILE_NAME, NULL);
-        return -ENOMEM;
+        ret = -ENOMEM;
+        goto err_log;
     }
 
     // 注册字符设备
     if (register_firewall_device() < 0) {
         log_message(LOG_WARN, "Failed to register firewall device");
-        remove_proc_entry(PROC_LOG_FILE_NAME, NULL);
-        remove_proc_entry(PROC_CONN_FILE_NAME, NULL);
-        return -1;
+        goto err_proc_log;
     }
 
-    if (rule_filter_load_rules() != 0) {
-        log_message(LOG_WARN, "Failed to load rules");
-        unregister_firewall_device(); // 注销字符设备
-        remove_proc_entry(PROC_LOG_FILE_NAME, NULL);
-        remove_proc_entry(PROC_CONN_FILE_NAME, NULL);
-        return -1;
+    // 为每个网络命名空间（包括 init_net）创建实例并注册过滤和 NAT 钩子
+    ret = register_pernet_subsys(&fw_net_ops);
+    if (ret < 0) {
+        log_message(LOG_WARN, "Failed to register firewall pernet operations");
+        goto err_device;
     }
 
-    // 设置钩子函数
-    firewall_in_hook.hook = rule_filter_apply_inbound;
-    firewall_out_hook.hook = rule_filter_apply_outbound;
-
-    // 注册入站钩子
-    if (nf_register_net_hook(&init_net, &firewall_in_hook) < 0) {
-        log_message(LOG_WARN, "Failed to register inbound firewall hook");
-        unregister_firewall_device(); // 注销字符设备
-        remove_proc_entry(PROC_LOG_FILE_NAME, NULL);
-        remove_proc_entry(PROC_CONN_FILE_NAME, NULL);
-        return -1;
+    // 只有 init_net 在加载时读取规则文件，其他命名空间经控制设备加载
+    if (rule_filter_load_rules(fw_net(&init_net)) != 0) {
+        log_message(LOG_WARN, "Failed to load rules");
+        ret = -EINVAL;
+        goto err_pernet;
     }
 
-    // 注册出站钩子
-    if (nf_register_net_hook(&init_net, &firewall_out_hook) < 0) {
-        log_message(LOG_WARN, "Failed to register outbound firewall hook");
-        nf_unregister_net_hook(&init_net, &firewall_in_hook); // 注销已注册的入站钩子
-        unregister_firewall_device(); // 注销字符设备
-        remove_proc_entry(PROC_LOG_FILE_NAME, NULL);
-        remove_proc_entry(PROC_CONN_FILE_NAME, NULL);
-        return -1;
+    // 加载NAT规则
+    if (nat_load_rules(fw_net(&init_net), get_nat_rule_file_path()) != 0) {
+        log_message(LOG_WARN, "Failed to load NAT rules");
+        ret = -EINVAL;
+        goto err_pernet;
     }
 
-    // 初始化状态检测功能
-    if (stateful_firewall_init() != 0) {
-        log_message(LOG_WARN, "Failed to initialize stateful firewall");
-        nf_unregister_net_hook(&init_net, &firewall_in_hook); // 注销入站钩子
-        nf_unregister_net_hook(&init_net, &firewall_out_hook); // 注销出站钩子
-        unregister_firewall_device(); // 注销字符设备
-        remove_proc_entry(PROC_LOG_FILE_NAME, NULL);
-        remove_proc_entry(PROC_CONN_FILE_NAME, NULL);
-        return -1;
-    }
+    // 恢复上次卸载时保存的连接，失败时从空连接表开始
+    stateful_firewall_restore(fw_net(&init_net));
 
-    // 注册NAT钩子
-    if (nf_register_net_hook(&init_net, &nat_hook) < 0) {
-        log_message(LOG_WARN, "Failed to register NAT hook");
-        nf_unregister_net_hook(&init_net, &firewall_in_hook); // 注销入站钩子
-        nf_unregister_net_hook(&init_net, &firewall_out_hook); // 注销出站钩子
-        stateful_firewall_exit(); // 清理状态检测功能
-        unregister_firewall_device(); // 注销字符设备
-        remove_proc_entry(PROC_LOG_FILE_NAME, NULL);
-        remove_proc_entry(PROC_CONN_FILE_NAME, NULL);
-        return -1;
+    // 创建 /proc/net/fw_stats 和 /proc/net/connection_table
+    ret = register_pernet_subsys(&fw_proc_net_ops);
+    if (ret < 0) {
+        log_message(LOG_WARN, "Failed to create /proc/net entries");
+        goto err_pernet;
     }
 
-    // 加载NAT规则
-    if (nat_load_rules(get_nat_rule_file_path()) != 0) {
-        log_message(LOG_WARN, "Failed to load NAT rules");
-        nf_unregister_net_hook(&init_net, &firewall_in_hook); // 注销入站钩子
-        nf_unregister_net_hook(&init_net, &firewall_out_hook); // 注销出站钩子
-        nf_unregister_net_hook(&init_net, &nat_hook); // 注销NAT钩子
-        stateful_firewall_exit(); // 清理状态检测功能
-        unregister_firewall_device(); // 注销字符设备
-        remove_proc_entry(PROC_LOG_FILE_NAME, NULL);
-        remove_proc_entry(PROC_CONN_FILE_NAME, NULL);
-        return -1;
+    // 原来的 /proc/fw_stats 和 /proc/connection_table 改为指向读者所在命名空间的符号链接，/proc/fw_top 同样
+    if (!proc_symlink(PROC_STATS_FILE_NAME, NULL, "net/" PROC_STATS_FILE_NAME)) {
+        ret = -ENOMEM;
+        goto err_proc_net;
+    }
+    if (!proc_symlink(PROC_CONN_FILE_NAME, NULL, "net/" PROC_CONN_FILE_NAME)) {
+        ret = -ENOMEM;
+        goto err_stats_link;
+    }
+    if (!proc_symlink(PROC_TOP_FILE_NAME, NULL, "net/" PROC_TOP_FILE_NAME)) {
+        ret = -ENOMEM;
+        goto err_conn_link;
     }
 
-    filter_status = 1; // 开启过滤器
     log_message(LOG_INFO, "Module initialized");
     return 0;
+
+    // 按初始化的逆序清理
+err_conn_link:
+    remove_proc_entry(PROC_CONN_FILE_NAME, NULL);
+err_stats_link:
+    remove_proc_entry(PROC_STATS_FILE_NAME, NULL);
+err_proc_net:
+    unregister_pernet_subsys(&fw_proc_net_ops);
+err_pernet:
+    unregister_pernet_subsys(&fw_net_ops); // 注销所有命名空间的钩子并释放实例
+err_device:
+    unregister_firewall_device(); // 注销字符设备
+err_proc_log:
+    remove_proc_entry(PROC_LOG_FILE_NAME, NULL);
+err_log:
+    stop_log();
+    event_ring_exit();
+    log_exit();
+    return ret;
 }
 
 static void __exit firewall_exit(void) {
-    struct firewall_rule *rule, *tmp;
-    list_for_each_entry_safe(rule, tmp, &rule_list, list) {
-        list_del(&rule->list);
-        kfree(rule);
-    }
+    // 删除符号链接和各命名空间的 /proc/net 文件
+    remove_proc_entry(PROC_TOP_FILE_NAME, NULL);
+    remove_proc_entry(PROC_CONN_FILE_NAME, NULL);
+    remove_proc_entry(PROC_STATS_FILE_NAME, NULL);
+    unregister_pernet_subsys(&fw_proc_net_ops);
 
-    // 注销钩子
-    nf_unregister_net_hook(&init_net, &firewall_in_hook);
-    nf_unregister_net_hook(&init_net, &firewall_out_hook);
-    nf_unregister_net_hook(&init_net, &nat_hook);
-    filter_status = 0; // 关闭过滤器
+    // 保存 init_net 的连接表，下次加载时恢复
+    stateful_firewall_save(fw_net(&init_net));
 
-    // 清理状态检测功能
-    stateful_firewall_exit();
+    // 注销所有命名空间的钩子，释放规则集、连接表和NAT规则，
+    // 并等待旧代规则集回收完毕
+    unregister_pernet_subsys(&fw_net_ops);
 
     // 注销字符设备
     unregister_firewall_device();
 
-    // 清理NAT规则
-    while (!list_empty(&nat_rule_list)) {
-        nat_rule_t *rule = list_first_entry(&nat_rule_list, nat_rule_t, list);
-        list_del(&rule->list);
-        kfree(rule);
-    }
-
     // 删除 /proc/fw_log 文件
     remove_proc_entry(PROC_LOG_FILE_NAME, NULL);
 
-    // 删除 /proc/connection_table 文件
-    remove_proc_entry(PROC_CONN_FILE_NAME, NULL);
-
     log_message(LOG_INFO, "Module exiting");
-    // stop_log();
+    stop_log();
+    event_ring_exit();
+    log_exit();
 }
 
 module_init(firewall_init);
@@ -10,9 +10,13 @@
 #include <linux/uaccess.h>
 #include <linux/slab.h>
 #include <linux/inet.h>
+#include "flow_key.h"
+#include "fw_trace.h"
+#include "fw_net.h"
 
-LIST_HEAD(nat_rule_list); // Define the nat_rule_list
 char nat_rule_file_path[256]="/home/moyi/ws/module/nat_rule.csv";
+module_param_string(nat_rule_file, nat_rule_file_path, sizeof(nat_rule_file_path), 0444);
+MODULE_PARM_DESC(nat_rule_file, "Path of the NAT rule CSV loaded at init");
 static int parse_nat_rule(char *line, nat_rule_t *rule)
 {
     char *token;
@@ -56,7 +60,7 @@ static int parse_nat_rule(char *line, nat_rule_t *rule)
     return 0;
 }
 
-int nat_load_rules(const char *path)
+int nat_load_rules(struct fw_net *fn, const char *path)
 {
     struct file *file;
     char *buf;
@@ -98,7 +102,7 @@ int nat_load_rules(const char *path)
             }
 
             if (parse_nat_rule(line, rule) == 0) {
-                list_add_tail(&rule->list, &nat_rule_list);
+                list_add_tail(&rule->list, &fn->nat_rules);
             } else {
                 kfree(rule);
             }
@@ -113,50 +117,91 @@ int nat_load_rules(const char *path)
     return 0;
 }
 
+// Called after the namespace's NAT hook is unregistered
+void nat_net_exit(struct fw_net *fn)
+{
+    while (!list_empty(&fn->nat_rules)) {
+        nat_rule_t *rule = list_first_entry(&fn->nat_rules, nat_rule_t, list);
+        list_del(&rule->list);
+        kfree(rule);
+    }
+}
+
+// Rewrite the address, and the port for TCP/UDP, in place. The headers are
+// made writable first, which copies them out of shared or paged data if
+// needed; the key's offsets stay valid across that.
+static void nat_rewrite(struct sk_buff *skb, const fw_flow_key_t *key, bool dnat, uint32_t ip, uint16_t port)
+{
+    bool has_ports = key->fragment != FW_FRAG_LATER && (key->proto == IPPROTO_TCP || key->proto == IPPROTO_UDP);
+    struct iphdr *iph;
+    __be16 *ports;
+
+    if (skb_ensure_writable(skb, has_ports ? key->l4_offset + 2 * sizeof(__be16) : skb_network_offset(skb) + sizeof(*iph)))
+        return;
+    iph = ip_hdr(skb);
+    if (dnat)
+        iph->daddr = ip;
+    else
+        iph->saddr = ip;
+    if (!has_ports)
+        return;
+    // Source and destination port lead both the TCP and the UDP header
+    ports = (__be16 *)(skb->data + key->l4_offset);
+    ports[dnat] = htons(port);
+}
+
 unsigned int nat_apply(void *priv, struct sk_buff *skb, const struct nf_hook_state *state)
 {
-    struct iphdr *iph = ip_hdr(skb);
-    struct tcphdr *tcph;
-    struct udphdr *udph;
+    struct fw_net *fn = fw_net(state->net);
+    fw_flow_key_t key;
     nat_rule_t *rule;
-    uint16_t port = 0;
-
-    if (iph->protocol == IPPROTO_TCP) {
-        tcph = tcp_hdr(skb);
-        port = ntohs(tcph->source);
-    } else if (iph->protocol == IPPROTO_UDP) {
-        udph = udp_hdr(skb);
-        port = ntohs(udph->source);
+    u64 start = fw_stat_hook_start();
+
+    // NAT rules hold IPv4 addresses and the hook is registered for IPv4 only
+    if (fw_flow_key_parse(skb, NFPROTO_IPV4, &key)) {
+        fw_stat_hook_end(fn->stats, FW_HOOK_NAT, start, NF_ACCEPT);
+        return NF_ACCEPT;
     }
 
-    list_for_each_entry(rule, &nat_rule_list, list) {
-        if (rule->proto == iph->protocol) {
+    list_for_each_entry(rule, &fn->nat_rules, list) {
+        if (rule->proto == key.proto) {
             if (rule->direction == 0) { // Source NAT
-                if (rule->orig_ip == iph->saddr && rule->orig_port == port) {
-                    iph->saddr = rule->new_ip;
-                    if (iph->protocol == IPPROTO_TCP) {
-                        tcph->source = htons(rule->new_port);
-                    } else if (iph->protocol == IPPROTO_UDP) {
-                        udph->source = htons(rule->new_port);
-                    }
+                if (rule->orig_ip == key.src_ip.ip6[3] && rule->orig_port == key.src_port) {
+                    trace_fw_nat_rewrite(0, key.proto, key.src_ip.ip6[3], key.src_port, rule->new_ip, rule->new_port);
+                    nat_rewrite(skb, &key, false, rule->new_ip, rule->new_port);
                     break;
                 }
             } else if (rule->direction == 1) { // Destination NAT
-                if (rule->orig_ip == iph->daddr && rule->orig_port == port) {
-                    iph->daddr = rule->new_ip;
-                    if (iph->protocol == IPPROTO_TCP) {
-                        tcph->dest = htons(rule->new_port);
-                    } else if (iph->protocol == IPPROTO_UDP) {
-                        udph->dest = htons(rule->new_port);
-                    }
+                if (rule->orig_ip == key.dst_ip.ip6[3] && rule->orig_port == key.src_port) {
+                    trace_fw_nat_rewrite(1, key.proto, key.dst_ip.ip6[3], key.src_port, rule->new_ip, rule->new_port);
+                    nat_rewrite(skb, &key, true, rule->new_ip, rule->new_port);
                     break;
                 }
             }
         }
     }
 
+    fw_stat_hook_end(fn->stats, FW_HOOK_NAT, start, NF_ACCEPT);
     return NF_ACCEPT;
 }
+EXPORT_SYMBOL_GPL(nat_apply);
+
+static struct nf_hook_ops nat_hook = {
+    .hook = nat_apply,
+    .pf = PF_INET,
+    .hooknum = NF_INET_POST_ROUTING,
+    .priority = NF_IP_PRI_FIRST,
+};
+
+int nat_register_hooks(struct net *net)
+{
+    return nf_register_net_hook(net, &nat_hook);
+}
+
+void nat_unregister_hooks(struct net *net)
+{
+    nf_unregister_net_hook(net, &nat_hook);
+}
 
 char *get_nat_rule_file_path(void)
 {
@@ -16,12 +16,17 @@ typedef struct nat_rule {
     struct list_head list;
 } nat_rule_t;
 
-extern struct list_head nat_rule_list; // Declare as extern
-char* get_nat_rule_file_path(void);
+struct net;
+struct fw_net;
 
+char* get_nat_rule_file_path(void);
 
 
-int nat_load_rules(const char *path);
+// 规则挂在 fn->nat_rules 上，只有 init_net 在模块加载时读取 nat_rule_file
+int nat_load_rules(struct fw_net *fn, const char *path);
+void nat_net_exit(struct fw_net *fn);
+int nat_register_hooks(struct net *net);
+void nat_unregister_hooks(struct net *net);
 unsigned int nat_apply(void *priv, struct sk_buff *skb, const struct nf_hook_state *state);
 
 #endif /* NAT_H */
\ No newline at end of file
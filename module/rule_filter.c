@@ -8,10 +8,26 @@
 #include <linux/slab.h>
 #include <linux/ctype.h>
 #include <linux/icmp.h> // Include for ICMP handling
-#include <linux/inet.h> // Include for in_aton
+#include <linux/netfilter_ipv6.h>
+#include <linux/ipv6.h>
+#include <linux/random.h>
+#include <linux/rcupdate.h>
+#include <linux/mutex.h>
+#include <linux/timekeeping.h>
+#include <linux/math64.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/workqueue.h>
 #include "rule_filter.h"
-#include "stateful_check.h"
+#include "fw_net.h"
+#include "flow_key.h"
+#include "frag_cache.h"
+#include "ipset.h"
 #include "log.h" // Include for logging
+#include "event_ring.h"
+#include "fw_trace.h"
+#include "stats.h"
+#include "fw_uapi.h"
 
 #define NIPQUAD(addr)                \
     ((unsigned char *)&addr)[3],     \
@@ -19,12 +35,60 @@
         ((unsigned char *)&addr)[1], \
         ((unsigned char *)&addr)[0]
 
-LIST_HEAD(rule_list);
-int default_action = ACTION_ACCEPT;
+// One generation of the rule set. A reload parses the file into a new
+// generation off to the side and publishes it with a single pointer store;
+// packets already walking the old generation finish on it, and it is freed
+// once a grace period has passed. Rules are kept in one list per
+// flow_direction so each hook only walks the rules that can match there.
+typedef struct firewall_ruleset {
+    struct list_head rules[FLOW_MAX];
+    struct list_head sets; // fw_ipset_t the rules reference, loaded with them
+    uint32_t count;
+    uint32_t set_count;
+    uint64_t set_entries;
+    uint64_t generation;
+    size_t bytes;
+    fw_rules_t *owner; // namespace whose retired counters this generation is charged to
+    struct rcu_head rcu;
+} firewall_ruleset_t;
+
+// Generation numbers are drawn from one module-wide sequence, so a
+// fragment cache entry taken in one namespace never matches in another
+static atomic64_t ruleset_generation;
 
 char rule_file_path[256] = "/home/moyi/ws/module/net_rule.csv";
-
-static int read_line(char *buf, loff_t *offset, struct file *file)
+module_param_string(rule_file, rule_file_path, sizeof(rule_file_path), 0444);
+MODULE_PARM_DESC(rule_file, "Path of the filter rule CSV of the initial namespace, loaded at init and on reload");
+
+// Log limits for rules whose log_rate/log_burst columns are left empty
+static unsigned int log_rate_default = 100;
+module_param(log_rate_default, uint, 0644);
+MODULE_PARM_DESC(log_rate_default, "Per-rule log messages per second when the rule does not set log_rate (0 = unlimited)");
+static unsigned int log_burst_default = 100;
+module_param(log_burst_default, uint, 0644);
+MODULE_PARM_DESC(log_burst_default, "Per-rule log burst when the rule does not set log_burst");
+
+// Buckets of a LIMIT rule keyed per source, rounded up to a power of two.
+// Sources that hash to the same bucket share its rate.
+static unsigned int limit_src_buckets = 1024;
+module_param(limit_src_buckets, uint, 0644);
+MODULE_PARM_DESC(limit_src_buckets, "Token buckets of each per-source LIMIT rule, taken at rule load");
+
+// Rule files are usually written with IPv4 in mind but also apply to IPv6;
+// a DROP default or a wildcard DROP rule would then cut the host off from
+// its IPv6 neighbours. Neighbor discovery is accepted before the rules unless
+// this is cleared.
+static bool ipv6_nd_accept = true;
+module_param(ipv6_nd_accept, bool, 0644);
+MODULE_PARM_DESC(ipv6_nd_accept, "Accept ICMPv6 neighbor discovery (types 133-137, hop limit 255) before the rules");
+
+#define ICMPV6_ND_FIRST 133 // router solicitation
+#define ICMPV6_ND_LAST 137  // redirect
+
+// Read the next non-empty line. *lines counts the newlines consumed so far,
+// blank lines included; *line_no is set to the 1-based physical line number
+// of the line returned.
+static int read_line(char *buf, loff_t *offset, struct file *file, uint32_t *lines, uint32_t *line_no)
 {
     char ch;
     int i = 0;
@@ -35,35 +99,61 @@ static int read_line(char *buf, loff_t *offset, struct file *file)
         ret = kernel_read(file, &ch, 1, offset);
         if (ret != 1)
             return -1;
+        if (ch == '\n')
+            (*lines)++;
         if (ch == '\n' || ch == '\r')
         {
             if (i == 0) // Skip empty lines
                 continue;
             break;
         }
+        if (i == 0)
+            *line_no = *lines + 1;
         buf[i++] = ch;
     }
     buf[i] = '\0';
 
-    log_message(LOG_INFO, "Read line: %s", buf); // Debug print
+    log_debug("Read line: %s", buf);
+    return 0;
+}
+
+// "@name" references a set of this generation; the address itself stays
+// a wildcard so fw_addr_match() passes and the set decides
+static int parse_rule_addr(const char *s, fw_addr_t *addr, fw_addr_t *mask, struct fw_ipset **set,
+                           struct list_head *sets)
+{
+    *set = NULL;
+    if (s[0] != '@')
+        return fw_addr_parse(s, addr, mask);
+    memset(addr, 0, sizeof(*addr));
+    memset(mask, 0, sizeof(*mask));
+    *set = fw_ipset_find(sets, s + 1);
+    if (!*set)
+    {
+        log_message(LOG_WARN, "Rule references unknown set %s", s + 1);
+        return -ENOENT;
+    }
     return 0;
 }
 
-static int parse_rule(char *line, firewall_rule_t *rule)
+static int parse_rule(char *line, firewall_rule_t *rule, struct list_head *sets)
 {
     char *token;
     unsigned int temp;
+    char src[FW_ADDR_STRLEN], dst[FW_ADDR_STRLEN];
 
-    log_message(LOG_INFO, "Parsing line: %s", line); // Debug print
-    printk(KERN_INFO "Parsing line: %s\n", line);    // Debug print
+    log_debug("Parsing line: %s", line);
+    rule->limit_src_tat = NULL;
 
-    // Parse source IP address
+    // Parse source address: IPv4 or IPv6, optionally with a /prefix, or @set
     token = strsep(&line, ",");
-    rule->src_ip = token && *token ? in_aton(token) : 0;
+    if (parse_rule_addr(token ? token : "", &rule->src_ip, &rule->src_mask, &rule->src_set, sets))
+        return -1;
 
-    // Parse destination IP address
+    // Parse destination address
     token = strsep(&line, ",");
-    rule->dst_ip = token && *token ? in_aton(token) : 0;
+    if (parse_rule_addr(token ? token : "", &rule->dst_ip, &rule->dst_mask, &rule->dst_set, sets))
+        return -1;
 
     // Parse source port
     token = strsep(&line, ",");
@@ -99,15 +189,67 @@ static int parse_rule(char *line, firewall_rule_t *rule)
     token = strsep(&line, ",");
     rule->log = token && *token ? kstrtoint(token, 0, &rule->log) ? 0 : rule->log : 0;
 
-    log_message(LOG_INFO, "Parsed rule: src_ip=%pI4, dst_ip=%pI4, src_port=%u, dst_port=%u, proto=%u, direction=%d, action=%d, log=%d",
-                &rule->src_ip, &rule->dst_ip, rule->src_port, rule->dst_port, rule->proto, rule->flow_direction, rule->action, rule->log); // Debug print
-    printk(KERN_INFO "Parsed rule: src_ip=%pI4, dst_ip=%pI4, src_port=%u, dst_port=%u, proto=%u, direction=%d, action=%d, log=%d\n",
-           &rule->src_ip, &rule->dst_ip, rule->src_port, rule->dst_port, rule->proto, rule->flow_direction, rule->action, rule->log); // Debug print
+    // Parse log rate limit (optional, empty = module default, 0 = unlimited)
+    token = strsep(&line, ",");
+    rule->log_rate = token && *token ? kstrtouint(token, 0, &temp) ? log_rate_default : temp : log_rate_default;
+
+    // Parse log burst (optional)
+    token = strsep(&line, ",");
+    rule->log_burst = token && *token ? kstrtouint(token, 0, &temp) ? log_burst_default : temp : log_burst_default;
+
+    // Parse log sampling, 1 in N (optional)
+    token = strsep(&line, ",");
+    rule->log_sample = token && *token ? kstrtouint(token, 0, &temp) ? 0 : temp : 0;
+
+    token_bucket_init(&rule->log_tb, rule->log_rate, rule->log_burst);
+    atomic_long_set(&rule->log_suppressed, 0);
+    atomic_long_set(&rule->log_sampled, 0);
+
+    // Parse the LIMIT columns: packets per second (0 = unlimited), burst,
+    // and whether each source gets its own bucket (optional)
+    token = strsep(&line, ",");
+    rule->limit_rate = token && *token ? kstrtouint(token, 0, &temp) ? 0 : temp : 0;
+    token = strsep(&line, ",");
+    rule->limit_burst = token && *token ? kstrtouint(token, 0, &temp) ? 0 : temp : 0;
+    token = strsep(&line, ",");
+    temp = token && *token ? kstrtouint(token, 0, &temp) ? 0 : temp : 0;
+    token_bucket_init(&rule->limit_tb, rule->limit_rate, rule->limit_burst);
+    if (rule->action == ACTION_LIMIT && temp && rule->limit_rate)
+    {
+        unsigned int n = roundup_pow_of_two(clamp_t(unsigned int, READ_ONCE(limit_src_buckets), 1, 1U << 20));
+
+        rule->limit_src_tat = kvcalloc(n, sizeof(*rule->limit_src_tat), GFP_KERNEL);
+        if (!rule->limit_src_tat)
+            return -ENOMEM;
+        rule->limit_src_mask = n - 1;
+        rule->limit_seed = get_random_u32();
+    }
+
+    // Parse connlimit: match only new connections from sources that
+    // already have this many (optional, 0 = off)
+    token = strsep(&line, ",");
+    rule->connlimit = token && *token ? kstrtouint(token, 0, &temp) ? 0 : temp : 0;
+
+    fw_addr_format(src, sizeof(src), &rule->src_ip);
+    fw_addr_format(dst, sizeof(dst), &rule->dst_ip);
+    log_debug("Parsed rule: src_ip=%s, dst_ip=%s, src_port=%u, dst_port=%u, proto=%u, direction=%d, action=%d, log=%d",
+              src, dst, rule->src_port, rule->dst_port, rule->proto, rule->flow_direction, rule->action, rule->log);
 
     return 0;
 }
 
-static int load_rules(void)
+static size_t rule_bytes(const firewall_rule_t *rule)
+{
+    return sizeof(*rule) + (rule->limit_src_tat ? (rule->limit_src_mask + 1) * sizeof(*rule->limit_src_tat) : 0);
+}
+
+static void rule_free(firewall_rule_t *rule)
+{
+    kvfree(rule->limit_src_tat);
+    kfree(rule);
+}
+
+static int load_rules(firewall_ruleset_t *rs, const char *rule_file, const char *set_file)
 {
     struct file *file;
     loff_t pos = 0;
@@ -115,8 +257,21 @@ static int load_rules(void)
     int ret;
     firewall_rule_t *rule;
     int i = 0;
+    uint32_t lines = 0, line_no = 0;
+    fw_ipset_t *set;
+
+    // Sets first, so the rules can resolve their names
+    ret = fw_ipset_load(&rs->sets, set_file);
+    if (ret)
+        return ret;
+    list_for_each_entry(set, &rs->sets, list)
+    {
+        rs->bytes += set->bytes;
+        rs->set_count++;
+        rs->set_entries += set->count;
+    }
 
-    file = filp_open(rule_file_path, O_RDONLY, 0);
+    file = filp_open(rule_file, O_RDONLY, 0);
     if (IS_ERR(file))
     {
         log_message(LOG_WARN, "Failed to open rule file");
@@ -131,7 +286,7 @@ static int load_rules(void)
     }
 
     // Skip the header line
-    if (read_line(buf, &pos, file) != 0)
+    if (read_line(buf, &pos, file, &lines, &line_no) != 0)
     {
         log_message(LOG_WARN, "Failed to read header line");
         kfree(buf);
@@ -139,10 +294,9 @@ static int load_rules(void)
         return -EIO;
     }
 
-    while (read_line(buf, &pos, file) == 0)
+    while (read_line(buf, &pos, file, &lines, &line_no) == 0)
     {
-        log_message(LOG_INFO, "Processing line: %s", buf); // Debug print
-        printk(KERN_INFO "Processing line: %s\n", buf);    // Debug print
+        log_debug("Processing line: %s", buf);
         rule = kmalloc(sizeof(firewall_rule_t), GFP_KERNEL);
         if (!rule)
         {
@@ -151,16 +305,27 @@ static int load_rules(void)
             return -ENOMEM;
         }
 
-        ret = parse_rule(buf, rule);
-        if (ret)
+        ret = parse_rule(buf, rule, &rs->sets);
+        if (ret == -ENOMEM)
+        {
+            rule_free(rule);
+            kfree(buf);
+            filp_close(file, NULL);
+            return ret;
+        }
+        if (ret || rule->flow_direction < 0 || rule->flow_direction >= FLOW_MAX)
         {
-            kfree(rule);
+            // A rule with an unknown direction could never match
+            rule_free(rule);
             continue;
         }
+        rule->id = line_no;
 
-        list_add(&rule->list, &rule_list);
+        list_add(&rule->list, &rs->rules[rule->flow_direction]);
+        rs->bytes += rule_bytes(rule);
         i++;
     }
+    rs->count = i;
     log_message(LOG_INFO, "Loaded %d rules", i);
     printk(KERN_INFO "Loaded %d rules\n", i);
     kfree(buf);
@@ -168,90 +333,542 @@ static int load_rules(void)
     return 0;
 }
 
-static int apply_rule(struct sk_buff *skb, int direction)
+#define RULE_LOG_SUMMARY_INTERVAL HZ
+
+static const fw_log_tuple_t rule_log_no_tuple;
+
+// Log how many messages the rule's rate limit and sampling skipped since
+// the last summary
+static void rule_log_summary(firewall_rule_t *rule, const fw_log_tuple_t *tuple, bool sampled)
 {
-    struct iphdr *iph = ip_hdr(skb);
-    struct firewall_rule *rule;
-    uint32_t src_ip = iph->saddr;
-    uint32_t dst_ip = iph->daddr;
-    uint16_t src_port = 0, dst_port = 0;
-    uint8_t proto = iph->protocol;
-    char src_ip_str[16], dst_ip_str[16];
-
-    snprintf(src_ip_str, 16, "%pI4", &src_ip);
-    snprintf(dst_ip_str, 16, "%pI4", &dst_ip);
-    if (proto == IPPROTO_TCP || proto == IPPROTO_UDP)
+    long n;
+
+    if (atomic_long_read(&rule->log_suppressed) && (n = atomic_long_xchg(&rule->log_suppressed, 0)))
+        log_event_arg(LOG_WARN, FW_EV_RULE_SUPPRESSED, rule->id, min_t(unsigned long, n, U32_MAX), tuple);
+    if (sampled && atomic_long_read(&rule->log_sampled) && (n = atomic_long_xchg(&rule->log_sampled, 0)))
+        log_event_arg(LOG_INFO, FW_EV_RULE_SAMPLED, rule->id, min_t(unsigned long, n, U32_MAX), tuple);
+}
+
+// The first skip since a summary arms the namespace's summary work, so a
+// burst followed by silence is still reported
+static inline void rule_log_skipped(struct fw_net *fn, atomic_long_t *count)
+{
+    if (atomic_long_inc_return(count) == 1)
+        schedule_delayed_work(&fn->rules.log_work, RULE_LOG_SUMMARY_INTERVAL);
+}
+
+static void rule_log_work(struct work_struct *work)
+{
+    fw_rules_t *r = container_of(to_delayed_work(work), fw_rules_t, log_work);
+    firewall_ruleset_t *rs;
+    firewall_rule_t *rule;
+    int dir;
+
+    rcu_read_lock();
+    rs = rcu_dereference(r->active);
+    for (dir = 0; rs && dir < FLOW_MAX; dir++)
     {
-        struct tcphdr *tcph = tcp_hdr(skb);
-        src_port = ntohs(tcph->source);
-        dst_port = ntohs(tcph->dest);
+        list_for_each_entry_rcu(rule, &rs->rules[dir], list)
+            rule_log_summary(rule, &rule_log_no_tuple, true);
     }
+    rcu_read_unlock();
+}
 
-    list_for_each_entry(rule, &rule_list, list)
+// Decide whether a matching packet is logged, applying 1-in-N sampling and
+// the rule's token bucket. Both skips are counted; the rate-limited count
+// is logged with the next message that gets through, and the summary work
+// reports what is left a second after the first skip.
+static bool rule_log_allowed(struct fw_net *fn, firewall_rule_t *rule, const fw_log_tuple_t *tuple)
+{
+    if (rule->log_sample > 1 && reciprocal_scale(get_random_u32(), rule->log_sample) != 0)
     {
-        if ((rule->src_ip == 0 || rule->src_ip == src_ip) &&
-            (rule->dst_ip == 0 || rule->dst_ip == dst_ip) &&
+        rule_log_skipped(fn, &rule->log_sampled);
+        return false;
+    }
+    if (!token_bucket_consume(&rule->log_tb, ktime_get_mono_fast_ns()))
+    {
+        rule_log_skipped(fn, &rule->log_suppressed);
+        return false;
+    }
+    rule_log_summary(rule, tuple, false);
+    return true;
+}
+
+// A LIMIT rule passes the packets within its rate. The GCRA update is one
+// cmpxchg on the rule's bucket or on the source's bucket.
+static inline bool rule_limit_allowed(firewall_rule_t *rule, const fw_flow_key_t *key)
+{
+    atomic64_t *tat = &rule->limit_tb.tat;
+
+    if (rule->limit_src_tat)
+        tat = &rule->limit_src_tat[jhash2((const u32 *)key->src_ip.ip6, 4, rule->limit_seed) & rule->limit_src_mask];
+    return token_bucket_consume_tat(&rule->limit_tb, tat, ktime_get_mono_fast_ns());
+}
+
+static inline bool rule_connlimit_match(struct fw_net *fn, firewall_rule_t *rule, const fw_flow_key_t *key)
+{
+    if (!stateful_firewall_over_limit(fn, key, rule->connlimit))
+        return false;
+    fw_stat_inc(fn->stats, FW_STAT_CONNLIMIT);
+    return true;
+}
+
+static unsigned int match_rules(struct fw_net *fn, firewall_ruleset_t *rs, const fw_flow_key_t *key, int direction,
+                                unsigned int len)
+{
+    struct firewall_rule *rule;
+    uint16_t src_port = key->src_port, dst_port = key->dst_port;
+    uint8_t proto = key->proto;
+    fw_log_tuple_t tuple;
+    bool log_it;
+    int action;
+
+    tuple.src_ip = key->src_ip;
+    tuple.dst_ip = key->dst_ip;
+    tuple.src_port = src_port;
+    tuple.dst_port = dst_port;
+    tuple.proto = proto;
+
+    list_for_each_entry_rcu(rule, &rs->rules[direction], list)
+    {
+        if (fw_addr_match(&key->src_ip, &rule->src_ip, &rule->src_mask) &&
+            fw_addr_match(&key->dst_ip, &rule->dst_ip, &rule->dst_mask) &&
             (rule->src_port == 0 || rule->src_port == src_port) &&
             (rule->dst_port == 0 || rule->dst_port == dst_port) &&
-            (rule->proto == proto||rule->proto==0) && rule->flow_direction == direction)
+            (rule->proto == proto||rule->proto==0) &&
+            // Set lookups cost more than the compares, so they come last
+            (!rule->src_set || fw_ipset_test(rule->src_set, &key->src_ip)) &&
+            (!rule->dst_set || fw_ipset_test(rule->dst_set, &key->dst_ip)) &&
+            // The sketch is read first; the conntrack lookup only runs for
+            // sources at or over the limit
+            (!rule->connlimit || rule_connlimit_match(fn, rule, key)))
         {
-            if (rule->log)
+            trace_fw_rule_match(rule->id, direction, rule->action, &key->src_ip, &key->dst_ip, src_port, dst_port, proto);
+            fw_top_rule(fn->top, rule->id, len);
+            // Within its rate a LIMIT rule accepts, beyond it it drops
+            action = rule->action;
+            if (action == ACTION_LIMIT)
             {
-                log_message(LOG_INFO, "Logging packet from %s to %s", src_ip_str, dst_ip_str);
+                action = rule_limit_allowed(rule, key) ? ACTION_ACCEPT : ACTION_DROP;
+                if (action == ACTION_DROP)
+                    fw_stat_inc(fn->stats, FW_STAT_LIMIT_DROP);
+            }
+            // Drops are always logged, other matches only with log=1;
+            // both go through the rule's sampling and rate limit. A logged
+            // drop writes only its drop record below.
+            log_it = (rule->log || action == ACTION_DROP) && rule_log_allowed(fn, rule, &tuple);
+            if (rule->log && action != ACTION_DROP)
+            {
+                if (log_it)
+                    log_event(LOG_INFO, FW_EV_RULE_LOG, rule->id, &tuple);
+                event_ring_emit(FW_EVENT_ACCEPT, direction, rule->id, 0, &tuple);
                 // printk(KERN_INFO "Logging packet from %s to %s\n", src_ip_str, dst_ip_str);
             }
-            switch (rule->action)
+            switch (action)
             {
             case ACTION_ACCEPT:
                 // log_message(LOG_INFO, "Accepting packet from %s to %s", src_ip_str, dst_ip_str);
                 // printk(KERN_INFO "Accepting packet from %s to %s\n", src_ip_str, dst_ip_str);
-                return stateful_firewall_check(skb, direction);
+                // PRE_ROUTING only filters early; LOCAL_IN or FORWARD still decides
+                if (direction == FLOW_PREROUTING)
+                    return NF_ACCEPT;
+                return stateful_firewall_check(fn, key, direction);
+            case ACTION_NOTRACK:
+                // Final without a conntrack lookup; at PRE_ROUTING it only
+                // skips the remaining pre-routing rules, like ACCEPT
+                if (direction != FLOW_PREROUTING)
+                    fw_stat_inc(fn->stats, FW_STAT_NOTRACK);
+                return NF_ACCEPT;
             case ACTION_DROP:
-                log_message(LOG_WARN, "Dropping packet from %s to %s", src_ip_str, dst_ip_str);
+                if (log_it)
+                    log_event(LOG_WARN, FW_EV_RULE_DROP, rule->id, &tuple);
+                event_ring_emit(FW_EVENT_DROP, direction, rule->id, 0, &tuple);
                 // printk(KERN_INFO "Dropping packet from %s to %s\n", src_ip_str, dst_ip_str);
                 return NF_DROP;
             }
         }
     }
+    // The default action is applied once, by the hook after routing
+    if (direction == FLOW_PREROUTING)
+        return NF_ACCEPT;
+    fw_top_rule(fn->top, 0, len);
     // 默认动作处理
-    switch (default_action)
+    switch (fn->rules.default_action)
     {
     // case ACTION_ACCEPT:
     //     log_message(LOG_INFO, "Default action: Accepting packet from %s to %s", src_ip_str, dst_ip_str);
     //     printk(KERN_INFO "Default action: Accepting packet from %s to %s\n", src_ip_str, dst_ip_str);
-        return stateful_firewall_check(skb, direction);
+        return stateful_firewall_check(fn, key, direction);
     case ACTION_DROP:
         // log_message(LOG_INFO, "Default action: Dropping packet from %s to %s", src_ip_str, dst_ip_str);
         // printk(KERN_INFO "Default action: Dropping packet from %s to %s\n", src_ip_str, dst_ip_str);
+        event_ring_emit(FW_EVENT_DROP, direction, 0, 0, &tuple);
         return NF_DROP;
     default:
-        return stateful_firewall_check(skb, direction);
+        return stateful_firewall_check(fn, key, direction);
     }
 }
 
+// IPv4 and IPv6 share the rule set and conntrack table; addresses are
+// compared in one representation, so a rule without addresses matches both
+static unsigned int apply_rule(struct fw_net *fn, struct sk_buff *skb, u8 pf, int direction)
+{
+    firewall_ruleset_t *rs;
+    fw_flow_key_t key;
+    unsigned int verdict;
+
+    // Headers are read once here and the key is handed to conntrack
+    if (fw_flow_key_parse(skb, pf, &key))
+        return NF_DROP;
+    // RFC 4861 neighbor discovery is always sent with hop limit 255, so an
+    // off-link sender cannot use this to get past the rules
+    if (pf == NFPROTO_IPV6 && key.proto == IPPROTO_ICMPV6 && key.fragment == FW_FRAG_NONE &&
+        key.icmp_type >= ICMPV6_ND_FIRST && key.icmp_type <= ICMPV6_ND_LAST &&
+        ipv6_hdr(skb)->hop_limit == 255 && READ_ONCE(ipv6_nd_accept)) {
+        fw_stat_inc(fn->stats, FW_STAT_ND_ACCEPT);
+        return NF_ACCEPT;
+    }
+    // Every packet enters through exactly one of these two hooks
+    if (direction == FLOW_PREROUTING || direction == FLOW_OUTBOUND)
+        fw_top_packet(fn->top, &key, skb->len);
+    // Hooks run under rcu_read_lock(), so the generation stays valid until we return
+    rs = rcu_dereference(fn->rules.active);
+    // Later fragments have no ports; they take the first fragment's verdict
+    if (key.fragment == FW_FRAG_LATER)
+    {
+        bool hit = frag_cache_lookup(&key, direction, rs->generation, &verdict);
+
+        fw_stat_inc(fn->stats, hit ? FW_STAT_FRAG_HIT : FW_STAT_FRAG_MISS);
+        if (hit)
+            return verdict;
+    }
+    verdict = match_rules(fn, rs, &key, direction, skb->len);
+    if (key.fragment == FW_FRAG_FIRST)
+        frag_cache_store(&key, direction, rs->generation, verdict);
+    return verdict;
+}
+
 unsigned int rule_filter_apply_inbound(void *priv, struct sk_buff *skb, const struct nf_hook_state *state)
 {
-    return apply_rule(skb, FLOW_INBOUND);
+    struct fw_net *fn = fw_net(state->net);
+    u64 start = fw_stat_hook_start();
+    unsigned int verdict = apply_rule(fn, skb, state->pf, FLOW_INBOUND);
+
+    fw_stat_hook_end(fn->stats, FW_HOOK_IN, start, verdict);
+    return verdict;
 }
+// Exported so test/stress can drive the hooks directly
+EXPORT_SYMBOL_GPL(rule_filter_apply_inbound);
 
 unsigned int rule_filter_apply_outbound(void *priv, struct sk_buff *skb, const struct nf_hook_state *state)
 {
-    return apply_rule(skb, FLOW_OUTBOUND);
+    struct fw_net *fn = fw_net(state->net);
+    u64 start = fw_stat_hook_start();
+    unsigned int verdict = apply_rule(fn, skb, state->pf, FLOW_OUTBOUND);
+
+    fw_stat_hook_end(fn->stats, FW_HOOK_OUT, start, verdict);
+    return verdict;
+}
+EXPORT_SYMBOL_GPL(rule_filter_apply_outbound);
+
+unsigned int rule_filter_apply_forward(void *priv, struct sk_buff *skb, const struct nf_hook_state *state)
+{
+    struct fw_net *fn = fw_net(state->net);
+    u64 start = fw_stat_hook_start();
+    unsigned int verdict = apply_rule(fn, skb, state->pf, FLOW_FORWARD);
+
+    fw_stat_hook_end(fn->stats, FW_HOOK_FWD, start, verdict);
+    return verdict;
+}
+EXPORT_SYMBOL_GPL(rule_filter_apply_forward);
+
+// Runs before the routing lookup for every received packet, so packets a
+// PRE_ROUTING rule drops cost no route lookup
+unsigned int rule_filter_apply_prerouting(void *priv, struct sk_buff *skb, const struct nf_hook_state *state)
+{
+    struct fw_net *fn = fw_net(state->net);
+    u64 start = fw_stat_hook_start();
+    unsigned int verdict = apply_rule(fn, skb, state->pf, FLOW_PREROUTING);
+
+    fw_stat_hook_end(fn->stats, FW_HOOK_PRE, start, verdict);
+    return verdict;
+}
+EXPORT_SYMBOL_GPL(rule_filter_apply_prerouting);
+
+#define FIREWALL_HOOK(fn, family, num, prio) \
+    {                                      \
+        .hook = fn,                        \
+        .pf = family,                      \
+        .hooknum = num,                    \
+        .priority = prio,                  \
+    }
+
+static struct nf_hook_ops firewall_hooks[] = {
+    FIREWALL_HOOK(rule_filter_apply_prerouting, NFPROTO_IPV4, NF_INET_PRE_ROUTING, NF_IP_PRI_FIRST),
+    FIREWALL_HOOK(rule_filter_apply_inbound, NFPROTO_IPV4, NF_INET_LOCAL_IN, NF_IP_PRI_FIRST),
+    FIREWALL_HOOK(rule_filter_apply_forward, NFPROTO_IPV4, NF_INET_FORWARD, NF_IP_PRI_FIRST),
+    FIREWALL_HOOK(rule_filter_apply_outbound, NFPROTO_IPV4, NF_INET_LOCAL_OUT, NF_IP_PRI_FIRST),
+    FIREWALL_HOOK(rule_filter_apply_prerouting, NFPROTO_IPV6, NF_INET_PRE_ROUTING, NF_IP6_PRI_FIRST),
+    FIREWALL_HOOK(rule_filter_apply_inbound, NFPROTO_IPV6, NF_INET_LOCAL_IN, NF_IP6_PRI_FIRST),
+    FIREWALL_HOOK(rule_filter_apply_forward, NFPROTO_IPV6, NF_INET_FORWARD, NF_IP6_PRI_FIRST),
+    FIREWALL_HOOK(rule_filter_apply_outbound, NFPROTO_IPV6, NF_INET_LOCAL_OUT, NF_IP6_PRI_FIRST),
+};
+
+// The same ops are registered in every namespace; each hook finds its
+// instance through state->net
+int rule_filter_register_hooks(struct net *net)
+{
+    return nf_register_net_hooks(net, firewall_hooks, ARRAY_SIZE(firewall_hooks));
+}
+
+void rule_filter_unregister_hooks(struct net *net)
+{
+    nf_unregister_net_hooks(net, firewall_hooks, ARRAY_SIZE(firewall_hooks));
+}
+
+static firewall_ruleset_t *ruleset_alloc(fw_rules_t *owner)
+{
+    firewall_ruleset_t *rs;
+    int dir;
+
+    rs = kzalloc(sizeof(*rs), GFP_KERNEL);
+    if (!rs)
+        return NULL;
+    for (dir = 0; dir < FLOW_MAX; dir++)
+        INIT_LIST_HEAD(&rs->rules[dir]);
+    INIT_LIST_HEAD(&rs->sets);
+    rs->bytes = sizeof(*rs);
+    rs->owner = owner;
+    return rs;
+}
+
+static void ruleset_free(firewall_ruleset_t *rs)
+{
+    firewall_rule_t *rule, *tmp;
+    int dir;
+
+    for (dir = 0; dir < FLOW_MAX; dir++)
+    {
+        list_for_each_entry_safe(rule, tmp, &rs->rules[dir], list)
+        {
+            // Counts the summary work has not reported yet
+            rule_log_summary(rule, &rule_log_no_tuple, true);
+            list_del(&rule->list);
+            rule_free(rule);
+        }
+    }
+    fw_ipset_free_all(&rs->sets);
+    kfree(rs);
 }
 
-int rule_filter_load_rules(void)
+static void ruleset_free_rcu(struct rcu_head *head)
 {
-    return load_rules();
+    firewall_ruleset_t *rs = container_of(head, firewall_ruleset_t, rcu);
+
+    atomic_long_dec(&rs->owner->retired_generations);
+    atomic_long_sub(rs->bytes, &rs->owner->retired_bytes);
+    ruleset_free(rs);
+}
+
+// A new namespace starts with an empty generation and the default action
+// ACCEPT until rules are loaded through its control handle.
+int rule_filter_net_init(struct fw_net *fn)
+{
+    fw_rules_t *r = &fn->rules;
+    firewall_ruleset_t *rs;
+
+    mutex_init(&r->mutex);
+    // Only the initial namespace takes the module parameters; a container
+    // must not read the host's files by default
+    if (net_eq(fn->net, &init_net))
+    {
+        strscpy(fn->rule_file, rule_file_path, sizeof(fn->rule_file));
+        strscpy(fn->set_file, get_set_file_path(), sizeof(fn->set_file));
+    }
+    else
+    {
+        fn->rule_file[0] = '\0';
+        fn->set_file[0] = '\0';
+    }
+    memset(&r->reload_stats, 0, sizeof(r->reload_stats));
+    atomic_long_set(&r->retired_generations, 0);
+    atomic_long_set(&r->retired_bytes, 0);
+    r->default_action = ACTION_ACCEPT;
+    INIT_DELAYED_WORK(&r->log_work, rule_log_work);
+
+    rs = ruleset_alloc(r);
+    if (!rs)
+        return -ENOMEM;
+    rs->generation = atomic64_inc_return(&ruleset_generation);
+    r->reload_stats.generation = rs->generation;
+    r->reload_stats.bytes = rs->bytes;
+    RCU_INIT_POINTER(r->active, rs);
+    return 0;
+}
+
+// Parse fn's rule file into a new generation and publish it in fn. On
+// failure the current generation stays in place. The path is resolved by
+// the caller, so a reload through a container's control handle reads the
+// file in the container's mount namespace. A namespace without a rule file
+// keeps its rules.
+int rule_filter_load_rules(struct fw_net *fn)
+{
+    fw_rules_t *r = &fn->rules;
+    firewall_ruleset_t *rs, *old;
+    u64 start, parsed, published;
+    int ret;
+
+    rs = ruleset_alloc(r);
+    if (!rs)
+        return -ENOMEM;
+
+    mutex_lock(&r->mutex);
+    start = ktime_get_ns();
+    if (!fn->rule_file[0])
+    {
+        log_message(LOG_WARN, "No rule file set for this namespace");
+        ret = -ENOENT;
+    }
+    else
+    {
+        ret = load_rules(rs, fn->rule_file, fn->set_file);
+    }
+    if (ret)
+    {
+        r->reload_stats.failures++;
+        mutex_unlock(&r->mutex);
+        ruleset_free(rs);
+        return ret;
+    }
+    parsed = ktime_get_ns();
+
+    rs->generation = atomic64_inc_return(&ruleset_generation);
+    old = rcu_dereference_protected(r->active, lockdep_is_held(&r->mutex));
+    rcu_assign_pointer(r->active, rs);
+    atomic_long_inc(&r->retired_generations);
+    atomic_long_add(old->bytes, &r->retired_bytes);
+    call_rcu(&old->rcu, ruleset_free_rcu);
+    published = ktime_get_ns();
+
+    r->reload_stats.generation = rs->generation;
+    r->reload_stats.rules = rs->count;
+    r->reload_stats.bytes = rs->bytes;
+    r->reload_stats.sets = rs->set_count;
+    r->reload_stats.set_entries = rs->set_entries;
+    r->reload_stats.reloads++;
+    r->reload_stats.last_load_ns = parsed - start;
+    r->reload_stats.last_publish_ns = published - parsed;
+    r->reload_stats.max_load_ns = max(r->reload_stats.max_load_ns, r->reload_stats.last_load_ns);
+    r->reload_stats.max_publish_ns = max(r->reload_stats.max_publish_ns, r->reload_stats.last_publish_ns);
+    mutex_unlock(&r->mutex);
+
+    log_message(LOG_INFO, "Published rule generation %llu (%u rules) in %llu us", rs->generation,
+                rs->count, div_u64(published - start, NSEC_PER_USEC));
+    return 0;
+}
+
+void rule_filter_get_reload_stats(struct fw_net *fn, rule_reload_stats_t *stats)
+{
+    fw_rules_t *r = &fn->rules;
+
+    mutex_lock(&r->mutex);
+    *stats = r->reload_stats;
+    mutex_unlock(&r->mutex);
+    stats->old_generations = atomic_long_read(&r->retired_generations);
+    stats->old_bytes = atomic_long_read(&r->retired_bytes);
+}
+
+// Called after the namespace's hooks are unregistered, which waits for the
+// packets still walking the active generation. Retired generations may
+// still be queued; fw_net_exit_batch() waits for them before fn goes away.
+void rule_filter_net_exit(struct fw_net *fn)
+{
+    firewall_ruleset_t *rs;
+
+    cancel_delayed_work_sync(&fn->rules.log_work);
+    rs = rcu_dereference_protected(fn->rules.active, 1);
+    RCU_INIT_POINTER(fn->rules.active, NULL);
+    ruleset_free(rs);
 }
 
 void change_rule_file_path(char *path)
 {
-    strcpy(rule_file_path, path);
+    strscpy(rule_file_path, path, sizeof(rule_file_path));
 }
 
-void switch_default_action()
+// The files are only read on the next reload. An empty path clears them.
+int rule_filter_set_rule_file(struct fw_net *fn, const char *path)
 {
-    default_action = default_action == ACTION_ACCEPT ? ACTION_DROP : ACTION_ACCEPT;
-    log_message(LOG_INFO, "Default action switched to %s", default_action == ACTION_ACCEPT ? "ACCEPT" : "DROP");
-    printk(KERN_INFO "Default action switched to %s\n", default_action == ACTION_ACCEPT ? "ACCEPT" : "DROP");
+    if (strlen(path) >= sizeof(fn->rule_file))
+        return -ENAMETOOLONG;
+    mutex_lock(&fn->rules.mutex);
+    strscpy(fn->rule_file, path, sizeof(fn->rule_file));
+    mutex_unlock(&fn->rules.mutex);
+    return 0;
+}
+
+int rule_filter_set_set_file(struct fw_net *fn, const char *path)
+{
+    if (strlen(path) >= sizeof(fn->set_file))
+        return -ENAMETOOLONG;
+    mutex_lock(&fn->rules.mutex);
+    strscpy(fn->set_file, path, sizeof(fn->set_file));
+    mutex_unlock(&fn->rules.mutex);
+    return 0;
+}
+
+void rule_filter_set_default_action(struct fw_net *fn, int action)
+{
+    WRITE_ONCE(fn->rules.default_action, action);
+    log_message(LOG_INFO, "Default action switched to %s", action == ACTION_ACCEPT ? "ACCEPT" : "DROP");
+    printk(KERN_INFO "Default action switched to %s\n", action == ACTION_ACCEPT ? "ACCEPT" : "DROP");
+}
+
+void switch_default_action(struct fw_net *fn)
+{
+    rule_filter_set_default_action(fn, fn->rules.default_action == ACTION_ACCEPT ? ACTION_DROP : ACTION_ACCEPT);
+}
+
+// Copy up to max rules of the active generation into out, grouped by hook
+// in match order, for the control device. Returns the number of rules in
+// the generation, which may be more than were copied.
+u32 rule_filter_dump_rules(struct fw_net *fn, struct fw_ctrl_rule *out, u32 max)
+{
+    firewall_ruleset_t *rs;
+    firewall_rule_t *rule;
+    u32 n = 0, total = 0;
+    int dir;
+
+    rcu_read_lock();
+    rs = rcu_dereference(fn->rules.active);
+    if (rs)
+        total = rs->count;
+    for (dir = 0; rs && dir < FLOW_MAX; dir++)
+    {
+        list_for_each_entry_rcu(rule, &rs->rules[dir], list)
+        {
+            struct fw_ctrl_rule *r;
+
+            if (n == max)
+                break;
+            r = &out[n];
+            memset(r, 0, sizeof(*r));
+            r->id = rule->id;
+            r->direction = rule->flow_direction;
+            r->action = rule->action;
+            r->proto = rule->proto;
+            r->flags = (rule->src_set ? FW_CTRL_RULE_SRC_SET : 0) | (rule->dst_set ? FW_CTRL_RULE_DST_SET : 0);
+            memcpy(r->src_ip, &rule->src_ip, sizeof(r->src_ip));
+            memcpy(r->src_mask, &rule->src_mask, sizeof(r->src_mask));
+            memcpy(r->dst_ip, &rule->dst_ip, sizeof(r->dst_ip));
+            memcpy(r->dst_mask, &rule->dst_mask, sizeof(r->dst_mask));
+            r->src_port = rule->src_port;
+            r->dst_port = rule->dst_port;
+            r->limit_rate = rule->limit_rate;
+            r->connlimit = rule->connlimit;
+            n++;
+        }
+    }
+    rcu_read_unlock();
+    return total;
 }
\ No newline at end of file
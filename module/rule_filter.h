@@ -3,49 +3,110 @@
 
 #include <linux/types.h>
 #include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/atomic.h>
 #include <linux/netfilter.h>
 #include <linux/netfilter_ipv4.h>
+#include <linux/workqueue.h>
+#include "token_bucket.h"
+#include "flow_key.h"
+
+struct fw_ipset;
 
 typedef struct firewall_rule {
-    uint32_t src_ip;
-    uint32_t dst_ip;
+    uint32_t id; // 1-based physical line number in the rule file (the header is line 1), used by the log
+    fw_addr_t src_ip;   // 已按 src_mask 取掩码，IPv4 为映射地址
+    fw_addr_t src_mask; // 全 0 表示任意地址
+    fw_addr_t dst_ip;
+    fw_addr_t dst_mask;
+    struct fw_ipset *src_set; // 地址列写 "@名字" 时引用的集合，此时 src_ip/src_mask 为任意地址
+    struct fw_ipset *dst_set;
     uint16_t src_port;
     uint16_t dst_port;
     uint8_t proto;
     int flow_direction;
     int action;
     int log; // New field for logging
+    uint32_t log_rate;   // log messages per second, 0 = unlimited
+    uint32_t log_burst;
+    uint32_t log_sample; // log 1 in N matching packets, 0/1 = all
+    token_bucket_t log_tb;
+    atomic_long_t log_suppressed; // messages dropped by the rate limit since the last summary
+    atomic_long_t log_sampled;    // matches skipped by 1-in-N sampling since the last summary
+    // ACTION_LIMIT：速率内的包按 ACCEPT 处理，超出的丢弃
+    uint32_t limit_rate;  // 每秒包数
+    uint32_t limit_burst;
+    token_bucket_t limit_tb; // 整条规则共用一个桶；按源限速时只提供速率
+    atomic64_t *limit_src_tat; // 按源地址限速时每个槽的 tat，否则为 NULL
+    uint32_t limit_src_mask;   // 槽数 - 1，哈希冲突的源共用一个槽
+    uint32_t limit_seed;
+    // 非 0 时规则只匹配新连接，且源地址已有不少于 connlimit 条连接，通常配合 DROP
+    uint32_t connlimit;
     struct list_head list;
 } firewall_rule_t;
-// 钩子操作结构体，用于处理入站流量
-static struct nf_hook_ops firewall_in_hook = {
-    .hook = NULL, // 将由模块加载时设置
-    .pf = PF_INET,
-    .hooknum = NF_INET_LOCAL_IN,
-    .priority = NF_IP_PRI_FIRST,
-};
-
-// 钩子操作结构体，用于处理出站流量
-static struct nf_hook_ops firewall_out_hook = {
-    .hook = NULL, // 将由模块加载时设置
-    .pf = PF_INET,
-    .hooknum = NF_INET_LOCAL_OUT,
-    .priority = NF_IP_PRI_FIRST,
-};
-extern struct list_head rule_list; // Declare as extern
+// 规则重载统计，/proc/fw_stats 的 ruleset 段
+typedef struct rule_reload_stats {
+    uint64_t generation;      // 当前发布的规则集代号，所有命名空间共用一个递增序列
+    uint32_t rules;
+    size_t bytes;             // 当前代占用的内存，含地址集合
+    uint32_t sets;            // 当前代的地址集合数
+    uint64_t set_entries;     // 所有集合的成员数
+    uint64_t reloads;
+    uint64_t failures;        // 加载失败次数，失败时保留旧规则集
+    uint64_t last_load_ns;    // 上次读文件并解析的耗时
+    uint64_t max_load_ns;
+    uint64_t last_publish_ns; // 上次替换指针并回收旧代的耗时
+    uint64_t max_publish_ns;
+    long old_generations;     // 已替换但仍在等待 RCU 宽限期的旧代
+    long old_bytes;
+} rule_reload_stats_t;
+
+struct firewall_ruleset;
+// 每个网络命名空间的规则状态（struct fw_net 的 rules）。新命名空间从空规则集和
+// 默认放行开始，由该命名空间内打开的控制设备加载规则
+typedef struct fw_rules {
+    struct firewall_ruleset __rcu *active;
+    struct mutex mutex;                // 串行化重载，保护 reload_stats
+    rule_reload_stats_t reload_stats;
+    atomic_long_t retired_generations; // 已替换、仍在等待 RCU 宽限期的旧代
+    atomic_long_t retired_bytes;
+    int default_action;
+    struct delayed_work log_work;      // 报告规则被采样和限速跳过的日志条数
+} fw_rules_t;
 
+struct net;
+struct fw_net;
 
 void change_rule_file_path(char *path);
-int rule_filter_load_rules(void);
+int rule_filter_net_init(struct fw_net *fn);
+void rule_filter_net_exit(struct fw_net *fn);
+int rule_filter_load_rules(struct fw_net *fn);
+int rule_filter_set_rule_file(struct fw_net *fn, const char *path);
+int rule_filter_set_set_file(struct fw_net *fn, const char *path);
+int rule_filter_register_hooks(struct net *net);
+void rule_filter_unregister_hooks(struct net *net);
+unsigned int rule_filter_apply_prerouting(void *priv, struct sk_buff *skb, const struct nf_hook_state *state);
+unsigned int rule_filter_apply_forward(void *priv, struct sk_buff *skb, const struct nf_hook_state *state);
+void rule_filter_get_reload_stats(struct fw_net *fn, rule_reload_stats_t *stats);
 unsigned int rule_filter_apply_inbound(void *priv, struct sk_buff *skb, const struct nf_hook_state *state);
 unsigned int rule_filter_apply_outbound(void *priv, struct sk_buff *skb, const struct nf_hook_state *state);
-void switch_default_action(void);
+void switch_default_action(struct fw_net *fn);
+void rule_filter_set_default_action(struct fw_net *fn, int action);
+struct fw_ctrl_rule;
+// 控制设备的规则列表：复制当前规则集的前 max 条，返回规则总数
+u32 rule_filter_dump_rules(struct fw_net *fn, struct fw_ctrl_rule *out, u32 max);
 
 // static int load_rules(void);
-#define FLOW_INBOUND 0
-#define FLOW_OUTBOUND 1
+// flow_direction 列，决定规则在哪个钩子上匹配
+#define FLOW_INBOUND 0    // LOCAL_IN，发往本机的包
+#define FLOW_OUTBOUND 1   // LOCAL_OUT，本机发出的包
+#define FLOW_FORWARD 2    // FORWARD，经本机转发的包
+#define FLOW_PREROUTING 3 // PRE_ROUTING，所有收到的包，路由查找之前
+#define FLOW_MAX 4
 
 #define ACTION_ACCEPT 0
 #define ACTION_DROP 1
+#define ACTION_LIMIT 2 // 令牌桶限速，列 limit_rate / limit_burst / limit_per_src
+#define ACTION_NOTRACK 3 // 放行，不查找也不新建连接
 
 #endif /* RULE_FILTER_H */
\ No newline at end of file
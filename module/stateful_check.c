@@ -3,6 +3,7 @@
 #include <linux/tcp.h>
 #include <linux/udp.h>
 #include <linux/icmp.h>
+#include <linux/icmpv6.h>
 #include <linux/jiffies.h>
 #include <linux/slab.h>
 #include <linux/timer.h>
@@ -10,13 +11,74 @@
 #include <linux/fs.h>
 #include <linux/uaccess.h>
 #include <linux/timekeeping.h>
+#include <linux/spinlock.h>
+#include <linux/rcupdate.h>
+#include <linux/atomic.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/random.h>
+#include <linux/bitops.h>
+#include "fw_net.h"
 #include "log.h"
+#include "event_ring.h"
+#include "fw_trace.h"
+#include "stats.h"
+#include "conn_sync.h"
+#include "fw_uapi.h"
 #define TIMEOUT_INTERVAL (5 * HZ) // 超时时间间隔，5秒
-
-struct hlist_head connection_table[1 << 16]; // 定义连接表
-static struct timer_list timeout_timer;
-static char *buffer;
-static size_t buffer_size;
+#define CONN_HASH_BITS_MIN 4
+#define CONN_HASH_BITS_MAX 20
+
+// 连接表：查找在 RCU 读临界区内无锁进行（netfilter 调用钩子时已持有
+// rcu_read_lock），插入和删除持有对应桶的自旋锁，删除的节点经 kfree_rcu 释放。
+// 每个网络命名空间一张，容器之间不共享桶和锁
+static unsigned int conntrack_hash_bits = 16;
+module_param(conntrack_hash_bits, uint, 0444);
+MODULE_PARM_DESC(conntrack_hash_bits, "log2 of the conntrack buckets of the initial network namespace");
+static unsigned int conntrack_netns_hash_bits = 12;
+module_param(conntrack_netns_hash_bits, uint, 0644);
+MODULE_PARM_DESC(conntrack_netns_hash_bits, "log2 of the conntrack buckets of each namespace created afterwards");
+
+// SYN 洪泛防护：半开连接（SYN 新建、还没见到握手后续包的 TCP 连接）分全局和
+// 按源地址两级上限。全局上限到达后新的 SYN 不再建连接，直接放行；对端回的
+// SYN-ACK 只在 cookie 表里记下其序号的带密钥哈希。超限期间没有连接的 ACK
+// 只有确认号对得上才建连接，伪造源地址的一方收不到 SYN-ACK，猜中的概率约
+// 2^-32；对不上的非 SYN 包（包括超时后又有数据的老连接）照常放行但不建连接
+static unsigned int syn_half_open_max;
+module_param(syn_half_open_max, uint, 0644);
+MODULE_PARM_DESC(syn_half_open_max, "half-open TCP connections per namespace before SYNs are passed without state (0 = half the conntrack buckets)");
+static unsigned int syn_half_open_per_src = 64;
+module_param(syn_half_open_per_src, uint, 0644);
+MODULE_PARM_DESC(syn_half_open_per_src, "half-open TCP connections per source address before its SYNs are dropped (0 = no limit)");
+
+// 每个命名空间的连接总数上限，到达后新连接的包被丢弃，包括同步和快照写入的
+static unsigned int conntrack_max;
+module_param(conntrack_max, uint, 0644);
+MODULE_PARM_DESC(conntrack_max, "connections per namespace before new ones are dropped (0 = four per conntrack bucket)");
+
+// 连接表快照：模块卸载前把 init_net 的连接写入该文件，加载时读回，升级或
+// make rebuild 之后已建立的连接不必重新匹配规则。空串表示不保存也不恢复
+static char conntrack_snapshot_path[256] = "/var/lib/mini-fire/conntrack.snap";
+module_param_string(conntrack_snapshot, conntrack_snapshot_path, sizeof(conntrack_snapshot_path), 0644);
+MODULE_PARM_DESC(conntrack_snapshot, "File the initial namespace's connections are saved to on unload and restored from on load (empty = off)");
+// 停机超过该秒数的快照不再恢复，对端早已放弃这些连接。0 表示不限
+static unsigned int conntrack_snapshot_max_age = 600;
+module_param(conntrack_snapshot_max_age, uint, 0644);
+MODULE_PARM_DESC(conntrack_snapshot_max_age, "Seconds after which a saved conntrack snapshot is no longer restored (0 = no limit)");
+
+#define CONN_SNAPSHOT_MAGIC 0x46574354 // "FWCT"
+#define CONN_SNAPSHOT_VERSION 1
+#define CONN_SNAPSHOT_CHUNK 1024 // 每次读写的记录数
+
+// 快照文件：文件头后接 count 条 conn_rec_t，按本机字节序
+struct conn_snapshot_hdr {
+    u32 magic;
+    u16 version;
+    u16 record_size;
+    u32 count;
+    u32 reserved;
+    u64 saved_ns; // 保存时的墙上时间，恢复时据此判断快照是否过旧
+};
 
 // 获取当前系统时间的字符串表示（仅时间部分）
 static void get_current_time_str(char *buffer, size_t buffer_size) {
@@ -28,17 +90,106 @@ static void get_current_time_str(char *buffer, size_t buffer_size) {
              tm.tm_hour, tm.tm_min, tm.tm_sec);
 }
 
+static inline atomic_t *conn_src_slot(fw_conntrack_t *ct, const fw_addr_t *src_ip) {
+    return &ct->src_half_open[jhash2((const u32 *)src_ip->ip6, 4, ct->src_seed) & (CONN_SRC_SLOTS - 1)];
+}
+
+// 本命名空间的半开连接上限，syn_half_open_max 为 0 时取桶数的一半
+static inline unsigned int conn_half_open_limit(const fw_conntrack_t *ct) {
+    unsigned int max = READ_ONCE(syn_half_open_max);
+
+    return max ? max : (1U << ct->bits) / 2;
+}
+
+// 连接数是否已达 conntrack_max，为 0 时上限是桶数的 4 倍
+static inline bool conn_table_full(const fw_conntrack_t *ct) {
+    unsigned int max = READ_ONCE(conntrack_max);
+
+    return atomic_read(&ct->count) >= (max ? max : 4U << ct->bits);
+}
+
+// 握手 cookie 的槽和值。client/server 是发起方和应答方，isn1 是应答方的
+// 初始序号加一，也就是发起方 ACK 的确认号。值为 0 表示空槽
+static inline u32 *conn_cookie(fw_conntrack_t *ct, const fw_addr_t *client, const fw_addr_t *server,
+                               u16 client_port, u16 server_port, u32 isn1, u32 *value) {
+    u32 h = jhash2((const u32 *)client->ip6, 4, ct->cookie_seed);
+
+    h = jhash2((const u32 *)server->ip6, 4, h);
+    h = jhash_1word((u32)client_port << 16 | server_port, h);
+    *value = jhash_1word(isn1, h) ?: 1;
+    return &ct->cookies[hash_min(h, ct->bits)];
+}
+
+// 放行的 SYN-ACK 记下 cookie，同一槽里的旧值被覆盖
+static inline void conn_cookie_set(fw_conntrack_t *ct, const fw_flow_key_t *key) {
+    u32 value;
+    u32 *slot = conn_cookie(ct, &key->dst_ip, &key->src_ip, key->dst_port, key->src_port, key->tcp_seq + 1, &value);
+
+    WRITE_ONCE(*slot, value);
+}
+
+// 发起方的 ACK 与记下的 cookie 相符时清空槽并返回 true，一次握手只建一条连接
+static inline bool conn_cookie_check(fw_conntrack_t *ct, const fw_flow_key_t *key) {
+    u32 value;
+    u32 *slot = conn_cookie(ct, &key->src_ip, &key->dst_ip, key->src_port, key->dst_port, key->tcp_ack, &value);
+
+    return READ_ONCE(*slot) == value && cmpxchg(slot, value, 0) == value;
+}
+
+// 连接离开半开状态（握手有了后续包或连接超时），归还占用的计数
+static inline void conn_half_open_done(fw_conntrack_t *ct, connection_t *conn) {
+    if (likely(!READ_ONCE(conn->flags)))
+        return;
+    if (test_and_clear_bit(CONN_F_HALF_OPEN, &conn->flags))
+        atomic_dec(&ct->half_open);
+    if (test_and_clear_bit(CONN_F_SRC_COUNTED, &conn->flags))
+        atomic_dec(conn_src_slot(ct, &conn->src_ip));
+}
+
+// 源地址在 sketch 每一行中的计数器，两个哈希组合出各行的下标
+static inline void conn_sketch_slots(fw_conntrack_t *ct, const fw_addr_t *src_ip, atomic_t *slots[CONN_SKETCH_ROWS]) {
+    u32 h1 = jhash2((const u32 *)src_ip->ip6, 4, ct->sketch_seed[0]);
+    u32 h2 = jhash2((const u32 *)src_ip->ip6, 4, ct->sketch_seed[1]) | 1;
+    u32 mask = (1U << ct->sketch_bits) - 1;
+    int i;
+
+    for (i = 0; i < CONN_SKETCH_ROWS; i++)
+        slots[i] = &ct->src_sketch[(i << ct->sketch_bits) + ((h1 + i * h2) & mask)];
+}
+
+static inline void conn_sketch_add(fw_conntrack_t *ct, const fw_addr_t *src_ip, int delta) {
+    atomic_t *slots[CONN_SKETCH_ROWS];
+    int i;
+
+    conn_sketch_slots(ct, src_ip, slots);
+    for (i = 0; i < CONN_SKETCH_ROWS; i++)
+        atomic_add(delta, slots[i]);
+}
+
+// 源地址 src_ip 当前的连接数（近似值，不小于真实值）
+u32 stateful_firewall_src_conns(struct fw_net *fn, const fw_addr_t *src_ip) {
+    fw_conntrack_t *ct = &fn->conntrack;
+    atomic_t *slots[CONN_SKETCH_ROWS];
+    int i, n = INT_MAX;
+
+    conn_sketch_slots(ct, src_ip, slots);
+    for (i = 0; i < CONN_SKETCH_ROWS; i++)
+        n = min(n, atomic_read(slots[i]));
+    return max(n, 0);
+}
+
 // TCP状态检测函数
-static int check_tcp_state(struct sk_buff *skb, connection_t *conn) {
-    struct tcphdr *tcph = tcp_hdr(skb);
+static int check_tcp_state(fw_conntrack_t *ct, const fw_flow_key_t *key, connection_t *conn) {
     // 更新连接状态
-    conn->last_seen = jiffies;
+    WRITE_ONCE(conn->last_seen, jiffies);
+    if (!(key->tcp_flags & FW_TCP_SYN))
+        conn_half_open_done(ct, conn);
     // 简单的状态检测逻辑，可以根据需要扩展
-    if (tcph->syn && !tcph->ack) {
+    if ((key->tcp_flags & FW_TCP_SYN) && !(key->tcp_flags & FW_TCP_ACK)) {
         conn->state = 1; // SYN_SENT
-    } else if (tcph->syn && tcph->ack) {
+    } else if (key->tcp_flags & FW_TCP_SYN) {
         conn->state = 2; // SYN_RECV
-    } else if (tcph->fin) {
+    } else if (key->tcp_flags & FW_TCP_FIN) {
         conn->state = 3; // FIN_WAIT
     } else {
         conn->state = 4; // ESTABLISHED
@@ -47,23 +198,23 @@ static int check_tcp_state(struct sk_buff *skb, connection_t *conn) {
 }
 
 // UDP状态检测函数
-static int check_udp_state(struct sk_buff *skb, connection_t *conn) {
+static int check_udp_state(const fw_flow_key_t *key, connection_t *conn) {
     // 更新连接状态
-    conn->last_seen = jiffies;
+    WRITE_ONCE(conn->last_seen, jiffies);
     // UDP是无连接的，简单更新状态
     conn->state = 1; // ACTIVE
     return NF_ACCEPT;
 }
 
-// ICMP状态检测函数
-static int check_icmp_state(struct sk_buff *skb, connection_t *conn) {
-    struct icmphdr *icmph = icmp_hdr(skb);
+// ICMP / ICMPv6 状态检测函数
+static int check_icmp_state(const fw_flow_key_t *key, connection_t *conn) {
+    bool v6 = conn->proto == IPPROTO_ICMPV6;
     // 更新连接状态
-    conn->last_seen = jiffies;
+    WRITE_ONCE(conn->last_seen, jiffies);
     // 简单的状态检测逻辑，可以根据需要扩展
-    if (icmph->type == ICMP_ECHO) {
+    if (key->icmp_type == (v6 ? ICMPV6_ECHO_REQUEST : ICMP_ECHO)) {
         conn->state = 1; // ECHO_REQUEST
-    } else if (icmph->type == ICMP_ECHOREPLY) {
+    } else if (key->icmp_type == (v6 ? ICMPV6_ECHO_REPLY : ICMP_ECHOREPLY)) {
         conn->state = 2; // ECHO_REPLY
     } else {
         conn->state = 3; // OTHER
@@ -71,172 +222,695 @@ static int check_icmp_state(struct sk_buff *skb, connection_t *conn) {
     return NF_ACCEPT;
 }
 
-// 状态检测主函数
-int stateful_firewall_check(struct sk_buff *skb, int direction) {
-    struct iphdr *iph = ip_hdr(skb);
-    uint32_t src_ip = iph->saddr;
-    uint32_t dst_ip = iph->daddr;
-    uint16_t src_port = 0, dst_port = 0;
-    uint8_t proto = iph->protocol;
+static inline spinlock_t *conn_lock(fw_conntrack_t *ct, u32 bucket) {
+    return &ct->locks[bucket & (CONN_LOCKS - 1)];
+}
+
+// 在桶内查找连接，调用者需处于 RCU 读临界区或持有桶锁
+static connection_t *conn_find(fw_conntrack_t *ct, u32 bucket, const fw_addr_t *src_ip, const fw_addr_t *dst_ip,
+                               uint16_t src_port, uint16_t dst_port, uint8_t proto) {
     connection_t *conn;
-    uint32_t hash_key = jhash_3words(src_ip, dst_ip, proto, 0);
-
-    if (proto == IPPROTO_TCP || proto == IPPROTO_UDP) {
-        struct tcphdr *tcph = tcp_hdr(skb);
-        src_port = ntohs(tcph->source);
-        dst_port = ntohs(tcph->dest);
-    }
-
-    hash_for_each_possible(connection_table, conn, list, hash_key) {
-        if (conn->src_ip == src_ip && conn->dst_ip == dst_ip && conn->src_port == src_port && conn->dst_port == dst_port && conn->proto == proto) {
-            switch (proto) {
-                case IPPROTO_TCP:
-                    return check_tcp_state(skb, conn);
-                case IPPROTO_UDP:
-                    return check_udp_state(skb, conn);
-                case IPPROTO_ICMP:
-                    return check_icmp_state(skb, conn);
-                default:
-                    return NF_ACCEPT;
+
+    hlist_for_each_entry_rcu(conn, &ct->table[bucket], list) {
+        if (fw_addr_equal(&conn->src_ip, src_ip) && fw_addr_equal(&conn->dst_ip, dst_ip) && conn->src_port == src_port && conn->dst_port == dst_port && conn->proto == proto)
+            return conn;
+    }
+    return NULL;
+}
+
+static int conn_update(fw_conntrack_t *ct, const fw_flow_key_t *key, connection_t *conn) {
+    switch (conn->proto) {
+        case IPPROTO_TCP:
+            return check_tcp_state(ct, key, conn);
+        case IPPROTO_UDP:
+            return check_udp_state(key, conn);
+        case IPPROTO_ICMP:
+        case IPPROTO_ICMPV6:
+            return check_icmp_state(key, conn);
+        default:
+            return NF_ACCEPT;
+    }
+}
+
+// conn_update 之后把新建、状态变了或该刷新的连接交给主备同步
+static int conn_update_sync(struct fw_net *fn, const fw_flow_key_t *key, connection_t *conn, bool created) {
+    int state = conn->state;
+    int ret = conn_update(&fn->conntrack, key, conn);
+
+    conn_sync_note(fn, conn, created || conn->state != state);
+    return ret;
+}
+
+// 从桶中删除连接并撤销它的计数，调用者持有桶锁
+static void conn_unlink(fw_conntrack_t *ct, connection_t *conn) {
+    conn_half_open_done(ct, conn);
+    conn_sketch_add(ct, &conn->src_ip, -1);
+    hlist_del_rcu(&conn->list);
+    kfree_rcu(conn, rcu);
+    atomic_dec(&ct->count);
+}
+
+// 状态检测主函数，key 由调用的钩子解析好
+int stateful_firewall_check(struct fw_net *fn, const fw_flow_key_t *key, int direction) {
+    fw_conntrack_t *ct = &fn->conntrack;
+    const fw_addr_t *src_ip = &key->src_ip;
+    const fw_addr_t *dst_ip = &key->dst_ip;
+    uint16_t src_port = key->src_port, dst_port = key->dst_port;
+    uint8_t proto = key->proto;
+    connection_t *conn, *old;
+    fw_log_tuple_t tuple;
+    uint32_t hash_key = jhash_3words(fw_addr_fold(src_ip), fw_addr_fold(dst_ip), proto, 0);
+    u32 bucket = hash_min(hash_key, ct->bits);
+    bool syn = proto == IPPROTO_TCP && (key->tcp_flags & FW_TCP_SYN);
+    bool pure_syn = syn && !(key->tcp_flags & FW_TCP_ACK);
+    atomic_t *src_slot = NULL;
+
+    // 后续分片没有端口，不能对应到连接，也不为它新建连接
+    if (key->fragment == FW_FRAG_LATER)
+        return NF_ACCEPT;
+
+    conn = conn_find(ct, bucket, src_ip, dst_ip, src_port, dst_port, proto);
+    if (conn)
+        return conn_update_sync(fn, key, conn, false);
+
+    if (syn) {
+        unsigned int per_src = READ_ONCE(syn_half_open_per_src);
+
+        if (pure_syn && per_src) {
+            src_slot = conn_src_slot(ct, src_ip);
+            if (atomic_read(src_slot) >= per_src) {
+                fw_stat_inc(fn->stats, FW_STAT_SYN_SRC_LIMIT);
+                return NF_DROP;
             }
         }
+        if (atomic_read(&ct->half_open) >= conn_half_open_limit(ct)) {
+            if (!pure_syn)
+                conn_cookie_set(ct, key);
+            fw_stat_inc(fn->stats, FW_STAT_SYN_STATELESS);
+            return NF_ACCEPT;
+        }
+    } else if (proto == IPPROTO_TCP && atomic_read(&ct->half_open) >= conn_half_open_limit(ct)) {
+        // 规则已经放行了这个包，校验只决定是否为它建连接
+        if (!(key->tcp_flags & FW_TCP_ACK) || !conn_cookie_check(ct, key)) {
+            fw_stat_inc(fn->stats, FW_STAT_SYN_NOSTATE);
+            return NF_ACCEPT;
+        }
+        fw_stat_inc(fn->stats, FW_STAT_SYN_COOKIE);
+    }
+    if (conn_table_full(ct)) {
+        fw_stat_inc(fn->stats, FW_STAT_CONN_FULL);
+        return NF_DROP;
     }
 
-    // 如果没有找到现有连接，则添加新连接
-    conn = kmalloc(sizeof(connection_t), GFP_KERNEL);
+    // 如果没有找到现有连接，则添加新连接（可能在软中断中，不能睡眠）
+    conn = kmalloc(sizeof(connection_t), GFP_ATOMIC);
     if (!conn) {
+        fw_stat_inc(fn->stats, FW_STAT_CONN_ALLOC_FAIL);
         log_message(LOG_ERROR, "Failed to allocate memory for connection");
         return NF_DROP;
     }
-    conn->src_ip = src_ip;
-    conn->dst_ip = dst_ip;
+    conn->src_ip = *src_ip;
+    conn->dst_ip = *dst_ip;
     conn->src_port = src_port;
     conn->dst_port = dst_port;
     conn->proto = proto;
     conn->state = 0;
+    conn->flags = 0;
     conn->last_seen = jiffies;
-    hash_add(connection_table, &conn->list, hash_key);
-    log_message(LOG_INFO, "New connection added: src_ip=%pI4, dst_ip=%pI4, src_port=%u, dst_port=%u, proto=%u",
-                &conn->src_ip, &conn->dst_ip, conn->src_port, conn->dst_port, conn->proto);
+    conn->synced = conn->last_seen;
 
-    switch (proto) {
-        case IPPROTO_TCP:
-            return check_tcp_state(skb, conn);
-        case IPPROTO_UDP:
-            return check_udp_state(skb, conn);
-        case IPPROTO_ICMP:
-            return check_icmp_state(skb, conn);
-        default:
-            return NF_ACCEPT;
+    spin_lock_bh(conn_lock(ct, bucket));
+    // 加锁后再查一次，其他 CPU 可能刚插入了同一条连接
+    old = conn_find(ct, bucket, src_ip, dst_ip, src_port, dst_port, proto);
+    if (old) {
+        spin_unlock_bh(conn_lock(ct, bucket));
+        kfree(conn);
+        return conn_update_sync(fn, key, old, false);
     }
+    // 计数在连接可见之前设好，超时扫描看到的标志和计数一致
+    if (syn) {
+        conn->flags = BIT(CONN_F_HALF_OPEN);
+        atomic_inc(&ct->half_open);
+        if (src_slot) {
+            conn->flags |= BIT(CONN_F_SRC_COUNTED);
+            atomic_inc(src_slot);
+        }
+    }
+    hlist_add_head_rcu(&conn->list, &ct->table[bucket]);
+    spin_unlock_bh(conn_lock(ct, bucket));
+    atomic_inc(&ct->count);
+    conn_sketch_add(ct, src_ip, 1);
+    fw_stat_inc(fn->stats, FW_STAT_CONN_INSERT);
+
+    tuple.src_ip = *src_ip;
+    tuple.dst_ip = *dst_ip;
+    tuple.src_port = src_port;
+    tuple.dst_port = dst_port;
+    tuple.proto = proto;
+    trace_fw_conn_insert(src_ip, dst_ip, src_port, dst_port, proto);
+    if (log_info_enabled())
+        log_event(LOG_INFO, FW_EV_CONN_NEW, 0, &tuple);
+    event_ring_emit(FW_EVENT_FLOW_NEW, direction, 0, 0, &tuple);
+
+    return conn_update_sync(fn, key, conn, true);
+}
+
+// connlimit 规则的条件：包不属于已有连接，且源地址的连接数已达到 limit。
+// 先查 sketch，只有超限时才查连接表
+bool stateful_firewall_over_limit(struct fw_net *fn, const fw_flow_key_t *key, u32 limit) {
+    fw_conntrack_t *ct = &fn->conntrack;
+    u32 bucket;
+
+    if (stateful_firewall_src_conns(fn, &key->src_ip) < limit)
+        return false;
+    if (key->fragment == FW_FRAG_LATER)
+        return false;
+    bucket = hash_min(jhash_3words(fw_addr_fold(&key->src_ip), fw_addr_fold(&key->dst_ip), key->proto, 0), ct->bits);
+    return !conn_find(ct, bucket, &key->src_ip, &key->dst_ip, key->src_port, key->dst_port, key->proto);
+}
+
+// 命名空间 net 的当前连接数
+unsigned long stateful_firewall_count(struct net *net) {
+    return atomic_read(&fw_net(net)->conntrack.count);
 }
+EXPORT_SYMBOL_GPL(stateful_firewall_count);
 
-// 超时检测函数
-void timeout_check(struct timer_list *t) {
+// 超时检测函数，每个命名空间的定时器只扫描自己的连接表
+static void timeout_check(struct timer_list *t) {
+    struct fw_net *fn = from_timer(fn, t, conntrack.timer);
+    fw_conntrack_t *ct = &fn->conntrack;
     int bkt;
     connection_t *conn;
     struct hlist_node *tmp;
     unsigned long now = jiffies;
-
-    hash_for_each_safe(connection_table, bkt, tmp, conn, list) {
-        if (time_after(now, (unsigned long)conn->last_seen + TIMEOUT_INTERVAL)) {
-            hash_del(&conn->list);
-            kfree(conn);
+    fw_log_tuple_t tuple;
+
+    for (bkt = 0; bkt < (1 << ct->bits); bkt++) {
+        if (hlist_empty(&ct->table[bkt]))
+            continue;
+        // 定时器运行在软中断中，已关闭下半部
+        spin_lock(conn_lock(ct, bkt));
+        hlist_for_each_entry_safe(conn, tmp, &ct->table[bkt], list) {
+            if (!time_after(now, READ_ONCE(conn->last_seen) + TIMEOUT_INTERVAL))
+                continue;
+            tuple.src_ip = conn->src_ip;
+            tuple.dst_ip = conn->dst_ip;
+            tuple.src_port = conn->src_port;
+            tuple.dst_port = conn->dst_port;
+            tuple.proto = conn->proto;
+            event_ring_emit(FW_EVENT_FLOW_END, 0, 0, conn->state, &tuple);
+            trace_fw_conn_expire(&conn->src_ip, &conn->dst_ip, conn->src_port, conn->dst_port,
+                                 conn->proto, conn->state, now - conn->last_seen);
+            if (static_branch_unlikely(&fw_conn_sync_key))
+                conn_sync_queue(fn, conn, CONN_REC_DELETE);
+            conn_unlink(ct, conn);
+            fw_stat_inc(fn->stats, FW_STAT_CONN_EXPIRE);
         }
+        spin_unlock(conn_lock(ct, bkt));
     }
 
     // 重新启动定时器
-    mod_timer(&timeout_timer, jiffies + TIMEOUT_INTERVAL);
+    mod_timer(&ct->timer, jiffies + TIMEOUT_INTERVAL);
 }
 
 // 打印连接表的函数
-void print_connection_table(void) {
-    struct file *file;
+// 连接表的 CSV 文本，返回的缓冲区由调用者 kfree，*len 为文本长度
+char *stateful_firewall_format_table(struct fw_net *fn, size_t *len) {
+    static const char header[] = "src_ip,dst_ip,src_port,dst_port,proto,state,last_seen\n";
+    fw_conntrack_t *ct = &fn->conntrack;
     int bkt;
     connection_t *conn;
-    size_t offset = 0;
-    loff_t pos = 0;
+    char *buffer;
+    size_t buffer_size, offset = 0;
     char time_str[32];
-
-    // 计算缓冲区大小
-    buffer_size = snprintf(NULL, 0, "src_ip,dst_ip,src_port,dst_port,proto,state,last_seen\n");
-    hash_for_each(connection_table, bkt, conn, list) {
-        buffer_size += snprintf(NULL, 0, "%pI4,%pI4,%u,%u,%u,%d,%lu\n",
-                                &conn->src_ip, &conn->dst_ip, conn->src_port, conn->dst_port, conn->proto, conn->state, conn->last_seen);
+    char src[FW_ADDR_STRLEN], dst[FW_ADDR_STRLEN];
+
+    // 计算缓冲区大小，两次遍历之间新增的连接不会写入
+    get_current_time_str(time_str, sizeof(time_str));
+    buffer_size = sizeof(header) - 1;
+    rcu_read_lock();
+    conn_for_each_rcu(ct, bkt, conn) {
+        fw_addr_format(src, sizeof(src), &conn->src_ip);
+        fw_addr_format(dst, sizeof(dst), &conn->dst_ip);
+        buffer_size += snprintf(NULL, 0, "%s,%s,%u,%u,%u,%d,%s\n",
+                                src, dst, conn->src_port, conn->dst_port, conn->proto, conn->state, time_str);
     }
-    // log_message(LOG_INFO, "Buffer size: %zu", buffer_size);
+    rcu_read_unlock();
 
-    // 分配缓冲区
-    buffer = kmalloc(buffer_size + 1, GFP_KERNEL);
+    buffer = kvmalloc(buffer_size + 1, GFP_KERNEL);
     if (!buffer) {
         log_message(LOG_ERROR, "Failed to allocate memory for buffer");
-        return;
+        return NULL;
     }
 
-    // 填充缓冲区
-    offset += snprintf(buffer + offset, buffer_size - offset + 1, "src_ip,dst_ip,src_port,dst_port,proto,state,last_seen\n");
-    hash_for_each(connection_table, bkt, conn, list) {
-        get_current_time_str(time_str, sizeof(time_str));
-        offset += snprintf(buffer + offset, buffer_size - offset + 1, "%pI4,%pI4,%u,%u,%u,%d,%s\n",
-                           &conn->src_ip, &conn->dst_ip, conn->src_port, conn->dst_port, conn->proto, conn->state, time_str);
+    offset += scnprintf(buffer + offset, buffer_size - offset + 1, "%s", header);
+    rcu_read_lock();
+    conn_for_each_rcu(ct, bkt, conn) {
+        if (offset >= buffer_size)
+            break;
+        fw_addr_format(src, sizeof(src), &conn->src_ip);
+        fw_addr_format(dst, sizeof(dst), &conn->dst_ip);
+        offset += scnprintf(buffer + offset, buffer_size - offset + 1, "%s,%s,%u,%u,%u,%d,%s\n",
+                            src, dst, conn->src_port, conn->dst_port, conn->proto, conn->state, time_str);
     }
+    rcu_read_unlock();
+    *len = offset;
+    return buffer;
+}
+
+void print_connection_table(struct fw_net *fn) {
+    struct file *file;
+    char *buffer;
+    size_t len;
+    loff_t pos = 0;
+
+    buffer = stateful_firewall_format_table(fn, &len);
+    if (!buffer)
+        return;
 
     // 打开文件
     file = filp_open("/tmp/connection_table.csv", O_WRONLY | O_CREAT | O_TRUNC, 0644);
     if (IS_ERR(file)) {
         log_message(LOG_ERROR, "Failed to open /tmp/connection_table.csv");
-        kfree(buffer);
+        kvfree(buffer);
         return;
     }
 
     // 写入文件
-    kernel_write(file, buffer, buffer_size, &pos);
+    kernel_write(file, buffer, len, &pos);
 
     // 关闭文件
     filp_close(file, NULL);
 
     // 释放缓冲区
-    kfree(buffer);
+    kvfree(buffer);
 }
 
-// 状态检测初始化函数
-int stateful_firewall_init(void) {
-    log_message(LOG_INFO, "Initializing Stateful Firewall");
+// 控制设备的连接表快照：最多复制 max 条，返回复制的条数
+unsigned int stateful_firewall_dump(struct fw_net *fn, struct fw_ctrl_conn *out, unsigned int max) {
+    fw_conntrack_t *ct = &fn->conntrack;
+    connection_t *conn;
+    unsigned long now = jiffies;
+    unsigned int n = 0;
+    int bkt;
 
-    // 初始化连接表
-    hash_init(connection_table);
+    rcu_read_lock();
+    conn_for_each_rcu(ct, bkt, conn) {
+        struct fw_ctrl_conn *c;
+
+        if (n == max)
+            break;
+        c = &out[n];
+        memset(c, 0, sizeof(*c));
+        memcpy(c->src_ip, &conn->src_ip, sizeof(c->src_ip));
+        memcpy(c->dst_ip, &conn->dst_ip, sizeof(c->dst_ip));
+        c->src_port = conn->src_port;
+        c->dst_port = conn->dst_port;
+        c->proto = conn->proto;
+        c->state = conn->state;
+        c->idle_ms = jiffies_to_msecs(now - min(READ_ONCE(conn->last_seen), now));
+        n++;
+    }
+    rcu_read_unlock();
+    return n;
+}
 
-    // 初始化定时器
-    timer_setup(&timeout_timer, timeout_check, 0);
-    mod_timer(&timeout_timer, jiffies + TIMEOUT_INTERVAL);
+void change_conntrack_snapshot_path(char *path) {
+    strscpy(conntrack_snapshot_path, path, sizeof(conntrack_snapshot_path));
+}
 
-    return 0;
+static int conn_snapshot_write(struct file *file, const void *buf, size_t len, loff_t *pos) {
+    ssize_t ret = kernel_write(file, buf, len, pos);
+
+    if (ret < 0)
+        return ret;
+    return ret == len ? 0 : -EIO;
 }
 
-// 状态检测退出函数
-void stateful_firewall_exit(void) {
-    int bkt;
+// 把连接表写入 conntrack_snapshot。写文件可能睡眠，不能在 RCU 读临界区内进行，
+// 所以逐个桶复制到缓冲区，缓冲区满时写出，再跳过已复制的项继续遍历同一个桶。
+// 保存期间钩子仍在运行，之后新建的连接不在快照里，同一个桶里的增删可能让
+// 一条连接重复或缺失，重复的在恢复时去掉
+int stateful_firewall_save(struct fw_net *fn) {
+    fw_conntrack_t *ct = &fn->conntrack;
+    struct conn_snapshot_hdr hdr = {
+        .magic = CONN_SNAPSHOT_MAGIC,
+        .version = CONN_SNAPSHOT_VERSION,
+        .record_size = sizeof(conn_rec_t),
+    };
+    conn_rec_t *recs;
     connection_t *conn;
-    struct hlist_node *tmp;
+    struct file *file;
+    loff_t pos = sizeof(hdr);
+    unsigned long now;
+    unsigned int n = 0, skip = 0, start, i;
+    int bkt = 0, ret = 0;
+
+    if (!conntrack_snapshot_path[0])
+        return 0;
+    recs = kvmalloc_array(CONN_SNAPSHOT_CHUNK, sizeof(*recs), GFP_KERNEL);
+    if (!recs)
+        return -ENOMEM;
+    file = filp_open(conntrack_snapshot_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (IS_ERR(file)) {
+        if (PTR_ERR(file) == -ENOENT)
+            log_message(LOG_ERROR, "Conntrack snapshot directory of %s does not exist, connections not saved",
+                        conntrack_snapshot_path);
+        else
+            log_message(LOG_WARN, "Failed to open conntrack snapshot %s", conntrack_snapshot_path);
+        kvfree(recs);
+        return PTR_ERR(file);
+    }
 
-    log_message(LOG_INFO, "Exiting Stateful Firewall");
+    hdr.saved_ns = ktime_get_real_ns();
+    now = jiffies;
+    while (bkt < (1 << ct->bits) && !ret) {
+        start = n;
+        i = 0;
+        rcu_read_lock();
+        hlist_for_each_entry_rcu(conn, &ct->table[bkt], list) {
+            conn_rec_t *rec = &recs[n];
+
+            if (i++ < skip)
+                continue;
+            if (n == CONN_SNAPSHOT_CHUNK)
+                break;
+            memset(rec, 0, sizeof(*rec));
+            rec->src_ip = conn->src_ip;
+            rec->dst_ip = conn->dst_ip;
+            rec->src_port = conn->src_port;
+            rec->dst_port = conn->dst_port;
+            rec->proto = conn->proto;
+            rec->state = conn->state;
+            rec->idle_ms = jiffies_to_msecs(now - min(READ_ONCE(conn->last_seen), now));
+            n++;
+        }
+        rcu_read_unlock();
+        if (n < CONN_SNAPSHOT_CHUNK) {
+            bkt++;
+            skip = 0;
+            continue;
+        }
+        // 缓冲区满，可能停在桶中间，写出后从下一项接着复制
+        skip += n - start;
+        ret = conn_snapshot_write(file, recs, n * sizeof(*recs), &pos);
+        hdr.count += n;
+        n = 0;
+    }
+    if (!ret && n) {
+        ret = conn_snapshot_write(file, recs, n * sizeof(*recs), &pos);
+        hdr.count += n;
+    }
+    // 文件头最后写，写到一半失败的快照 count 为 0
+    pos = 0;
+    if (!ret)
+        ret = conn_snapshot_write(file, &hdr, sizeof(hdr), &pos);
+    filp_close(file, NULL);
+    kvfree(recs);
 
-    // 删除定时器
-    del_timer_sync(&timeout_timer);
+    if (ret)
+        log_message(LOG_WARN, "Failed to write conntrack snapshot %s: %d", conntrack_snapshot_path, ret);
+    else
+        log_message(LOG_INFO, "Saved %u connections to %s", hdr.count, conntrack_snapshot_path);
+    return ret;
+}
+
+// 已有的连接遇到快照或同步来的同一连接：记录较新时才更新，表里的连接可能
+// 已经被之后的包更新过
+static void conn_apply_update(connection_t *conn, const conn_rec_t *rec, unsigned long last_seen) {
+    if (time_after(last_seen, READ_ONCE(conn->last_seen))) {
+        WRITE_ONCE(conn->state, rec->state);
+        WRITE_ONCE(conn->last_seen, last_seen);
+    }
+}
 
-    // 清理连接表
-    hash_for_each_safe(connection_table, bkt, tmp, conn, list) {
-        hash_del(&conn->list);
+// 写入一条快照或同步来的连接，可能睡眠。返回 1 表示新插入，0 表示已有，
+// 连接表已满时返回 -ENOSPC
+static int conn_apply(fw_conntrack_t *ct, const conn_rec_t *rec, unsigned long last_seen) {
+    u32 bucket = hash_min(jhash_3words(fw_addr_fold(&rec->src_ip), fw_addr_fold(&rec->dst_ip), rec->proto, 0), ct->bits);
+    connection_t *conn, *old;
+
+    // 同步来的记录多数是已有连接的更新，先查找，找不到再分配
+    spin_lock_bh(conn_lock(ct, bucket));
+    old = conn_find(ct, bucket, &rec->src_ip, &rec->dst_ip, rec->src_port, rec->dst_port, rec->proto);
+    if (old)
+        conn_apply_update(old, rec, last_seen);
+    spin_unlock_bh(conn_lock(ct, bucket));
+    if (old)
+        return 0;
+    if (conn_table_full(ct))
+        return -ENOSPC;
+
+    conn = kmalloc(sizeof(connection_t), GFP_KERNEL);
+    if (!conn)
+        return -ENOMEM;
+    conn->src_ip = rec->src_ip;
+    conn->dst_ip = rec->dst_ip;
+    conn->src_port = rec->src_port;
+    conn->dst_port = rec->dst_port;
+    conn->proto = rec->proto;
+    conn->state = rec->state;
+    conn->flags = 0; // 写入的半开连接不计入 SYN 洪泛的计数
+    conn->last_seen = last_seen;
+    conn->synced = jiffies;
+
+    spin_lock_bh(conn_lock(ct, bucket));
+    // 钩子已注册，解锁期间可能已经有包建了它
+    old = conn_find(ct, bucket, &rec->src_ip, &rec->dst_ip, rec->src_port, rec->dst_port, rec->proto);
+    if (old) {
+        conn_apply_update(old, rec, last_seen);
+        spin_unlock_bh(conn_lock(ct, bucket));
         kfree(conn);
+        return 0;
     }
+    hlist_add_head_rcu(&conn->list, &ct->table[bucket]);
+    spin_unlock_bh(conn_lock(ct, bucket));
+    atomic_inc(&ct->count);
+    conn_sketch_add(ct, &conn->src_ip, 1);
+    return 1;
+}
 
-    // 释放缓冲区
-    if (buffer) {
-        kfree(buffer);
-        buffer = NULL;
+// 主机发送一条同步记录前调用：填入连接的最新状态和空闲时间，清除排队标志。
+// 连接已经删除时返回 false，删除记录另外排队
+bool stateful_firewall_sync_fill(struct fw_net *fn, conn_rec_t *rec) {
+    fw_conntrack_t *ct = &fn->conntrack;
+    u32 bucket = hash_min(jhash_3words(fw_addr_fold(&rec->src_ip), fw_addr_fold(&rec->dst_ip), rec->proto, 0), ct->bits);
+    unsigned long now = jiffies;
+    connection_t *conn;
+
+    rcu_read_lock();
+    conn = conn_find(ct, bucket, &rec->src_ip, &rec->dst_ip, rec->src_port, rec->dst_port, rec->proto);
+    if (conn) {
+        rec->state = READ_ONCE(conn->state);
+        rec->idle_ms = jiffies_to_msecs(now - min(READ_ONCE(conn->last_seen), now));
+        WRITE_ONCE(conn->synced, now);
+        // 之后状态再变的包会重新排队
+        clear_bit(CONN_F_SYNC_QUEUED, &conn->flags);
+    }
+    rcu_read_unlock();
+    return conn != NULL;
+}
+
+// 备机写入一条收到的记录，可能睡眠。返回 1 表示插入或删除了连接，0 表示
+// 只更新了已有连接或要删除的连接不存在，连接表已满时返回 -ENOSPC
+int stateful_firewall_sync_apply(struct fw_net *fn, const conn_rec_t *rec) {
+    fw_conntrack_t *ct = &fn->conntrack;
+    u32 bucket = hash_min(jhash_3words(fw_addr_fold(&rec->src_ip), fw_addr_fold(&rec->dst_ip), rec->proto, 0), ct->bits);
+    connection_t *conn;
+
+    if (rec->op == CONN_REC_UPDATE) {
+        int ret;
+
+        if (rec->idle_ms >= jiffies_to_msecs(TIMEOUT_INTERVAL))
+            return 0;
+        ret = conn_apply(ct, rec, jiffies - msecs_to_jiffies(rec->idle_ms));
+        if (ret == -ENOSPC)
+            fw_stat_inc(fn->stats, FW_STAT_CONN_FULL);
+        return ret;
     }
+    spin_lock_bh(conn_lock(ct, bucket));
+    conn = conn_find(ct, bucket, &rec->src_ip, &rec->dst_ip, rec->src_port, rec->dst_port, rec->proto);
+    if (conn)
+        conn_unlink(ct, conn);
+    spin_unlock_bh(conn_lock(ct, bucket));
+    return conn != NULL;
+}
 
-    log_message(LOG_INFO, "Stateful Firewall exited successfully");
+// 快照文件不存在时检查它所在的目录，目录不存在则卸载时无法保存，加载时就提示
+static void conn_snapshot_check_dir(void) {
+    char dir[sizeof(conntrack_snapshot_path)];
+    char *slash;
+    struct file *file;
+
+    strscpy(dir, conntrack_snapshot_path, sizeof(dir));
+    slash = strrchr(dir, '/');
+    if (!slash || slash == dir)
+        return;
+    *slash = '\0';
+    file = filp_open(dir, O_RDONLY | O_DIRECTORY, 0);
+    if (IS_ERR(file)) {
+        log_message(LOG_ERROR, "Conntrack snapshot directory %s does not exist, connections will not be saved",
+                    dir);
+        return;
+    }
+    filp_close(file, NULL);
+}
+
+// 从 conntrack_snapshot 读回连接，文件不存在时什么也不做。恢复的连接从现在
+// 重新计时，有一个完整的超时周期等待下一个包；保存时已经超时的连接不恢复，
+// 停机超过 conntrack_snapshot_max_age 的快照整个忽略
+int stateful_firewall_restore(struct fw_net *fn) {
+    fw_conntrack_t *ct = &fn->conntrack;
+    struct conn_snapshot_hdr hdr;
+    conn_rec_t *recs = NULL;
+    struct file *file;
+    loff_t pos = 0;
+    unsigned long now = jiffies;
+    u64 down_ms, real_ns, max_age_ms;
+    unsigned int left, restored = 0, expired = 0, i;
+    ssize_t len;
+    int ret = 0;
+
+    if (!conntrack_snapshot_path[0])
+        return 0;
+    file = filp_open(conntrack_snapshot_path, O_RDONLY, 0);
+    if (IS_ERR(file)) {
+        if (PTR_ERR(file) != -ENOENT)
+            return PTR_ERR(file);
+        conn_snapshot_check_dir();
+        return 0;
+    }
+
+    len = kernel_read(file, &hdr, sizeof(hdr), &pos);
+    if (len != sizeof(hdr) || hdr.magic != CONN_SNAPSHOT_MAGIC || hdr.version != CONN_SNAPSHOT_VERSION ||
+        hdr.record_size != sizeof(conn_rec_t)) {
+        log_message(LOG_WARN, "Ignoring invalid conntrack snapshot %s", conntrack_snapshot_path);
+        ret = -EINVAL;
+        goto out;
+    }
+    recs = kvmalloc_array(CONN_SNAPSHOT_CHUNK, sizeof(*recs), GFP_KERNEL);
+    if (!recs) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    real_ns = ktime_get_real_ns();
+    down_ms = real_ns > hdr.saved_ns ? div_u64(real_ns - hdr.saved_ns, NSEC_PER_MSEC) : 0;
+    max_age_ms = (u64)READ_ONCE(conntrack_snapshot_max_age) * MSEC_PER_SEC;
+    if (max_age_ms && down_ms >= max_age_ms) {
+        log_message(LOG_WARN, "Ignoring conntrack snapshot %s saved %llu ms ago", conntrack_snapshot_path, down_ms);
+        goto out;
+    }
+
+    for (left = hdr.count; left && !ret; ) {
+        len = kernel_read(file, recs, min(left, (unsigned int)CONN_SNAPSHOT_CHUNK) * sizeof(*recs), &pos);
+        if (len < (ssize_t)sizeof(*recs))
+            break; // 文件比 count 短
+        for (i = 0; i < len / sizeof(*recs); i++) {
+            if (recs[i].idle_ms >= jiffies_to_msecs(TIMEOUT_INTERVAL)) {
+                expired++;
+                continue;
+            }
+            ret = conn_apply(ct, &recs[i], now);
+            if (ret == -ENOSPC)
+                log_message(LOG_WARN, "Conntrack table full, %u connections not restored", left - i);
+            if (ret < 0)
+                break;
+            restored += ret;
+            ret = 0;
+        }
+        left -= len / sizeof(*recs);
+    }
+    log_message(LOG_INFO, "Restored %u connections from %s after %llu ms, %u had expired before saving",
+                restored, conntrack_snapshot_path, down_ms, expired);
+out:
+    kvfree(recs);
+    filp_close(file, NULL);
+    return ret;
+}
+
+// 状态检测初始化函数，命名空间创建时调用。初始命名空间按 conntrack_hash_bits
+// 分配桶，之后创建的命名空间按 conntrack_netns_hash_bits，容器默认用小表
+int stateful_firewall_init(struct fw_net *fn) {
+    fw_conntrack_t *ct = &fn->conntrack;
+    unsigned int bits = net_eq(fn->net, &init_net) ? conntrack_hash_bits : READ_ONCE(conntrack_netns_hash_bits);
+    int i;
+
+    ct->bits = clamp_t(unsigned int, bits, CONN_HASH_BITS_MIN, CONN_HASH_BITS_MAX);
+    ct->table = kvcalloc(1 << ct->bits, sizeof(*ct->table), GFP_KERNEL);
+    if (!ct->table)
+        return -ENOMEM;
+    ct->src_half_open = kvcalloc(CONN_SRC_SLOTS, sizeof(*ct->src_half_open), GFP_KERNEL);
+    if (!ct->src_half_open) {
+        kvfree(ct->table);
+        ct->table = NULL;
+        return -ENOMEM;
+    }
+    ct->src_seed = get_random_u32();
+    // sketch 的宽度随桶数，每行是桶数的 1/4
+    ct->sketch_bits = max_t(unsigned int, ct->bits - 2, CONN_SKETCH_BITS_MIN);
+    ct->src_sketch = kvcalloc(CONN_SKETCH_ROWS << ct->sketch_bits, sizeof(*ct->src_sketch), GFP_KERNEL);
+    if (!ct->src_sketch) {
+        kvfree(ct->src_half_open);
+        kvfree(ct->table);
+        ct->src_half_open = NULL;
+        ct->table = NULL;
+        return -ENOMEM;
+    }
+    ct->sketch_seed[0] = get_random_u32();
+    ct->sketch_seed[1] = get_random_u32();
+    ct->cookies = kvcalloc(1 << ct->bits, sizeof(*ct->cookies), GFP_KERNEL);
+    if (!ct->cookies) {
+        kvfree(ct->src_sketch);
+        kvfree(ct->src_half_open);
+        kvfree(ct->table);
+        ct->src_sketch = NULL;
+        ct->src_half_open = NULL;
+        ct->table = NULL;
+        return -ENOMEM;
+    }
+    ct->cookie_seed = get_random_u32();
+    for (i = 0; i < CONN_LOCKS; i++)
+        spin_lock_init(&ct->locks[i]);
+    atomic_set(&ct->count, 0);
+    atomic_set(&ct->half_open, 0);
+
+    // 初始化定时器
+    timer_setup(&ct->timer, timeout_check, 0);
+    mod_timer(&ct->timer, jiffies + TIMEOUT_INTERVAL);
+
+    log_message(LOG_INFO, "Initialized conntrack with %u buckets", 1U << ct->bits);
+    return 0;
+}
+
+// 状态检测退出函数，命名空间销毁时调用，钩子已注销
+void stateful_firewall_exit(struct fw_net *fn) {
+    fw_conntrack_t *ct = &fn->conntrack;
+    int bkt;
+    connection_t *conn;
+    struct hlist_node *tmp;
+
+    // 删除定时器
+    del_timer_sync(&ct->timer);
+
+    // 清理连接表，节点经 kfree_rcu 释放，fw_net_exit_batch() 中等待回调完成
+    for (bkt = 0; bkt < (1 << ct->bits); bkt++) {
+        spin_lock_bh(conn_lock(ct, bkt));
+        hlist_for_each_entry_safe(conn, tmp, &ct->table[bkt], list) {
+            hlist_del_rcu(&conn->list);
+            kfree_rcu(conn, rcu);
+        }
+        spin_unlock_bh(conn_lock(ct, bkt));
+    }
+    atomic_set(&ct->count, 0);
+    atomic_set(&ct->half_open, 0);
+    kvfree(ct->table);
+    ct->table = NULL;
+    kvfree(ct->src_half_open);
+    ct->src_half_open = NULL;
+    kvfree(ct->src_sketch);
+    ct->src_sketch = NULL;
+    kvfree(ct->cookies);
+    ct->cookies = NULL;
 }
 
 const char* get_protocol_type(uint8_t proto) {
@@ -247,6 +921,8 @@ const char* get_protocol_type(uint8_t proto) {
             return "UDP";
         case IPPROTO_ICMP:
             return "ICMP";
+        case IPPROTO_ICMPV6:
+            return "ICMPv6";
         case IPPROTO_IP:
             return "IP";
         default:
@@ -7,23 +7,99 @@
 #include <linux/skbuff.h>      // 包含 sk_buff 类型
 #include <linux/timer.h>       // 包含 timer_list 类型
 #include <linux/hashtable.h>   // 包含 DEFINE_HASHTABLE 宏
+#include <linux/rcupdate.h>    // 包含 rcu_head 类型
+#include <linux/spinlock.h>
+#include <linux/atomic.h>
+#include "flow_key.h"
+
+#define CONN_LOCKS 1024 // 桶锁条带数，多个桶共用一把锁
+#define CONN_SRC_SLOTS 4096 // 按源地址统计半开连接的槽数，哈希冲突的源共用一个槽
+
+// 按源地址统计连接数的 count-min sketch：CONN_SKETCH_ROWS 行，每行 1 << sketch_bits
+// 个计数器，每行用不同的哈希选一个计数器，取各行的最小值。只会高估，不会低估
+#define CONN_SKETCH_ROWS 4
+#define CONN_SKETCH_BITS_MIN 8
+
+// connection_t.flags
+#define CONN_F_HALF_OPEN 0    // 计入 fw_conntrack_t.half_open
+#define CONN_F_SRC_COUNTED 1  // 计入 src_half_open 中源地址的槽
+#define CONN_F_SYNC_QUEUED 2  // 已在主备同步的发送队列中，发送时取最新状态
 
 typedef struct connection_t {
-    uint32_t src_ip;
-    uint32_t dst_ip;
+    fw_addr_t src_ip; // IPv4 为映射地址，与 IPv6 共用一张表
+    fw_addr_t dst_ip;
     uint16_t src_port;
     uint16_t dst_port;
     uint8_t proto;
     int state;
+    unsigned long flags; // CONN_F_*，原子位操作
     unsigned long last_seen;
+    unsigned long synced; // 上次同步给对端的时间（jiffies）
     struct hlist_node list;
+    struct rcu_head rcu;
 } connection_t;
 
-extern struct hlist_head connection_table[1 << 16]; // 声明连接表
+// 连接表，每个网络命名空间一张（struct fw_net 的 conntrack）。
+// 桶数在命名空间创建时按模块参数确定，各自的定时器各自老化
+typedef struct fw_conntrack {
+    struct hlist_head *table; // 1 << bits 个桶
+    unsigned int bits;
+    spinlock_t locks[CONN_LOCKS];
+    atomic_t count;
+    // 由 SYN 或 SYN-ACK 新建、同方向还没有不带 SYN 的包跟上的 TCP 连接
+    atomic_t half_open;
+    atomic_t *src_half_open; // CONN_SRC_SLOTS 个，只统计纯 SYN 新建的连接
+    u32 src_seed;
+    atomic_t *src_sketch; // CONN_SKETCH_ROWS << sketch_bits 个，连接插入时加一、删除时减一
+    unsigned int sketch_bits;
+    u32 sketch_seed[2];
+    // 半开连接超限期间放行的 SYN-ACK：按四元组选槽，存 (四元组, 服务端 ISN + 1)
+    // 的带密钥哈希，1 << bits 个。客户端 ACK 的确认号与之相符才建连接
+    u32 *cookies;
+    u32 cookie_seed;
+    struct timer_list timer;
+} fw_conntrack_t;
+
+// 同 hash_for_each_rcu：遍历 ct 中的连接，循环体内的 break 结束整个遍历
+#define conn_for_each_rcu(ct, bkt, conn)                                                \
+    for ((bkt) = 0, (conn) = NULL; (conn) == NULL && (bkt) < (1 << (ct)->bits); (bkt)++) \
+        hlist_for_each_entry_rcu(conn, &(ct)->table[bkt], list)
+
+// 一条连接的记录，连接表快照和主备同步共用，按本机字节序
+#define CONN_REC_UPDATE 0 // 新建或更新连接
+#define CONN_REC_DELETE 1 // 删除连接，只用于同步
+
+typedef struct conn_rec {
+    fw_addr_t src_ip;
+    fw_addr_t dst_ip;
+    u16 src_port;
+    u16 dst_port;
+    u8 proto;
+    u8 state;
+    u8 op;       // CONN_REC_*
+    u8 reserved;
+    u32 idle_ms; // 距 last_seen 的毫秒数
+} conn_rec_t;
+
+struct net;
+struct fw_net;
 
-int stateful_firewall_check(struct sk_buff *skb, int direction);
-int stateful_firewall_init(void);
-void stateful_firewall_exit(void);
-void print_connnection_table(void);
+int stateful_firewall_check(struct fw_net *fn, const fw_flow_key_t *key, int direction);
+int stateful_firewall_init(struct fw_net *fn);
+void stateful_firewall_exit(struct fw_net *fn);
+void print_connection_table(struct fw_net *fn);
+char *stateful_firewall_format_table(struct fw_net *fn, size_t *len);
+struct fw_ctrl_conn;
+unsigned int stateful_firewall_dump(struct fw_net *fn, struct fw_ctrl_conn *out, unsigned int max);
+unsigned long stateful_firewall_count(struct net *net);
+u32 stateful_firewall_src_conns(struct fw_net *fn, const fw_addr_t *src_ip);
+bool stateful_firewall_over_limit(struct fw_net *fn, const fw_flow_key_t *key, u32 limit);
 const char *get_protocol_type(uint8_t proto);
+// 连接表快照，只用于 init_net：卸载前保存，加载时恢复
+int stateful_firewall_save(struct fw_net *fn);
+int stateful_firewall_restore(struct fw_net *fn);
+void change_conntrack_snapshot_path(char *path);
+// 主备同步：主机发送前取连接的最新状态，备机写入收到的记录
+bool stateful_firewall_sync_fill(struct fw_net *fn, conn_rec_t *rec);
+int stateful_firewall_sync_apply(struct fw_net *fn, const conn_rec_t *rec);
 #endif // STATEFUL_CHECK_H
\ No newline at end of file
@@ -0,0 +1,228 @@
+#include "stats.h"
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/seq_file.h>
+#include <linux/cpumask.h>
+#include <linux/hashtable.h>
+#include <linux/uaccess.h>
+#include <linux/slab.h>
+#include <linux/math64.h>
+#include <linux/seq_file_net.h>
+#include "fw_net.h"
+
+#define CHAIN_HIST_MAX 8 // chains of this length or longer share the last bucket
+
+DEFINE_STATIC_KEY_TRUE(fw_stats_latency_key);
+
+static int stats_key_set(const char *val, const struct kernel_param *kp)
+{
+    bool enable;
+    int ret = kstrtobool(val, &enable);
+
+    if (ret)
+        return ret;
+    if (enable)
+        static_branch_enable(&fw_stats_latency_key);
+    else
+        static_branch_disable(&fw_stats_latency_key);
+    return 0;
+}
+
+static int stats_key_get(char *buffer, const struct kernel_param *kp)
+{
+    return sprintf(buffer, "%c\n", static_key_enabled(&fw_stats_latency_key) ? 'Y' : 'N');
+}
+
+static const struct kernel_param_ops stats_key_ops = {
+    .set = stats_key_set,
+    .get = stats_key_get,
+};
+
+module_param_cb(stats_latency, &stats_key_ops, NULL, 0644);
+MODULE_PARM_DESC(stats_latency, "Time every hook invocation for /proc/fw_stats (default Y)");
+
+static const char *const hook_names[FW_HOOK_MAX] = {
+    [FW_HOOK_PRE] = "pre_routing",
+    [FW_HOOK_IN] = "local_in",
+    [FW_HOOK_FWD] = "forward",
+    [FW_HOOK_OUT] = "local_out",
+    [FW_HOOK_NAT] = "nat",
+};
+
+static const char *const counter_names[FW_STAT_MAX] = {
+    [FW_STAT_CONN_INSERT] = "conn_insert",
+    [FW_STAT_CONN_EXPIRE] = "conn_expire",
+    [FW_STAT_CONN_ALLOC_FAIL] = "conn_alloc_fail",
+    [FW_STAT_FRAG_HIT] = "frag_hit",
+    [FW_STAT_FRAG_MISS] = "frag_miss",
+    [FW_STAT_SYN_STATELESS] = "syn_stateless",
+    [FW_STAT_SYN_SRC_LIMIT] = "syn_src_limit",
+    [FW_STAT_LIMIT_DROP] = "limit_drop",
+    [FW_STAT_NOTRACK] = "notrack",
+    [FW_STAT_CONNLIMIT] = "connlimit",
+    [FW_STAT_SYNC_SENT] = "sync_sent",
+    [FW_STAT_SYNC_QUEUE_DROP] = "sync_queue_drop",
+    [FW_STAT_SYNC_RECV] = "sync_recv",
+    [FW_STAT_SYNC_LOST] = "sync_lost",
+    [FW_STAT_SYNC_BAD] = "sync_bad",
+    [FW_STAT_ND_ACCEPT] = "nd_accept",
+    [FW_STAT_SYN_NOSTATE] = "syn_nostate",
+    [FW_STAT_CONN_FULL] = "conn_full",
+    [FW_STAT_SYNC_FOREIGN] = "sync_foreign",
+    [FW_STAT_SYN_COOKIE] = "syn_cookie",
+};
+
+// Sum every CPU's counters. Readers may see a value mid-update on a 32-bit
+// machine; the numbers are for monitoring, not accounting.
+void fw_stats_sum(struct fw_cpu_stats __percpu *stats, struct fw_cpu_stats *sum)
+{
+    int cpu, h, b, c;
+
+    memset(sum, 0, sizeof(*sum));
+    for_each_possible_cpu(cpu) {
+        const struct fw_cpu_stats *s = per_cpu_ptr(stats, cpu);
+
+        for (h = 0; h < FW_HOOK_MAX; h++) {
+            sum->accept[h] += READ_ONCE(s->accept[h]);
+            sum->drop[h] += READ_ONCE(s->drop[h]);
+            for (b = 0; b < FW_LAT_BUCKETS; b++)
+                sum->lat[h][b] += READ_ONCE(s->lat[h][b]);
+        }
+        for (c = 0; c < FW_STAT_MAX; c++)
+            sum->counter[c] += READ_ONCE(s->counter[c]);
+    }
+}
+
+// Approximate percentile from the log2 histogram: the upper bound of the
+// bucket containing it.
+static u64 stats_percentile(const u64 *lat, u64 total, unsigned int pct)
+{
+    u64 want = div_u64(total * pct + 99, 100), seen = 0;
+    int b;
+
+    for (b = 0; b < FW_LAT_BUCKETS; b++) {
+        seen += lat[b];
+        if (seen >= want)
+            return b ? 1ULL << b : 0;
+    }
+    return 1ULL << (FW_LAT_BUCKETS - 1);
+}
+
+static void stats_show_conntrack(struct seq_file *m, fw_conntrack_t *ct)
+{
+    unsigned long chain_hist[CHAIN_HIST_MAX + 1] = { 0 };
+    unsigned long entries = 0, used = 0, max_chain = 0;
+    connection_t *conn;
+    int bkt, i;
+
+    // Lockless walk; chains may change while we count
+    rcu_read_lock();
+    for (bkt = 0; bkt < (1 << ct->bits); bkt++) {
+        unsigned long len = 0;
+
+        hlist_for_each_entry_rcu(conn, &ct->table[bkt], list)
+            len++;
+        entries += len;
+        used += len != 0;
+        max_chain = max(max_chain, len);
+        chain_hist[min_t(unsigned long, len, CHAIN_HIST_MAX)]++;
+    }
+    rcu_read_unlock();
+
+    seq_printf(m, "\nconntrack\n");
+    seq_printf(m, "  entries          %lu\n", entries);
+    seq_printf(m, "  half_open        %d\n", atomic_read(&ct->half_open));
+    seq_printf(m, "  src_sketch       %dx%u\n", CONN_SKETCH_ROWS, 1U << ct->sketch_bits);
+    seq_printf(m, "  buckets          %lu\n", 1UL << ct->bits);
+    seq_printf(m, "  buckets_used     %lu\n", used);
+    seq_printf(m, "  max_chain        %lu\n", max_chain);
+    seq_printf(m, "  chain_length     buckets\n");
+    for (i = 0; i <= CHAIN_HIST_MAX; i++)
+        seq_printf(m, "  %2d%-14s %lu\n", i, i == CHAIN_HIST_MAX ? "+" : "", chain_hist[i]);
+}
+
+static void stats_show_ruleset(struct seq_file *m, struct fw_net *fn)
+{
+    rule_reload_stats_t rs;
+
+    rule_filter_get_reload_stats(fn, &rs);
+    seq_printf(m, "\nruleset\n");
+    seq_printf(m, "  generation       %llu\n", rs.generation);
+    seq_printf(m, "  rules            %u\n", rs.rules);
+    seq_printf(m, "  bytes            %zu\n", rs.bytes);
+    seq_printf(m, "  sets             %u\n", rs.sets);
+    seq_printf(m, "  set_entries      %llu\n", rs.set_entries);
+    seq_printf(m, "  reloads          %llu\n", rs.reloads);
+    seq_printf(m, "  reload_failures  %llu\n", rs.failures);
+    seq_printf(m, "  last_load_us     %llu\n", div_u64(rs.last_load_ns, NSEC_PER_USEC));
+    seq_printf(m, "  max_load_us      %llu\n", div_u64(rs.max_load_ns, NSEC_PER_USEC));
+    seq_printf(m, "  last_publish_ns  %llu\n", rs.last_publish_ns);
+    seq_printf(m, "  max_publish_ns   %llu\n", rs.max_publish_ns);
+    seq_printf(m, "  old_generations  %ld\n", rs.old_generations);
+    seq_printf(m, "  old_bytes        %ld\n", rs.old_bytes);
+}
+
+// Everything shown is the reading namespace's own instance
+int stats_proc_show(struct seq_file *m, void *v)
+{
+    struct fw_net *fn = fw_net(seq_file_single_net(m));
+    struct fw_cpu_stats *sum;
+    int h, b, c;
+
+    sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+    if (!sum)
+        return -ENOMEM;
+    fw_stats_sum(fn->stats, sum);
+
+    seq_printf(m, "%-12s %14s %14s %10s %10s %10s\n", "hook", "accept", "drop", "p50_ns", "p99_ns", "max_ns");
+    for (h = 0; h < FW_HOOK_MAX; h++) {
+        u64 total = 0;
+        int top = 0;
+
+        for (b = 0; b < FW_LAT_BUCKETS; b++) {
+            total += sum->lat[h][b];
+            if (sum->lat[h][b])
+                top = b;
+        }
+        seq_printf(m, "%-12s %14llu %14llu %10llu %10llu %10llu\n", hook_names[h],
+                   sum->accept[h], sum->drop[h],
+                   total ? stats_percentile(sum->lat[h], total, 50) : 0,
+                   total ? stats_percentile(sum->lat[h], total, 99) : 0,
+                   total && top ? 1ULL << top : 0);
+    }
+
+    seq_printf(m, "\nlatency_ns\n");
+    for (h = 0; h < FW_HOOK_MAX; h++) {
+        for (b = 0; b < FW_LAT_BUCKETS; b++) {
+            if (!sum->lat[h][b])
+                continue;
+            if (b == 0)
+                seq_printf(m, "  %-12s %21s %14llu\n", hook_names[h], "0", sum->lat[h][b]);
+            else
+                seq_printf(m, "  %-12s %10llu-%-10llu %14llu\n", hook_names[h],
+                           1ULL << (b - 1), (1ULL << b) - 1, sum->lat[h][b]);
+        }
+    }
+
+    seq_printf(m, "\ncounters\n");
+    for (c = 0; c < FW_STAT_MAX; c++)
+        seq_printf(m, "  %-16s %llu\n", counter_names[c], sum->counter[c]);
+
+    stats_show_ruleset(m, fn);
+    stats_show_conntrack(m, &fn->conntrack);
+    kfree(sum);
+    return 0;
+}
+
+// Writing anything to /proc/net/fw_stats clears that namespace's counters,
+// e.g. before a benchmark run. Concurrent increments may survive the reset.
+int stats_proc_write(struct file *file, char *buf, size_t count)
+{
+    struct fw_net *fn = fw_net(seq_file_single_net(file->private_data));
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        memset(per_cpu_ptr(fn->stats, cpu), 0, sizeof(struct fw_cpu_stats));
+    return 0;
+}
@@ -0,0 +1,100 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/percpu.h>
+#include <linux/sched/clock.h>
+#include <linux/bitops.h>
+#include <linux/jump_label.h>
+#include <linux/netfilter.h>
+
+// 被计时的钩子
+enum fw_stat_hook {
+    FW_HOOK_PRE,
+    FW_HOOK_IN,
+    FW_HOOK_FWD,
+    FW_HOOK_OUT,
+    FW_HOOK_NAT,
+    FW_HOOK_MAX,
+};
+
+// 全局计数器
+enum fw_stat_counter {
+    FW_STAT_CONN_INSERT,     // 新建连接
+    FW_STAT_CONN_EXPIRE,     // 超时删除的连接
+    FW_STAT_CONN_ALLOC_FAIL, // 连接分配失败（包被丢弃）
+    FW_STAT_FRAG_HIT,        // 后续分片沿用了首分片的判决
+    FW_STAT_FRAG_MISS,       // 后续分片没有缓存，按端口 0 匹配规则
+    FW_STAT_SYN_STATELESS,   // 半开连接达到 syn_half_open_max，SYN 放行但不建连接
+    FW_STAT_SYN_SRC_LIMIT,   // 源地址的半开连接达到 syn_half_open_per_src，SYN 被丢弃
+    FW_STAT_LIMIT_DROP,      // 超出 LIMIT 规则速率被丢弃的包
+    FW_STAT_NOTRACK,         // NOTRACK 规则放行、没有经过连接表的包
+    FW_STAT_CONNLIMIT,       // connlimit 条件成立的包
+    FW_STAT_SYNC_SENT,       // 发给同步对端的记录
+    FW_STAT_SYNC_QUEUE_DROP, // 同步队列满而没有排队的记录
+    FW_STAT_SYNC_RECV,       // 从同步对端收到的记录
+    FW_STAT_SYNC_LOST,       // 按序号推算丢失的同步报文
+    FW_STAT_SYNC_BAD,        // 格式不对被丢弃的同步报文
+    FW_STAT_ND_ACCEPT,       // 未经规则直接放行的 IPv6 邻居发现报文（ipv6_nd_accept）
+    FW_STAT_SYN_NOSTATE,     // 半开连接超限期间，没有连接、cookie 不符的非 SYN TCP 包，放行不建连接
+    FW_STAT_CONN_FULL,       // 连接数达到 conntrack_max，新连接的包被丢弃
+    FW_STAT_SYNC_FOREIGN,    // 源地址不是同步对端而被丢弃的同步报文
+    FW_STAT_SYN_COOKIE,      // 半开连接超限期间，cookie 校验通过、建了连接的握手 ACK
+    FW_STAT_MAX,
+};
+
+#define FW_LAT_BUCKETS 32 // 第 i 个桶统计 [2^(i-1), 2^i) ns，最后一个桶包含更大的值
+
+// 每 CPU 统计，每个网络命名空间一份（struct fw_net 的 stats），
+// 只由本 CPU 写，读取该命名空间的 /proc/net/fw_stats 时汇总
+struct fw_cpu_stats {
+    u64 lat[FW_HOOK_MAX][FW_LAT_BUCKETS];
+    u64 accept[FW_HOOK_MAX];
+    u64 drop[FW_HOOK_MAX];
+    u64 counter[FW_STAT_MAX];
+};
+
+// 钩子计时开关，对应模块参数 stats_latency，所有命名空间共用
+DECLARE_STATIC_KEY_TRUE(fw_stats_latency_key);
+
+struct seq_file;
+// /proc/net/fw_stats，经 proc_create_net_single_write 创建
+int stats_proc_show(struct seq_file *m, void *v);
+int stats_proc_write(struct file *file, char *buf, size_t count);
+// 汇总各 CPU 的统计，/proc/net/fw_stats 和控制设备共用
+void fw_stats_sum(struct fw_cpu_stats __percpu *stats, struct fw_cpu_stats *sum);
+
+static inline void fw_stat_inc(struct fw_cpu_stats __percpu *stats, enum fw_stat_counter c)
+{
+    this_cpu_inc(stats->counter[c]);
+}
+
+static inline void fw_stat_add(struct fw_cpu_stats __percpu *stats, enum fw_stat_counter c, u64 n)
+{
+    this_cpu_add(stats->counter[c], n);
+}
+
+// 钩子入口取时间戳，关闭计时时返回 0
+static inline u64 fw_stat_hook_start(void)
+{
+    if (static_branch_likely(&fw_stats_latency_key))
+        return local_clock();
+    return 0;
+}
+
+// 钩子出口记录判决和耗时
+static inline void fw_stat_hook_end(struct fw_cpu_stats __percpu *stats, enum fw_stat_hook hook, u64 start,
+                                    unsigned int verdict)
+{
+    if (verdict == NF_DROP)
+        this_cpu_inc(stats->drop[hook]);
+    else
+        this_cpu_inc(stats->accept[hook]);
+    if (start) {
+        int b = fls64(local_clock() - start);
+        this_cpu_inc(stats->lat[hook][min(b, FW_LAT_BUCKETS - 1)]);
+    }
+}
+
+#endif // STATS_H
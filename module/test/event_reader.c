@@ -0,0 +1,135 @@
+// 从 /dev/firewall_ctrl 的 mmap 事件环批量读取事件
+// 用法: ./event_reader [秒数]   默认读取 1 秒后退出
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include "../fw_uapi.h"
+
+static const char *event_name(unsigned int type)
+{
+    switch (type) {
+        case FW_EVENT_DROP: return "DROP";
+        case FW_EVENT_ACCEPT: return "ACCEPT";
+        case FW_EVENT_FLOW_NEW: return "FLOW_NEW";
+        case FW_EVENT_FLOW_END: return "FLOW_END";
+        default: return "UNKNOWN";
+    }
+}
+
+// IPv4 映射地址按点分十进制输出
+static void format_addr(const unsigned char *addr, char *buf, size_t size)
+{
+    static const unsigned char v4mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+    if (!memcmp(addr, v4mapped, sizeof(v4mapped)))
+        inet_ntop(AF_INET, addr + 12, buf, size);
+    else
+        inet_ntop(AF_INET6, addr, buf, size);
+}
+
+// 返回序号最小的、已交给用户态的块，没有则返回 -1
+static int oldest_user_block(char *ring, unsigned int nr_blocks)
+{
+    int i, best = -1;
+    unsigned long long best_seq = 0;
+
+    for (i = 0; i < (int)nr_blocks; i++) {
+        struct fw_block_desc *desc = (struct fw_block_desc *)(ring + (size_t)i * FW_EVENT_BLOCK_SIZE);
+        if (__atomic_load_n(&desc->block_status, __ATOMIC_ACQUIRE) != FW_BLOCK_STATUS_USER)
+            continue;
+        if (best < 0 || desc->seq_num < best_seq) {
+            best = i;
+            best_seq = desc->seq_num;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 1;
+    unsigned long total = 0, dropped = 0;
+    time_t end = time(NULL) + seconds;
+    struct pollfd pfd;
+    unsigned int nr_blocks;
+    size_t ring_size;
+    char *ring;
+    int fd;
+
+    fd = open("/dev/firewall_ctrl", O_RDWR);
+    if (fd < 0) {
+        perror("open /dev/firewall_ctrl");
+        return 1;
+    }
+    // 先只映射块 0，检查布局并读出块数，再映射整个环
+    ring = mmap(NULL, FW_EVENT_BLOCK_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return 1;
+    }
+    // 内核与本程序编译时的记录布局不同就不读
+    {
+        struct fw_block_desc *desc = (struct fw_block_desc *)ring;
+
+        if (desc->magic != FW_EVENT_MAGIC || desc->version != FW_EVENT_VERSION ||
+            desc->record_size != sizeof(struct fw_event)) {
+            fprintf(stderr, "event ring layout mismatch: magic %#x version %u record_size %u, expected %#x %u %zu\n",
+                    desc->magic, desc->version, desc->record_size, FW_EVENT_MAGIC, FW_EVENT_VERSION,
+                    sizeof(struct fw_event));
+            munmap(ring, FW_EVENT_BLOCK_SIZE);
+            close(fd);
+            return 1;
+        }
+        nr_blocks = desc->nr_blocks;
+    }
+    munmap(ring, FW_EVENT_BLOCK_SIZE);
+    ring_size = (size_t)nr_blocks * FW_EVENT_BLOCK_SIZE;
+    ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return 1;
+    }
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (time(NULL) < end) {
+        int block = oldest_user_block(ring, nr_blocks);
+        struct fw_block_desc *desc;
+        struct fw_event *ev;
+        unsigned int i;
+
+        if (block < 0) {
+            poll(&pfd, 1, 100);
+            continue;
+        }
+        desc = (struct fw_block_desc *)(ring + (size_t)block * FW_EVENT_BLOCK_SIZE);
+
+        ev = (struct fw_event *)((char *)desc + desc->offset_to_first);
+        for (i = 0; i < desc->num_records; i++, ev++) {
+            char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+            format_addr(ev->src_ip, src, sizeof(src));
+            format_addr(ev->dst_ip, dst, sizeof(dst));
+            printf("%llu %s rule=%u proto=%u %s:%u -> %s:%u\n",
+                   (unsigned long long)ev->ts_ns, event_name(ev->type), ev->rule_id, ev->proto,
+                   src, ev->src_port, dst, ev->dst_port);
+        }
+        total += desc->num_records;
+        dropped += desc->dropped;
+
+        // 归还该块
+        __atomic_store_n(&desc->block_status, FW_BLOCK_STATUS_KERNEL, __ATOMIC_RELEASE);
+    }
+
+    printf("events: %lu, dropped by kernel: %lu\n", total, dropped);
+    munmap(ring, ring_size);
+    close(fd);
+    return 0;
+}
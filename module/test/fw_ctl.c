@@ -0,0 +1,146 @@
+// 用一次 ioctl(FW_IOC_BATCH) 查询状态、统计、规则，并快照连接表
+// 用法: ./fw_ctl                    打印状态、统计和规则
+//       ./fw_ctl conns              另外用 read() 读出连接表快照
+//       ./fw_ctl load RULES [SETS]  为本命名空间设置规则文件（和集合文件）并重载
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include "../fw_uapi.h"
+
+#define MAX_RULES 1024
+#define MAX_VALUES 256
+
+// IPv4 映射地址按点分十进制输出
+static void format_addr(const unsigned char *addr, char *buf, size_t size)
+{
+    static const unsigned char v4mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+    if (!memcmp(addr, v4mapped, sizeof(v4mapped)))
+        inet_ntop(AF_INET, addr + 12, buf, size);
+    else
+        inet_ntop(AF_INET6, addr, buf, size);
+}
+
+// 设置文件和重载放在同一批里，设置失败就不重载
+static int load_files(int fd, const char *rules, const char *sets)
+{
+    struct fw_ctrl_cmd cmds[3] = {
+        { .op = FW_CTRL_SET_RULE_FILE, .arg = (uintptr_t)rules },
+        { .op = FW_CTRL_SET_SET_FILE, .arg = (uintptr_t)(sets ? sets : "") },
+        { .op = FW_CTRL_RELOAD },
+    };
+    struct fw_ctrl_batch batch = {
+        .version = FW_CTRL_VERSION,
+        .count = 3,
+        .cmds = (uintptr_t)cmds,
+    };
+
+    if (ioctl(fd, FW_IOC_BATCH, &batch) < 0) {
+        perror("ioctl FW_IOC_BATCH");
+        return 1;
+    }
+    if (batch.done < 3 || cmds[2].result < 0) {
+        unsigned int i = batch.done ? batch.done - 1 : 0;
+
+        fprintf(stderr, "command %u (op %u): %s\n", i, cmds[i].op, strerror(-cmds[i].result));
+        return 1;
+    }
+    printf("loaded %d rules from %s\n", cmds[2].result, rules);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static struct fw_ctrl_rule rules[MAX_RULES];
+    static union {
+        struct fw_ctrl_stats hdr;
+        char buf[sizeof(struct fw_ctrl_stats) + MAX_VALUES * sizeof(__u64)];
+    } stats;
+    struct fw_ctrl_status status;
+    struct fw_ctrl_cmd cmds[4] = {
+        { .op = FW_CTRL_GET_STATUS, .out = (uintptr_t)&status, .out_len = sizeof(status) },
+        { .op = FW_CTRL_GET_STATS, .out = (uintptr_t)&stats, .out_len = sizeof(stats) },
+        { .op = FW_CTRL_GET_RULES, .out = (uintptr_t)rules, .out_len = sizeof(rules) },
+        { .op = FW_CTRL_SNAPSHOT_CONNS },
+    };
+    struct fw_ctrl_batch batch = {
+        .version = FW_CTRL_VERSION,
+        .flags = FW_CTRL_F_CONTINUE,
+        .count = argc > 1 && !strcmp(argv[1], "conns") ? 4 : 3,
+        .cmds = (uintptr_t)cmds,
+    };
+    unsigned int i, n;
+    int fd;
+
+    fd = open("/dev/firewall_ctrl", O_RDWR);
+    if (fd < 0) {
+        perror("open /dev/firewall_ctrl");
+        return 1;
+    }
+    if (argc > 2 && !strcmp(argv[1], "load")) {
+        int ret = load_files(fd, argv[2], argc > 3 ? argv[3] : NULL);
+
+        close(fd);
+        return ret;
+    }
+    if (ioctl(fd, FW_IOC_BATCH, &batch) < 0) {
+        perror("ioctl FW_IOC_BATCH");
+        close(fd);
+        return 1;
+    }
+    for (i = 0; i < batch.done; i++)
+        if (cmds[i].result < 0)
+            fprintf(stderr, "command %u (op %u): %s\n", i, cmds[i].op, strerror(-cmds[i].result));
+
+    if (cmds[0].result >= 0)
+        printf("hooks %s, default %s, %u rules (generation %llu), %llu connections\n",
+               status.hooks ? "on" : "off", status.default_action == FW_CTRL_ACCEPT ? "ACCEPT" : "DROP",
+               status.rules, (unsigned long long)status.generation, (unsigned long long)status.connections);
+
+    if (cmds[1].result >= 0) {
+        const struct fw_ctrl_stats *s = &stats.hdr;
+
+        for (i = 0; i < s->nr_hooks; i++)
+            printf("hook %u: accept %llu drop %llu\n", i, (unsigned long long)s->value[i],
+                   (unsigned long long)s->value[s->nr_hooks + i]);
+        for (i = 0; i < s->nr_counters; i++)
+            printf("counter %u: %llu\n", i, (unsigned long long)s->value[2 * s->nr_hooks + i]);
+    }
+
+    if (cmds[2].result >= 0) {
+        n = cmds[2].out_len / sizeof(rules[0]);
+        for (i = 0; i < n; i++) {
+            char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+
+            format_addr(rules[i].src_ip, src, sizeof(src));
+            format_addr(rules[i].dst_ip, dst, sizeof(dst));
+            printf("rule %u dir=%u action=%u proto=%u %s:%u -> %s:%u\n", rules[i].id, rules[i].direction,
+                   rules[i].action, rules[i].proto, src, rules[i].src_port, dst, rules[i].dst_port);
+        }
+        if (n < (unsigned int)cmds[2].result)
+            printf("... %u more rules\n", cmds[2].result - n);
+    }
+
+    // 快照留在这次打开的文件里，逐条读出
+    if (batch.count > 3 && cmds[3].result >= 0) {
+        struct fw_ctrl_conn conn;
+
+        while (read(fd, &conn, sizeof(conn)) == sizeof(conn)) {
+            char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+
+            format_addr(conn.src_ip, src, sizeof(src));
+            format_addr(conn.dst_ip, dst, sizeof(dst));
+            printf("conn proto=%u %s:%u -> %s:%u state=%u idle=%ums\n", conn.proto, src, conn.src_port,
+                   dst, conn.dst_port, conn.state, conn.idle_ms);
+        }
+        printf("%d connections\n", cmds[3].result);
+    }
+
+    close(fd);
+    return 0;
+}
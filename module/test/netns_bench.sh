@@ -0,0 +1,339 @@
+#!/bin/bash
+# 防火墙端到端吞吐测试
+#
+# 建一对 veth：fwb0 放进网络命名空间 fwb-gen 作为发包端，fwb1 留在初始命名
+# 空间，由 init_net 的防火墙实例过滤。fwb-gen 有自己的实例（空规则集），但
+# pktgen 和 tcpreplay 直接往设备发包，不经过它的钩子。发包端用内核 pktgen 打
+# UDP 流量，或用 tcpreplay 回放 pcap。对每个规则数 x 连接数组合重新加载 firewall.ko，记录：
+#   tx_pps       发包端实际发出的速率
+#   fw_pps       经过 LOCAL_IN 钩子的速率（/proc/fw_stats 的 local_in 行）
+#   fw_drop      被规则丢弃的包
+#   rx_drop      veth 和 backlog 队列上的丢包（接收端处理不过来）
+#   conntrack    结束时连接表条目数
+#   xdp_drop     -x 时被 XDP 程序提前丢弃的包（xdp/fw_xdp）
+#   softirq%     各 CPU 软中断时间占比（/proc/stat）
+# 不需要外部网络。
+#
+#   sudo ./netns_bench.sh                                  # 默认矩阵
+#   sudo ./netns_bench.sh -r "10 1000 100000" -c "1000 1000000" -t 10 -j 4
+#   sudo ./netns_bench.sh -p mix.pcap -p imix.pcap -r "10 10000"
+#   sudo ./netns_bench.sh -d -x generic -r "10 10000"      # 对比 XDP 提前丢弃
+#
+# 生成的规则全部不命中测试流量，每个包都要走完整个规则链（最坏情况）。-d 在
+# 链尾（最后检查）加一条丢弃发往 fwb1 的全部流量的规则。
+set -u
+
+SCRIPT_DIR=$(cd "$(dirname "$0")" && pwd)
+KO=$SCRIPT_DIR/../build/firewall.ko
+FW_XDP=$SCRIPT_DIR/../xdp/fw_xdp
+RULE_SIZES="10 100 1000 10000 100000"
+FLOW_COUNTS="1000 100000 1000000"
+DURATION=5
+THREADS=1
+PKT_SIZE=64
+PCAPS=()
+OUT_CSV=""
+BASELINE=0
+DROP_TRAFFIC=0
+XDP_MODE=""
+
+NS=fwb-gen
+DEV_GEN=fwb0
+DEV_FW=fwb1
+IP_GEN=10.200.0.2
+IP_FW=10.200.0.1
+SRC_NET=10.201.0.0 # pktgen 源地址段，经 IP_GEN 路由回去
+WORK_DIR=""
+
+usage() {
+    cat <<EOF
+usage: sudo $0 [options]
+  -k PATH    firewall.ko (default $KO)
+  -r LIST    rule set sizes (default "$RULE_SIZES")
+  -c LIST    connection counts for pktgen (default "$FLOW_COUNTS")
+  -t SEC     seconds per run (default $DURATION)
+  -j N       pktgen threads, one per CPU (default $THREADS)
+  -s BYTES   pktgen packet size (default $PKT_SIZE)
+  -p FILE    replay a pcap with tcpreplay instead of pktgen (repeatable)
+  -b         also measure without the module loaded
+  -d         add a rule, checked last, that drops all test traffic
+  -x MODE    offload DROP rules to XDP on $DEV_FW, MODE is generic or native
+  -o FILE    append results as CSV
+EOF
+    exit 1
+}
+
+while getopts "k:r:c:t:j:s:p:bdx:o:h" opt; do
+    case $opt in
+        k) KO=$OPTARG ;;
+        r) RULE_SIZES=$OPTARG ;;
+        c) FLOW_COUNTS=$OPTARG ;;
+        t) DURATION=$OPTARG ;;
+        j) THREADS=$OPTARG ;;
+        s) PKT_SIZE=$OPTARG ;;
+        p) PCAPS+=("$OPTARG") ;;
+        b) BASELINE=1 ;;
+        d) DROP_TRAFFIC=1 ;;
+        x) XDP_MODE=$OPTARG ;;
+        o) OUT_CSV=$OPTARG ;;
+        *) usage ;;
+    esac
+done
+
+die() {
+    echo "netns_bench: $*" >&2
+    exit 1
+}
+
+[ "$(id -u)" -eq 0 ] || die "must run as root"
+[ -f "$KO" ] || die "$KO not found, run make in module/ first"
+if [ ${#PCAPS[@]} -gt 0 ]; then
+    command -v tcpreplay >/dev/null || die "tcpreplay not installed"
+    command -v tcprewrite >/dev/null || die "tcprewrite not installed"
+else
+    modprobe pktgen || die "pktgen module not available"
+fi
+case $XDP_MODE in
+    "") ;;
+    generic) XDP_FLAG=-g ;;
+    native) XDP_FLAG=-n ;;
+    *) die "-x takes generic or native" ;;
+esac
+[ -z "$XDP_MODE" ] || [ -x "$FW_XDP" ] || die "$FW_XDP not found, run make in module/xdp first"
+
+cleanup() {
+    pktgen_stop 2>/dev/null
+    [ -n "$XDP_MODE" ] && "$FW_XDP" detach $DEV_FW >/dev/null 2>&1
+    grep -q "^firewall " /proc/modules && rmmod firewall
+    ip link del $DEV_FW 2>/dev/null
+    ip netns del $NS 2>/dev/null
+    [ -n "$WORK_DIR" ] && rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT INT TERM
+
+setup_topology() {
+    ip netns add $NS || die "cannot create netns $NS"
+    ip link add $DEV_FW type veth peer name $DEV_GEN || die "cannot create veth"
+    ip link set $DEV_GEN netns $NS
+    ip addr add $IP_FW/24 dev $DEV_FW
+    ip link set $DEV_FW up
+    ip -n $NS addr add $IP_GEN/24 dev $DEV_GEN
+    ip -n $NS link set $DEV_GEN up
+    ip -n $NS link set lo up
+    # 回包（ICMP 端口不可达等）统一发给 IP_GEN，只需要一条邻居表项
+    ip route add $SRC_NET/16 via $IP_GEN dev $DEV_FW
+    sysctl -qw net.ipv4.conf.$DEV_FW.rp_filter=0
+    sysctl -qw net.ipv4.conf.all.rp_filter=0
+    ping -q -c 1 -W 1 $IP_GEN >/dev/null || die "veth link not up"
+    FW_MAC=$(cat /sys/class/net/$DEV_FW/address)
+    GEN_MAC=$(ip netns exec $NS cat /sys/class/net/$DEV_GEN/address)
+}
+
+# 生成 n 条不命中测试流量的规则，源地址取 172.16.0.0/12
+gen_rules() {
+    local n=$1 file=$2
+    awk -v n="$n" -v drop="$DROP_TRAFFIC" -v dst="$IP_FW" 'BEGIN {
+        print "src_ip,dst_ip,src_port,dst_port,protocol,flow_direction,action,log"
+        if (drop)
+            printf "0.0.0.0,%s,0,0,0,0,1,0\n", dst
+        for (i = 0; i < n; i++)
+            printf "172.%d.%d.%d,0.0.0.0,0,%d,17,0,1,0\n", 16 + int(i / 65536) % 16, int(i / 256) % 256, i % 256, 1 + i % 60000
+    }' > "$file"
+}
+
+unload_firewall() {
+    if [ -n "$XDP_MODE" ]; then
+        "$FW_XDP" detach $DEV_FW >/dev/null 2>&1
+    fi
+    if grep -q "^firewall " /proc/modules; then
+        rmmod firewall || die "rmmod firewall failed"
+    fi
+}
+
+load_firewall() {
+    local rules=$1
+    unload_firewall
+    gen_rules "$rules" "$WORK_DIR/rules.csv"
+    echo "orig_ip,orig_port,new_ip,new_port,proto,direction,list" > "$WORK_DIR/nat.csv"
+    insmod "$KO" rule_file="$WORK_DIR/rules.csv" nat_rule_file="$WORK_DIR/nat.csv" log_file="" \
+        || die "insmod $KO failed"
+    # 只需要 accept/drop 计数，关掉每包计时
+    echo 0 > /sys/module/firewall/parameters/stats_latency 2>/dev/null
+    if [ -n "$XDP_MODE" ]; then
+        "$FW_XDP" attach $DEV_FW $XDP_FLAG >/dev/null || die "fw_xdp attach failed"
+    fi
+}
+
+xdp_drops() {
+    if [ -n "$XDP_MODE" ]; then
+        "$FW_XDP" stats 2>/dev/null | awk '$1 == "dropped" { print $2; exit }'
+    else
+        echo 0
+    fi
+}
+
+pgset() {
+    ip netns exec $NS sh -c "echo '$2' > /proc/net/pktgen/$1" || die "pktgen: $1: $2"
+}
+
+# 每个线程绑定一个 kpktgend_N，源地址和端口随机，flows 个并发流
+pktgen_setup() {
+    local flows=$1 i nips src_max
+    nips=$(( (flows + 64511) / 64512 ))
+    src_max=$(printf "10.201.%d.%d" $(( nips / 256 )) $(( nips % 256 )))
+    for i in $(seq 0 $((THREADS - 1))); do
+        pgset kpktgend_$i "rem_device_all"
+        pgset kpktgend_$i "add_device $DEV_GEN@$i"
+        local dev=$DEV_GEN@$i
+        pgset $dev "count 0"
+        pgset $dev "clone_skb 0" # veth 不支持共享 skb
+        pgset $dev "pkt_size $PKT_SIZE"
+        pgset $dev "delay 0"
+        pgset $dev "dst $IP_FW"
+        pgset $dev "dst_mac $FW_MAC"
+        pgset $dev "src_min 10.201.0.1"
+        pgset $dev "src_max $src_max"
+        pgset $dev "udp_src_min 1024"
+        pgset $dev "udp_src_max 65535"
+        pgset $dev "udp_dst_min 9"
+        pgset $dev "udp_dst_max 9"
+        pgset $dev "flag IPSRC_RND"
+        pgset $dev "flag UDPSRC_RND"
+        pgset $dev "flows $(( (flows + THREADS - 1) / THREADS ))"
+        pgset $dev "flowlen 4"
+    done
+}
+
+pktgen_stop() {
+    ip netns exec $NS sh -c "echo stop > /proc/net/pktgen/pgctrl" 2>/dev/null
+}
+
+# 把 pcap 的目的 MAC/IP 改写成 fwb1，校验和重算
+pcap_prepare() {
+    local in=$1 out=$2
+    tcprewrite --infile="$in" --outfile="$out" --enet-smac="$GEN_MAC" --enet-dmac="$FW_MAC" \
+        --dstipmap=0.0.0.0/0:$IP_FW/32 --fixcsum >/dev/null || die "tcprewrite $in failed"
+}
+
+gen_counter() {
+    ip netns exec $NS cat /sys/class/net/$DEV_GEN/statistics/$1
+}
+
+fw_counter() {
+    cat /sys/class/net/$DEV_FW/statistics/$1
+}
+
+# /proc/net/softnet_stat 第二列是 backlog 满丢包数（十六进制）
+backlog_drops() {
+    local sum=0 v
+    for v in $(awk '{ print $2 }' /proc/net/softnet_stat); do
+        sum=$(( sum + 16#$v ))
+    done
+    echo $sum
+}
+
+# 每个 CPU 的 softirq 时间（USER_HZ），空格分隔
+softirq_ticks() {
+    awk '/^cpu[0-9]/ { printf "%s ", $8 }' /proc/stat
+}
+
+# 从 /proc/fw_stats 取某个钩子的 accept/drop 列
+fw_stat() {
+    awk -v h="$1" -v col="$2" '$1 == h && NF == 6 { print $col; exit }' /proc/fw_stats 2>/dev/null
+}
+
+conntrack_entries() {
+    awk '$1 == "entries" { print $2; exit }' /proc/fw_stats 2>/dev/null
+}
+
+print_header() {
+    printf "%-14s %8s %9s %12s %12s %12s %12s %10s %10s %10s %9s\n" \
+        mode rules flows tx_pps fw_pps fw_drop xdp_drop rx_drop backlog conntrack softirq%
+    if [ -n "$OUT_CSV" ] && [ ! -s "$OUT_CSV" ]; then
+        echo "mode,rules,flows,pkt_size,tx_pps,fw_pps,fw_drop,xdp_drop,rx_drop,backlog_drop,conntrack,softirq_total_pct,softirq_per_cpu_pct" > "$OUT_CSV"
+    fi
+}
+
+# run_one <mode> <rules|-> <flows|-> <pcap|->
+run_one() {
+    local mode=$1 rules=$2 flows=$3 pcap=$4
+    local tx0 tx1 rxd0 rxd1 bl0 bl1 xd0 xd1 si0 si1 t0 t1 elapsed
+    local fw_acc=0 fw_drop=0 entries=0
+
+    [ -e /proc/fw_stats ] && echo reset > /proc/fw_stats
+    tx0=$(gen_counter tx_packets)
+    rxd0=$(( $(fw_counter rx_dropped) + $(gen_counter tx_dropped) ))
+    bl0=$(backlog_drops)
+    xd0=$(xdp_drops)
+    si0=($(softirq_ticks))
+    t0=$(date +%s%N)
+
+    if [ "$pcap" = "-" ]; then
+        pktgen_setup "$flows"
+        ip netns exec $NS sh -c "echo start > /proc/net/pktgen/pgctrl" &
+        sleep "$DURATION"
+        pktgen_stop
+        wait
+    else
+        ip netns exec $NS timeout "$DURATION" tcpreplay -q -i $DEV_GEN --topspeed --loop=0 "$pcap" >/dev/null 2>&1
+    fi
+
+    t1=$(date +%s%N)
+    si1=($(softirq_ticks))
+    tx1=$(gen_counter tx_packets)
+    rxd1=$(( $(fw_counter rx_dropped) + $(gen_counter tx_dropped) ))
+    bl1=$(backlog_drops)
+    xd1=$(xdp_drops)
+    if [ -e /proc/fw_stats ]; then
+        fw_acc=$(fw_stat local_in 2)
+        fw_drop=$(fw_stat local_in 3)
+        entries=$(conntrack_entries)
+    fi
+
+    elapsed=$(( (t1 - t0) / 1000 ))
+    local tx_pps=$(( (tx1 - tx0) * 1000000 / elapsed ))
+    local fw_pps=$(( (${fw_acc:-0} + ${fw_drop:-0}) * 1000000 / elapsed ))
+    local hz ticks total=0 per_cpu="" i d
+    hz=$(getconf CLK_TCK)
+    ticks=$(( elapsed * hz / 1000000 ))
+    [ "$ticks" -gt 0 ] || ticks=1
+    for i in "${!si1[@]}"; do
+        d=$(( (si1[i] - si0[i]) * 100 / ticks ))
+        total=$(( total + d ))
+        per_cpu+="${per_cpu:+ }$d"
+    done
+
+    printf "%-14s %8s %9s %12d %12d %12s %12d %10d %10d %10s %9d\n" \
+        "$mode" "$rules" "$flows" "$tx_pps" "$fw_pps" "${fw_drop:-0}" $(( ${xd1:-0} - ${xd0:-0} )) \
+        $(( rxd1 - rxd0 )) $(( bl1 - bl0 )) "${entries:-0}" "$total"
+    printf "%-14s per-cpu softirq%%: %s\n" "" "$per_cpu"
+    if [ -n "$OUT_CSV" ]; then
+        echo "$mode,$rules,$flows,$PKT_SIZE,$tx_pps,$fw_pps,${fw_drop:-0},$(( ${xd1:-0} - ${xd0:-0} )),$(( rxd1 - rxd0 )),$(( bl1 - bl0 )),${entries:-0},$total,$per_cpu" >> "$OUT_CSV"
+    fi
+}
+
+WORK_DIR=$(mktemp -d /tmp/fwb.XXXXXX)
+grep -q "^firewall " /proc/modules && die "firewall module already loaded, unload it first"
+setup_topology
+print_header
+
+if [ ${#PCAPS[@]} -gt 0 ]; then
+    idx=0
+    for p in "${PCAPS[@]}"; do
+        pcap_prepare "$p" "$WORK_DIR/replay$idx.pcap"
+        [ "$BASELINE" -eq 1 ] && unload_firewall && run_one "nofw:$(basename "$p")" - - "$WORK_DIR/replay$idx.pcap"
+        for r in $RULE_SIZES; do
+            load_firewall "$r"
+            run_one "$(basename "$p")" "$r" - "$WORK_DIR/replay$idx.pcap"
+        done
+        idx=$((idx + 1))
+    done
+else
+    for f in $FLOW_COUNTS; do
+        [ "$BASELINE" -eq 1 ] && unload_firewall && run_one nofw - "$f" -
+        for r in $RULE_SIZES; do
+            load_firewall "$r"
+            run_one pktgen "$r" "$f" -
+        done
+    done
+fi
@@ -0,0 +1,362 @@
+// 防火墙钩子多线程压力测试模块
+//
+// 构造合成 skb，在绑定到不同 CPU 的 kthread 中直接调用 firewall.ko 导出的
+// 钩子函数，依次测量 1、2、4 ... threads 个核心下的吞吐（Mpps）和连接表
+// 状态，用来观察数据路径的多核扩展性和锁竞争。不需要网卡。
+//
+//   insmod fw_stress.ko threads=8 duration_ms=2000 hook=in shared=1
+//   cat /proc/fw_stress        # 查看最近一次结果
+//   echo run > /proc/fw_stress # 重新测量
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/skbuff.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <linux/if_ether.h>
+#include <linux/netdevice.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter_ipv4.h>
+#include <linux/random.h>
+#include <linux/completion.h>
+#include <linux/delay.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/mutex.h>
+#include <linux/cpumask.h>
+#include <linux/ktime.h>
+#include "rule_filter.h"
+#include "stateful_check.h"
+#include "nat.h"
+
+#define STRESS_BATCH 64      // 每次关下半部处理的包数，与 NAPI 默认预算一致
+#define STRESS_SEQ_LEN 8192  // 每个线程预先生成的包序列长度
+#define STRESS_MAX_STEPS 16
+
+static unsigned int threads;
+module_param(threads, uint, 0644);
+MODULE_PARM_DESC(threads, "Largest number of worker threads, one per CPU (default: online CPUs)");
+static unsigned int duration_ms = 2000;
+module_param(duration_ms, uint, 0644);
+MODULE_PARM_DESC(duration_ms, "Run time of each step");
+static unsigned int flows = 4096;
+module_param(flows, uint, 0644);
+MODULE_PARM_DESC(flows, "Flows per thread");
+static bool shared = true;
+module_param(shared, bool, 0644);
+MODULE_PARM_DESC(shared, "All threads send the same flows and contend on the same conntrack entries");
+static char *hook = "in";
+module_param(hook, charp, 0644);
+MODULE_PARM_DESC(hook, "Hook to drive: pre, in, fwd, out or nat");
+static unsigned int udp_percent = 30;
+module_param(udp_percent, uint, 0644);
+MODULE_PARM_DESC(udp_percent, "Share of UDP flows, the rest are TCP");
+
+struct stress_worker {
+    struct task_struct *task;
+    unsigned int cpu;
+    unsigned int id;
+    struct sk_buff **skbs;
+    u16 *seq;
+    u64 packets;
+    u64 drops;
+    u64 elapsed_ns;
+};
+
+struct stress_result {
+    unsigned int threads;
+    u64 packets;
+    u64 drops;
+    u64 pps; // 各线程 packets/elapsed 之和
+    unsigned long conntrack;
+};
+
+static nf_hookfn *stress_fn;
+static struct nf_hook_state stress_state;
+static DECLARE_COMPLETION(stress_start);
+static DEFINE_MUTEX(stress_mutex);
+static struct stress_result results[STRESS_MAX_STEPS];
+static unsigned int nr_results;
+static struct proc_dir_entry *stress_proc;
+
+static struct sk_buff *stress_build_skb(unsigned int thread, unsigned int flow)
+{
+    struct sk_buff *skb;
+    struct iphdr *iph;
+    bool udp = flow % 100 < udp_percent; // 协议只由 flow 决定，shared 模式下各线程元组相同
+
+    skb = alloc_skb(LL_MAX_HEADER + sizeof(struct iphdr) + sizeof(struct tcphdr), GFP_KERNEL);
+    if (!skb)
+        return NULL;
+    skb_reserve(skb, LL_MAX_HEADER);
+    skb_reset_network_header(skb);
+    iph = skb_put_zero(skb, sizeof(*iph));
+    iph->version = 4;
+    iph->ihl = 5;
+    iph->ttl = 64;
+    iph->tot_len = htons(sizeof(*iph) + sizeof(struct tcphdr));
+    iph->protocol = udp ? IPPROTO_UDP : IPPROTO_TCP;
+    // 不共享时每个线程使用独立的源地址段
+    iph->saddr = htonl(0x0a000000 | ((shared ? 0 : thread + 1) << 16) | (flow & 0xffff));
+    iph->daddr = htonl(0xc0a80001 + (flow % 16));
+    skb_set_transport_header(skb, sizeof(*iph));
+    if (udp) {
+        struct udphdr *uh = skb_put_zero(skb, sizeof(struct tcphdr));
+        uh->source = htons(1024 + (flow % 60000));
+        uh->dest = htons(53);
+        uh->len = htons(sizeof(struct udphdr));
+    } else {
+        struct tcphdr *th = skb_put_zero(skb, sizeof(struct tcphdr));
+        th->source = htons(1024 + (flow % 60000));
+        th->dest = htons(443);
+        th->doff = 5;
+        th->ack = 1;
+    }
+    skb->protocol = htons(ETH_P_IP);
+    return skb;
+}
+
+static void stress_free_worker(struct stress_worker *w)
+{
+    unsigned int i;
+
+    if (w->skbs) {
+        for (i = 0; i < flows; i++)
+            kfree_skb(w->skbs[i]);
+        kvfree(w->skbs);
+    }
+    kvfree(w->seq);
+    w->skbs = NULL;
+    w->seq = NULL;
+}
+
+static int stress_init_worker(struct stress_worker *w)
+{
+    unsigned int i;
+
+    w->skbs = kvcalloc(flows, sizeof(*w->skbs), GFP_KERNEL);
+    w->seq = kvmalloc_array(STRESS_SEQ_LEN, sizeof(*w->seq), GFP_KERNEL);
+    if (!w->skbs || !w->seq)
+        goto fail;
+    for (i = 0; i < flows; i++) {
+        w->skbs[i] = stress_build_skb(w->id, i);
+        if (!w->skbs[i])
+            goto fail;
+    }
+    for (i = 0; i < STRESS_SEQ_LEN; i++)
+        w->seq[i] = reciprocal_scale(get_random_u32(), flows);
+    w->packets = w->drops = w->elapsed_ns = 0;
+    return 0;
+
+fail:
+    stress_free_worker(w);
+    return -ENOMEM;
+}
+
+static int stress_thread(void *arg)
+{
+    struct stress_worker *w = arg;
+    unsigned int pos = 0, i;
+    u64 start;
+
+    wait_for_completion(&stress_start);
+    start = ktime_get_ns();
+    while (!kthread_should_stop()) {
+        // 模拟软中断上下文：关下半部并持有 RCU 读锁，与 netfilter 调用钩子时一致
+        local_bh_disable();
+        rcu_read_lock();
+        for (i = 0; i < STRESS_BATCH; i++) {
+            struct sk_buff *skb = w->skbs[w->seq[pos]];
+
+            if (stress_fn(NULL, skb, &stress_state) == NF_DROP)
+                w->drops++;
+            pos = (pos + 1) & (STRESS_SEQ_LEN - 1);
+        }
+        rcu_read_unlock();
+        local_bh_enable();
+        w->packets += STRESS_BATCH;
+        cond_resched();
+    }
+    w->elapsed_ns = ktime_get_ns() - start;
+    return 0;
+}
+
+static int stress_step(unsigned int nr, struct stress_result *res)
+{
+    struct stress_worker *workers;
+    unsigned int i, cpu, started = 0;
+    int ret = 0;
+
+    workers = kcalloc(nr, sizeof(*workers), GFP_KERNEL);
+    if (!workers)
+        return -ENOMEM;
+
+    reinit_completion(&stress_start);
+    i = 0;
+    for_each_online_cpu(cpu) {
+        struct stress_worker *w = &workers[i];
+
+        if (i == nr)
+            break;
+        w->cpu = cpu;
+        w->id = i;
+        ret = stress_init_worker(w);
+        if (ret)
+            goto out;
+        w->task = kthread_create_on_node(stress_thread, w, cpu_to_node(cpu), "fw_stress/%u", cpu);
+        if (IS_ERR(w->task)) {
+            ret = PTR_ERR(w->task);
+            w->task = NULL;
+            goto out;
+        }
+        kthread_bind(w->task, cpu);
+        wake_up_process(w->task);
+        started++;
+        i++;
+    }
+
+    complete_all(&stress_start);
+    msleep(duration_ms);
+
+out:
+    // 出错时也要放行已启动的线程，否则 kthread_stop 会一直等待
+    complete_all(&stress_start);
+    for (i = 0; i < started; i++)
+        kthread_stop(workers[i].task);
+
+    memset(res, 0, sizeof(*res));
+    res->threads = started;
+    for (i = 0; i < started; i++) {
+        struct stress_worker *w = &workers[i];
+
+        res->packets += w->packets;
+        res->drops += w->drops;
+        if (w->elapsed_ns)
+            res->pps += div64_u64(w->packets * NSEC_PER_SEC, w->elapsed_ns);
+    }
+    res->conntrack = stateful_firewall_count(&init_net);
+    for (i = 0; i < nr; i++)
+        stress_free_worker(&workers[i]);
+    kfree(workers);
+    return ret;
+}
+
+static int stress_run(void)
+{
+    unsigned int nr, max_threads = threads ? min(threads, num_online_cpus()) : num_online_cpus();
+    int ret = 0;
+
+    if (!strcmp(hook, "pre")) {
+        stress_fn = rule_filter_apply_prerouting;
+        stress_state.hook = NF_INET_PRE_ROUTING;
+    } else if (!strcmp(hook, "in")) {
+        stress_fn = rule_filter_apply_inbound;
+        stress_state.hook = NF_INET_LOCAL_IN;
+    } else if (!strcmp(hook, "fwd")) {
+        stress_fn = rule_filter_apply_forward;
+        stress_state.hook = NF_INET_FORWARD;
+    } else if (!strcmp(hook, "out")) {
+        stress_fn = rule_filter_apply_outbound;
+        stress_state.hook = NF_INET_LOCAL_OUT;
+    } else if (!strcmp(hook, "nat")) {
+        stress_fn = nat_apply;
+        stress_state.hook = NF_INET_POST_ROUTING;
+    } else {
+        printk(KERN_ERR "fw_stress: unknown hook %s\n", hook);
+        return -EINVAL;
+    }
+    stress_state.pf = NFPROTO_IPV4;
+    stress_state.net = &init_net;
+
+    mutex_lock(&stress_mutex);
+    nr_results = 0;
+    // 1、2、4 ... 个线程，最后一步总是 max_threads
+    for (nr = 1; nr_results < STRESS_MAX_STEPS; nr *= 2) {
+        struct stress_result *res = &results[nr_results];
+
+        nr = min(nr, max_threads);
+        ret = stress_step(nr, res);
+        if (ret) {
+            printk(KERN_ERR "fw_stress: step with %u threads failed: %d\n", nr, ret);
+            break;
+        }
+        nr_results++;
+        printk(KERN_INFO "fw_stress: hook=%s threads=%u %llu.%02llu Mpps, conntrack %lu\n", hook,
+               res->threads, div_u64(res->pps, 1000000), div_u64(res->pps % 1000000, 10000), res->conntrack);
+        if (nr == max_threads)
+            break;
+    }
+    mutex_unlock(&stress_mutex);
+    return ret;
+}
+
+static int stress_proc_show(struct seq_file *m, void *v)
+{
+    unsigned int i;
+    u64 base;
+
+    mutex_lock(&stress_mutex);
+    seq_printf(m, "hook %s  flows/thread %u  shared %d  duration %u ms\n", hook, flows, shared, duration_ms);
+    seq_printf(m, "%7s %12s %12s %10s %8s %12s\n", "threads", "Mpps", "Mpps/core", "scaling%", "drop%", "conntrack");
+    base = nr_results ? results[0].pps : 0;
+    for (i = 0; i < nr_results; i++) {
+        const struct stress_result *r = &results[i];
+        u64 per_core = div_u64(r->pps, r->threads);
+
+        seq_printf(m, "%7u %9llu.%02llu %9llu.%02llu %10llu %8llu %12lu\n", r->threads,
+                   div_u64(r->pps, 1000000), div_u64(r->pps % 1000000, 10000),
+                   div_u64(per_core, 1000000), div_u64(per_core % 1000000, 10000),
+                   base ? div64_u64(per_core * 100, base) : 0,
+                   r->packets ? div64_u64(r->drops * 100, r->packets) : 0, r->conntrack);
+    }
+    mutex_unlock(&stress_mutex);
+    return 0;
+}
+
+static int stress_proc_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, stress_proc_show, NULL);
+}
+
+// 写入任意内容重新测量
+static ssize_t stress_proc_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+    int ret = stress_run();
+
+    return ret ? ret : count;
+}
+
+static const struct proc_ops stress_proc_ops = {
+    .proc_open = stress_proc_open,
+    .proc_read = seq_read,
+    .proc_lseek = seq_lseek,
+    .proc_release = single_release,
+    .proc_write = stress_proc_write,
+};
+
+static int __init fw_stress_init(void)
+{
+    if (!flows || flows > U16_MAX + 1) {
+        printk(KERN_ERR "fw_stress: flows must be 1..65536\n");
+        return -EINVAL;
+    }
+    stress_proc = proc_create("fw_stress", 0644, NULL, &stress_proc_ops);
+    if (!stress_proc)
+        return -ENOMEM;
+    stress_run();
+    return 0;
+}
+
+static void __exit fw_stress_exit(void)
+{
+    remove_proc_entry("fw_stress", NULL);
+}
+
+module_init(fw_stress_init);
+module_exit(fw_stress_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Multi-core stress test for the firewall hooks");
@@ -0,0 +1,48 @@
+#ifndef TOKEN_BUCKET_H
+#define TOKEN_BUCKET_H
+
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/timekeeping.h>
+
+/*
+ * 无锁令牌桶（GCRA 形式）。整个状态只有一个 64 位“理论到达时间”，
+ * 更新用一次 cmpxchg，可在多个 CPU 的软中断里并发调用。
+ */
+typedef struct token_bucket {
+    atomic64_t tat;  // 理论到达时间 (ns)
+    u64 interval_ns; // 每个令牌的间隔 = 1s / rate
+    u64 burst_ns;    // interval_ns * burst
+} token_bucket_t;
+
+// rate 为每秒令牌数，0 表示不限速
+static inline void token_bucket_init(token_bucket_t *tb, u32 rate, u32 burst)
+{
+    atomic64_set(&tb->tat, 0);
+    tb->interval_ns = rate ? div_u64(NSEC_PER_SEC, rate) : 0;
+    tb->burst_ns = tb->interval_ns * (burst ? burst : 1);
+}
+
+// 用 tb 的速率消耗 tat 指向的桶里的一个令牌。按键限速时一组桶共用
+// 一份速率，每个键只存自己的 tat
+static inline bool token_bucket_consume_tat(const token_bucket_t *tb, atomic64_t *tat_p, u64 now)
+{
+    s64 tat, new_tat;
+
+    if (!tb->interval_ns)
+        return true;
+    tat = atomic64_read(tat_p);
+    do {
+        new_tat = (tat > (s64)now ? tat : (s64)now) + tb->interval_ns;
+        if (new_tat - (s64)now > (s64)tb->burst_ns)
+            return false;
+    } while (!atomic64_try_cmpxchg(tat_p, &tat, new_tat));
+    return true;
+}
+
+static inline bool token_bucket_consume(token_bucket_t *tb, u64 now)
+{
+    return token_bucket_consume_tat(tb, &tb->tat, now);
+}
+
+#endif // TOKEN_BUCKET_H
@@ -0,0 +1,182 @@
+#include "top.h"
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/seq_file.h>
+#include <linux/seq_file_net.h>
+#include <linux/cpumask.h>
+#include <linux/hash.h>
+#include <linux/bottom_half.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include "fw_net.h"
+
+DEFINE_STATIC_KEY_TRUE(fw_top_key);
+
+static int top_key_set(const char *val, const struct kernel_param *kp)
+{
+    bool enable;
+    int ret = kstrtobool(val, &enable);
+
+    if (ret)
+        return ret;
+    if (enable)
+        static_branch_enable(&fw_top_key);
+    else
+        static_branch_disable(&fw_top_key);
+    return 0;
+}
+
+static int top_key_get(char *buffer, const struct kernel_param *kp)
+{
+    return sprintf(buffer, "%c\n", static_key_enabled(&fw_top_key) ? 'Y' : 'N');
+}
+
+static const struct kernel_param_ops top_key_ops = {
+    .set = top_key_set,
+    .get = top_key_get,
+};
+
+module_param_cb(top_talkers, &top_key_ops, NULL, 0644);
+MODULE_PARM_DESC(top_talkers, "Track the heaviest sources, destinations and rules for /proc/fw_top (default Y)");
+
+static const char *const dim_names[FW_TOP_MAX] = {
+    [FW_TOP_SRC] = "sources",
+    [FW_TOP_DST] = "destinations",
+    [FW_TOP_RULE] = "rules",
+};
+
+// Space-Saving within one bucket: a known key is counted, an unknown one
+// takes over the entry with the smallest count and inherits it, so a key's
+// count is never underestimated and heavy keys cannot be pushed out by a
+// stream of small ones. Weighted by n, this holds for bytes as well.
+static void top_count(fw_top_entry_t *e, const fw_addr_t *key, u64 n)
+{
+    fw_top_entry_t *min = e;
+    int i;
+
+    for (i = 0; i < FW_TOP_WAYS; i++, e++)
+    {
+        if (fw_addr_equal(&e->key, key) && e->count)
+            goto found;
+        if (e->count < min->count)
+            min = e;
+    }
+    e = min;
+    e->key = *key;
+    e->err = e->count;
+found:
+    e->count += n;
+}
+
+// Packets and bytes have separate tables, so that a key is evicted by the
+// metric it is reported by. LOCAL_OUT can run with bottom halves enabled,
+// so keep a softirq on this CPU out of the buckets meanwhile.
+void fw_top_add(struct fw_top __percpu *top, enum fw_top_dim dim, const fw_addr_t *key, unsigned int len)
+{
+    u32 bucket = hash_32(fw_addr_fold(key), FW_TOP_BUCKET_BITS);
+    struct fw_top *t;
+
+    local_bh_disable();
+    t = this_cpu_ptr(top);
+    top_count(&t->entry[dim][FW_TOP_PACKETS][bucket * FW_TOP_WAYS], key, 1);
+    top_count(&t->entry[dim][FW_TOP_BYTES][bucket * FW_TOP_WAYS], key, len);
+    local_bh_enable();
+}
+
+static int top_cmp_key(const void *a, const void *b)
+{
+    return memcmp(&((const fw_top_entry_t *)a)->key, &((const fw_top_entry_t *)b)->key, sizeof(fw_addr_t));
+}
+
+static int top_cmp_count(const void *a, const void *b)
+{
+    u64 x = ((const fw_top_entry_t *)a)->count, y = ((const fw_top_entry_t *)b)->count;
+
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// Copy every CPU's non-empty entries of one table into buf and add up the
+// ones with the same key; returns the number of distinct keys. Entries are
+// read without a lock and may be mid-update.
+static int top_merge(struct fw_top __percpu *top, enum fw_top_dim dim, enum fw_top_metric metric,
+                     fw_top_entry_t *buf)
+{
+    int cpu, i, n = 0, out = 0;
+
+    for_each_possible_cpu(cpu)
+    {
+        const fw_top_entry_t *e = per_cpu_ptr(top, cpu)->entry[dim][metric];
+
+        for (i = 0; i < FW_TOP_ENTRIES; i++)
+            if (READ_ONCE(e[i].count))
+                buf[n++] = e[i];
+    }
+    sort(buf, n, sizeof(*buf), top_cmp_key, NULL);
+    for (i = 0; i < n; i++)
+    {
+        if (out && fw_addr_equal(&buf[out - 1].key, &buf[i].key))
+        {
+            buf[out - 1].count += buf[i].count;
+            buf[out - 1].err += buf[i].err;
+            continue;
+        }
+        buf[out++] = buf[i];
+    }
+    return out;
+}
+
+static void top_show_table(struct seq_file *m, enum fw_top_dim dim, const char *by, fw_top_entry_t *buf, int n)
+{
+    char name[FW_ADDR_STRLEN];
+    int i;
+
+    seq_printf(m, "\n%s by %s\n", dim_names[dim], by);
+    seq_printf(m, "  %-40s %16s %16s\n", dim == FW_TOP_RULE ? "rule" : "address", by, "err");
+    for (i = 0; i < min(n, FW_TOP_REPORT); i++)
+    {
+        if (dim != FW_TOP_RULE)
+            fw_addr_format(name, sizeof(name), &buf[i].key);
+        else if (buf[i].key.ip6[3])
+            scnprintf(name, sizeof(name), "%u", (__force u32)buf[i].key.ip6[3]);
+        else
+            strscpy(name, "default", sizeof(name));
+        seq_printf(m, "  %-40s %16llu %16llu\n", name, buf[i].count, buf[i].err);
+    }
+}
+
+// The reading namespace's heaviest keys. Counts are upper bounds; err is
+// how much of a count may belong to keys the entry replaced.
+int fw_top_proc_show(struct seq_file *m, void *v)
+{
+    struct fw_net *fn = fw_net(seq_file_single_net(m));
+    fw_top_entry_t *buf;
+    int dim, n;
+
+    buf = kvmalloc_array(nr_cpu_ids * FW_TOP_ENTRIES, sizeof(*buf), GFP_KERNEL);
+    if (!buf)
+        return -ENOMEM;
+    seq_printf(m, "top_talkers      %s\n", static_key_enabled(&fw_top_key) ? "on" : "off");
+    for (dim = 0; dim < FW_TOP_MAX; dim++)
+    {
+        n = top_merge(fn->top, dim, FW_TOP_PACKETS, buf);
+        sort(buf, n, sizeof(*buf), top_cmp_count, NULL);
+        top_show_table(m, dim, "packets", buf, n);
+        n = top_merge(fn->top, dim, FW_TOP_BYTES, buf);
+        sort(buf, n, sizeof(*buf), top_cmp_count, NULL);
+        top_show_table(m, dim, "bytes", buf, n);
+    }
+    kvfree(buf);
+    return 0;
+}
+
+// Writing anything to /proc/net/fw_top starts the namespace's tables over
+int fw_top_proc_write(struct file *file, char *buf, size_t count)
+{
+    struct fw_net *fn = fw_net(seq_file_single_net(file->private_data));
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        memset(per_cpu_ptr(fn->top, cpu), 0, sizeof(struct fw_top));
+    return 0;
+}
@@ -0,0 +1,70 @@
+#ifndef TOP_H
+#define TOP_H
+
+#include <linux/types.h>
+#include <linux/percpu.h>
+#include <linux/jump_label.h>
+#include "flow_key.h"
+
+// 热点统计（top talkers）：按源地址、目的地址和命中的规则统计包数和字节数。
+// 每个维度每种计量（包数、字节数）一张固定大小的表，每个桶按 Space-Saving
+// 替换：未命中时顶替计数最小的一项并继承它的计数。两种计量分表，字节表按
+// 字节数替换，误差界对两者都成立。更新的代价是每张表一次哈希加一个桶内比较，
+// 与连接数和不同地址的数量无关。每个网络命名空间一份，每 CPU 一张，读取时合并
+#define FW_TOP_BUCKET_BITS 6 // 每 CPU 每个维度 64 个桶
+#define FW_TOP_WAYS 4        // 每桶 4 项
+#define FW_TOP_ENTRIES ((1 << FW_TOP_BUCKET_BITS) * FW_TOP_WAYS)
+#define FW_TOP_REPORT 10     // /proc/net/fw_top 每张表列出的项数
+
+enum fw_top_dim {
+    FW_TOP_SRC,  // 收到的包按源地址、本机发出的包按源地址
+    FW_TOP_DST,
+    FW_TOP_RULE, // 命中的规则，一个包可能在 PRE_ROUTING 和之后的钩子各命中一条
+    FW_TOP_MAX,
+};
+
+enum fw_top_metric {
+    FW_TOP_PACKETS,
+    FW_TOP_BYTES,
+    FW_TOP_METRICS,
+};
+
+typedef struct fw_top_entry {
+    fw_addr_t key; // FW_TOP_RULE 只用 ip6[3]，存规则号，0 为默认动作
+    u64 count;     // 包数或字节数，为 0 的项是空项
+    u64 err;       // 顶替时继承的计数，count - err 是真实计数的下界
+} fw_top_entry_t;
+
+struct fw_top {
+    fw_top_entry_t entry[FW_TOP_MAX][FW_TOP_METRICS][FW_TOP_ENTRIES];
+};
+
+// 模块参数 top_talkers，所有命名空间共用
+DECLARE_STATIC_KEY_TRUE(fw_top_key);
+
+void fw_top_add(struct fw_top __percpu *top, enum fw_top_dim dim, const fw_addr_t *key, unsigned int len);
+
+// 包进入防火墙时调用一次（PRE_ROUTING 或 LOCAL_OUT）
+static inline void fw_top_packet(struct fw_top __percpu *top, const fw_flow_key_t *key, unsigned int len)
+{
+    if (!static_branch_likely(&fw_top_key))
+        return;
+    fw_top_add(top, FW_TOP_SRC, &key->src_ip, len);
+    fw_top_add(top, FW_TOP_DST, &key->dst_ip, len);
+}
+
+static inline void fw_top_rule(struct fw_top __percpu *top, u32 rule_id, unsigned int len)
+{
+    fw_addr_t key = { .ip6 = { 0, 0, 0, (__force __be32)rule_id } };
+
+    if (static_branch_likely(&fw_top_key))
+        fw_top_add(top, FW_TOP_RULE, &key, len);
+}
+
+struct seq_file;
+struct file;
+// /proc/net/fw_top，经 proc_create_net_single_write 创建，写入任意内容清零
+int fw_top_proc_show(struct seq_file *m, void *v);
+int fw_top_proc_write(struct file *file, char *buf, size_t count);
+
+#endif // TOP_H
@@ -0,0 +1,140 @@
+// XDP early drop for the firewall's pre-routing and inbound DROP rules.
+//
+// Packets matching an offloaded rule are dropped in the driver, before an
+// skb is allocated or a route looked up. Everything else, including every
+// packet the program cannot classify exactly as the module would, is passed
+// up to the netfilter hooks unchanged.
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/in.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+#include "fw_xdp.h"
+
+#define IP_MF 0x2000
+#define IP_OFFSET 0x1fff
+#ifndef AF_INET
+#define AF_INET 2
+#endif
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+    __uint(max_entries, FW_XDP_MAX_RULES);
+    __type(key, struct fw_xdp_key);
+    __type(value, struct fw_xdp_rule);
+} fw_xdp_rules SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct fw_xdp_masks);
+} fw_xdp_masks SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, FW_XDP_STAT_MAX);
+    __type(key, __u32);
+    __type(value, __u64);
+} fw_xdp_stats SEC(".maps");
+
+static __always_inline int fw_xdp_count(__u32 stat, int verdict)
+{
+    __u64 *n = bpf_map_lookup_elem(&fw_xdp_stats, &stat);
+
+    if (n)
+        (*n)++;
+    return verdict;
+}
+
+// Whether the stack would deliver the packet to this host, i.e. it would
+// reach LOCAL_IN rather than FORWARD. NOT_FWDED covers local, broadcast and
+// multicast routes; with forwarding off on the interface nothing is forwarded.
+static __always_inline int fw_xdp_local(struct xdp_md *ctx, struct iphdr *iph)
+{
+    struct bpf_fib_lookup fib = {};
+    long ret;
+
+    fib.family = AF_INET;
+    fib.tos = iph->tos;
+    fib.l4_protocol = iph->protocol;
+    fib.tot_len = bpf_ntohs(iph->tot_len);
+    fib.ipv4_src = iph->saddr;
+    fib.ipv4_dst = iph->daddr;
+    fib.ifindex = ctx->ingress_ifindex;
+    ret = bpf_fib_lookup(ctx, &fib, sizeof(fib), 0);
+    return ret == BPF_FIB_LKUP_RET_NOT_FWDED || ret == BPF_FIB_LKUP_RET_FWD_DISABLED;
+}
+
+SEC("xdp")
+int fw_xdp_filter(struct xdp_md *ctx)
+{
+    void *data = (void *)(long)ctx->data;
+    void *data_end = (void *)(long)ctx->data_end;
+    struct ethhdr *eth = data;
+    struct iphdr *iph;
+    struct fw_xdp_masks *masks;
+    struct fw_xdp_rule *rule;
+    __u16 sport = 0, dport = 0;
+    __u32 zero = 0, i;
+    int fragment;
+
+    if ((void *)(eth + 1) > data_end || eth->h_proto != bpf_htons(ETH_P_IP))
+        return XDP_PASS;
+    iph = (void *)(eth + 1);
+    if ((void *)(iph + 1) > data_end || iph->ihl < 5)
+        return XDP_PASS;
+
+    // The hooks see reassembled packets; fragments carry no reliable ports,
+    // so they can only match rules that do not look at ports
+    fragment = (iph->frag_off & bpf_htons(IP_MF | IP_OFFSET)) != 0;
+    if (!fragment && (iph->protocol == IPPROTO_TCP || iph->protocol == IPPROTO_UDP)) {
+        // Source and destination port sit at the same offset in both headers
+        struct udphdr *l4 = (void *)iph + iph->ihl * 4;
+
+        if ((void *)(l4 + 1) > data_end)
+            return XDP_PASS;
+        sport = l4->source;
+        dport = l4->dest;
+    }
+
+    masks = bpf_map_lookup_elem(&fw_xdp_masks, &zero);
+    if (!masks)
+        return XDP_PASS;
+
+    for (i = 0; i < FW_XDP_MAX_MASKS; i++) {
+        struct fw_xdp_key key = {};
+        __u8 m;
+
+        if (i >= masks->count)
+            break;
+        m = masks->mask[i];
+        if (fragment && (m & FW_XDP_PORTS))
+            continue;
+        key.mask = m;
+        if (m & FW_XDP_SRC_IP)
+            key.src_ip = iph->saddr;
+        if (m & FW_XDP_DST_IP)
+            key.dst_ip = iph->daddr;
+        if (m & FW_XDP_SRC_PORT)
+            key.src_port = sport;
+        if (m & FW_XDP_DST_PORT)
+            key.dst_port = dport;
+        if (m & FW_XDP_PROTO)
+            key.proto = iph->protocol;
+        rule = bpf_map_lookup_elem(&fw_xdp_rules, &key);
+        // An inbound rule does not see forwarded packets; a later mask may still match
+        if (rule && (rule->flags & FW_XDP_LOCAL_ONLY) && !fw_xdp_local(ctx, iph))
+            continue;
+        if (rule) {
+            rule->packets++;
+            return fw_xdp_count(FW_XDP_STAT_DROP, XDP_DROP);
+        }
+    }
+    return fw_xdp_count(FW_XDP_STAT_PASS, XDP_PASS);
+}
+
+char LICENSE[] SEC("license") = "GPL";
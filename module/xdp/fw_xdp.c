@@ -0,0 +1,809 @@
+/*
+ * fw_xdp: load the XDP early-drop program and keep its maps in step with the
+ * firewall's rule file.
+ *
+ *   fw_xdp attach IFNAME [-g|-n] [-f RULES]  load, pin maps, sync, attach
+ *   fw_xdp sync [-f RULES]                   rebuild the maps from the rules
+ *   fw_xdp watch [-f RULES] [-i MS]          sync whenever the module's state changes
+ *   fw_xdp stats                             per-rule drop counters
+ *   fw_xdp detach IFNAME                     detach and unpin
+ *
+ * RULES defaults to the module's rule_file parameter. A rule is offloaded
+ * only if dropping it in XDP cannot change a verdict:
+ *   - flow_direction is pre-routing or inbound and action is DROP;
+ *   - log is 0, since XDP drops are counted per rule but not logged;
+ *   - connlimit is 0, since the module only drops new connections over the limit;
+ *   - no ACCEPT, LIMIT or NOTRACK rule of the same direction that the module checks first
+ *     overlaps it (load_rules() inserts with list_add(), so later lines are
+ *     checked first).
+ * The remaining rules stay in the module only. Pre-routing rules see every
+ * received packet, as XDP does. Inbound rules only see LOCAL_IN, so their
+ * entries carry FW_XDP_LOCAL_ONLY and the program drops only packets a FIB
+ * lookup routes to this host.
+ *
+ * The maps are only filled while the module is loaded with its hooks on, as
+ * reported by FW_CTRL_GET_STATUS; otherwise sync empties them. watch resyncs
+ * on every change of that status (reload, hooks on/off, default action,
+ * rmmod), so run it next to an attached program or detach before unloading.
+ */
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
+#include <net/if.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <linux/if_link.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include "fw_xdp.h"
+#include "../fw_uapi.h"
+
+#define RULE_FILE_PARAM "/sys/module/firewall/parameters/rule_file"
+#ifndef FW_CTRL_DEV
+#define FW_CTRL_DEV "/dev/firewall_ctrl"
+#endif
+#define BPF_OBJ "fw_xdp.bpf.o" // next to the fw_xdp binary
+
+// Same values as rule_filter.h
+#define FLOW_INBOUND 0
+#define FLOW_PREROUTING 3
+#define ACTION_ACCEPT 0
+#define ACTION_DROP 1
+#define ACTION_LIMIT 2
+#define ACTION_NOTRACK 3
+
+// Rule address as the module keeps it (fw_addr_t): IPv4 as ::ffff:a.b.c.d,
+// len is the prefix length over all 128 bits, 0 for any address
+struct csv_addr {
+    unsigned char a[16];
+    unsigned int len;
+    bool set; // "@name": an IP set, treated as any address when checking overlaps
+};
+
+struct csv_rule {
+    uint32_t id;
+    struct csv_addr src_ip;
+    struct csv_addr dst_ip;
+    uint16_t src_port; // host order
+    uint16_t dst_port;
+    uint8_t proto;
+    int direction;
+    int action;
+    int log;
+    unsigned int connlimit; // the rule only matches some packets of its flows
+};
+
+struct offload_entry {
+    struct fw_xdp_key key;
+    uint32_t rule_id;
+    uint32_t flags; // FW_XDP_LOCAL_ONLY
+};
+
+// What watch compares between polls
+struct module_state {
+    bool loaded;
+    struct fw_ctrl_status status;
+};
+
+struct sync_result {
+    unsigned int rules;
+    unsigned int offloaded;
+    unsigned int skipped_logged;
+    unsigned int skipped_shadowed;
+    unsigned int skipped_prefix;
+    unsigned int skipped_connlimit;
+    unsigned int added, removed;
+    bool inactive; // the module is not filtering, the maps were emptied
+};
+
+static const char *rule_path;
+static const unsigned char v4mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+// Byte i of a len-bit prefix mask
+static unsigned char prefix_byte(unsigned int len, unsigned int i)
+{
+    if (len >= (i + 1) * 8)
+        return 0xff;
+    if (len <= i * 8)
+        return 0;
+    return 0xff << (8 - (len - i * 8));
+}
+
+static int parse_field_uint(const char *tok, unsigned int *out)
+{
+    char *end;
+    unsigned long v;
+
+    if (!tok || !*tok) {
+        *out = 0;
+        return 0;
+    }
+    v = strtoul(tok, &end, 0);
+    if (*end)
+        return -1;
+    *out = v;
+    return 0;
+}
+
+// Mirrors fw_addr_parse(): "", "0" and an unspecified address without a
+// prefix are wildcards, an IPv4 /len is /(96 + len) of the mapped address
+static int parse_field_ip(const char *tok, struct csv_addr *out)
+{
+    bool v6 = tok && strchr(tok, ':');
+    char buf[INET6_ADDRSTRLEN];
+    unsigned int len, max = v6 ? 128 : 32, i;
+    const char *slash;
+    char *end;
+
+    memset(out, 0, sizeof(*out));
+    if (!tok || !*tok || !strcmp(tok, "0"))
+        return 0;
+    if (tok[0] == '@') {
+        out->set = true;
+        return 0;
+    }
+    slash = strchr(tok, '/');
+    len = slash ? slash - tok : strlen(tok);
+    if (len >= sizeof(buf))
+        return -1;
+    memcpy(buf, tok, len);
+    buf[len] = '\0';
+    if (v6 ? inet_pton(AF_INET6, buf, out->a) != 1 : inet_pton(AF_INET, buf, out->a + 12) != 1)
+        return -1;
+    if (!v6)
+        memcpy(out->a, v4mapped, sizeof(v4mapped));
+
+    if (slash) {
+        if (!slash[1] || !isdigit((unsigned char)slash[1]))
+            return -1;
+        len = strtoul(slash + 1, &end, 10);
+        if (*end || len > max)
+            return -1;
+    } else {
+        static const unsigned char zero[16];
+
+        if (!memcmp(v6 ? out->a : out->a + 12, zero, v6 ? 16 : 4)) {
+            memset(out, 0, sizeof(*out));
+            return 0;
+        }
+        len = max;
+    }
+    out->len = v6 ? len : 96 + len;
+    for (i = 0; i < 16; i++)
+        out->a[i] &= prefix_byte(out->len, i);
+    return 0;
+}
+
+// Mirrors parse_rule() in rule_filter.c; lines it rejects are skipped here too
+static int parse_rule_line(char *line, struct csv_rule *r)
+{
+    char *fields[15] = { 0 };
+    unsigned int v[6];
+    int i;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    for (i = 0; i < 15; i++)
+        fields[i] = strsep(&line, ",");
+    if (parse_field_ip(fields[0], &r->src_ip) || parse_field_ip(fields[1], &r->dst_ip))
+        return -1; // invalid address
+    for (i = 0; i < 6; i++)
+        if (parse_field_uint(fields[i + 2], &v[i]))
+            v[i] = 0;
+    if (fields[6] && *fields[6] && parse_field_uint(fields[6], &v[4]))
+        return -1; // invalid action
+    r->src_port = v[0];
+    r->dst_port = v[1];
+    r->proto = v[2];
+    r->direction = v[3];
+    r->action = v[4];
+    r->log = v[5];
+    if (parse_field_uint(fields[14], &r->connlimit))
+        r->connlimit = 0;
+    return 0;
+}
+
+static int read_rules(const char *path, struct csv_rule **out)
+{
+    char line[512];
+    struct csv_rule *rules = NULL;
+    size_t n = 0, cap = 0;
+    uint32_t line_no = 0;
+    FILE *fp;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+    // Header line; empty lines are skipped and not numbered, as in read_line()
+    do {
+        if (!fgets(line, sizeof(line), fp)) {
+            fclose(fp);
+            *out = NULL;
+            return 0;
+        }
+    } while (line[strspn(line, "\r\n")] == '\0');
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[strspn(line, "\r\n")] == '\0')
+            continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 1024;
+            rules = realloc(rules, cap * sizeof(*rules));
+            if (!rules) {
+                fclose(fp);
+                return -1;
+            }
+        }
+        line_no++;
+        if (parse_rule_line(line, &rules[n]))
+            continue;
+        rules[n].id = line_no;
+        n++;
+    }
+    fclose(fp);
+    *out = rules;
+    return n;
+}
+
+static bool field_overlaps(uint32_t a, uint32_t b)
+{
+    return !a || !b || a == b;
+}
+
+// Two prefixes overlap when they agree on the bits of the shorter one
+static bool addr_overlaps(const struct csv_addr *a, const struct csv_addr *b)
+{
+    unsigned int len = a->len < b->len ? a->len : b->len, i;
+
+    for (i = 0; i < 16; i++)
+        if ((a->a[i] ^ b->a[i]) & prefix_byte(len, i))
+            return false;
+    return true;
+}
+
+// The XDP program matches exact IPv4 addresses only, and has no IP sets
+static bool addr_offloadable(const struct csv_addr *a)
+{
+    return (a->len == 0 && !a->set) || (a->len == 128 && !memcmp(a->a, v4mapped, sizeof(v4mapped)));
+}
+
+static uint32_t addr_v4(const struct csv_addr *a)
+{
+    uint32_t ip = 0;
+
+    if (a->len)
+        memcpy(&ip, a->a + 12, sizeof(ip));
+    return ip;
+}
+
+static bool rules_overlap(const struct csv_rule *a, const struct csv_rule *b)
+{
+    return addr_overlaps(&a->src_ip, &b->src_ip) && addr_overlaps(&a->dst_ip, &b->dst_ip) &&
+           field_overlaps(a->src_port, b->src_port) && field_overlaps(a->dst_port, b->dst_port) &&
+           field_overlaps(a->proto, b->proto);
+}
+
+static struct fw_xdp_key rule_key(const struct csv_rule *r)
+{
+    struct fw_xdp_key key;
+
+    memset(&key, 0, sizeof(key));
+    key.src_ip = addr_v4(&r->src_ip);
+    key.dst_ip = addr_v4(&r->dst_ip);
+    key.src_port = htons(r->src_port);
+    key.dst_port = htons(r->dst_port);
+    key.proto = r->proto;
+    key.mask = (r->src_ip.len ? FW_XDP_SRC_IP : 0) | (r->dst_ip.len ? FW_XDP_DST_IP : 0) |
+               (r->src_port ? FW_XDP_SRC_PORT : 0) | (r->dst_port ? FW_XDP_DST_PORT : 0) |
+               (r->proto ? FW_XDP_PROTO : 0);
+    return key;
+}
+
+static int key_cmp(const void *a, const void *b)
+{
+    return memcmp(&((const struct offload_entry *)a)->key, &((const struct offload_entry *)b)->key,
+                  sizeof(struct fw_xdp_key));
+}
+
+// Select the offloadable rules. Entries come out sorted by key with one
+// entry per key, owned by the rule the module would hit first.
+static int build_offload(const struct csv_rule *rules, int n, struct offload_entry **out,
+                         struct sync_result *res)
+{
+    struct offload_entry *e;
+    int i, j, cnt = 0, uniq = 0;
+
+    e = calloc(n ? n : 1, sizeof(*e));
+    if (!e)
+        return -1;
+    // Highest priority first: the last line of the file
+    for (i = n - 1; i >= 0; i--) {
+        const struct csv_rule *d = &rules[i];
+        bool shadowed = false;
+
+        if ((d->direction != FLOW_INBOUND && d->direction != FLOW_PREROUTING) || d->action != ACTION_DROP)
+            continue;
+        if (d->log) {
+            res->skipped_logged++;
+            continue;
+        }
+        if (d->connlimit) {
+            res->skipped_connlimit++;
+            continue;
+        }
+        if (!addr_offloadable(&d->src_ip) || !addr_offloadable(&d->dst_ip)) {
+            res->skipped_prefix++;
+            continue;
+        }
+        // LIMIT and NOTRACK rules accept (some of) their traffic, so they shadow like ACCEPT
+        for (j = i + 1; j < n && !shadowed; j++)
+            shadowed = rules[j].direction == d->direction && rules[j].action != ACTION_DROP &&
+                       rules_overlap(&rules[j], d);
+        if (shadowed) {
+            res->skipped_shadowed++;
+            continue;
+        }
+        e[cnt].key = rule_key(d);
+        e[cnt].rule_id = d->id;
+        e[cnt].flags = d->direction == FLOW_INBOUND ? FW_XDP_LOCAL_ONLY : 0;
+        cnt++;
+    }
+    // Stable order is not guaranteed by qsort, so break ties on rule_id
+    // afterwards: keep the highest id (highest priority) per key. A key that
+    // a pre-routing rule drops is dropped whatever the route.
+    qsort(e, cnt, sizeof(*e), key_cmp);
+    for (i = 0; i < cnt; i++) {
+        if (uniq && !key_cmp(&e[uniq - 1], &e[i])) {
+            if (e[i].rule_id > e[uniq - 1].rule_id)
+                e[uniq - 1].rule_id = e[i].rule_id;
+            e[uniq - 1].flags &= e[i].flags;
+            continue;
+        }
+        e[uniq++] = e[i];
+    }
+    res->offloaded = uniq;
+    *out = e;
+    return uniq;
+}
+
+static int open_pinned(const char *name)
+{
+    char path[256];
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/%s", FW_XDP_PIN_DIR, name);
+    fd = bpf_obj_get(path);
+    if (fd < 0)
+        fprintf(stderr, "fw_xdp: %s: %s (not attached?)\n", path, strerror(errno));
+    return fd;
+}
+
+static int write_masks(int masks_fd, uint32_t bitmap)
+{
+    struct fw_xdp_masks masks;
+    uint32_t zero = 0;
+    int m;
+
+    memset(&masks, 0, sizeof(masks));
+    for (m = 0; m < FW_XDP_MAX_MASKS; m++)
+        if (bitmap & (1u << m))
+            masks.mask[masks.count++] = m;
+    return bpf_map_update_elem(masks_fd, &zero, &masks, BPF_ANY);
+}
+
+static uint32_t read_masks(int masks_fd)
+{
+    struct fw_xdp_masks masks;
+    uint32_t zero = 0, bitmap = 0, i;
+
+    if (bpf_map_lookup_elem(masks_fd, &zero, &masks))
+        return 0;
+    for (i = 0; i < masks.count && i < FW_XDP_MAX_MASKS; i++)
+        bitmap |= 1u << masks.mask[i];
+    return bitmap;
+}
+
+static const char *module_rule_file(void)
+{
+    static char path[256];
+    FILE *fp = fopen(RULE_FILE_PARAM, "r");
+
+    if (!fp)
+        return NULL;
+    if (!fgets(path, sizeof(path), fp))
+        path[0] = '\0';
+    fclose(fp);
+    path[strcspn(path, "\n")] = '\0';
+    return path[0] ? path : NULL;
+}
+
+// Bring the maps to the new rule set, or empty them when !active. New entries
+// and masks go in first and stale ones come out last, so while a sync runs a
+// packet is dropped if either the old or the new rule set drops it, as during
+// a module reload.
+static int sync_maps(int rules_fd, int masks_fd, bool active, struct sync_result *res)
+{
+    struct csv_rule *rules = NULL;
+    struct offload_entry *want = NULL;
+    struct fw_xdp_rule *vals;
+    struct fw_xdp_key key, next, *stale = NULL;
+    size_t nstale = 0, cap = 0, k;
+    uint32_t new_masks = 0;
+    int ncpus, n, cnt, i, ret = -1;
+    void *prev = NULL;
+
+    ncpus = libbpf_num_possible_cpus();
+    if (ncpus <= 0)
+        return -1;
+    vals = calloc(ncpus, sizeof(*vals));
+    if (!vals)
+        return -1;
+
+    memset(res, 0, sizeof(*res));
+    res->inactive = !active;
+    n = 0;
+    if (active) {
+        // The module may have been loaded since we started
+        const char *path = rule_path ? rule_path : module_rule_file();
+
+        if (!path) {
+            fprintf(stderr, "fw_xdp: no rule_file parameter, pass -f RULES\n");
+            goto out;
+        }
+        n = read_rules(path, &rules);
+    }
+    if (n < 0)
+        goto out;
+    res->rules = n;
+    cnt = build_offload(rules, n, &want, res);
+    if (cnt < 0)
+        goto out;
+
+    for (i = 0; i < cnt; i++)
+        new_masks |= 1u << want[i].key.mask;
+    if (write_masks(masks_fd, read_masks(masks_fd) | new_masks))
+        goto out;
+
+    for (i = 0; i < cnt; i++) {
+        // Keep the counters of entries that did not change owner
+        if (!bpf_map_lookup_elem(rules_fd, &want[i].key, vals) && vals[0].rule_id == want[i].rule_id &&
+            vals[0].flags == want[i].flags)
+            continue;
+        memset(vals, 0, ncpus * sizeof(*vals));
+        for (k = 0; k < (size_t)ncpus; k++) {
+            vals[k].rule_id = want[i].rule_id;
+            vals[k].flags = want[i].flags;
+        }
+        if (bpf_map_update_elem(rules_fd, &want[i].key, vals, BPF_ANY)) {
+            fprintf(stderr, "fw_xdp: map update failed: %s\n", strerror(errno));
+            goto out;
+        }
+        res->added++;
+    }
+
+    // Collect stale keys first; deleting while walking restarts the walk
+    while (!bpf_map_get_next_key(rules_fd, prev, &next)) {
+        struct offload_entry probe = { .key = next };
+
+        if (!bsearch(&probe, want, cnt, sizeof(*want), key_cmp)) {
+            if (nstale == cap) {
+                cap = cap ? cap * 2 : 256;
+                stale = realloc(stale, cap * sizeof(*stale));
+                if (!stale)
+                    goto out;
+            }
+            stale[nstale++] = next;
+        }
+        key = next;
+        prev = &key;
+    }
+    for (k = 0; k < nstale; k++)
+        if (!bpf_map_delete_elem(rules_fd, &stale[k]))
+            res->removed++;
+    if (write_masks(masks_fd, new_masks))
+        goto out;
+    ret = 0;
+out:
+    free(stale);
+    free(want);
+    free(rules);
+    free(vals);
+    return ret;
+}
+
+static void print_sync(const struct sync_result *res)
+{
+    if (res->inactive) {
+        printf("fw_xdp: firewall module not loaded or its hooks are off, %u entries removed\n", res->removed);
+        return;
+    }
+    printf("fw_xdp: %u rules, %u offloaded (+%u -%u), %u kept in the module because they log, "
+           "%u because an ACCEPT rule overlaps them, %u because they match a prefix, IPv6 or an IP set, "
+           "%u because they set connlimit\n",
+           res->rules, res->offloaded, res->added, res->removed, res->skipped_logged, res->skipped_shadowed,
+           res->skipped_prefix, res->skipped_connlimit);
+}
+
+// Ask the module for its status in the caller's namespace; loaded is false
+// when the control device is missing, i.e. the module is not loaded
+static void read_module_state(struct module_state *st)
+{
+    struct fw_ctrl_cmd cmd = {
+        .op = FW_CTRL_GET_STATUS, .out = (uintptr_t)&st->status, .out_len = sizeof(st->status),
+    };
+    struct fw_ctrl_batch batch = { .version = FW_CTRL_VERSION, .count = 1, .cmds = (uintptr_t)&cmd };
+    int fd;
+
+    memset(st, 0, sizeof(*st));
+    fd = open(FW_CTRL_DEV, O_RDWR);
+    if (fd < 0)
+        return;
+    st->loaded = !ioctl(fd, FW_IOC_BATCH, &batch) && cmd.result >= 0;
+    close(fd);
+}
+
+// Drops may only be offloaded while the module itself filters
+static bool module_active(const struct module_state *st)
+{
+    return st->loaded && st->status.hooks;
+}
+
+static int cmd_sync(const struct module_state *st)
+{
+    struct sync_result res;
+    int rules_fd, masks_fd, ret;
+
+    rules_fd = open_pinned("fw_xdp_rules");
+    masks_fd = open_pinned("fw_xdp_masks");
+    if (rules_fd < 0 || masks_fd < 0)
+        return 1;
+    ret = sync_maps(rules_fd, masks_fd, module_active(st), &res);
+    if (!ret)
+        print_sync(&res);
+    close(rules_fd);
+    close(masks_fd);
+    return ret ? 1 : 0;
+}
+
+static const char *bpf_obj_path(void)
+{
+    static char path[PATH_MAX];
+    char exe[PATH_MAX];
+    ssize_t n;
+
+    n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (n <= 0)
+        return BPF_OBJ;
+    exe[n] = '\0';
+    snprintf(path, sizeof(path), "%s/%s", dirname(exe), BPF_OBJ);
+    return path;
+}
+
+static int cmd_attach(const char *ifname, __u32 flags)
+{
+    struct bpf_object *obj;
+    struct bpf_program *prog;
+    struct bpf_map *map;
+    struct sync_result res;
+    struct module_state st;
+    int ifindex, ret;
+
+    ifindex = if_nametoindex(ifname);
+    if (!ifindex) {
+        fprintf(stderr, "fw_xdp: no interface %s\n", ifname);
+        return 1;
+    }
+    obj = bpf_object__open_file(bpf_obj_path(), NULL);
+    if (!obj || libbpf_get_error(obj)) {
+        fprintf(stderr, "fw_xdp: cannot open %s\n", bpf_obj_path());
+        return 1;
+    }
+    bpf_object__for_each_map(map, obj) {
+        char path[256];
+
+        snprintf(path, sizeof(path), "%s/%s", FW_XDP_PIN_DIR, bpf_map__name(map));
+        // Reuse maps left pinned by an earlier attach on another interface
+        bpf_map__set_pin_path(map, path);
+    }
+    mkdir(FW_XDP_PIN_DIR, 0700);
+    if (bpf_object__load(obj)) {
+        fprintf(stderr, "fw_xdp: loading %s failed\n", bpf_obj_path());
+        goto err;
+    }
+    read_module_state(&st);
+    ret = sync_maps(bpf_map__fd(bpf_object__find_map_by_name(obj, "fw_xdp_rules")),
+                    bpf_map__fd(bpf_object__find_map_by_name(obj, "fw_xdp_masks")), module_active(&st), &res);
+    if (ret)
+        goto err;
+    print_sync(&res);
+
+    prog = bpf_object__find_program_by_name(obj, "fw_xdp_filter");
+    if (bpf_xdp_attach(ifindex, bpf_program__fd(prog), flags, NULL)) {
+        fprintf(stderr, "fw_xdp: attaching to %s failed: %s\n", ifname, strerror(errno));
+        goto err;
+    }
+    printf("fw_xdp: attached to %s (%s)\n", ifname,
+           flags & XDP_FLAGS_SKB_MODE ? "generic" : flags & XDP_FLAGS_DRV_MODE ? "native" : "auto");
+    bpf_object__close(obj); // the link keeps the program, the pins keep the maps
+    return 0;
+err:
+    bpf_object__close(obj);
+    return 1;
+}
+
+static int cmd_detach(const char *ifname)
+{
+    static const char *const maps[] = { "fw_xdp_rules", "fw_xdp_masks", "fw_xdp_stats" };
+    char path[256];
+    int ifindex;
+    size_t i;
+
+    ifindex = if_nametoindex(ifname);
+    if (!ifindex || bpf_xdp_detach(ifindex, 0, NULL)) {
+        fprintf(stderr, "fw_xdp: detaching from %s failed\n", ifname);
+        return 1;
+    }
+    for (i = 0; i < sizeof(maps) / sizeof(maps[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", FW_XDP_PIN_DIR, maps[i]);
+        unlink(path);
+    }
+    rmdir(FW_XDP_PIN_DIR);
+    return 0;
+}
+
+static int cmd_stats(void)
+{
+    struct fw_xdp_key key, next;
+    struct fw_xdp_rule *vals;
+    __u64 *counts, total[FW_XDP_STAT_MAX] = { 0 };
+    void *prev = NULL;
+    int rules_fd, stats_fd, ncpus, c;
+    __u32 s;
+
+    rules_fd = open_pinned("fw_xdp_rules");
+    stats_fd = open_pinned("fw_xdp_stats");
+    if (rules_fd < 0 || stats_fd < 0)
+        return 1;
+    ncpus = libbpf_num_possible_cpus();
+    vals = calloc(ncpus, sizeof(*vals));
+    counts = calloc(ncpus, sizeof(*counts));
+    if (!vals || !counts)
+        return 1;
+
+    for (s = 0; s < FW_XDP_STAT_MAX; s++)
+        if (!bpf_map_lookup_elem(stats_fd, &s, counts))
+            for (c = 0; c < ncpus; c++)
+                total[s] += counts[c];
+    printf("passed  %llu\ndropped %llu\n\n%-8s %-18s %-18s %6s %6s %5s %14s\n",
+           (unsigned long long)total[FW_XDP_STAT_PASS], (unsigned long long)total[FW_XDP_STAT_DROP],
+           "rule", "src_ip", "dst_ip", "sport", "dport", "proto", "packets");
+    while (!bpf_map_get_next_key(rules_fd, prev, &next)) {
+        char src[INET_ADDRSTRLEN] = "*", dst[INET_ADDRSTRLEN] = "*";
+        __u64 packets = 0;
+
+        if (!bpf_map_lookup_elem(rules_fd, &next, vals)) {
+            for (c = 0; c < ncpus; c++)
+                packets += vals[c].packets;
+            if (next.mask & FW_XDP_SRC_IP)
+                inet_ntop(AF_INET, &next.src_ip, src, sizeof(src));
+            if (next.mask & FW_XDP_DST_IP)
+                inet_ntop(AF_INET, &next.dst_ip, dst, sizeof(dst));
+            printf("%-8u %-18s %-18s %6u %6u %5u %14llu\n", vals[0].rule_id, src, dst,
+                   ntohs(next.src_port), ntohs(next.dst_port), next.proto, (unsigned long long)packets);
+        }
+        key = next;
+        prev = &key;
+    }
+    free(vals);
+    free(counts);
+    return 0;
+}
+
+static bool module_state_equal(const struct module_state *a, const struct module_state *b)
+{
+    return a->loaded == b->loaded && a->status.hooks == b->status.hooks &&
+           a->status.default_action == b->status.default_action && a->status.generation == b->status.generation;
+}
+
+// One poll of watch: resync when the module reloaded, turned its hooks on or
+// off, switched its default action or went away. *synced is false until the
+// first sync succeeds.
+static int watch_step(struct module_state *seen, bool *synced)
+{
+    struct module_state st;
+
+    read_module_state(&st);
+    if (*synced && module_state_equal(&st, seen))
+        return 0;
+    if (cmd_sync(&st))
+        return 1;
+    *seen = st;
+    *synced = true;
+    return 0;
+}
+
+static int cmd_watch(unsigned int interval_ms)
+{
+    struct module_state seen;
+    bool synced = false;
+
+    for (;;) {
+        if (watch_step(&seen, &synced))
+            return 1;
+        usleep(interval_ms * 1000);
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s attach IFNAME [-g | -n] [-f RULES]\n"
+            "       %s sync [-f RULES]\n"
+            "       %s watch [-f RULES] [-i MS]\n"
+            "       %s stats\n"
+            "       %s detach IFNAME\n"
+            "  -g  generic (skb) XDP   -n  native XDP   default: native if the driver supports it\n"
+            "  -f  rule file (default: the loaded module's rule_file parameter)\n"
+            "  -i  poll interval for watch (default 500)\n",
+            prog, prog, prog, prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *cmd, *ifname = NULL;
+    unsigned int interval_ms = 500;
+    __u32 flags = 0;
+    int c;
+
+    if (argc < 2) {
+        usage(argv[0]);
+        return 2;
+    }
+    cmd = argv[1];
+    optind = 2;
+    if (!strcmp(cmd, "attach") || !strcmp(cmd, "detach")) {
+        if (argc < 3) {
+            usage(argv[0]);
+            return 2;
+        }
+        ifname = argv[2];
+        optind = 3;
+    }
+    while ((c = getopt(argc, argv, "gnf:i:h")) != -1) {
+        switch (c) {
+        case 'g': flags = XDP_FLAGS_SKB_MODE; break;
+        case 'n': flags = XDP_FLAGS_DRV_MODE; break;
+        case 'f': rule_path = optarg; break;
+        case 'i': interval_ms = strtoul(optarg, NULL, 0); break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 2;
+        }
+    }
+    if (!strcmp(cmd, "attach"))
+        return cmd_attach(ifname, flags);
+    if (!strcmp(cmd, "detach"))
+        return cmd_detach(ifname);
+    if (!strcmp(cmd, "sync")) {
+        struct module_state st;
+
+        read_module_state(&st);
+        return cmd_sync(&st);
+    }
+    if (!strcmp(cmd, "watch"))
+        return cmd_watch(interval_ms);
+    if (!strcmp(cmd, "stats"))
+        return cmd_stats();
+    usage(argv[0]);
+    return 2;
+}
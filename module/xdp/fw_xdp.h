@@ -0,0 +1,59 @@
+#ifndef FW_XDP_H
+#define FW_XDP_H
+
+// Layout shared by the XDP program (fw_xdp.bpf.c) and its loader (fw_xdp.c).
+//
+// Only pre-routing and inbound DROP rules are offloaded. Rules are grouped by
+// which fields they specify (the mask); each offloaded rule is one entry in
+// fw_xdp_rules keyed by the packet fields under its mask, so a packet is
+// classified with one hash lookup per distinct mask in use (at most
+// FW_XDP_MAX_MASKS). Inbound rules are marked FW_XDP_LOCAL_ONLY and only drop
+// packets the stack would deliver to this host, as LOCAL_IN only sees those.
+
+#include <linux/types.h>
+
+#define FW_XDP_SRC_IP   (1 << 0)
+#define FW_XDP_DST_IP   (1 << 1)
+#define FW_XDP_SRC_PORT (1 << 2)
+#define FW_XDP_DST_PORT (1 << 3)
+#define FW_XDP_PROTO    (1 << 4)
+#define FW_XDP_PORTS    (FW_XDP_SRC_PORT | FW_XDP_DST_PORT)
+#define FW_XDP_MAX_MASKS 32
+
+#define FW_XDP_MAX_RULES 131072
+
+struct fw_xdp_key {
+    __u32 src_ip;   // network order, 0 unless the mask has FW_XDP_SRC_IP
+    __u32 dst_ip;
+    __u16 src_port; // network order
+    __u16 dst_port;
+    __u8 proto;
+    __u8 mask;
+    __u16 pad;      // must be zero
+};
+
+#define FW_XDP_LOCAL_ONLY (1 << 0) // drop only packets routed to this host
+
+// Per-CPU value of fw_xdp_rules
+struct fw_xdp_rule {
+    __u32 rule_id;  // line number in the rule file, as in the module's log
+    __u32 flags;    // FW_XDP_LOCAL_ONLY
+    __u64 packets;  // packets dropped by this rule on this CPU
+};
+
+// Single entry of fw_xdp_masks: the masks in use, any order
+struct fw_xdp_masks {
+    __u32 count;
+    __u8 mask[FW_XDP_MAX_MASKS];
+};
+
+enum {
+    FW_XDP_STAT_PASS,
+    FW_XDP_STAT_DROP,
+    FW_XDP_STAT_MAX,
+};
+
+// Maps are pinned here so sync/stats/detach can find them
+#define FW_XDP_PIN_DIR "/sys/fs/bpf/fw_xdp"
+
+#endif // FW_XDP_H
@@ -0,0 +1,168 @@
+/*
+ * fw_xdp selftest: the loader (fw_xdp.c) and the program (fw_xdp.bpf.c, see
+ * selftest_prog.c) run in userspace on the shared maps of shim/xdp_shim.c.
+ * The module's status comes from a fake FW_IOC_BATCH and the route from
+ * fake_fib_result, so no kernel, clang or libbpf is needed.
+ *
+ *   make check
+ */
+#include <stdarg.h>
+
+#define FW_CTRL_DEV "/dev/null" // any file that opens; the ioctl is faked
+#define ioctl selftest_ioctl
+#define main fw_xdp_main
+#include "fw_xdp.c"
+#undef main
+#undef ioctl
+
+void selftest_prog_init(void);
+int selftest_prog_run(void *frame, unsigned int len);
+
+static struct module_state fake_module; // what the fake ioctl reports
+static int failures;
+
+int selftest_ioctl(int fd, unsigned long request, ...)
+{
+    struct fw_ctrl_batch *batch;
+    struct fw_ctrl_cmd *cmd;
+    va_list ap;
+
+    (void)fd;
+    va_start(ap, request);
+    batch = va_arg(ap, struct fw_ctrl_batch *);
+    va_end(ap);
+    if (!fake_module.loaded || request != FW_IOC_BATCH) {
+        errno = ENOTTY;
+        return -1;
+    }
+    cmd = (struct fw_ctrl_cmd *)(uintptr_t)batch->cmds;
+    memcpy((void *)(uintptr_t)cmd->out, &fake_module.status, sizeof(fake_module.status));
+    cmd->result = 0;
+    batch->done = 1;
+    return 0;
+}
+
+static void write_rules(const char *path, const char *rules)
+{
+    FILE *fp = fopen(path, "w");
+
+    if (!fp) {
+        perror(path);
+        exit(1);
+    }
+    fputs("src_ip,dst_ip,src_port,dst_port,protocol,flow_direction,action,log\n", fp);
+    fputs(rules, fp);
+    fclose(fp);
+}
+
+// Verdict for an IPv4 TCP packet from src to dst:dport, routed as fib says
+static int verdict(const char *src, const char *dst, uint16_t dport, long fib)
+{
+    unsigned char frame[14 + 20 + 20] = { 0 };
+    unsigned char *ip = frame + 14, *tcp = ip + 20;
+
+    frame[12] = 0x08; // ETH_P_IP
+    ip[0] = 0x45;
+    ip[3] = sizeof(frame) - 14;
+    ip[8] = 64;
+    ip[9] = IPPROTO_TCP;
+    inet_pton(AF_INET, src, ip + 12);
+    inet_pton(AF_INET, dst, ip + 16);
+    tcp[0] = 0x30;
+    tcp[1] = 0x39; // source port 12345
+    tcp[2] = dport >> 8;
+    tcp[3] = dport & 0xff;
+    fake_fib_result = fib;
+    return selftest_prog_run(frame, sizeof(frame));
+}
+
+static void expect(const char *what, int got, int want)
+{
+    if (got == want)
+        return;
+    printf("FAIL %s: got %d, want %d\n", what, got, want);
+    failures++;
+}
+
+#define LOCAL BPF_FIB_LKUP_RET_NOT_FWDED
+#define FORWARDED BPF_FIB_LKUP_RET_SUCCESS
+
+int main(void)
+{
+    char path[] = "/tmp/fw_xdp_selftest_XXXXXX";
+    struct module_state seen;
+    bool synced = false;
+    int fd;
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    rule_path = path;
+    selftest_prog_init();
+
+    // Line 2: pre-routing drop; 3: inbound drop; 4: logged; 5: shadowed by the
+    // ACCEPT on line 6; 7 and 8: the same key inbound and pre-routing
+    write_rules(path, "10.0.0.9,0,0,0,0,3,1,0\n"
+                      "0,10.0.0.1,0,80,6,0,1,0\n"
+                      "10.0.0.5,0,0,0,0,0,1,1\n"
+                      "10.0.0.6,0,0,0,0,0,1,0\n"
+                      "10.0.0.6,0,0,22,6,0,0,0\n"
+                      "10.0.0.7,0,0,0,0,0,1,0\n"
+                      "10.0.0.7,0,0,0,0,3,1,0\n");
+    fake_module.loaded = true;
+    fake_module.status.hooks = 1;
+    fake_module.status.generation = 1;
+    expect("attach", cmd_attach("lo", XDP_FLAGS_SKB_MODE), 0);
+    expect("attached", fake_xdp_ifindex != 0, 1);
+    expect("entries", fake_map_count("fw_xdp_rules"), 3);
+
+    expect("pre-routing, forwarded", verdict("10.0.0.9", "192.0.2.1", 80, FORWARDED), XDP_DROP);
+    expect("inbound, local", verdict("10.0.0.2", "10.0.0.1", 80, LOCAL), XDP_DROP);
+    expect("inbound, forwarding off", verdict("10.0.0.2", "10.0.0.1", 80, BPF_FIB_LKUP_RET_FWD_DISABLED),
+           XDP_DROP);
+    expect("inbound, forwarded", verdict("10.0.0.2", "10.0.0.1", 80, FORWARDED), XDP_PASS);
+    expect("inbound, other port", verdict("10.0.0.2", "10.0.0.1", 81, LOCAL), XDP_PASS);
+    expect("logged rule", verdict("10.0.0.5", "10.0.0.1", 80, FORWARDED), XDP_PASS);
+    expect("shadowed rule", verdict("10.0.0.6", "10.0.0.1", 22, LOCAL), XDP_PASS);
+    expect("inbound and pre-routing, forwarded", verdict("10.0.0.7", "192.0.2.1", 80, FORWARDED), XDP_DROP);
+
+    // watch: nothing changed, then hooks off, on, rmmod, reload, default action
+    expect("watch first sync", watch_step(&seen, &synced), 0);
+    fake_module.status.hooks = 0;
+    expect("watch hooks off", watch_step(&seen, &synced), 0);
+    expect("hooks off: entries", fake_map_count("fw_xdp_rules"), 0);
+    expect("hooks off: verdict", verdict("10.0.0.9", "192.0.2.1", 80, FORWARDED), XDP_PASS);
+    fake_module.status.hooks = 1;
+    expect("watch hooks on", watch_step(&seen, &synced), 0);
+    expect("hooks on: verdict", verdict("10.0.0.9", "192.0.2.1", 80, FORWARDED), XDP_DROP);
+    fake_module.loaded = false;
+    expect("watch rmmod", watch_step(&seen, &synced), 0);
+    expect("rmmod: entries", fake_map_count("fw_xdp_rules"), 0);
+    expect("rmmod: verdict", verdict("10.0.0.7", "192.0.2.1", 80, FORWARDED), XDP_PASS);
+    fake_module.loaded = true;
+    fake_module.status.generation = 2;
+    write_rules(path, "10.0.0.7,0,0,0,0,3,1,0\n");
+    expect("watch reload", watch_step(&seen, &synced), 0);
+    expect("reload: entries", fake_map_count("fw_xdp_rules"), 1);
+    expect("reload: removed rule", verdict("10.0.0.9", "192.0.2.1", 80, FORWARDED), XDP_PASS);
+    expect("reload: kept rule", verdict("10.0.0.7", "192.0.2.1", 80, FORWARDED), XDP_DROP);
+    write_rules(path, "");
+    expect("watch unchanged", watch_step(&seen, &synced), 0);
+    expect("unchanged: entries", fake_map_count("fw_xdp_rules"), 1);
+    fake_module.status.default_action = FW_CTRL_DROP;
+    expect("watch default action", watch_step(&seen, &synced), 0);
+    expect("default action: entries", fake_map_count("fw_xdp_rules"), 0);
+
+    expect("detach", cmd_detach("lo"), 0);
+    expect("detached", fake_xdp_ifindex, 0);
+    unlink(path);
+    if (failures) {
+        printf("fw_xdp selftest: %d failures\n", failures);
+        return 1;
+    }
+    printf("fw_xdp selftest: ok\n");
+    return 0;
+}
@@ -0,0 +1,37 @@
+/*
+ * fw_xdp.bpf.c compiled for userspace, see shim/xdp_shim.h. The program
+ * reads packet pointers from 32-bit fields of struct xdp_md, which cannot
+ * hold a userspace address, so the kernel's layout is replaced by a wide one.
+ */
+#define xdp_md xdp_md_kernel
+#include <linux/bpf.h>
+#undef xdp_md
+
+struct xdp_md {
+    unsigned long data;
+    unsigned long data_end;
+    unsigned long data_meta;
+    __u32 ingress_ifindex;
+    __u32 rx_queue_index;
+};
+
+#include "fw_xdp.bpf.c"
+
+void selftest_prog_init(void)
+{
+    FAKE_MAP_BIND(fw_xdp_rules);
+    FAKE_MAP_BIND(fw_xdp_masks);
+    FAKE_MAP_BIND(fw_xdp_stats);
+}
+
+// Verdict of the program for one Ethernet frame
+int selftest_prog_run(void *frame, unsigned int len)
+{
+    struct xdp_md ctx = {
+        .data = (unsigned long)frame,
+        .data_end = (unsigned long)frame + len,
+        .ingress_ifindex = 1,
+    };
+
+    return fw_xdp_filter(&ctx);
+}
@@ -0,0 +1,10 @@
+#ifndef XDP_SHIM_BPF_BPF_H
+#define XDP_SHIM_BPF_BPF_H
+#include <xdp_shim.h>
+
+int bpf_obj_get(const char *pathname);
+int bpf_map_lookup_elem(int fd, const void *key, void *value);
+int bpf_map_update_elem(int fd, const void *key, const void *value, __u64 flags);
+int bpf_map_delete_elem(int fd, const void *key);
+int bpf_map_get_next_key(int fd, const void *key, void *next_key);
+#endif
@@ -0,0 +1,9 @@
+#ifndef XDP_SHIM_BPF_ENDIAN_H
+#define XDP_SHIM_BPF_ENDIAN_H
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define bpf_htons(x) ((__u16)__builtin_bswap16(x))
+#else
+#define bpf_htons(x) ((__u16)(x))
+#endif
+#define bpf_ntohs(x) bpf_htons(x)
+#endif
@@ -0,0 +1,13 @@
+#ifndef XDP_SHIM_BPF_HELPERS_H
+#define XDP_SHIM_BPF_HELPERS_H
+#include <xdp_shim.h>
+
+#define SEC(name)
+#define __uint(name, val) int (*name)[val]
+#define __type(name, val) typeof(val) *name
+#ifndef __always_inline
+#define __always_inline inline __attribute__((always_inline))
+#endif
+#define bpf_map_lookup_elem(map, key) xdp_map_lookup_elem(map, key)
+#define bpf_fib_lookup(ctx, params, plen, flags) xdp_fib_lookup(ctx, params, plen, flags)
+#endif
@@ -0,0 +1,28 @@
+#ifndef XDP_SHIM_BPF_LIBBPF_H
+#define XDP_SHIM_BPF_LIBBPF_H
+#include <bpf/bpf.h>
+
+// One object holding the program and every bound map
+struct bpf_object;
+struct bpf_map;
+struct bpf_program;
+struct bpf_object_open_opts;
+struct bpf_xdp_attach_opts;
+
+struct bpf_object *bpf_object__open_file(const char *path, const struct bpf_object_open_opts *opts);
+long libbpf_get_error(const void *ptr);
+int bpf_object__load(struct bpf_object *obj);
+void bpf_object__close(struct bpf_object *obj);
+struct bpf_map *bpf_object__next_map(const struct bpf_object *obj, const struct bpf_map *map);
+#define bpf_object__for_each_map(pos, obj) \
+    for ((pos) = bpf_object__next_map((obj), NULL); (pos); (pos) = bpf_object__next_map((obj), (pos)))
+struct bpf_map *bpf_object__find_map_by_name(const struct bpf_object *obj, const char *name);
+struct bpf_program *bpf_object__find_program_by_name(const struct bpf_object *obj, const char *name);
+const char *bpf_map__name(const struct bpf_map *map);
+int bpf_map__set_pin_path(struct bpf_map *map, const char *path);
+int bpf_map__fd(const struct bpf_map *map);
+int bpf_program__fd(const struct bpf_program *prog);
+int bpf_xdp_attach(int ifindex, int prog_fd, __u32 flags, const struct bpf_xdp_attach_opts *opts);
+int bpf_xdp_detach(int ifindex, __u32 flags, const struct bpf_xdp_attach_opts *opts);
+int libbpf_num_possible_cpus(void);
+#endif
@@ -0,0 +1,328 @@
+/*
+ * Userspace maps behind both the libbpf calls of the loader and the helpers
+ * of the program. The shim has a single CPU, so per-CPU values are plain ones.
+ */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <bpf/libbpf.h>
+#include <xdp_shim.h>
+
+#define FAKE_MAX_MAPS 8
+#define FAKE_FD_BASE 100
+#define FAKE_PROG_FD 99
+
+struct fake_map {
+    const void *def;
+    const char *name;
+    int type;
+    size_t key_size, value_size, max_entries;
+    size_t count;          // entries in use; arrays always have max_entries
+    unsigned char *keys;
+    unsigned char *values;
+    bool pinned;
+};
+
+static struct fake_map fake_maps[FAKE_MAX_MAPS];
+static int nr_fake_maps;
+static int fake_object; // the only bpf_object, its address is the handle
+long fake_fib_result = BPF_FIB_LKUP_RET_NOT_FWDED;
+int fake_xdp_ifindex;
+
+static bool fake_is_array(const struct fake_map *m)
+{
+    return m->type == BPF_MAP_TYPE_ARRAY || m->type == BPF_MAP_TYPE_PERCPU_ARRAY;
+}
+
+static void fake_map_clear(struct fake_map *m)
+{
+    free(m->keys);
+    m->keys = NULL;
+    m->count = 0;
+    if (fake_is_array(m)) {
+        m->count = m->max_entries;
+        memset(m->values, 0, m->max_entries * m->value_size);
+    } else {
+        free(m->values);
+        m->values = NULL;
+    }
+}
+
+void fake_map_bind(const void *def, const char *name, int type, size_t key_size, size_t value_size,
+                   size_t max_entries)
+{
+    struct fake_map *m = &fake_maps[nr_fake_maps++];
+
+    m->def = def;
+    m->name = name;
+    m->type = type;
+    m->key_size = key_size;
+    m->value_size = value_size;
+    m->max_entries = max_entries;
+    if (fake_is_array(m))
+        m->values = calloc(max_entries, value_size);
+    fake_map_clear(m);
+}
+
+void fake_maps_reset(void)
+{
+    int i;
+
+    for (i = 0; i < nr_fake_maps; i++) {
+        fake_map_clear(&fake_maps[i]);
+        fake_maps[i].pinned = false;
+    }
+    fake_xdp_ifindex = 0;
+}
+
+static struct fake_map *fake_map_by_name(const char *name)
+{
+    int i;
+
+    for (i = 0; i < nr_fake_maps; i++)
+        if (!strcmp(fake_maps[i].name, name))
+            return &fake_maps[i];
+    return NULL;
+}
+
+size_t fake_map_count(const char *name)
+{
+    struct fake_map *m = fake_map_by_name(name);
+
+    return m ? m->count : 0;
+}
+
+static struct fake_map *fake_map_by_fd(int fd)
+{
+    if (fd < FAKE_FD_BASE || fd >= FAKE_FD_BASE + nr_fake_maps)
+        return NULL;
+    return &fake_maps[fd - FAKE_FD_BASE];
+}
+
+// Index of key in m, or -1
+static long fake_map_find(const struct fake_map *m, const void *key)
+{
+    size_t i;
+
+    if (fake_is_array(m)) {
+        __u32 idx;
+
+        memcpy(&idx, key, sizeof(idx));
+        return idx < m->max_entries ? (long)idx : -1;
+    }
+    for (i = 0; i < m->count; i++)
+        if (!memcmp(m->keys + i * m->key_size, key, m->key_size))
+            return i;
+    return -1;
+}
+
+static int fake_error(int err)
+{
+    errno = err;
+    return -err;
+}
+
+void *xdp_map_lookup_elem(const void *map, const void *key)
+{
+    long i;
+    int j;
+
+    for (j = 0; j < nr_fake_maps; j++) {
+        if (fake_maps[j].def != map)
+            continue;
+        i = fake_map_find(&fake_maps[j], key);
+        return i < 0 ? NULL : fake_maps[j].values + i * fake_maps[j].value_size;
+    }
+    return NULL;
+}
+
+long xdp_fib_lookup(void *ctx, struct bpf_fib_lookup *params, int plen, __u32 flags)
+{
+    (void)ctx;
+    (void)params;
+    (void)plen;
+    (void)flags;
+    return fake_fib_result;
+}
+
+int bpf_obj_get(const char *pathname)
+{
+    const char *name = strrchr(pathname, '/');
+    struct fake_map *m = fake_map_by_name(name ? name + 1 : pathname);
+
+    if (!m || !m->pinned)
+        return fake_error(ENOENT);
+    return FAKE_FD_BASE + (int)(m - fake_maps);
+}
+
+int bpf_map_lookup_elem(int fd, const void *key, void *value)
+{
+    struct fake_map *m = fake_map_by_fd(fd);
+    long i;
+
+    if (!m)
+        return fake_error(EBADF);
+    i = fake_map_find(m, key);
+    if (i < 0)
+        return fake_error(ENOENT);
+    memcpy(value, m->values + i * m->value_size, m->value_size);
+    return 0;
+}
+
+int bpf_map_update_elem(int fd, const void *key, const void *value, __u64 flags)
+{
+    struct fake_map *m = fake_map_by_fd(fd);
+    long i;
+
+    (void)flags;
+    if (!m)
+        return fake_error(EBADF);
+    i = fake_map_find(m, key);
+    if (i < 0 && fake_is_array(m))
+        return fake_error(E2BIG);
+    if (i < 0) {
+        if (m->count == m->max_entries)
+            return fake_error(E2BIG);
+        m->keys = realloc(m->keys, (m->count + 1) * m->key_size);
+        m->values = realloc(m->values, (m->count + 1) * m->value_size);
+        i = m->count++;
+        memcpy(m->keys + i * m->key_size, key, m->key_size);
+    }
+    memcpy(m->values + i * m->value_size, value, m->value_size);
+    return 0;
+}
+
+int bpf_map_delete_elem(int fd, const void *key)
+{
+    struct fake_map *m = fake_map_by_fd(fd);
+    long i;
+
+    if (!m)
+        return fake_error(EBADF);
+    if (fake_is_array(m))
+        return fake_error(EINVAL);
+    i = fake_map_find(m, key);
+    if (i < 0)
+        return fake_error(ENOENT);
+    // Move the last entry into the hole
+    m->count--;
+    memmove(m->keys + i * m->key_size, m->keys + m->count * m->key_size, m->key_size);
+    memmove(m->values + i * m->value_size, m->values + m->count * m->value_size, m->value_size);
+    return 0;
+}
+
+// As in the kernel, a missing key restarts the walk from the first entry
+int bpf_map_get_next_key(int fd, const void *key, void *next_key)
+{
+    struct fake_map *m = fake_map_by_fd(fd);
+    long i = -1;
+
+    if (!m)
+        return fake_error(EBADF);
+    if (key)
+        i = fake_map_find(m, key);
+    if ((size_t)(i + 1) >= m->count)
+        return fake_error(ENOENT);
+    if (fake_is_array(m)) {
+        __u32 next = i + 1;
+        memcpy(next_key, &next, sizeof(next));
+    } else {
+        memcpy(next_key, m->keys + (i + 1) * m->key_size, m->key_size);
+    }
+    return 0;
+}
+
+struct bpf_object *bpf_object__open_file(const char *path, const struct bpf_object_open_opts *opts)
+{
+    (void)path;
+    (void)opts;
+    return (struct bpf_object *)&fake_object;
+}
+
+long libbpf_get_error(const void *ptr)
+{
+    return ptr ? 0 : -ENOENT;
+}
+
+// Nothing to verify; bpf_map__set_pin_path already pinned the maps
+int bpf_object__load(struct bpf_object *obj)
+{
+    (void)obj;
+    return 0;
+}
+
+void bpf_object__close(struct bpf_object *obj)
+{
+    (void)obj;
+}
+
+struct bpf_map *bpf_object__next_map(const struct bpf_object *obj, const struct bpf_map *map)
+{
+    const struct fake_map *m = (const struct fake_map *)map;
+
+    (void)obj;
+    m = m ? m + 1 : fake_maps;
+    return m < fake_maps + nr_fake_maps ? (struct bpf_map *)m : NULL;
+}
+
+struct bpf_map *bpf_object__find_map_by_name(const struct bpf_object *obj, const char *name)
+{
+    (void)obj;
+    return (struct bpf_map *)fake_map_by_name(name);
+}
+
+struct bpf_program *bpf_object__find_program_by_name(const struct bpf_object *obj, const char *name)
+{
+    (void)obj;
+    (void)name;
+    return (struct bpf_program *)&fake_object;
+}
+
+const char *bpf_map__name(const struct bpf_map *map)
+{
+    return ((const struct fake_map *)map)->name;
+}
+
+int bpf_map__set_pin_path(struct bpf_map *map, const char *path)
+{
+    (void)path;
+    ((struct fake_map *)map)->pinned = true;
+    return 0;
+}
+
+int bpf_map__fd(const struct bpf_map *map)
+{
+    return FAKE_FD_BASE + (int)((const struct fake_map *)map - fake_maps);
+}
+
+int bpf_program__fd(const struct bpf_program *prog)
+{
+    (void)prog;
+    return FAKE_PROG_FD;
+}
+
+int bpf_xdp_attach(int ifindex, int prog_fd, __u32 flags, const struct bpf_xdp_attach_opts *opts)
+{
+    (void)flags;
+    (void)opts;
+    if (prog_fd != FAKE_PROG_FD)
+        return fake_error(EBADF);
+    fake_xdp_ifindex = ifindex;
+    return 0;
+}
+
+int bpf_xdp_detach(int ifindex, __u32 flags, const struct bpf_xdp_attach_opts *opts)
+{
+    (void)flags;
+    (void)opts;
+    if (ifindex != fake_xdp_ifindex)
+        return fake_error(ENOENT);
+    fake_xdp_ifindex = 0;
+    return 0;
+}
+
+int libbpf_num_possible_cpus(void)
+{
+    return 1;
+}
@@ -0,0 +1,28 @@
+/*
+ * Userspace stand-ins for the BPF maps and helpers, shared by the loader
+ * (through bpf/bpf.h and bpf/libbpf.h) and the program (bpf/bpf_helpers.h),
+ * so that selftest.c can run both against the same maps without a kernel.
+ */
+#ifndef XDP_SHIM_H
+#define XDP_SHIM_H
+#include <stddef.h>
+#include <linux/bpf.h>
+
+// Register a map defined in the program under its name
+void fake_map_bind(const void *def, const char *name, int type, size_t key_size, size_t value_size,
+                   size_t max_entries);
+#define FAKE_MAP_BIND(m)                                                                           \
+    fake_map_bind(&(m), #m, sizeof(*(m).type) / sizeof(int), sizeof(*(m).key), sizeof(*(m).value), \
+                  sizeof(*(m).max_entries) / sizeof(int))
+// Drop every entry and pin; the program's map definitions stay bound
+void fake_maps_reset(void);
+// Number of entries in a hash map
+size_t fake_map_count(const char *name);
+
+// Program-side helpers, see bpf/bpf_helpers.h
+void *xdp_map_lookup_elem(const void *map, const void *key);
+long xdp_fib_lookup(void *ctx, struct bpf_fib_lookup *params, int plen, __u32 flags);
+extern long fake_fib_result; // what xdp_fib_lookup returns
+extern int fake_xdp_ifindex; // interface the program is attached to, 0 if none
+
+#endif // XDP_SHIM_H